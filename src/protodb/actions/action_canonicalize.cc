@@ -0,0 +1,192 @@
+#include "protodb/actions/action_canonicalize.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "protodb/actions/common.h"
+#include "protodb/db/protodb.h"
+#include "protodb/io/canonical.h"
+#include "protodb/io/content_hash.h"
+#include "protodb/io/delimited.h"
+#include "protodb/io/ordered_pipeline.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::FileInputStream;
+using ::google::protobuf::io::FileOutputStream;
+
+namespace {
+
+constexpr std::string_view kCanonicalizeFlags[] = {"delimited", "hash",
+                                                   "jobs"};
+
+// Canonicalizes one message and appends either its canonical encoding or,
+// with `hash`, the hex content hash of that encoding on its own line.
+class MessageCanonicalizer {
+ public:
+  MessageCanonicalizer(const ParsePlan* plan, bool delimited, bool hash)
+      : canonicalizer_(plan), delimited_(delimited), hash_(hash) {}
+
+  bool Canonicalize(absl::string_view wire, std::string* output) {
+    canonical_.clear();
+    if (!canonicalizer_.Canonicalize(wire, &canonical_)) {
+      return false;
+    }
+    if (hash_) {
+      output->append(ContentHashToHex(ContentHash(canonical_)));
+      output->push_back('\n');
+    } else if (delimited_) {
+      AppendDelimited(canonical_, output);
+    } else {
+      output->append(canonical_);
+    }
+    return true;
+  }
+
+ private:
+  Canonicalizer canonicalizer_;
+  const bool delimited_;
+  const bool hash_;
+  std::string canonical_;
+};
+
+// Canonicalizes a stream of length-delimited messages from stdin.  With
+// more than one job the messages are framed by a reader thread, handled by
+// `jobs` workers and written back out in their original order.
+bool CanonicalizeDelimited(const ParsePlan* plan, bool hash, int jobs) {
+  FileInputStream in(STDIN_FILENO);
+  FileOutputStream out(STDOUT_FILENO);
+  DelimitedReader reader(&in);
+  bool read_error = false;
+  bool ok = true;
+
+  {
+    CodedOutputStream coded_out(&out);
+    if (jobs <= 1) {
+      MessageCanonicalizer canonicalizer(plan, true, hash);
+      std::string wire;
+      std::string output;
+      DelimitedReader::Status status;
+      while ((status = reader.Next(&wire)) == DelimitedReader::OK) {
+        output.clear();
+        if (!canonicalizer.Canonicalize(wire, &output)) {
+          std::cerr << "Failed to parse message " << reader.count() - 1
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        coded_out.WriteRaw(output.data(), output.size());
+      }
+      read_error = status == DelimitedReader::ERROR;
+    } else {
+      std::vector<std::unique_ptr<MessageCanonicalizer>> canonicalizers;
+      for (int i = 0; i < jobs; ++i) {
+        canonicalizers.push_back(
+            std::make_unique<MessageCanonicalizer>(plan, true, hash));
+      }
+
+      OrderedPipeline<DelimitedMessage, std::string> pipeline(jobs);
+      ok = pipeline.Run(
+          [&](DelimitedMessage* wire) {
+            const auto status = reader.Next(wire);
+            read_error = status == DelimitedReader::ERROR;
+            return status == DelimitedReader::OK;
+          },
+          [&](int worker, DelimitedMessage& wire, std::string* output) {
+            if (!canonicalizers[worker]->Canonicalize(wire.data, output)) {
+              std::cerr << "Failed to parse message " << wire.index
+                        << std::endl;
+              return false;
+            }
+            return true;
+          },
+          [&](std::string& output) {
+            coded_out.WriteRaw(output.data(), output.size());
+            return !coded_out.HadError();
+          });
+    }
+    ok = ok && !coded_out.HadError();
+  }
+
+  if (read_error) {
+    std::cerr << "Failed to read delimited input after " << reader.count()
+              << " message(s)." << std::endl;
+    return false;
+  }
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Canonicalize(const protodb::ProtoSchemaDb& protodb,
+                  const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  if (!CheckActionFlags("canonicalize", args, kCanonicalizeFlags)) {
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  if (!jobs) {
+    return false;
+  }
+  if (args.positional.empty()) {
+    std::cerr << "canonicalize: no message type specified" << std::endl;
+    return false;
+  }
+  const std::string& message_type = args.positional[0];
+  const Descriptor* type =
+      protodb.snapshot_pool()->FindMessageTypeByName(message_type);
+  if (type == nullptr) {
+    std::cerr << "Type not defined: " << message_type << std::endl;
+    return false;
+  }
+  const ParsePlan* plan = protodb.FindParsePlan(type);
+  const bool hash = args.Has("hash");
+
+  if (args.Has("delimited")) {
+    return CanonicalizeDelimited(plan, hash, *jobs);
+  }
+
+  FileInputStream in(STDIN_FILENO);
+  std::string wire;
+  if (!ReadAll(&in, &wire)) {
+    std::cerr << "input: I/O error." << std::endl;
+    return false;
+  }
+
+  MessageCanonicalizer canonicalizer(plan, false, hash);
+  std::string output;
+  if (!canonicalizer.Canonicalize(wire, &output)) {
+    std::cerr << "Failed to parse message." << std::endl;
+    return false;
+  }
+
+  FileOutputStream out(STDOUT_FILENO);
+  {
+    CodedOutputStream coded_out(&out);
+    coded_out.WriteRaw(output.data(), output.size());
+  }
+  if (!out.Close()) {
+    std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace protodb
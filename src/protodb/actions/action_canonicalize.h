@@ -0,0 +1,16 @@
+#ifndef PROTODB_ACTION_CANONICALIZE_H__
+#define PROTODB_ACTION_CANONICALIZE_H__
+
+#include <span>
+#include <string>
+
+namespace protodb {
+
+struct ProtoSchemaDb;
+
+bool Canonicalize(const ProtoSchemaDb& protodb,
+                  const std::span<std::string>& params);
+
+}  // namespace protodb
+
+#endif  // PROTODB_ACTION_CANONICALIZE_H__
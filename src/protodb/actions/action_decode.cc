@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -19,34 +20,129 @@
 #include <utility>
 #include <vector>
 
+#include "absl/log/absl_check.h"
 #include "absl/strings/string_view.h"
 #include "google/protobuf/descriptor.h"
-#include "google/protobuf/dynamic_message.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
-#include "google/protobuf/text_format.h"
+#include "protodb/actions/common.h"
+#include "protodb/actions/message_decoder.h"
 #include "protodb/db/protodb.h"
+#include "protodb/io/delimited.h"
+#include "protodb/io/field_projection.h"
+#include "protodb/io/ordered_pipeline.h"
 
 namespace protodb {
 
 using ::google::protobuf::Descriptor;
 using ::google::protobuf::DescriptorPool;
-using ::google::protobuf::DynamicMessageFactory;
-using ::google::protobuf::Message;
-using ::google::protobuf::TextFormat;
+using ::google::protobuf::io::CodedOutputStream;
 using ::google::protobuf::io::FileInputStream;
 using ::google::protobuf::io::FileOutputStream;
 
+namespace {
+
+constexpr std::string_view kDecodeFlags[] = {
+    "arena_block_size", "delimited", "fields", "format", "jobs"};
+
+// Decodes a stream of length-delimited messages from stdin, one message per
+// line of output.  When more than one job is requested the messages are
+// framed by a reader thread, parsed and formatted by `jobs` workers and
+// written back out in their original order.
+bool DecodeDelimited(const Descriptor* type, DecodeOptions options,
+                     int jobs) {
+  options.single_line = true;
+  FileInputStream in(STDIN_FILENO);
+  FileOutputStream out(STDOUT_FILENO);
+  DelimitedReader reader(&in);
+  bool read_error = false;
+  bool ok = true;
+
+  {
+    CodedOutputStream coded_out(&out);
+    if (jobs <= 1) {
+      MessageDecoder decoder(type, options);
+      std::string wire;
+      std::string text;
+      DelimitedReader::Status status;
+      while ((status = reader.Next(&wire)) == DelimitedReader::OK) {
+        text.clear();
+        if (!decoder.Decode(wire, &text)) {
+          std::cerr << "Failed to parse message " << reader.count() - 1
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        coded_out.WriteRaw(text.data(), text.size());
+      }
+      read_error = status == DelimitedReader::ERROR;
+    } else {
+      std::vector<std::unique_ptr<MessageDecoder>> decoders;
+      for (int i = 0; i < jobs; ++i) {
+        decoders.push_back(std::make_unique<MessageDecoder>(type, options));
+      }
+
+      OrderedPipeline<DelimitedMessage, std::string> pipeline(jobs);
+      ok = pipeline.Run(
+          [&](DelimitedMessage* wire) {
+            const auto status = reader.Next(wire);
+            read_error = status == DelimitedReader::ERROR;
+            return status == DelimitedReader::OK;
+          },
+          [&](int worker, DelimitedMessage& wire, std::string* text) {
+            if (!decoders[worker]->Decode(wire.data, text)) {
+              std::cerr << "Failed to parse message " << wire.index
+                        << std::endl;
+              return false;
+            }
+            return true;
+          },
+          [&](std::string& text) {
+            coded_out.WriteRaw(text.data(), text.size());
+            return !coded_out.HadError();
+          });
+    }
+    ok = ok && !coded_out.HadError();
+  }
+
+  if (read_error) {
+    std::cerr << "Failed to read delimited input after " << reader.count()
+              << " message(s)." << std::endl;
+    return false;
+  }
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 bool Decode(const protodb::ProtoSchemaDb& protodb,
             const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  if (!CheckActionFlags("decode", args, kDecodeFlags)) {
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  const auto arena_block_size = GetArenaBlockSize(args);
+  const auto format = GetMessageFormat(args);
+  if (!jobs || !arena_block_size || !format) {
+    return false;
+  }
+  DecodeOptions options{.format = *format,
+                        .arena_block_size = *arena_block_size};
+
   auto db = protodb.snapshot_database();
   ABSL_CHECK(db);
   auto descriptor_pool = std::make_unique<DescriptorPool>(db, nullptr);
   ABSL_CHECK(descriptor_pool);
 
   std::string decode_type = "unset";
-  if (params.size() >= 1) {
-    decode_type = params[0];
+  if (args.positional.size() >= 1) {
+    decode_type = args.positional[0];
   } else {
     decode_type = "google.protobuf.Empty";
   }
@@ -57,22 +153,41 @@ bool Decode(const protodb::ProtoSchemaDb& protodb,
     return false;
   }
 
-  DynamicMessageFactory dynamic_factory(descriptor_pool.get());
-  std::unique_ptr<Message> message(dynamic_factory.GetPrototype(type)->New());
+  std::unique_ptr<FieldProjection> projection;
+  if (auto fields = args.Get("fields")) {
+    std::string error;
+    projection = FieldProjection::Compile(type, *fields, &error);
+    if (!projection) {
+      std::cerr << "--fields: " << error << std::endl;
+      return false;
+    }
+    options.projection = projection.get();
+  }
+
+  if (args.Has("delimited")) {
+    return DecodeDelimited(type, options, *jobs);
+  }
 
   FileInputStream in(STDIN_FILENO);
-  if (!message->ParsePartialFromZeroCopyStream(&in)) {
-    std::cerr << "Failed to parse input." << std::endl;
+  std::string wire;
+  if (!ReadAll(&in, &wire)) {
+    std::cerr << "input: I/O error." << std::endl;
     return false;
   }
 
-  if (!message->IsInitialized()) {
-    std::cerr << "warning:  Input message is missing required fields:  "
-              << message->InitializationErrorString() << std::endl;
+  MessageDecoder decoder(type, options);
+  std::string text;
+  if (!decoder.Decode(wire, &text)) {
+    std::cerr << "Failed to parse input." << std::endl;
+    return false;
   }
 
   FileOutputStream out(STDOUT_FILENO);
-  if (!TextFormat::Print(*message, &out)) {
+  {
+    CodedOutputStream coded_out(&out);
+    coded_out.WriteRaw(text.data(), text.size());
+  }
+  if (!out.Close()) {
     std::cerr << "output: I/O error." << std::endl;
     return false;
   }
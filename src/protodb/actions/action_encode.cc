@@ -10,6 +10,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -19,49 +21,235 @@
 #include <utility>
 #include <vector>
 
+#include "absl/log/absl_check.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "google/protobuf/descriptor.h"
-#include "google/protobuf/dynamic_message.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
-#include "google/protobuf/text_format.h"
+#include "protodb/actions/common.h"
+#include "protodb/actions/message_encoder.h"
 #include "protodb/db/protodb.h"
+#include "protodb/io/ordered_pipeline.h"
 
 namespace protodb {
 
 using ::google::protobuf::Descriptor;
 using ::google::protobuf::DescriptorPool;
-using ::google::protobuf::DynamicMessageFactory;
-using ::google::protobuf::Message;
-using ::google::protobuf::TextFormat;
+using ::google::protobuf::io::CodedOutputStream;
 using ::google::protobuf::io::FileInputStream;
 using ::google::protobuf::io::FileOutputStream;
 
+namespace {
+
+constexpr std::string_view kEncodeFlags[] = {"arena_block_size", "delimited",
+                                             "format", "jobs"};
+
+// A single message to encode and where it came from, for error messages.
+struct EncodeInput {
+  std::string source;
+  std::string text;
+};
+
+bool ReadFile(const std::string& path, std::string* data) {
+  int fd;
+  do {
+    fd = open(path.c_str(), O_RDONLY);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  FileInputStream in(fd);
+  in.SetCloseOnDelete(true);
+  if (!ReadAll(&in, data)) {
+    std::cerr << path << ": " << strerror(in.GetErrno()) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Frames the inputs to encode: each file is one message, or without files,
+// each non-blank line of stdin is one JSON message.
+class InputReader {
+ public:
+  explicit InputReader(std::span<const std::string> files) : files_(files) {}
+
+  // Returns false at the end of input or on error.
+  bool Next(EncodeInput* input) {
+    if (!files_.empty()) {
+      if (next_file_ == files_.size())
+        return false;
+      input->source = files_[next_file_++];
+      input->text.clear();
+      if (!ReadFile(input->source, &input->text)) {
+        error_ = true;
+        return false;
+      }
+      return true;
+    }
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      ++line_number_;
+      if (!absl::StripAsciiWhitespace(line).empty()) {
+        input->source = absl::StrCat("input:", line_number_);
+        input->text = std::move(line);
+        return true;
+      }
+    }
+    if (std::cin.bad()) {
+      std::cerr << "input: I/O error." << std::endl;
+      error_ = true;
+    }
+    return false;
+  }
+
+  bool error() const {
+    return error_;
+  }
+
+ private:
+  const std::span<const std::string> files_;
+  size_t next_file_ = 0;
+  uint64_t line_number_ = 0;
+  bool error_ = false;
+};
+
+// Encodes every input as a length-delimited message on stdout.  With more
+// than one job, inputs are read on a reader thread, parsed and serialized by
+// `jobs` workers that each have their own encoder, and written in input
+// order.
+bool EncodeDelimited(const Descriptor* type, const EncodeOptions& options,
+                     std::span<const std::string> files, int jobs) {
+  InputReader reader(files);
+  FileOutputStream out(STDOUT_FILENO);
+  bool ok = true;
+  {
+    CodedOutputStream coded_out(&out);
+    if (jobs <= 1) {
+      MessageEncoder encoder(type, options);
+      EncodeInput input;
+      std::string wire;
+      while (reader.Next(&input)) {
+        wire.clear();
+        if (!encoder.Encode(input.text, &wire)) {
+          std::cerr << input.source << ": failed to encode message"
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        coded_out.WriteRaw(wire.data(), wire.size());
+      }
+    } else {
+      std::vector<std::unique_ptr<MessageEncoder>> encoders;
+      for (int i = 0; i < jobs; ++i) {
+        encoders.push_back(std::make_unique<MessageEncoder>(type, options));
+      }
+
+      OrderedPipeline<EncodeInput, std::string> pipeline(jobs);
+      ok = pipeline.Run(
+          [&](EncodeInput* input) { return reader.Next(input); },
+          [&](int worker, EncodeInput& input, std::string* wire) {
+            if (!encoders[worker]->Encode(input.text, wire)) {
+              std::cerr << input.source << ": failed to encode message"
+                        << std::endl;
+              return false;
+            }
+            return true;
+          },
+          [&](std::string& wire) {
+            coded_out.WriteRaw(wire.data(), wire.size());
+            return !coded_out.HadError();
+          });
+    }
+    ok = ok && !reader.error() && !coded_out.HadError();
+  }
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 bool Encode(const protodb::ProtoSchemaDb& protodb,
             const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  if (!CheckActionFlags("encode", args, kEncodeFlags)) {
+    return false;
+  }
+  const auto arena_block_size = GetArenaBlockSize(args);
+  const auto format = GetMessageFormat(args);
+  if (!arena_block_size || !format) {
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  if (!jobs) {
+    return false;
+  }
+  const EncodeOptions options{.format = *format,
+                              .delimited = args.Has("delimited"),
+                              .arena_block_size = *arena_block_size};
+  const auto files = std::span<const std::string>(args.positional).subspan(
+      std::min<size_t>(1, args.positional.size()));
+  if (options.delimited && files.empty() &&
+      options.format != MessageFormat::JSON) {
+    std::cerr << "encode: --delimited reads input files, or JSON lines from "
+                 "stdin with --format=json"
+              << std::endl;
+    return false;
+  }
+  if (!options.delimited && !files.empty()) {
+    std::cerr << "encode: input files require --delimited" << std::endl;
+    return false;
+  }
+
   auto db = protodb.snapshot_database();
   ABSL_CHECK(db);
   auto descriptor_pool = std::make_unique<DescriptorPool>(db, nullptr);
   ABSL_CHECK(descriptor_pool);
 
-  if (params.empty()) {
+  if (args.positional.empty()) {
     std::cerr << "encode: no message type specified" << std::endl;
     return false;
   }
-  const std::string message_type = params[0];
+  const std::string message_type = args.positional[0];
   const Descriptor* type = descriptor_pool->FindMessageTypeByName(message_type);
+  if (type == nullptr) {
+    std::cerr << "Type not defined: " << message_type << std::endl;
+    return false;
+  }
 
-  DynamicMessageFactory dynamic_factory(descriptor_pool.get());
-  std::unique_ptr<Message> message(dynamic_factory.GetPrototype(type)->New());
+  if (options.delimited) {
+    return EncodeDelimited(type, options, files, *jobs);
+  }
 
   FileInputStream in(STDIN_FILENO);
-  if (!TextFormat::Parse(&in, message.get())) {
+  std::string input;
+  if (!ReadAll(&in, &input)) {
     std::cerr << "input: I/O error." << std::endl;
     return false;
   }
 
-  return message->SerializeToFileDescriptor(STDOUT_FILENO);
+  MessageEncoder encoder(type, options);
+  std::string wire;
+  if (!encoder.Encode(input, &wire)) {
+    return false;
+  }
 
+  FileOutputStream out(STDOUT_FILENO);
+  {
+    CodedOutputStream coded_out(&out);
+    coded_out.WriteRaw(wire.data(), wire.size());
+  }
+  if (!out.Close()) {
+    std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
   return true;
 }
 
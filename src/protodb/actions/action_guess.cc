@@ -45,6 +45,7 @@
 #include "google/protobuf/wire_format_lite.h"
 #include "protodb/db/protodb.h"
 #include "protodb/io/mark.h"
+#include "protodb/io/parse_plan.h"
 #include "protodb/io/parsing_scanner.h"
 #include "protodb/io/scan_context.h"
 
@@ -209,22 +210,24 @@ std::optional<ParsedFieldsGroup> FieldsToGroup(
 
 static int ScoreMessageAgainstParsedFields(
     const GuessContext& context, const std::vector<const ParsedField*>& fields,
-    const Descriptor* descriptor);
+    const ParsePlan* plan);
 
+// Scoring looks fields up through the message's parse plan, which has the
+// expected wire type and submessage plan of every field precomputed.
 static int ScoreMessageAgainstGroup(const GuessContext& context,
                                     const ParsedFieldsGroup& group,
-                                    const Descriptor* descriptor) {
+                                    const ParsePlan* plan) {
   int score = 0;
 
-  if (descriptor->FindExtensionRangeContainingNumber(group.field_number)) {
+  const ParsePlan::Field* plan_field = plan->Find(group.field_number);
+  if (!plan_field && plan->descriptor()->FindExtensionRangeContainingNumber(
+                    group.field_number)) {
     // TODO: implement scoring for extension fields.
     score += 2;
     return score;
   }
 
-  const auto* field_descriptor =
-      descriptor->FindFieldByNumber(group.field_number);
-  if (!field_descriptor) {
+  if (!plan_field) {
     // Missing field from the message, skip message.  An undeclared
     // field isn't strictly an error, but too many indicated we don't
     // have a good match.
@@ -233,7 +236,7 @@ static int ScoreMessageAgainstGroup(const GuessContext& context,
   }
   score += 2;
 
-  if (group.is_repeated == field_descriptor->is_repeated()) {
+  if (group.is_repeated == plan_field->repeated) {
     score += 5;
   } else {
     // Field isn't repeated in descriptor.  There are legitimate cases
@@ -243,9 +246,7 @@ static int ScoreMessageAgainstGroup(const GuessContext& context,
       return score;
   }
 
-  auto field_type =
-      static_cast<WireFormatLite::FieldType>(field_descriptor->type());
-  if (group.wire_type == WireFormatLite::WireTypeForFieldType(field_type)) {
+  if (group.wire_type == plan_field->wire_type) {
     score += 1;
   } else {
     score -= 10;
@@ -266,9 +267,9 @@ static int ScoreMessageAgainstGroup(const GuessContext& context,
       for (const ParsedField& field : field->length_delimited->message_fields) {
         message_fields.push_back(&field);
       }
-      if (field_descriptor->message_type()) {
+      if (plan_field->message) {
         const int message_score = ScoreMessageAgainstParsedFields(
-            subcontext, message_fields, field_descriptor->message_type());
+            subcontext, message_fields, plan_field->message);
         if (message_score) {
           score += message_score;
         }
@@ -281,7 +282,7 @@ static int ScoreMessageAgainstGroup(const GuessContext& context,
 
 static int ScoreMessageAgainstParsedFields(
     const GuessContext& context, const std::vector<const ParsedField*>& fields,
-    const Descriptor* descriptor) {
+    const ParsePlan* plan) {
   std::map<uint32_t, std::vector<const ParsedField*>> field_map;
   for (const auto* field : fields) {
     field_map[field->field_number].push_back(field);
@@ -299,7 +300,7 @@ static int ScoreMessageAgainstParsedFields(
   int score = 0;
   for (const ParsedFieldsGroup& group : groups) {
     const int message_score =
-        ScoreMessageAgainstGroup(context, group, descriptor);
+        ScoreMessageAgainstGroup(context, group, plan);
     score += message_score;
 
     if (score < context.min_scoring_threshold)
@@ -310,14 +311,11 @@ static int ScoreMessageAgainstParsedFields(
 
 static bool Guess(const absl::Cord& data, const protodb::ProtoSchemaDb& protodb,
                   std::set<std::string>* matches) {
-  auto pool =
-      std::make_unique<DescriptorPool>(protodb.snapshot_database(), nullptr);
-
   CordInputStream cord_input(&data);
   ZeroCopyInputStream* zcis = &cord_input;
   CodedInputStream cis(zcis);
 
-  GuessContext context{cis, &data, nullptr, pool.get(),
+  GuessContext context{cis, &data, nullptr, protodb.snapshot_pool(),
                        protodb.snapshot_database()};
   cis.SetTotalBytesLimit(data.size());
   std::vector<ParsedField> fields;
@@ -343,8 +341,8 @@ static bool Guess(const absl::Cord& data, const protodb::ProtoSchemaDb& protodb,
     const Descriptor* descriptor =
         context.descriptor_pool->FindMessageTypeByName(message);
     ABSL_CHECK(descriptor);
-    const int score =
-        ScoreMessageAgainstParsedFields(context, field_ptrs, descriptor);
+    const int score = ScoreMessageAgainstParsedFields(
+        context, field_ptrs, protodb.FindParsePlan(descriptor));
     scores.push_back(std::make_pair(score, message));
   }
 
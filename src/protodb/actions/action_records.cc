@@ -0,0 +1,669 @@
+#include "protodb/actions/action_records.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/descriptor_database.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "protodb/actions/common.h"
+#include "protodb/actions/message_decoder.h"
+#include "protodb/db/protodb.h"
+#include "protodb/io/columnar.h"
+#include "protodb/io/field_projection.h"
+#include "protodb/io/ordered_pipeline.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/sort_key.h"
+#include "records/external_sort.h"
+#include "records/parallel_reader.h"
+#include "records/record_follower.h"
+#include "records/record_reader.h"
+#include "records/record_writer.h"
+#include "src/records/columns.pb.h"
+#include "src/records/records.pb.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::DescriptorPoolDatabase;
+using ::google::protobuf::MergedDescriptorDatabase;
+using ::google::protobuf::SimpleDescriptorDatabase;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::FileOutputStream;
+
+namespace {
+
+constexpr std::string_view kCatFlags[] = {"arena_block_size", "fields",
+                                          "format", "jobs", "type"};
+constexpr std::string_view kColumnarizeFlags[] = {"chunk_records", "fields",
+                                                  "jobs", "output", "type"};
+constexpr std::string_view kTailFlags[] = {"arena_block_size", "fields",
+                                           "follow", "format", "lines",
+                                           "type"};
+constexpr std::string_view kSortFlags[] = {
+    "jobs", "key", "memory_limit", "output", "temp_dir", "type", "unique"};
+
+// The schema a records file carries in `RecordSetHeader.descriptor_set`.
+// Types are built from the header alone, falling back to the types compiled
+// into protodb for well-known types the set leaves out, so reading a file
+// needs no `.protodb` directory.
+class HeaderSchema {
+ public:
+  // Returns nullptr and reports the error to stderr if the header has no
+  // usable descriptor set.
+  static std::unique_ptr<HeaderSchema> Load(
+      const std::string& path, const records::RecordSetHeader& header) {
+    const auto& files = header.descriptor_set().file();
+    if (files.empty()) {
+      std::cerr << path << ": the header has no descriptor set" << std::endl;
+      return nullptr;
+    }
+    auto schema = std::make_unique<HeaderSchema>();
+    for (const auto& file : files) {
+      if (!schema->header_db_.Add(file)) {
+        std::cerr << path << ": invalid descriptor set in header" << std::endl;
+        return nullptr;
+      }
+    }
+    // Descriptor sets list dependencies first, so the last file is the one
+    // the set was written for.
+    const auto& main_file = files[files.size() - 1];
+    if (main_file.message_type_size() > 0) {
+      schema->default_type_ = main_file.package().empty()
+                                  ? main_file.message_type(0).name()
+                                  : main_file.package() + "." +
+                                        main_file.message_type(0).name();
+    }
+    return schema;
+  }
+
+  // Finds `name`, or with an empty name, the first message of the last file
+  // in the set.  Returns nullptr and reports the error to stderr if the type
+  // isn't found.
+  const Descriptor* FindType(const std::string& name) {
+    const std::string& type_name = name.empty() ? default_type_ : name;
+    if (type_name.empty()) {
+      std::cerr << "records: no message type in the header, use --type"
+                << std::endl;
+      return nullptr;
+    }
+    const Descriptor* type = pool_.FindMessageTypeByName(type_name);
+    if (type == nullptr) {
+      std::cerr << "Type not defined in header: " << type_name << std::endl;
+    }
+    return type;
+  }
+
+ private:
+  SimpleDescriptorDatabase header_db_;
+  DescriptorPoolDatabase generated_db_{*DescriptorPool::generated_pool()};
+  MergedDescriptorDatabase merged_db_{&header_db_, &generated_db_};
+  DescriptorPool pool_{&merged_db_, nullptr};
+  std::string default_type_;
+};
+
+// A file written under a temporary name next to `path` and renamed over
+// it by Commit(), so that a failed run leaves an existing file untouched.
+// The temporary file is removed unless committed.
+class OutputFile {
+ public:
+  explicit OutputFile(std::string path)
+      : path_(std::move(path)), temp_path_(path_ + ".tmp") {
+    std::remove(temp_path_.c_str());
+  }
+  OutputFile(const OutputFile&) = delete;
+  OutputFile& operator=(const OutputFile&) = delete;
+  ~OutputFile() {
+    if (!committed_)
+      std::remove(temp_path_.c_str());
+  }
+
+  const std::string& temp_path() const {
+    return temp_path_;
+  }
+
+  // Returns false and reports the error to stderr if the rename fails.
+  bool Commit() {
+    if (std::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+      std::cerr << path_ << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    committed_ = true;
+    return true;
+  }
+
+ private:
+  const std::string path_;
+  const std::string temp_path_;
+  bool committed_ = false;
+};
+
+// Reports why a scan of `path` stopped early.  A partial record at the end
+// of the file is expected while it is being written and only warns.
+bool CheckReadStatus(const std::string& path,
+                     const records::RecordReader& reader,
+                     records::RecordReader::Status status) {
+  if (status == records::RecordReader::CORRUPT) {
+    std::cerr << path << ": corrupt record at offset " << reader.offset()
+              << std::endl;
+    return false;
+  }
+  if (status == records::RecordReader::TRUNCATED) {
+    std::cerr << path << ": warning: partial record at offset "
+              << reader.offset() << std::endl;
+  }
+  return true;
+}
+
+// A record copied out of a records file and its 0-based index in the file.
+struct IndexedRecord {
+  uint64_t index = 0;
+  std::string data;
+};
+
+// Prints every record of a records file, decoded with the schema in the
+// file's header.  With more than one job, records are read on a reader
+// thread, decoded by `jobs` workers that each reuse their own decoder and
+// written in file order.
+bool Cat(const ActionParams& args) {
+  if (!CheckActionFlags("records cat", args, kCatFlags)) {
+    return false;
+  }
+  if (args.positional.size() != 2) {
+    std::cerr << "records cat: expected a single records file" << std::endl;
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  const auto arena_block_size = GetArenaBlockSize(args);
+  const auto format = GetMessageFormat(args);
+  if (!jobs || !arena_block_size || !format) {
+    return false;
+  }
+  DecodeOptions options{.format = *format,
+                        .single_line = true,
+                        .arena_block_size = *arena_block_size};
+
+  const std::string& path = args.positional[1];
+  auto reader = records::RecordReader::Open(path);
+  if (!reader) {
+    return false;
+  }
+  auto schema = HeaderSchema::Load(path, reader->header());
+  if (!schema) {
+    return false;
+  }
+  const Descriptor* type = schema->FindType(args.Get("type").value_or(""));
+  if (type == nullptr) {
+    return false;
+  }
+
+  std::unique_ptr<FieldProjection> projection;
+  if (auto fields = args.Get("fields")) {
+    std::string error;
+    projection = FieldProjection::Compile(type, *fields, &error);
+    if (!projection) {
+      std::cerr << "--fields: " << error << std::endl;
+      return false;
+    }
+    options.projection = projection.get();
+  }
+
+  FileOutputStream out(STDOUT_FILENO);
+  records::RecordReader::Status status = records::RecordReader::OK;
+  bool ok = true;
+  {
+    CodedOutputStream coded_out(&out);
+    if (*jobs <= 1) {
+      MessageDecoder decoder(type, options);
+      absl::string_view data;
+      std::string text;
+      while ((status = reader->Next(&data)) == records::RecordReader::OK) {
+        text.clear();
+        if (!decoder.Decode(data, &text)) {
+          std::cerr << path << ": failed to parse record "
+                    << reader->count() - 1 << std::endl;
+          ok = false;
+          break;
+        }
+        coded_out.WriteRaw(text.data(), text.size());
+      }
+    } else {
+      std::vector<std::unique_ptr<MessageDecoder>> decoders;
+      for (int i = 0; i < *jobs; ++i) {
+        decoders.push_back(std::make_unique<MessageDecoder>(type, options));
+      }
+
+      // Records are copied out of the reader, since its views don't outlive
+      // the block they point into.
+      OrderedPipeline<IndexedRecord, std::string> pipeline(*jobs);
+      ok = pipeline.Run(
+          [&](IndexedRecord* record) {
+            absl::string_view data;
+            status = reader->Next(&data);
+            if (status != records::RecordReader::OK)
+              return false;
+            record->index = reader->count() - 1;
+            record->data.assign(data.data(), data.size());
+            return true;
+          },
+          [&](int worker, IndexedRecord& record, std::string* text) {
+            if (!decoders[worker]->Decode(record.data, text)) {
+              std::cerr << path << ": failed to parse record " << record.index
+                        << std::endl;
+              return false;
+            }
+            return true;
+          },
+          [&](std::string& text) {
+            coded_out.WriteRaw(text.data(), text.size());
+            return !coded_out.HadError();
+          });
+    }
+    ok = ok && !coded_out.HadError();
+  }
+
+  ok = CheckReadStatus(path, *reader, status) && ok;
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Shreds the records of a records file into columns and writes them to a
+// column file next to it, see records::ColumnChunk.  Blocks are read and
+// decompressed by `jobs` workers and shredded on the calling thread in file
+// order, `chunk_records` records per chunk.
+bool Columnarize(const ActionParams& args) {
+  if (!CheckActionFlags("records columnarize", args, kColumnarizeFlags)) {
+    return false;
+  }
+  if (args.positional.size() != 2) {
+    std::cerr << "records columnarize: expected a single records file"
+              << std::endl;
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  const auto chunk_records = args.GetInt("chunk_records", 1 << 16);
+  if (!jobs || !chunk_records) {
+    return false;
+  }
+  if (*chunk_records <= 0) {
+    std::cerr << "--chunk_records: must be positive" << std::endl;
+    return false;
+  }
+
+  const std::string& path = args.positional[1];
+  records::ParallelReaderOptions reader_options;
+  reader_options.threads = *jobs;
+  auto reader = records::ParallelRecordReader::Open(path, reader_options);
+  if (!reader) {
+    return false;
+  }
+  auto schema = HeaderSchema::Load(path, reader->header());
+  if (!schema) {
+    return false;
+  }
+  const Descriptor* type = schema->FindType(args.Get("type").value_or(""));
+  if (type == nullptr) {
+    return false;
+  }
+
+  std::vector<std::string> paths;
+  if (auto fields = args.Get("fields")) {
+    paths = absl::StrSplit(*fields, ',', absl::SkipWhitespace());
+  }
+  ParsePlanCache plans;
+  std::string error;
+  auto shredder = ColumnShredder::Create(plans.Get(type), paths, &error);
+  if (!shredder) {
+    std::cerr << "--fields: " << error << std::endl;
+    return false;
+  }
+  if (shredder->columns().empty()) {
+    std::cerr << "records columnarize: " << type->full_name()
+              << " has no fields to shred" << std::endl;
+    return false;
+  }
+
+  // The column file describes its chunks, so `records cat` can print them.
+  records::RecordSetHeader header;
+  header.set_name(type->full_name());
+  header.set_comment("columns of " + path);
+  header.set_codec(reader->header().codec());
+  records::ColumnChunk::descriptor()->file()->CopyTo(
+      header.mutable_descriptor_set()->add_file());
+
+  const std::string output = args.Get("output").value_or(path + ".columns");
+  OutputFile output_file(output);
+  // One chunk per block, so the footer index finds a column's chunks by
+  // their path.
+  records::RecordWriterOptions writer_options;
+  writer_options.block_size = 1;
+  auto writer = records::RecordWriter::Open(output_file.temp_path(), header,
+                                            writer_options);
+  if (!writer) {
+    return false;
+  }
+
+  struct Summary {
+    uint64_t chunks = 0;
+    uint64_t values = 0;
+    uint64_t bytes = 0;
+  };
+  absl::btree_map<std::string, Summary> summaries;
+  std::vector<records::ColumnChunk> chunks;
+  std::string serialized;
+  const auto flush = [&] {
+    chunks.clear();
+    shredder->Flush(&chunks);
+    for (const records::ColumnChunk& chunk : chunks) {
+      Summary& summary = summaries[chunk.path()];
+      ++summary.chunks;
+      summary.values += chunk.value_count();
+      serialized.clear();
+      chunk.SerializeToString(&serialized);
+      summary.bytes += serialized.size();
+      if (!writer->Append(serialized, chunk.path()))
+        return false;
+    }
+    return true;
+  };
+
+  uint64_t count = 0;
+  bool ok = reader->ReadOrdered([&](const records::RecordBatch& batch) {
+    for (absl::string_view record : batch.records) {
+      // A record that would overfill a chunk starts the next one.
+      if (!shredder->Add(record) &&
+          (shredder->pending() == 0 || !flush() || !shredder->Add(record))) {
+        std::cerr << path << ": failed to parse record " << count
+                  << std::endl;
+        return false;
+      }
+      ++count;
+      if (shredder->pending() == static_cast<uint64_t>(*chunk_records) &&
+          !flush()) {
+        return false;
+      }
+    }
+    return true;
+  });
+  ok = ok && (shredder->pending() == 0 || flush());
+  ok = writer->Close() && ok;
+  if (!ok || !output_file.Commit()) {
+    return false;
+  }
+
+  std::cout << output << ": " << count << " records" << std::endl;
+  for (const auto& [column, summary] : summaries) {
+    std::cout << "  " << column << ": " << summary.chunks << " chunks, "
+              << summary.values << " values, " << summary.bytes << " bytes"
+              << std::endl;
+  }
+  return true;
+}
+
+// Sorts the records of a records file by a key field into a new file, with
+// an external merge sort so that the file can be larger than memory.  Keys
+// are read from the wire data by `jobs` workers, which also sort and spill
+// runs in parallel; the runs are then merged on one thread.  With
+// --unique, only the last record for each key is kept.
+bool Sort(const ActionParams& args) {
+  if (!CheckActionFlags("records sort", args, kSortFlags)) {
+    return false;
+  }
+  if (args.positional.size() != 2) {
+    std::cerr << "records sort: expected a single records file" << std::endl;
+    return false;
+  }
+  const auto key_path = args.Get("key");
+  if (!key_path) {
+    std::cerr << "records sort: --key is required" << std::endl;
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  const auto memory_limit = args.GetInt("memory_limit", int64_t{1} << 30);
+  if (!jobs || !memory_limit) {
+    return false;
+  }
+  if (*memory_limit <= 0) {
+    std::cerr << "--memory_limit: must be positive" << std::endl;
+    return false;
+  }
+
+  const std::string& path = args.positional[1];
+  records::ParallelReaderOptions reader_options;
+  reader_options.threads = *jobs;
+  auto reader = records::ParallelRecordReader::Open(path, reader_options);
+  if (!reader) {
+    return false;
+  }
+  auto schema = HeaderSchema::Load(path, reader->header());
+  if (!schema) {
+    return false;
+  }
+  const Descriptor* type = schema->FindType(args.Get("type").value_or(""));
+  if (type == nullptr) {
+    return false;
+  }
+  ParsePlanCache plans;
+  std::string error;
+  auto key = SortKey::Compile(plans.Get(type), *key_path, &error);
+  if (!key) {
+    std::cerr << "--key: " << error << std::endl;
+    return false;
+  }
+
+  records::ExternalSortOptions sort_options;
+  sort_options.temp_dir = args.Get("temp_dir").value_or("");
+  sort_options.memory_limit = *memory_limit;
+  sort_options.workers = reader->threads();
+  sort_options.unique = args.Has("unique");
+  records::ExternalSorter sorter(sort_options);
+
+  // Records are numbered by range and position so that equal keys keep
+  // their order in the file.
+  std::vector<std::string> keys(reader->threads());
+  const bool ok =
+      reader->ReadUnordered([&](int worker,
+                                const records::RecordBatch& batch) {
+        std::string& record_key = keys[worker];
+        for (size_t i = 0; i < batch.records.size(); ++i) {
+          if (!key->Extract(batch.records[i], &record_key)) {
+            std::cerr << path << ": failed to parse record " << i
+                      << " of range " << batch.range << std::endl;
+            return false;
+          }
+          const uint64_t sequence =
+              (static_cast<uint64_t>(batch.range) << 32) | i;
+          if (!sorter.Add(worker, record_key, sequence, batch.records[i]))
+            return false;
+        }
+        return true;
+      });
+  if (!ok) {
+    return false;
+  }
+
+  const size_t runs = sorter.spilled_runs();
+  const std::string output = args.Get("output").value_or(path + ".sorted");
+  OutputFile output_file(output);
+  auto writer =
+      records::RecordWriter::Open(output_file.temp_path(), reader->header());
+  if (!writer) {
+    return false;
+  }
+  // Keys go into the block index, so readers can find blocks by key.
+  if (!sorter.Merge([&](absl::string_view record_key,
+                        absl::string_view record) {
+        return writer->Append(record, record_key);
+      })) {
+    return false;
+  }
+  if (!writer->Close() || !output_file.Commit()) {
+    return false;
+  }
+  std::cout << output << ": " << writer->count() << " records, "
+            << runs << " runs spilled" << std::endl;
+  return true;
+}
+
+// Prints the last records of a records file and, with -f, the records
+// written to it from then on.  The schema and decoder are set up once, so
+// each record appended costs one decode, and the follower sleeps on inotify
+// between appends.
+bool Tail(const ActionParams& params) {
+  ActionParams args = params;
+  bool follow = args.Has("follow");
+  // `-f` as in tail(1).
+  auto short_follow =
+      std::find(args.positional.begin(), args.positional.end(), "-f");
+  if (short_follow != args.positional.end()) {
+    args.positional.erase(short_follow);
+    follow = true;
+  }
+  if (!CheckActionFlags("records tail", args, kTailFlags)) {
+    return false;
+  }
+  if (args.positional.size() != 2) {
+    std::cerr << "records tail: expected a single records file" << std::endl;
+    return false;
+  }
+  const auto lines = args.GetInt("lines", 10);
+  const auto arena_block_size = GetArenaBlockSize(args);
+  const auto format = GetMessageFormat(args);
+  if (!lines || !arena_block_size || !format) {
+    return false;
+  }
+  if (*lines < 0) {
+    std::cerr << "--lines: must not be negative" << std::endl;
+    return false;
+  }
+  DecodeOptions options{.format = *format,
+                        .single_line = true,
+                        .arena_block_size = *arena_block_size};
+
+  const std::string& path = args.positional[1];
+  auto follower = records::RecordFollower::Open(path);
+  if (!follower) {
+    return false;
+  }
+  auto schema = HeaderSchema::Load(path, follower->header());
+  if (!schema) {
+    return false;
+  }
+  const Descriptor* type = schema->FindType(args.Get("type").value_or(""));
+  if (type == nullptr) {
+    return false;
+  }
+  std::unique_ptr<FieldProjection> projection;
+  if (auto fields = args.Get("fields")) {
+    std::string error;
+    projection = FieldProjection::Compile(type, *fields, &error);
+    if (!projection) {
+      std::cerr << "--fields: " << error << std::endl;
+      return false;
+    }
+    options.projection = projection.get();
+  }
+  MessageDecoder decoder(type, options);
+
+  // With a block index, skip straight to the block holding the first record
+  // to print.
+  const records::RecordReader& reader = follower->reader();
+  if (reader.has_index() && reader.index().block_size() > 0) {
+    const records::RecordBlock& last =
+        reader.index().block(reader.index().block_size() - 1);
+    const uint64_t count = last.first_record() + last.record_count();
+    follower->SeekToRecord(count - std::min<uint64_t>(count, *lines));
+  }
+  // The last records, with their indexes in the file.
+  std::deque<std::pair<uint64_t, std::string>> last_records;
+  if (!follower->Read([&](absl::string_view data) {
+        if (*lines == 0)
+          return true;
+        if (last_records.size() == static_cast<size_t>(*lines))
+          last_records.pop_front();
+        last_records.emplace_back(follower->count() - 1, data);
+        return true;
+      })) {
+    return false;
+  }
+
+  FileOutputStream out(STDOUT_FILENO);
+  std::string text;
+  const auto print = [&](uint64_t index, absl::string_view data) {
+    text.clear();
+    if (!decoder.Decode(data, &text)) {
+      std::cerr << path << ": failed to parse record " << index << std::endl;
+      return false;
+    }
+    CodedOutputStream coded_out(&out);
+    coded_out.WriteRaw(text.data(), text.size());
+    return !coded_out.HadError();
+  };
+  bool ok = true;
+  for (const auto& [index, data] : last_records) {
+    if (!(ok = print(index, data)))
+      break;
+  }
+  last_records.clear();
+  ok = ok && out.Flush();
+  const auto print_next = [&](absl::string_view data) {
+    return print(follower->count() - 1, data);
+  };
+  while (ok && follow) {
+    ok = follower->Wait() && follower->Read(print_next) && out.Flush();
+  }
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Records(const protodb::ProtoSchemaDb& protodb,
+             const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  const std::string subcommand =
+      args.positional.empty() ? "" : args.positional[0];
+  if (subcommand == "cat") {
+    return Cat(args);
+  }
+  if (subcommand == "columnarize") {
+    return Columnarize(args);
+  }
+  if (subcommand == "sort") {
+    return Sort(args);
+  }
+  if (subcommand == "tail") {
+    return Tail(args);
+  }
+  std::cerr << "records: expected a subcommand: cat, columnarize, sort, tail"
+            << std::endl;
+  return false;
+}
+
+}  // namespace protodb
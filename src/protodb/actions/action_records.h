@@ -0,0 +1,17 @@
+#ifndef PROTODB_ACTION_RECORDS_H__
+#define PROTODB_ACTION_RECORDS_H__
+
+#include <span>
+#include <string>
+
+namespace protodb {
+
+struct ProtoSchemaDb;
+
+// Runs a `records` subcommand on a records file, see src/records.
+bool Records(const ProtoSchemaDb& protodb,
+             const std::span<std::string>& params);
+
+}  // namespace protodb
+
+#endif  // PROTODB_ACTION_RECORDS_H__
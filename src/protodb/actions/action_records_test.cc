@@ -0,0 +1,160 @@
+#include "protodb/actions/action_records.h"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+#include "protodb/db/protodb.h"
+#include "protodb/io/columnar.h"
+#include "protodb/io/test_util.h"
+#include "records/record_reader.h"
+#include "records/record_writer.h"
+#include "src/records/columns.pb.h"
+#include "src/records/records.pb.h"
+
+namespace protodb {
+namespace {
+
+// Runs `protodb records` on a records file of test::Person messages, which
+// carries its schema in the header.
+class RecordsTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    const char* tmpdir = getenv("TEST_TMPDIR");
+    path_ = std::string(tmpdir ? tmpdir : "/tmp") + "/action_records_test." +
+            std::to_string(getpid()) + ".rec";
+    TearDown();
+
+    records::RecordSetHeader header;
+    header.set_name("protodb.test.Person");
+    test::Person::descriptor()->file()->CopyTo(
+        header.mutable_descriptor_set()->add_file());
+    auto writer = records::RecordWriter::Open(path_, header);
+    ASSERT_NE(writer, nullptr);
+    for (absl::string_view text : {R"pb(name: "c" age: 30)pb",
+                                   R"pb(name: "a" age: 10)pb",
+                                   R"pb(name: "b" age: 20)pb"}) {
+      ASSERT_TRUE(writer->Append(test::Wire<test::Person>(text)));
+    }
+    ASSERT_TRUE(writer->Close());
+  }
+  void TearDown() override {
+    for (const std::string& path :
+         {path_, path_ + ".columns", path_ + ".sorted"}) {
+      unlink(path.c_str());
+    }
+  }
+
+  // Runs `records` with `args` and the test file, and returns whether it
+  // succeeded.  What it prints goes to `out`.  The file's first message is
+  // not a Person, so the type is always given.
+  bool Run(std::vector<std::string> args, std::string* out = nullptr) {
+    args.push_back("--type=protodb.test.Person");
+    testing::internal::CaptureStdout();
+    const bool ok = Records(db_, std::span<std::string>(args));
+    const std::string printed = testing::internal::GetCapturedStdout();
+    if (out != nullptr)
+      *out = printed;
+    return ok;
+  }
+
+  // The records of the file at `path`.
+  std::vector<std::string> ReadRecords(const std::string& path) {
+    std::vector<std::string> result;
+    auto reader = records::RecordReader::Open(path);
+    EXPECT_NE(reader, nullptr);
+    if (reader == nullptr)
+      return result;
+    absl::string_view data;
+    while (reader->Next(&data) == records::RecordReader::OK) {
+      result.emplace_back(data);
+    }
+    return result;
+  }
+
+  ProtoSchemaDb db_{""};
+  std::string path_;
+};
+
+TEST_F(RecordsTest, CatsRecords) {
+  const std::string all = "name: \"c\" age: 30\n"
+                          "name: \"a\" age: 10\n"
+                          "name: \"b\" age: 20\n";
+  std::string out;
+  ASSERT_TRUE(Run({"cat", "--jobs=1", path_}, &out));
+  EXPECT_EQ(out, all);
+  ASSERT_TRUE(Run({"cat", "--jobs=3", path_}, &out));
+  EXPECT_EQ(out, all);
+  ASSERT_TRUE(Run({"cat", "--arena_block_size=0", path_}, &out));
+  EXPECT_EQ(out, all);
+  ASSERT_TRUE(Run({"cat", "--fields=age", path_}, &out));
+  EXPECT_EQ(out, "age: 30\nage: 10\nage: 20\n");
+
+  EXPECT_FALSE(Run({"cat", "--fields=nope", path_}));
+  EXPECT_FALSE(Run({"cat", "--jobs=0", path_}));
+  EXPECT_FALSE(Run({"cat", "--jobs=100000", path_}));
+  EXPECT_FALSE(Run({"cat", "--arena_block_size=-1", path_}));
+  EXPECT_FALSE(Run({"cat", "--arena_block_size=2147483648", path_}));
+  EXPECT_FALSE(Run({"cat", path_ + ".missing"}));
+}
+
+TEST_F(RecordsTest, TailsRecords) {
+  std::string out;
+  ASSERT_TRUE(Run({"tail", "--lines=2", path_}, &out));
+  EXPECT_EQ(out, "name: \"a\" age: 10\nname: \"b\" age: 20\n");
+  ASSERT_TRUE(Run({"tail", "--lines=0", path_}, &out));
+  EXPECT_EQ(out, "");
+}
+
+TEST_F(RecordsTest, SortsRecords) {
+  ASSERT_TRUE(Run({"sort", "--key=age", path_}));
+  EXPECT_EQ(ReadRecords(path_ + ".sorted"),
+            (std::vector<std::string>{
+                test::Wire<test::Person>(R"pb(name: "a" age: 10)pb"),
+                test::Wire<test::Person>(R"pb(name: "b" age: 20)pb"),
+                test::Wire<test::Person>(R"pb(name: "c" age: 30)pb")}));
+
+  // Sorting a file onto itself replaces it once the sort is done.
+  ASSERT_TRUE(Run({"sort", "--key=name", "--output=" + path_,
+                   path_ + ".sorted"}));
+  std::string out;
+  ASSERT_TRUE(Run({"cat", path_}, &out));
+  EXPECT_EQ(out, "name: \"a\" age: 10\n"
+                 "name: \"b\" age: 20\n"
+                 "name: \"c\" age: 30\n");
+
+  EXPECT_FALSE(Run({"sort", path_}));
+  EXPECT_FALSE(Run({"sort", "--key=tags", path_}));
+}
+
+TEST_F(RecordsTest, ColumnarizesRecords) {
+  ASSERT_TRUE(Run({"columnarize", "--fields=age,name", path_}));
+  std::vector<std::string> paths;
+  for (const std::string& record : ReadRecords(path_ + ".columns")) {
+    records::ColumnChunk chunk;
+    ASSERT_TRUE(chunk.ParseFromString(record));
+    EXPECT_EQ(chunk.record_count(), 3);
+    paths.push_back(chunk.path());
+    if (chunk.path() == "age") {
+      ColumnValues values;
+      ASSERT_TRUE(DecodeColumnChunk(
+          chunk, test::Person::descriptor()->FindFieldByName("age"),
+          &values));
+      EXPECT_EQ(values.scalars, (std::vector<uint64_t>{30, 10, 20}));
+    }
+  }
+  // Columns are in field order.
+  EXPECT_EQ(paths, (std::vector<std::string>{"name", "age"}));
+
+  EXPECT_FALSE(Run({"columnarize", "--fields=nope", path_}));
+}
+
+}  // namespace
+}  // namespace protodb
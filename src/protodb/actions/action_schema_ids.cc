@@ -0,0 +1,361 @@
+#include "protodb/actions/action_schema_ids.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/text_format.h"
+#include "protodb/actions/common.h"
+#include "protodb/db/protodb.h"
+#include "protodb/io/content_hash.h"
+#include "schema_id/message_id_map.pb.h"
+#include "schema_id/schema_map.h"
+
+namespace protodb {
+
+using ::google::protobuf::DescriptorProto;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::FileDescriptorSet;
+using ::google::protobuf::TextFormat;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::FileOutputStream;
+using ::protobunny::schema_id::MessageIdMap;
+
+namespace schema_id = ::protobunny::schema_id;
+
+namespace {
+
+constexpr std::string_view kSchemaIdsFlags[] = {"assign", "jobs", "output",
+                                             "previous"};
+
+// A message type found in a snapshot, with the key of its schema id or 0.
+struct FoundType {
+  std::string full_name;
+  uint64_t key;
+};
+
+// The id of a message type, and the snapshot it was first seen with it.
+struct TypeId {
+  uint64_t key = 0;
+  size_t snapshot = 0;
+};
+
+std::string KeyName(uint64_t key) {
+  return absl::StrFormat("%s %#x", key & schema_id::kId32Key ? "id32" : "id64",
+                         schema_id::KeyId(key));
+}
+
+void FindTypes(const DescriptorProto& message, const std::string& scope,
+               std::vector<FoundType>* types) {
+  if (message.options().map_entry())
+    return;
+  std::string full_name =
+      scope.empty() ? message.name() : absl::StrCat(scope, ".", message.name());
+  for (const DescriptorProto& nested : message.nested_type()) {
+    FindTypes(nested, full_name, types);
+  }
+  const uint64_t key = schema_id::OptionsKey(message.options());
+  types->push_back(FoundType{std::move(full_name), key});
+}
+
+// Reads the message types in the descriptor set at `path`.  Files repeated
+// within the set are only read once.
+bool ReadSnapshotTypes(const std::string& path,
+                       std::vector<FoundType>* types) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  FileDescriptorSet set;
+  const bool parsed = set.ParseFromFileDescriptor(fd);
+  close(fd);
+  if (!parsed) {
+    std::cerr << path << ": unable to parse" << std::endl;
+    return false;
+  }
+  absl::flat_hash_map<std::string, bool> files;
+  for (const FileDescriptorProto& file : set.file()) {
+    if (!files.try_emplace(file.name(), true).second)
+      continue;
+    for (const DescriptorProto& message : file.message_type()) {
+      FindTypes(message, file.package(), types);
+    }
+  }
+  return true;
+}
+
+// An id for `full_name` from a stable hash of it, the `attempt`th after
+// earlier attempts collided.
+uint64_t AssignedKey(const std::string& full_name, bool id32,
+                     uint64_t attempt) {
+  const uint64_t hash = absl::Uint128Low64(ContentHash(full_name, attempt));
+  if (id32) {
+    return schema_id::Id32Key(
+        schema_id::kMinId +
+        hash % (schema_id::kMaxId32 - schema_id::kMinId + 1));
+  }
+  return schema_id::Id64Key(
+      schema_id::kMinId + hash % (schema_id::kMaxId64 - schema_id::kMinId + 1));
+}
+
+uint64_t EntryKey(const MessageIdMap::Entry& entry) {
+  return entry.has_id32() ? schema_id::Id32Key(entry.id32())
+                          : schema_id::Id64Key(entry.id64());
+}
+
+bool ReadMap(const std::string& path, MessageIdMap* map) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  const bool parsed = map->ParseFromFileDescriptor(fd);
+  close(fd);
+  if (!parsed) {
+    std::cerr << path << ": unable to parse" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool WriteMap(const MessageIdMap& map, const std::string& path) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  FileOutputStream out(fd);
+  {
+    CodedOutputStream coded_out(&out);
+    coded_out.SetSerializationDeterministic(true);
+    map.SerializeToCodedStream(&coded_out);
+  }
+  if (!out.Close()) {
+    std::cerr << path << ": " << strerror(out.GetErrno()) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// Snapshots are parsed by `jobs` threads, each into a list of its types.
+// The lists are then merged on one thread through two hash indexes, by
+// full name and by id, so that finding an id used twice, or a type whose id
+// changed between snapshots, is a lookup per type.
+bool SchemaIds(const ProtoSchemaDb& protodb,
+               const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  if (!CheckActionFlags("schema-ids", args, kSchemaIdsFlags)) {
+    return false;
+  }
+  if (!args.positional.empty()) {
+    std::cerr << "schema-ids: unexpected argument: " << args.positional[0]
+              << std::endl;
+    return false;
+  }
+  const std::string assign = args.Get("assign").value_or("");
+  if (!assign.empty() && assign != "id32" && assign != "id64") {
+    std::cerr << "--assign: expected id32 or id64" << std::endl;
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  if (!jobs) {
+    return false;
+  }
+
+  // Ids already handed out stay with their types, so that Anys packed with
+  // them keep unpacking.  An existing --output is the previous map unless
+  // --previous names another.
+  const auto output = args.Get("output");
+  std::optional<std::string> previous_path = args.Get("previous");
+  if (!previous_path && output && access(output->c_str(), F_OK) == 0) {
+    previous_path = *output;
+  }
+  MessageIdMap previous;
+  if (previous_path && !ReadMap(*previous_path, &previous)) {
+    return false;
+  }
+
+  const auto& paths = protodb.snapshot_paths();
+  std::vector<std::vector<FoundType>> snapshots(paths.size());
+  std::vector<char> loaded(paths.size());
+  {
+    std::atomic<size_t> next = 0;
+    const auto worker = [&] {
+      for (size_t i = next++; i < paths.size(); i = next++) {
+        loaded[i] = ReadSnapshotTypes(paths[i], &snapshots[i]);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min<int64_t>(*jobs, paths.size()); ++i) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+  if (std::find(loaded.begin(), loaded.end(), 0) != loaded.end()) {
+    return false;
+  }
+
+  // Snapshots mostly hold the same types, so the largest is a good guess of
+  // how many there are.
+  size_t largest = 0;
+  for (const auto& types : snapshots) {
+    largest = std::max(largest, types.size());
+  }
+  absl::flat_hash_map<std::string, TypeId> by_name;
+  by_name.reserve(largest);
+  bool ok = true;
+  for (size_t snapshot = 0; snapshot < snapshots.size(); ++snapshot) {
+    for (FoundType& type : snapshots[snapshot]) {
+      auto [it, added] = by_name.try_emplace(std::move(type.full_name),
+                                             TypeId{type.key, snapshot});
+      if (added || type.key == 0)
+        continue;
+      TypeId& id = it->second;
+      if (id.key == 0) {
+        id = TypeId{type.key, snapshot};
+      } else if (id.key != type.key) {
+        std::cerr << it->first << ": " << KeyName(id.key) << " in "
+                  << paths[id.snapshot].filename() << " but "
+                  << KeyName(type.key) << " in "
+                  << paths[snapshot].filename() << std::endl;
+        ok = false;
+      }
+    }
+  }
+
+  // Types in the previous map keep their ids.  Those no longer in any
+  // snapshot stay in the map, so that their ids are never reused.
+  size_t kept = 0;
+  size_t missing = 0;
+  for (const MessageIdMap::Entry& entry : previous.entries()) {
+    const uint64_t key = EntryKey(entry);
+    auto [it, added] = by_name.try_emplace(entry.message_type(),
+                                           TypeId{key, snapshots.size()});
+    if (added) {
+      std::cerr << entry.message_type() << ": " << KeyName(key) << " in "
+                << *previous_path << " but in no snapshot" << std::endl;
+      ++missing;
+      continue;
+    }
+    TypeId& id = it->second;
+    if (id.key == 0) {
+      id.key = key;
+      ++kept;
+    } else if (id.key != key) {
+      std::cerr << it->first << ": " << KeyName(id.key) << " in "
+                << paths[id.snapshot].filename() << " but " << KeyName(key)
+                << " in " << *previous_path << std::endl;
+      ok = false;
+    }
+  }
+
+  // Names are sorted so that both the map and assigned ids are the same
+  // from one run to the next.
+  using Type = std::pair<const std::string, TypeId>;
+  std::vector<Type*> types;
+  types.reserve(by_name.size());
+  for (Type& type : by_name) {
+    types.push_back(&type);
+  }
+  std::sort(types.begin(), types.end(),
+            [](const Type* a, const Type* b) { return a->first < b->first; });
+
+  absl::flat_hash_map<uint64_t, const std::string*> by_id;
+  by_id.reserve(by_name.size());
+  size_t annotated = 0;
+  for (const Type* type : types) {
+    const uint64_t key = type->second.key;
+    if (key == 0)
+      continue;
+    ++annotated;
+    if (!schema_id::IsValidKey(key)) {
+      std::cerr << type->first << ": " << KeyName(key) << " is reserved"
+                << std::endl;
+      ok = false;
+    }
+    const auto [it, added] = by_id.try_emplace(key, &type->first);
+    if (!added) {
+      std::cerr << *it->second << ", " << type->first << ": both have "
+                << KeyName(key) << std::endl;
+      ok = false;
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+
+  // A collision moves a type on to the next hash of its name.  Only types
+  // with no id yet are assigned one, so types with ids in their options or
+  // in the previous map never move.
+  size_t assigned = 0;
+  if (!assign.empty()) {
+    for (Type* type : types) {
+      TypeId& id = type->second;
+      if (id.key != 0)
+        continue;
+      for (uint64_t attempt = 0;; ++attempt) {
+        id.key = AssignedKey(type->first, assign == "id32", attempt);
+        if (by_id.try_emplace(id.key, &type->first).second)
+          break;
+      }
+      ++assigned;
+    }
+  }
+
+  MessageIdMap map;
+  for (const Type* type : types) {
+    const uint64_t key = type->second.key;
+    if (key == 0)
+      continue;
+    MessageIdMap::Entry* entry = map.add_entries();
+    if (key & schema_id::kId32Key) {
+      entry->set_id32(schema_id::KeyId(key));
+    } else {
+      entry->set_id64(key);
+    }
+    entry->set_message_type(type->first);
+  }
+
+  if (!output) {
+    std::string text;
+    TextFormat::PrintToString(map, &text);
+    std::cout << text;
+    return true;
+  }
+  if (!WriteMap(map, *output)) {
+    return false;
+  }
+  std::cout << *output << ": " << map.entries_size() << " of "
+            << types.size() - missing << " message types from "
+            << paths.size() << " snapshots, " << annotated - kept - missing
+            << " with ids, " << kept << " kept, " << assigned << " assigned, "
+            << missing << " missing" << std::endl;
+  return true;
+}
+
+}  // namespace protodb
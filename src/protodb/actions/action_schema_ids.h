@@ -0,0 +1,18 @@
+#ifndef PROTODB_ACTION_SCHEMA_IDS_H__
+#define PROTODB_ACTION_SCHEMA_IDS_H__
+
+#include <span>
+#include <string>
+
+namespace protodb {
+
+struct ProtoSchemaDb;
+
+// Collects the schema ids of the messages in every snapshot of the db into
+// a protobunny.schema_id.MessageIdMap, see src/schema_id.
+bool SchemaIds(const ProtoSchemaDb& protodb,
+               const std::span<std::string>& params);
+
+}  // namespace protodb
+
+#endif  // PROTODB_ACTION_SCHEMA_IDS_H__
@@ -0,0 +1,187 @@
+#include "protodb/actions/action_transcode.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "protodb/actions/common.h"
+#include "protodb/db/protodb.h"
+#include "protodb/io/delimited.h"
+#include "protodb/io/ordered_pipeline.h"
+#include "protodb/transcoder.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::FileInputStream;
+using ::google::protobuf::io::FileOutputStream;
+
+namespace {
+
+constexpr std::string_view kTranscodeFlags[] = {"delimited", "from", "jobs",
+                                                "to", "to_type"};
+
+// Loads the descriptor set named by `--<flag>`.
+std::unique_ptr<ProtoSchemaDb::Snapshot> LoadSnapshotFlag(
+    const ProtoSchemaDb& protodb, const ActionParams& args,
+    std::string_view flag) {
+  const auto name = args.Get(flag);
+  if (!name || name->empty()) {
+    std::cerr << "transcode: --" << flag << " is required" << std::endl;
+    return nullptr;
+  }
+  return protodb.LoadSnapshot(*name);
+}
+
+// Transcodes a stream of length-delimited messages from stdin to stdout.
+// With more than one job the messages are framed by a reader thread,
+// transcoded by `jobs` workers sharing the transcoder and written back out
+// in their original order.
+bool TranscodeDelimited(const Transcoder& transcoder, int jobs) {
+  FileInputStream in(STDIN_FILENO);
+  FileOutputStream out(STDOUT_FILENO);
+  DelimitedReader reader(&in);
+  bool read_error = false;
+  bool ok = true;
+
+  // Transcodes message `index` of the stream.
+  const auto transcode = [&](uint64_t index, absl::string_view wire,
+                             std::string* output) {
+    std::string message;
+    if (!transcoder.Transcode(wire, &message)) {
+      std::cerr << "Failed to transcode message " << index << std::endl;
+      return false;
+    }
+    AppendDelimited(message, output);
+    return true;
+  };
+
+  {
+    CodedOutputStream coded_out(&out);
+    if (jobs <= 1) {
+      std::string wire;
+      std::string output;
+      DelimitedReader::Status status;
+      while ((status = reader.Next(&wire)) == DelimitedReader::OK) {
+        output.clear();
+        if (!transcode(reader.count() - 1, wire, &output)) {
+          ok = false;
+          break;
+        }
+        coded_out.WriteRaw(output.data(), output.size());
+      }
+      read_error = status == DelimitedReader::ERROR;
+    } else {
+      OrderedPipeline<DelimitedMessage, std::string> pipeline(jobs);
+      ok = pipeline.Run(
+          [&](DelimitedMessage* wire) {
+            const auto status = reader.Next(wire);
+            read_error = status == DelimitedReader::ERROR;
+            return status == DelimitedReader::OK;
+          },
+          [&](int worker, DelimitedMessage& wire, std::string* output) {
+            return transcode(wire.index, wire.data, output);
+          },
+          [&](std::string& output) {
+            coded_out.WriteRaw(output.data(), output.size());
+            return !coded_out.HadError();
+          });
+    }
+    ok = ok && !coded_out.HadError();
+  }
+
+  if (read_error) {
+    std::cerr << "Failed to read delimited input after " << reader.count()
+              << " message(s)." << std::endl;
+    return false;
+  }
+  if (!out.Close() || !ok) {
+    if (out.GetErrno())
+      std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Transcode(const protodb::ProtoSchemaDb& protodb,
+               const std::span<std::string>& params) {
+  const ActionParams args = ParseActionParams(params);
+  if (!CheckActionFlags("transcode", args, kTranscodeFlags)) {
+    return false;
+  }
+  const auto jobs = GetJobs(args);
+  if (!jobs) {
+    return false;
+  }
+  if (args.positional.empty()) {
+    std::cerr << "transcode: no message type specified" << std::endl;
+    return false;
+  }
+  const std::string& from_type_name = args.positional[0];
+  const std::string to_type_name = args.Get("to_type").value_or(from_type_name);
+
+  const auto from = LoadSnapshotFlag(protodb, args, "from");
+  const auto to = LoadSnapshotFlag(protodb, args, "to");
+  if (!from || !to) {
+    return false;
+  }
+  const Descriptor* from_type =
+      from->pool->FindMessageTypeByName(from_type_name);
+  if (from_type == nullptr) {
+    std::cerr << "Type not defined in --from: " << from_type_name << std::endl;
+    return false;
+  }
+  const Descriptor* to_type = to->pool->FindMessageTypeByName(to_type_name);
+  if (to_type == nullptr) {
+    std::cerr << "Type not defined in --to: " << to_type_name << std::endl;
+    return false;
+  }
+
+  const auto transcoder = Transcoder::Create(from_type, to_type);
+  for (const std::string& dropped : transcoder->dropped_fields()) {
+    std::cerr << "warning: dropping " << dropped << std::endl;
+  }
+
+  if (args.Has("delimited")) {
+    return TranscodeDelimited(*transcoder, *jobs);
+  }
+
+  FileInputStream in(STDIN_FILENO);
+  std::string input;
+  if (!ReadAll(&in, &input)) {
+    std::cerr << "input: I/O error." << std::endl;
+    return false;
+  }
+
+  std::string wire;
+  if (!transcoder->Transcode(input, &wire)) {
+    std::cerr << "Failed to transcode input." << std::endl;
+    return false;
+  }
+
+  FileOutputStream out(STDOUT_FILENO);
+  {
+    CodedOutputStream coded_out(&out);
+    coded_out.WriteRaw(wire.data(), wire.size());
+  }
+  if (!out.Close()) {
+    std::cerr << "output: I/O error." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace protodb
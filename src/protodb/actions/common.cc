@@ -7,20 +7,40 @@
 
 #include <string>
 
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "absl/algorithm/container.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/cord.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/string_view.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "google/protobuf/wire_format_lite.h"
 
 namespace protodb {
 
+using ::google::protobuf::ArenaOptions;
 using ::google::protobuf::internal::WireFormatLite;
 using ::google::protobuf::io::CodedInputStream;
 using ::google::protobuf::io::CordInputStream;
 
+bool ReadAll(FileInputStream* in, std::string* data) {
+  const void* buffer;
+  int size;
+  while (in->Next(&buffer, &size)) {
+    data->append(static_cast<const char*>(buffer), size);
+  }
+  return in->GetErrno() == 0;
+}
+
 bool IsAsciiPrintable(std::string_view str) {
   for (char c : str) {
     if (!absl::ascii_isprint(c))
@@ -56,4 +76,112 @@ bool IsParseableAsMessage(absl::Cord cord) {
   return true;
 }
 
-}  // namespace protodb
\ No newline at end of file
+ReusableArena::ReusableArena(size_t initial_block_size) {
+  ArenaOptions options;
+  if (initial_block_size > 0) {
+    initial_block_.reset(new char[initial_block_size]);
+    options.initial_block = initial_block_.get();
+    options.initial_block_size = initial_block_size;
+    options.start_block_size = initial_block_size;
+    options.max_block_size = std::max(initial_block_size, options.max_block_size);
+  }
+  arena_ = std::make_unique<Arena>(options);
+}
+
+bool ActionParams::Has(std::string_view name) const {
+  return flags.find(name) != flags.end();
+}
+
+std::optional<std::string> ActionParams::Get(std::string_view name) const {
+  auto iter = flags.find(name);
+  if (iter == flags.end())
+    return std::nullopt;
+  return iter->second;
+}
+
+std::optional<int64_t> ActionParams::GetInt(std::string_view name,
+                                            int64_t default_value) const {
+  auto iter = flags.find(name);
+  if (iter == flags.end())
+    return default_value;
+  int64_t value = 0;
+  if (!absl::SimpleAtoi(iter->second, &value)) {
+    std::cerr << "--" << name << ": expected an integer: " << iter->second
+              << std::endl;
+    return std::nullopt;
+  }
+  return value;
+}
+
+ActionParams ParseActionParams(std::span<std::string> params) {
+  ActionParams action_params;
+  for (const std::string& param : params) {
+    if (!absl::StartsWith(param, "--")) {
+      action_params.positional.push_back(param);
+      continue;
+    }
+    std::string_view flag = absl::StripPrefix(param, "--");
+    const auto equals = flag.find('=');
+    if (equals == flag.npos) {
+      action_params.flags[flag] = "";
+    } else {
+      action_params.flags[flag.substr(0, equals)] = flag.substr(equals + 1);
+    }
+  }
+  return action_params;
+}
+
+std::optional<size_t> GetArenaBlockSize(const ActionParams& params) {
+  const auto block_size =
+      params.GetInt("arena_block_size", kDefaultArenaBlockSize);
+  if (!block_size)
+    return std::nullopt;
+  if (*block_size < 0) {
+    std::cerr << "--arena_block_size: must not be negative" << std::endl;
+    return std::nullopt;
+  }
+  if (static_cast<uint64_t>(*block_size) > kMaxArenaBlockSize) {
+    std::cerr << "--arena_block_size: must be at most " << kMaxArenaBlockSize
+              << std::endl;
+    return std::nullopt;
+  }
+  return *block_size;
+}
+
+std::optional<int> GetJobs(const ActionParams& params) {
+  const auto jobs = params.GetInt(
+      "jobs", std::clamp<int64_t>(std::thread::hardware_concurrency(), 1,
+                                  kMaxJobs));
+  if (!jobs)
+    return std::nullopt;
+  if (*jobs <= 0 || *jobs > kMaxJobs) {
+    std::cerr << "--jobs: expected a number from 1 to " << kMaxJobs
+              << std::endl;
+    return std::nullopt;
+  }
+  return static_cast<int>(*jobs);
+}
+
+std::optional<MessageFormat> GetMessageFormat(const ActionParams& params) {
+  const auto format = params.Get("format");
+  if (!format || *format == "text")
+    return MessageFormat::TEXT;
+  if (*format == "json")
+    return MessageFormat::JSON;
+  std::cerr << "--format: must be text or json" << std::endl;
+  return std::nullopt;
+}
+
+bool CheckActionFlags(std::string_view action, const ActionParams& params,
+                      std::span<const std::string_view> known_flags) {
+  bool ok = true;
+  for (const auto& [name, value] : params.flags) {
+    if (absl::c_find(known_flags, name) == known_flags.end()) {
+      std::cerr << action << ": unknown flag --" << name << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+}  // namespace protodb
@@ -6,12 +6,99 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <vector>
 
+#include "absl/container/btree_map.h"
 #include "absl/strings/cord.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
 
 namespace protodb {
 
+using ::google::protobuf::Arena;
+using ::google::protobuf::io::FileInputStream;
+
+// The default size of the first block of a ReusableArena.
+constexpr size_t kDefaultArenaBlockSize = 256 << 10;
+
+// The largest first block --arena_block_size can ask for, which each
+// worker allocates up front.
+constexpr size_t kMaxArenaBlockSize = size_t{1} << 30;
+
+// An arena whose first block is a buffer owned by this object.  Resetting the
+// arena keeps that buffer, so a message that fits within it can be parsed
+// over and over without going back to the allocator.  Larger messages spill
+// into blocks allocated by the arena as usual.
+class ReusableArena {
+ public:
+  explicit ReusableArena(size_t initial_block_size = kDefaultArenaBlockSize);
+  ReusableArena(const ReusableArena&) = delete;
+  ReusableArena& operator=(const ReusableArena&) = delete;
+
+  Arena* get() {
+    return arena_.get();
+  }
+
+  // Destroys everything allocated on the arena.
+  void Reset() {
+    arena_->Reset();
+  }
+
+ private:
+  std::unique_ptr<char[]> initial_block_;
+  std::unique_ptr<Arena> arena_;
+};
+
+// Parameters passed to an action, split into positional arguments and
+// flags.  Flags are given as `--name=value`, or `--name` for booleans.
+struct ActionParams {
+  std::vector<std::string> positional;
+  absl::btree_map<std::string, std::string> flags;
+
+  bool Has(std::string_view name) const;
+  std::optional<std::string> Get(std::string_view name) const;
+
+  // Returns the flag parsed as an integer, `default_value` when it isn't set
+  // or std::nullopt when it can't be parsed.
+  std::optional<int64_t> GetInt(std::string_view name,
+                                int64_t default_value) const;
+};
+
+ActionParams ParseActionParams(std::span<std::string> params);
+
+// Reads --arena_block_size, which sets the initial block size of the arena
+// used when parsing messages.  It must be at most kMaxArenaBlockSize.
+std::optional<size_t> GetArenaBlockSize(const ActionParams& params);
+
+// The format messages are read or written in.
+enum class MessageFormat {
+  TEXT,
+  JSON,
+};
+
+// The most threads --jobs can ask for.
+constexpr int kMaxJobs = 1024;
+
+// Reads --jobs, the number of threads to use, which defaults to one per
+// core and must be from 1 to kMaxJobs.
+std::optional<int> GetJobs(const ActionParams& params);
+
+// Reads --format, which is either `text` (the default) or `json`.
+std::optional<MessageFormat> GetMessageFormat(const ActionParams& params);
+
+// Reports any flag that isn't in `known_flags` to stderr.  Returns false if
+// an unknown flag was found.
+bool CheckActionFlags(std::string_view action, const ActionParams& params,
+                      std::span<const std::string_view> known_flags);
+
+// Appends everything left in `in` to `data`.  Returns false on a read error.
+bool ReadAll(FileInputStream* in, std::string* data);
+
 bool IsAsciiPrintable(std::string_view str);
 bool IsAsciiPrintable(absl::Cord str);
 
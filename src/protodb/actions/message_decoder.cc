@@ -0,0 +1,75 @@
+#include "protodb/actions/message_decoder.h"
+
+#include <iostream>
+#include <string>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/json/json.h"
+#include "google/protobuf/text_format.h"
+
+namespace protodb {
+
+MessageDecoder::MessageDecoder(const Descriptor* descriptor,
+                               const DecodeOptions& options)
+    : descriptor_(descriptor),
+      options_(options),
+      factory_(descriptor->file()->pool()),
+      prototype_(factory_.GetPrototype(descriptor)),
+      arena_(options.arena_block_size) {
+  ABSL_CHECK(prototype_);
+  printer_.SetSingleLineMode(options_.single_line);
+  json_options_.add_whitespace = !options_.single_line;
+}
+
+bool MessageDecoder::Decode(absl::string_view wire, std::string* output) {
+  if (options_.projection) {
+    projected_.clear();
+    if (!options_.projection->Project(wire, &projected_)) {
+      return false;
+    }
+    wire = projected_;
+  }
+
+  Message* message = prototype_->New(arena_.get());
+  if (!message->ParsePartialFromArray(wire.data(), wire.size())) {
+    arena_.Reset();
+    return false;
+  }
+
+  if (!message->IsInitialized()) {
+    std::cerr << "warning:  Input message is missing required fields:  "
+              << message->InitializationErrorString() << std::endl;
+  }
+
+  if (options_.format == MessageFormat::JSON) {
+    text_.clear();
+    const auto status =
+        google::protobuf::json::MessageToJsonString(*message, &text_,
+                                                    json_options_);
+    if (!status.ok()) {
+      std::cerr << "Failed to print JSON: " << status.message() << std::endl;
+      arena_.Reset();
+      return false;
+    }
+    // JSON is printed without a trailing newline.
+    if (text_.empty() || text_.back() != '\n')
+      text_.push_back('\n');
+  } else {
+    printer_.PrintToString(*message, &text_);
+    if (options_.single_line) {
+      // Single line mode leaves a trailing space instead of a newline.
+      if (!text_.empty() && text_.back() == ' ')
+        text_.pop_back();
+      text_.push_back('\n');
+    }
+  }
+  output->append(text_);
+
+  arena_.Reset();
+  return true;
+}
+
+}  // namespace protodb
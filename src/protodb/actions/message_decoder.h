@@ -0,0 +1,78 @@
+#ifndef PROTODB_ACTIONS_MESSAGE_DECODER_H__
+#define PROTODB_ACTIONS_MESSAGE_DECODER_H__
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/json/json.h"
+#include "google/protobuf/text_format.h"
+#include "protodb/actions/common.h"
+#include "protodb/io/field_projection.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::Message;
+using ::google::protobuf::TextFormat;
+
+struct DecodeOptions {
+  // Print messages as text format or JSON.
+  MessageFormat format = MessageFormat::TEXT;
+
+  // Print each message on a single line.
+  bool single_line = false;
+
+  // Size of the reusable first block of the arena messages are parsed on.
+  // Zero leaves block sizes up to the arena.
+  size_t arena_block_size = kDefaultArenaBlockSize;
+
+  // When set, only the fields selected by the projection are parsed and
+  // printed.  Must outlive the decoder.
+  const FieldProjection* projection = nullptr;
+};
+
+// Parses wire data for a single message type and formats it as text or
+// JSON.
+//
+// With a projection, the wire data is first filtered down to the selected
+// fields so that only those are materialized in the parsed message.
+//
+// A decoder owns its own DynamicMessageFactory and arena so that one can be
+// created per thread and used without any locking.  The arena is reset after
+// every message so memory is reused across a stream of messages.
+class MessageDecoder {
+ public:
+  MessageDecoder(const Descriptor* descriptor, const DecodeOptions& options);
+  MessageDecoder(const MessageDecoder&) = delete;
+  MessageDecoder& operator=(const MessageDecoder&) = delete;
+
+  // Decodes `wire` and appends the formatted message to `output`.  Returns
+  // false if the wire data can't be parsed.
+  bool Decode(absl::string_view wire, std::string* output);
+
+  const Descriptor* descriptor() const {
+    return descriptor_;
+  }
+
+ private:
+  const Descriptor* const descriptor_;
+  const DecodeOptions options_;
+  DynamicMessageFactory factory_;
+  const Message* prototype_;
+  ReusableArena arena_;
+  TextFormat::Printer printer_;
+  google::protobuf::json::PrintOptions json_options_;
+
+  // Scratch space for projecting and formatting, reused across messages so
+  // their capacity is only grown once.
+  std::string projected_;
+  std::string text_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_ACTIONS_MESSAGE_DECODER_H__
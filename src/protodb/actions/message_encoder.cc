@@ -0,0 +1,81 @@
+#include "protodb/actions/message_encoder.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/json/json.h"
+#include "google/protobuf/text_format.h"
+#include "protodb/io/delimited.h"
+
+namespace protodb {
+
+namespace {
+
+// The arena is reset when it has grown to this many times its first block.
+constexpr size_t kMaxArenaGrowth = 4;
+
+}  // namespace
+
+MessageEncoder::MessageEncoder(const Descriptor* descriptor,
+                               const EncodeOptions& options)
+    : descriptor_(descriptor),
+      options_(options),
+      factory_(descriptor->file()->pool()),
+      prototype_(factory_.GetPrototype(descriptor)),
+      arena_(options.arena_block_size),
+      max_arena_size_(kMaxArenaGrowth *
+                      std::max(options.arena_block_size,
+                               kDefaultArenaBlockSize)) {
+  ABSL_CHECK(prototype_);
+}
+
+bool MessageEncoder::Encode(absl::string_view input, std::string* output) {
+  if (message_ == nullptr) {
+    message_ = prototype_->New(arena_.get());
+  } else {
+    message_->Clear();
+  }
+  Message* const message = message_;
+
+  bool ok;
+  if (options_.format == MessageFormat::JSON) {
+    const auto status =
+        google::protobuf::json::JsonStringToMessage(input, message,
+                                                    json_options_);
+    if (!status.ok()) {
+      std::cerr << "Failed to parse JSON: " << status.message() << std::endl;
+    }
+    ok = status.ok();
+  } else {
+    // The parser reports its own errors to stderr.
+    ok = parser_.ParseFromString(input, message);
+  }
+
+  if (ok) {
+    ok = message->SerializeToString(&wire_);
+    if (!ok) {
+      std::cerr << "Failed to serialize " << descriptor_->full_name() << ": "
+                << message->InitializationErrorString() << std::endl;
+    }
+  }
+  if (arena_.get()->SpaceAllocated() > max_arena_size_) {
+    arena_.Reset();
+    message_ = nullptr;
+  }
+  if (!ok)
+    return false;
+
+  if (options_.delimited) {
+    AppendDelimited(wire_, output);
+  } else {
+    output->append(wire_);
+  }
+  return true;
+}
+
+}  // namespace protodb
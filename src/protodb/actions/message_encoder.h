@@ -0,0 +1,72 @@
+#ifndef PROTODB_ACTIONS_MESSAGE_ENCODER_H__
+#define PROTODB_ACTIONS_MESSAGE_ENCODER_H__
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/json/json.h"
+#include "google/protobuf/text_format.h"
+#include "protodb/actions/common.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::Message;
+using ::google::protobuf::TextFormat;
+
+struct EncodeOptions {
+  // Parse messages as text format or JSON.
+  MessageFormat format = MessageFormat::TEXT;
+
+  // Prefix each encoded message with its length as a varint.
+  bool delimited = false;
+
+  // Size of the reusable first block of the arena messages are parsed on.
+  // Zero leaves block sizes up to the arena.
+  size_t arena_block_size = kDefaultArenaBlockSize;
+};
+
+// Parses text format or JSON for a single message type and serializes it to
+// wire format.
+//
+// Like MessageDecoder, an encoder owns its own DynamicMessageFactory and
+// arena so that one can be created per thread.  A single message is parsed
+// into over and over, so repeated fields and strings keep their capacity
+// from one message to the next.  The arena is only reset once it has grown
+// well past its first block.
+class MessageEncoder {
+ public:
+  MessageEncoder(const Descriptor* descriptor, const EncodeOptions& options);
+  MessageEncoder(const MessageEncoder&) = delete;
+  MessageEncoder& operator=(const MessageEncoder&) = delete;
+
+  // Parses `input` and appends the encoded message to `output`.  Returns
+  // false and reports the error to stderr if `input` can't be parsed.
+  bool Encode(absl::string_view input, std::string* output);
+
+  const Descriptor* descriptor() const {
+    return descriptor_;
+  }
+
+ private:
+  const Descriptor* const descriptor_;
+  const EncodeOptions options_;
+  DynamicMessageFactory factory_;
+  const Message* prototype_;
+  ReusableArena arena_;
+  const size_t max_arena_size_;
+  Message* message_ = nullptr;
+  TextFormat::Parser parser_;
+  google::protobuf::json::ParseOptions json_options_;
+
+  // Scratch space for the serialized message, reused across messages.
+  std::string wire_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_ACTIONS_MESSAGE_ENCODER_H__
@@ -0,0 +1,75 @@
+// Compares the throughput of the text format and JSON paths of
+// MessageDecoder and MessageEncoder.
+//
+//   bazel run -c opt //src/protodb/actions:message_format_benchmark
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "protodb/actions/common.h"
+#include "protodb/actions/message_decoder.h"
+#include "protodb/actions/message_encoder.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::FileDescriptorProto;
+
+// A reasonably large and deeply nested message: the schema of
+// descriptor.proto itself.
+std::string SampleWire() {
+  FileDescriptorProto file;
+  FileDescriptorProto::descriptor()->file()->CopyTo(&file);
+  return file.SerializeAsString();
+}
+
+std::string SampleFormatted(MessageFormat format) {
+  MessageDecoder decoder(FileDescriptorProto::descriptor(),
+                         {.format = format, .single_line = true});
+  std::string output;
+  decoder.Decode(SampleWire(), &output);
+  return output;
+}
+
+void BM_Decode(benchmark::State& state, MessageFormat format) {
+  const std::string wire = SampleWire();
+  MessageDecoder decoder(FileDescriptorProto::descriptor(),
+                         {.format = format, .single_line = true});
+  std::string output;
+  for (auto _ : state) {
+    output.clear();
+    if (!decoder.Decode(wire, &output)) {
+      state.SkipWithError("decode failed");
+      break;
+    }
+    benchmark::DoNotOptimize(output);
+  }
+  state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK_CAPTURE(BM_Decode, text, MessageFormat::TEXT);
+BENCHMARK_CAPTURE(BM_Decode, json, MessageFormat::JSON);
+
+void BM_Encode(benchmark::State& state, MessageFormat format) {
+  const std::string input = SampleFormatted(format);
+  MessageEncoder encoder(FileDescriptorProto::descriptor(),
+                         {.format = format, .delimited = true});
+  std::string output;
+  for (auto _ : state) {
+    output.clear();
+    if (!encoder.Encode(input, &output)) {
+      state.SkipWithError("encode failed");
+      break;
+    }
+    benchmark::DoNotOptimize(output);
+  }
+  state.SetBytesProcessed(state.iterations() * output.size());
+}
+BENCHMARK_CAPTURE(BM_Encode, text, MessageFormat::TEXT);
+BENCHMARK_CAPTURE(BM_Encode, json, MessageFormat::JSON);
+
+}  // namespace
+}  // namespace protodb
+
+BENCHMARK_MAIN();
@@ -48,11 +48,15 @@
 #include "google/protobuf/stubs/common.h"
 #include "google/protobuf/text_format.h"
 #include "google/protobuf/wire_format_lite.h"
+#include "protodb/actions/action_canonicalize.h"
 #include "protodb/actions/action_decode.h"
 #include "protodb/actions/action_encode.h"
 #include "protodb/actions/action_explain.h"
 #include "protodb/actions/action_guess.h"
+#include "protodb/actions/action_records.h"
+#include "protodb/actions/action_schema_ids.h"
 #include "protodb/actions/action_show.h"
+#include "protodb/actions/action_transcode.h"
 #include "protodb/actions/action_update.h"
 #include "protodb/db/protodb.h"
 #include "protodb/error_printer.h"
@@ -674,6 +678,8 @@ int CommandLineInterface::Run(const CommandLineArgs& args) {
     Guess(*protodb.get(), params);
   } else if (command == "encode") {
     Encode(*protodb.get(), params);
+  } else if (command == "canonicalize") {
+    Canonicalize(*protodb.get(), params);
   } else if (command == "decode") {
     Decode(*protodb.get(), params);
   } else if (command == "inspect" || command == "explain") {
@@ -681,8 +687,14 @@ int CommandLineInterface::Run(const CommandLineArgs& args) {
       std::cerr << "error reading input" << std::endl;
     }
   } else if (command == "print") {
+  } else if (command == "records") {
+    Records(*protodb.get(), params);
+  } else if (command == "schema-ids") {
+    SchemaIds(*protodb.get(), params);
   } else if (command == "show") {
     Show(*protodb.get(), params);
+  } else if (command == "transcode") {
+    Transcode(*protodb.get(), params);
   } else {
     std::cerr << "Unexpected command: " << command << std::endl;
     PrintHelpText();
@@ -697,12 +709,17 @@ void CommandLineInterface::PrintHelpText() {
   std::cout << R"(
 Commands:
     add        adds a .proto file or descriptor set to the local db
+    canonicalize
+               re-encode a binary proto canonically, or print its hash
     decode     convert a binary proto to text format
     encode     convert a text proto to binary encoding
     guess      given an input proto, guess the type
     help       show help for any action
     print      print the descriptor for a proto in the database
+    records    read records files, or convert them to columns
+    schema-ids collect or assign schema ids into a MessageIdMap
     show       show info about descriptors in the database
+    transcode  rewrite binary protos from one schema snapshot to another
     version    print the libprotobuf version in use
 )";
   std::cout << std::endl;
@@ -189,6 +189,7 @@ bool ProtoSchemaDb::_LoadDatabase(const std::string& _path) {
 
           databases_per_descriptor_set_.push_back(
               std::move(simple_descriptor_database));
+          snapshot_paths_.push_back(dir_entry.path());
         }
       }
     }
@@ -202,8 +203,41 @@ bool ProtoSchemaDb::_LoadDatabase(const std::string& _path) {
   }
   merged_database_.reset(
       new MergedDescriptorDatabase(raw_databases_per_descriptor_set));
+  snapshot_pool_ =
+      std::make_unique<DescriptorPool>(merged_database_.get(), nullptr);
+  parse_plans_ = std::make_unique<ParsePlanCache>();
 
   return true;
 }
 
+std::unique_ptr<ProtoSchemaDb::Snapshot> ProtoSchemaDb::LoadSnapshot(
+    const std::string& name) const {
+  std::filesystem::path path = protodb_path_ / name;
+  if (!std::filesystem::exists(path)) {
+    path = name;
+  }
+
+  auto file_descriptor_set = ReadProtoFromFile<FileDescriptorSet>(path);
+  if (!file_descriptor_set) {
+    return nullptr;
+  }
+  auto snapshot = std::make_unique<Snapshot>();
+  snapshot->database = PopulateDescriptorDatabase(*file_descriptor_set);
+  if (!snapshot->database) {
+    std::cerr << name << ": conflicting definitions in descriptor set"
+              << std::endl;
+    return nullptr;
+  }
+  snapshot->pool =
+      std::make_unique<DescriptorPool>(snapshot->database.get(), nullptr);
+  return snapshot;
+}
+
+const ParsePlan* ProtoSchemaDb::FindParsePlan(
+    const Descriptor* descriptor) const {
+  ABSL_CHECK(descriptor->file()->pool() == snapshot_pool_.get())
+      << descriptor->full_name() << " is not from the snapshot pool";
+  return parse_plans_->Get(descriptor);
+}
+
 }  // namespace protodb
\ No newline at end of file
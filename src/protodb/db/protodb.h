@@ -14,10 +14,13 @@
 #include "google/protobuf/descriptor_database.h"
 #include "google/protobuf/port.h"
 #include "google/protobuf/repeated_field.h"
+#include "protodb/io/parse_plan.h"
 
 namespace protodb {
 
+using ::google::protobuf::Descriptor;
 using ::google::protobuf::DescriptorDatabase;
+using ::google::protobuf::DescriptorPool;
 using ::google::protobuf::MergedDescriptorDatabase;
 using ::google::protobuf::SimpleDescriptorDatabase;
 
@@ -30,10 +33,39 @@ struct ProtoSchemaDb {
   DescriptorDatabase* staging_database() const {
     return merged_database_.get();
   }
-  std::string path() {
+  std::string path() const {
     return protodb_path_;
   }
 
+  // A pool over the snapshot database that is shared by everything running
+  // against this db.  Files are loaded into it on demand.
+  DescriptorPool* snapshot_pool() const {
+    return snapshot_pool_.get();
+  }
+
+  // Returns the compiled parse plan for `descriptor`, which must come from
+  // snapshot_pool().  Plans are compiled once and cached for the lifetime of
+  // the db.
+  const ParsePlan* FindParsePlan(const Descriptor* descriptor) const;
+
+  // A single descriptor set loaded on its own, such as one version of the
+  // schema to compare with another.
+  struct Snapshot {
+    std::unique_ptr<SimpleDescriptorDatabase> database;
+    std::unique_ptr<DescriptorPool> pool;
+  };
+
+  // Loads the descriptor set `name` from the database directory, or from
+  // the path `name` if the database has no such file.  Returns nullptr and
+  // reports the error to stderr if it can't be loaded.
+  std::unique_ptr<Snapshot> LoadSnapshot(const std::string& name) const;
+
+  // The descriptor sets loaded from the database directory, one for each
+  // snapshot of the schema, in the order they were loaded.
+  const std::vector<std::filesystem::path>& snapshot_paths() const {
+    return snapshot_paths_;
+  }
+
   // Searches for a '.protodb' root from the current working directory.
   static std::filesystem::path FindDatabase();
 
@@ -45,10 +77,13 @@ struct ProtoSchemaDb {
   bool _LoadDatabase(const std::string& _path);
 
   std::filesystem::path protodb_path_;
+  std::vector<std::filesystem::path> snapshot_paths_;
   std::vector<std::unique_ptr<SimpleDescriptorDatabase>>
       databases_per_descriptor_set_;
   std::vector<DescriptorDatabase*> raw_databases_per_descriptor_set_;
   std::unique_ptr<MergedDescriptorDatabase> merged_database_;
+  std::unique_ptr<DescriptorPool> snapshot_pool_;
+  std::unique_ptr<ParsePlanCache> parse_plans_;
 };
 
 }  // namespace protodb
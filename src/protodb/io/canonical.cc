@@ -0,0 +1,419 @@
+#include "protodb/io/canonical.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace {
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+constexpr int kMaxVarintBytes = 10;
+
+void AppendVarint(uint64_t value, std::string* output) {
+  // Tags and lengths mostly fit in a single byte.
+  if (value < 0x80) {
+    output->push_back(static_cast<char>(value));
+    return;
+  }
+  uint8_t buffer[kMaxVarintBytes];
+  const uint8_t* end = CodedOutputStream::WriteVarint64ToArray(value, buffer);
+  output->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+void AppendTag(const ParsePlan::Field& field,
+               WireFormatLite::WireType wire_type, std::string* output) {
+  AppendVarint(WireFormatLite::MakeTag(field.descriptor->number(), wire_type),
+               output);
+}
+
+// Appends a scalar value as passed by ParsePlan::Parse(), without its tag.
+void AppendScalar(const ParsePlan::Field& field, uint64_t bits,
+                  std::string* output) {
+  switch (field.type) {
+    case FieldDescriptor::TYPE_SINT32:
+      AppendVarint(
+          WireFormatLite::ZigZagEncode32(static_cast<int32_t>(bits)), output);
+      return;
+    case FieldDescriptor::TYPE_SINT64:
+      AppendVarint(
+          WireFormatLite::ZigZagEncode64(static_cast<int64_t>(bits)), output);
+      return;
+    default:
+      break;
+  }
+  switch (field.wire_type) {
+    case WireFormatLite::WIRETYPE_FIXED32: {
+      const uint32_t value =
+          absl::little_endian::FromHost32(static_cast<uint32_t>(bits));
+      output->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case WireFormatLite::WIRETYPE_FIXED64: {
+      const uint64_t value = absl::little_endian::FromHost64(bits);
+      output->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    default:
+      AppendVarint(bits, output);
+      return;
+  }
+}
+
+void AppendBytes(absl::string_view bytes, std::string* output) {
+  AppendVarint(bytes.size(), output);
+  output->append(bytes);
+}
+
+// Length-delimited values whose contents are written in place reserve a
+// single byte for their length, which is widened afterwards if needed.
+size_t ReserveLength(std::string* output) {
+  output->push_back('\0');
+  return output->size();
+}
+
+void PatchLength(size_t contents_start, std::string* output) {
+  const size_t length = output->size() - contents_start;
+  uint8_t varint[kMaxVarintBytes];
+  const int varint_size =
+      CodedOutputStream::WriteVarint64ToArray(length, varint) - varint;
+  if (varint_size > 1) {
+    output->insert(contents_start, varint_size - 1, '\0');
+  }
+  memcpy(&(*output)[contents_start - 1], varint, varint_size);
+}
+
+bool IsSigned(FieldDescriptor::Type type) {
+  switch (type) {
+    case FieldDescriptor::TYPE_INT32:
+    case FieldDescriptor::TYPE_INT64:
+    case FieldDescriptor::TYPE_SINT32:
+    case FieldDescriptor::TYPE_SINT64:
+    case FieldDescriptor::TYPE_SFIXED32:
+    case FieldDescriptor::TYPE_SFIXED64:
+    case FieldDescriptor::TYPE_ENUM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether the parser would keep `bits` as an unknown field rather than as
+// the value of `field`: a value missing from a closed enum.
+bool IsUnknownEnumValue(const ParsePlan::Field& field, uint64_t bits) {
+  if (field.type != FieldDescriptor::TYPE_ENUM)
+    return false;
+  const auto* enum_type = field.descriptor->enum_type();
+  return enum_type->is_closed() &&
+         enum_type->FindValueByNumber(static_cast<int32_t>(bits)) == nullptr;
+}
+
+// Finds the last value of a map entry's value field.
+struct MapValueHandler {
+  void Scalar(const ParsePlan::Field& field, uint64_t value) {
+    if (field.descriptor->number() == 2) {
+      bits = value;
+      found = true;
+    }
+  }
+  void LengthDelimited(const ParsePlan::Field&, absl::string_view) {}
+
+  uint64_t bits = 0;
+  bool found = false;
+};
+
+// The key of a canonicalized map entry.
+struct MapKey {
+  uint64_t bits = 0;
+  absl::string_view bytes;
+  int entry = 0;
+};
+
+struct MapKeyHandler {
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    if (field.descriptor->number() == 1)
+      key->bits = bits;
+  }
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    if (field.descriptor->number() == 1)
+      key->bytes = value;
+  }
+
+  MapKey* key;
+};
+
+}  // namespace
+
+struct Canonicalizer::Frame {
+  struct OneofWinner {
+    // The index of the field last set in the oneof, or -1.
+    int index = -1;
+    // The sequence of the first of its values since another member of the
+    // oneof was set, which cleared the values before it.
+    uint32_t since = 0;
+  };
+
+  std::vector<Value> values;
+  std::vector<OneofWinner> oneof_winners;
+  // Occurrences of a singular message field, concatenated to merge them.
+  std::string merged;
+  std::vector<std::string> map_entries;
+  std::vector<MapKey> map_keys;
+};
+
+// Collects the values of a message in wire order.
+struct Canonicalizer::CollectingHandler {
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    Add(field, bits, absl::string_view());
+  }
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    Add(field, 0, value);
+  }
+
+  void Add(const ParsePlan::Field& field, uint64_t bits,
+           absl::string_view bytes) {
+    // The parser keeps these as unknown fields, which are dropped.
+    if (IsUnknownEnumValue(field, bits))
+      return;
+    const auto sequence = static_cast<uint32_t>(values->size());
+    values->push_back({&field, sequence, bits, bytes});
+    if (field.oneof >= 0) {
+      Frame::OneofWinner& winner = (*oneof_winners)[field.oneof];
+      if (winner.index != field.index) {
+        winner.index = field.index;
+        winner.since = sequence;
+      }
+    }
+  }
+
+  std::vector<Value>* values;
+  std::vector<Frame::OneofWinner>* oneof_winners;
+};
+
+Canonicalizer::Canonicalizer(const ParsePlan* plan) : plan_(plan) {}
+
+Canonicalizer::~Canonicalizer() {}
+
+bool Canonicalizer::Canonicalize(absl::string_view wire, std::string* output) {
+  return CanonicalizeMessage(plan_, wire, 0, output);
+}
+
+bool Canonicalizer::CanonicalizeMessage(const ParsePlan* plan,
+                                        absl::string_view wire, int depth,
+                                        std::string* output) {
+  if (depth > kMaxDepth)
+    return false;
+  while (frames_.size() <= static_cast<size_t>(depth)) {
+    frames_.push_back(std::make_unique<Frame>());
+  }
+  Frame& frame = *frames_[depth];
+  frame.values.clear();
+  frame.oneof_winners.assign(plan->descriptor()->oneof_decl_count(), {});
+  // Map entries are written without the key or value when it holds its
+  // default, whether or not the entry's fields track presence, so that
+  // entries with and without explicit defaults encode the same.
+  const bool map_entry = plan->descriptor()->options().map_entry();
+
+  CollectingHandler handler{.values = &frame.values,
+                            .oneof_winners = &frame.oneof_winners};
+  if (!plan->Parse(wire, handler))
+    return false;
+
+  // Order by field number, keeping the wire order of each field's values.
+  // Most encoders already write fields in order, so check before sorting.
+  const auto by_number = [](const Value& lhs, const Value& rhs) {
+    return lhs.field->descriptor->number() < rhs.field->descriptor->number();
+  };
+  std::vector<Value>& values = frame.values;
+  if (!std::is_sorted(values.begin(), values.end(), by_number)) {
+    std::stable_sort(values.begin(), values.end(), by_number);
+  }
+
+  for (size_t begin = 0; begin < values.size();) {
+    const ParsePlan::Field& field = *values[begin].field;
+    size_t end = begin + 1;
+    while (end < values.size() && values[end].field == &field) {
+      ++end;
+    }
+    const Value* first = &values[begin];
+    const Value* last = &values[end - 1];
+    begin = end;
+
+    if (field.repeated) {
+      if (field.map) {
+        if (!WriteMapField(field, first, last + 1, depth, output))
+          return false;
+      } else if (field.message) {
+        for (const Value* value = first; value <= last; ++value) {
+          if (!WriteMessageField(field, value->bytes, depth, output))
+            return false;
+        }
+      } else if (field.packed) {
+        AppendTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, output);
+        const size_t contents_start = ReserveLength(output);
+        for (const Value* value = first; value <= last; ++value) {
+          AppendScalar(field, value->bits, output);
+        }
+        PatchLength(contents_start, output);
+      } else {
+        for (const Value* value = first; value <= last; ++value) {
+          AppendTag(field, field.wire_type, output);
+          if (field.packable) {
+            AppendScalar(field, value->bits, output);
+          } else {
+            AppendBytes(value->bytes, output);
+          }
+        }
+      }
+      continue;
+    }
+
+    if (field.oneof >= 0) {
+      const Frame::OneofWinner& winner = frame.oneof_winners[field.oneof];
+      if (winner.index != field.index)
+        continue;
+      // Setting another member cleared the values before it.
+      while (first->sequence < winner.since) {
+        ++first;
+      }
+    }
+
+    if (field.message) {
+      // Repeated occurrences of a singular message are merged, which is the
+      // same as parsing their concatenation.
+      absl::string_view contents = last->bytes;
+      if (first != last) {
+        frame.merged.clear();
+        for (const Value* value = first; value <= last; ++value) {
+          frame.merged.append(value->bytes);
+        }
+        contents = frame.merged;
+      }
+      const size_t field_start = output->size();
+      if (!WriteMessageField(field, contents, depth, output))
+        return false;
+      // An empty message value is the default: a one byte tag and a zero
+      // length.
+      if (map_entry && output->size() - field_start == 2)
+        output->resize(field_start);
+      continue;
+    }
+
+    const bool is_bytes =
+        field.wire_type == WireFormatLite::WIRETYPE_LENGTH_DELIMITED;
+    if ((!field.presence || map_entry) &&
+        (is_bytes ? last->bytes.empty()
+                  : last->bits == ParsePlan::DefaultBits(field.descriptor))) {
+      continue;
+    }
+    AppendTag(field, field.wire_type, output);
+    if (is_bytes) {
+      AppendBytes(last->bytes, output);
+    } else {
+      AppendScalar(field, last->bits, output);
+    }
+  }
+  return true;
+}
+
+bool Canonicalizer::WriteMessageField(const ParsePlan::Field& field,
+                                      absl::string_view contents, int depth,
+                                      std::string* output) {
+  if (field.type == FieldDescriptor::TYPE_GROUP) {
+    AppendTag(field, WireFormatLite::WIRETYPE_START_GROUP, output);
+    if (!CanonicalizeMessage(field.message, contents, depth + 1, output))
+      return false;
+    AppendTag(field, WireFormatLite::WIRETYPE_END_GROUP, output);
+    return true;
+  }
+  AppendTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, output);
+  const size_t contents_start = ReserveLength(output);
+  if (!CanonicalizeMessage(field.message, contents, depth + 1, output))
+    return false;
+  PatchLength(contents_start, output);
+  return true;
+}
+
+bool Canonicalizer::WriteMapField(const ParsePlan::Field& field,
+                                  const Value* begin, const Value* end,
+                                  int depth, std::string* output) {
+  Frame& frame = *frames_[depth];
+  const size_t count = end - begin;
+  if (frame.map_entries.size() < count) {
+    frame.map_entries.resize(count);
+  }
+  frame.map_keys.clear();
+  // The parser keeps an entry whose value is missing from a closed enum as
+  // an unknown field, so the entry is dropped.
+  const ParsePlan::Field* value_field = field.message->Find(2);
+  const bool closed_enum_value =
+      value_field && value_field->type == FieldDescriptor::TYPE_ENUM &&
+      value_field->descriptor->enum_type()->is_closed();
+  for (size_t i = 0; i < count; ++i) {
+    if (closed_enum_value) {
+      MapValueHandler handler;
+      if (!field.message->Parse(begin[i].bytes, handler))
+        return false;
+      if (handler.found && IsUnknownEnumValue(*value_field, handler.bits))
+        continue;
+    }
+    std::string& entry = frame.map_entries[i];
+    entry.clear();
+    if (!CanonicalizeMessage(field.message, begin[i].bytes, depth + 1,
+                             &entry)) {
+      return false;
+    }
+    MapKey& key = frame.map_keys.emplace_back();
+    key.entry = i;
+    MapKeyHandler handler{.key = &key};
+    if (!field.message->Parse(entry, handler))
+      return false;
+  }
+
+  // Sort by key, keeping the entries for the same key in wire order so that
+  // the last one wins.
+  const ParsePlan::Field* key_field = field.message->Find(1);
+  const bool is_signed = key_field && IsSigned(key_field->type);
+  std::stable_sort(frame.map_keys.begin(), frame.map_keys.end(),
+                   [&](const MapKey& lhs, const MapKey& rhs) {
+                     if (lhs.bytes != rhs.bytes)
+                       return lhs.bytes < rhs.bytes;
+                     if (is_signed) {
+                       return static_cast<int64_t>(lhs.bits) <
+                              static_cast<int64_t>(rhs.bits);
+                     }
+                     return lhs.bits < rhs.bits;
+                   });
+
+  for (size_t i = 0; i < frame.map_keys.size(); ++i) {
+    const MapKey& key = frame.map_keys[i];
+    if (i + 1 < frame.map_keys.size()) {
+      const MapKey& next = frame.map_keys[i + 1];
+      if (key.bytes == next.bytes && key.bits == next.bits)
+        continue;
+    }
+    AppendTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, output);
+    AppendBytes(frame.map_entries[key.entry], output);
+  }
+  return true;
+}
+
+}  // namespace protodb
@@ -0,0 +1,73 @@
+#ifndef PROTODB_IO_CANONICAL_H__
+#define PROTODB_IO_CANONICAL_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+// Re-encodes wire data into a canonical form, so that any two encodings of
+// the same message value produce the same bytes.
+//
+// The canonical encoding is the one a deterministic serializer would write
+// for the parsed message:
+//   * fields are written in field number order,
+//   * repeated scalars are packed or unpacked as declared by the schema,
+//   * singular fields without presence are dropped when they have their
+//     default value, and repeated occurrences of a singular field collapse
+//     to the last one (or are merged, for messages),
+//   * only the last member set of a oneof is kept,
+//   * map entries are sorted by key, keeping the last entry for each key.
+// Unknown fields are dropped, since the schema gives them no meaning, and
+// so are values missing from a closed enum, which the parser keeps as
+// unknown fields.  Unlike the serializer, map entries leave out a key or
+// value that holds its default, so that entries with and without explicit
+// defaults encode the same.
+//
+// The wire data is walked with ParsePlans, without parsing into messages.
+// A Canonicalizer keeps scratch buffers between calls and is not
+// thread-safe; use one per thread.
+class Canonicalizer {
+ public:
+  explicit Canonicalizer(const ParsePlan* plan);
+  Canonicalizer(const Canonicalizer&) = delete;
+  Canonicalizer& operator=(const Canonicalizer&) = delete;
+  ~Canonicalizer();
+
+  // Appends the canonical encoding of `wire` to `output`.  Returns false if
+  // the wire data is malformed.
+  bool Canonicalize(absl::string_view wire, std::string* output);
+
+ private:
+  // A single value found in the wire data.
+  struct Value {
+    const ParsePlan::Field* field;
+    // The value's position in the wire data, to keep the last one set.
+    uint32_t sequence;
+    uint64_t bits;
+    absl::string_view bytes;
+  };
+  struct Frame;
+  struct CollectingHandler;
+
+  bool CanonicalizeMessage(const ParsePlan* plan, absl::string_view wire,
+                           int depth, std::string* output);
+  bool WriteMessageField(const ParsePlan::Field& field,
+                         absl::string_view contents, int depth,
+                         std::string* output);
+  bool WriteMapField(const ParsePlan::Field& field, const Value* begin,
+                     const Value* end, int depth, std::string* output);
+
+  const ParsePlan* const plan_;
+  // Scratch space for each level of nesting, reused between messages.
+  std::vector<std::unique_ptr<Frame>> frames_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_CANONICAL_H__
@@ -0,0 +1,86 @@
+// Measures canonicalizing and hashing messages for deduplication, against
+// round tripping them through a DynamicMessage with deterministic
+// serialization.
+//
+//   bazel run -c opt //src/protodb/io:canonical_benchmark
+
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "protodb/io/canonical.h"
+#include "protodb/io/content_hash.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::Arena;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::Message;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::StringOutputStream;
+
+std::string SampleWire() {
+  FileDescriptorProto file;
+  FileDescriptorProto::descriptor()->file()->CopyTo(&file);
+  return file.SerializeAsString();
+}
+
+void BM_ContentHash(benchmark::State& state) {
+  const std::string data(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ContentHash(data));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_ContentHash)->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+
+void BM_DeterministicHash(benchmark::State& state) {
+  const std::string wire = SampleWire();
+  DynamicMessageFactory factory;
+  const Message* prototype =
+      factory.GetPrototype(FileDescriptorProto::descriptor());
+  Arena arena;
+  std::string output;
+  for (auto _ : state) {
+    Message* message = prototype->New(&arena);
+    message->ParsePartialFromString(wire);
+    output.clear();
+    {
+      StringOutputStream stream(&output);
+      CodedOutputStream coded(&stream);
+      coded.SetSerializationDeterministic(true);
+      message->SerializePartialToCodedStream(&coded);
+    }
+    benchmark::DoNotOptimize(ContentHash(output));
+    arena.Reset();
+  }
+  state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK(BM_DeterministicHash);
+
+void BM_CanonicalHash(benchmark::State& state) {
+  const std::string wire = SampleWire();
+  ParsePlanCache plans;
+  Canonicalizer canonicalizer(plans.Get(FileDescriptorProto::descriptor()));
+  std::string output;
+  for (auto _ : state) {
+    output.clear();
+    canonicalizer.Canonicalize(wire, &output);
+    benchmark::DoNotOptimize(ContentHash(output));
+  }
+  state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK(BM_CanonicalHash);
+
+}  // namespace
+}  // namespace protodb
+
+BENCHMARK_MAIN();
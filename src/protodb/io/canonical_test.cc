@@ -0,0 +1,246 @@
+#include "protodb/io/canonical.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "gtest/gtest.h"
+#include "protodb/io/content_hash.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/test_messages.pb.h"
+#include "protodb/io/test_messages_proto3.pb.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::StringOutputStream;
+
+class CanonicalTest : public testing::Test {
+ protected:
+  // The encoding of the deterministic serializer, which the canonical form
+  // must match.
+  std::string Deterministic(absl::string_view wire) {
+    test::Record message;
+    EXPECT_TRUE(message.ParseFromString(wire));
+    std::string output;
+    {
+      StringOutputStream stream(&output);
+      CodedOutputStream coded(&stream);
+      coded.SetSerializationDeterministic(true);
+      message.SerializeToCodedStream(&coded);
+    }
+    return output;
+  }
+
+  std::string Canonical(absl::string_view wire) {
+    return Canonical(plan_, wire);
+  }
+  std::string Canonical(const ParsePlan* plan, absl::string_view wire) {
+    Canonicalizer canonicalizer(plan);
+    std::string output;
+    EXPECT_TRUE(canonicalizer.Canonicalize(wire, &output));
+    return output;
+  }
+
+  ParsePlanCache plans_;
+  const ParsePlan* const plan_ = plans_.Get(test::Record::descriptor());
+};
+
+void AppendTag(int number, WireFormatLite::WireType wire_type,
+               std::string* output) {
+  StringOutputStream stream(output);
+  CodedOutputStream coded(&stream);
+  coded.WriteTag(WireFormatLite::MakeTag(number, wire_type));
+}
+
+void AppendVarint(uint64_t value, std::string* output) {
+  StringOutputStream stream(output);
+  CodedOutputStream coded(&stream);
+  coded.WriteVarint64(value);
+}
+
+void AppendBytes(int number, absl::string_view bytes, std::string* output) {
+  AppendTag(number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, output);
+  AppendVarint(bytes.size(), output);
+  output->append(bytes.data(), bytes.size());
+}
+
+void AppendEntry(int key, absl::string_view value, std::string* output) {
+  std::string entry;
+  AppendTag(2, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, &entry);
+  AppendVarint(value.size(), &entry);
+  entry.append(value.data(), value.size());
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &entry);
+  AppendVarint(WireFormatLite::ZigZagEncode32(key), &entry);
+  AppendBytes(7, entry, output);
+}
+
+// A message written the way no serializer would: out of order, with
+// unpacked and duplicated values, explicit defaults, split submessages,
+// unsorted map keys and an overwritten oneof.
+std::string ScrambledWire() {
+  std::string wire;
+  AppendEntry(5, "five", &wire);
+  AppendTag(9, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(12, &wire);
+  AppendTag(5, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(3, &wire);
+  AppendBytes(2, "first", &wire);
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(0, &wire);
+  AppendEntry(-1, "minus one", &wire);
+  AppendBytes(6, "\x08\x07", &wire);
+  AppendTag(5, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(300, &wire);
+  AppendBytes(8, "text wins", &wire);
+  AppendBytes(2, "second", &wire);
+  AppendBytes(6, "\x12\x02hi", &wire);
+  AppendEntry(3, "three", &wire);
+  AppendTag(3, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(WireFormatLite::ZigZagEncode32(-4), &wire);
+  AppendTag(10, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(0, &wire);
+  // An unknown field.
+  AppendTag(99, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(1, &wire);
+  return wire;
+}
+
+TEST_F(CanonicalTest, MatchesDeterministicSerialization) {
+  const std::string wire = ScrambledWire();
+  std::string expected = Deterministic(wire);
+  // The serializer keeps unknown fields, which are dropped canonically.
+  std::string unknown;
+  AppendTag(99, WireFormatLite::WIRETYPE_VARINT, &unknown);
+  AppendVarint(1, &unknown);
+  ASSERT_EQ(expected.substr(expected.size() - unknown.size()), unknown);
+  expected.resize(expected.size() - unknown.size());
+
+  EXPECT_EQ(Canonical(wire), expected);
+}
+
+TEST_F(CanonicalTest, KeepsLastMapEntryForKey) {
+  std::string wire;
+  AppendEntry(5, "five", &wire);
+  AppendEntry(1, "one", &wire);
+  AppendEntry(5, "FIVE", &wire);
+
+  std::string expected;
+  AppendEntry(1, "one", &expected);
+  AppendEntry(5, "FIVE", &expected);
+  EXPECT_EQ(Canonical(wire), Canonical(expected));
+}
+
+TEST_F(CanonicalTest, MergesOneofMessagesSetSinceTheLastSwitch) {
+  // detail { id: 1 }, text, detail { name: "b" }: setting text clears the
+  // first detail, so only the second remains.
+  std::string wire;
+  AppendBytes(11, "\x08\x01", &wire);
+  AppendBytes(8, "text", &wire);
+  AppendBytes(11, "\x12\x01" "b", &wire);
+  AppendBytes(11, "\x18\x04", &wire);
+  EXPECT_EQ(Canonical(wire), Deterministic(wire));
+
+  std::string expected;
+  AppendBytes(11, "\x12\x01" "b" "\x18\x04", &expected);
+  EXPECT_EQ(Canonical(wire), expected);
+}
+
+TEST_F(CanonicalTest, LeavesDefaultsOutOfMapEntries) {
+  const ParsePlan* plan = plans_.Get(test::Legacy::descriptor());
+  // An entry with an explicit empty key and the enum's default value, BLACK,
+  // and one with neither.
+  std::string explicit_defaults;
+  AppendBytes(1, std::string("\x0a\x00\x10\x00", 4), &explicit_defaults);
+  std::string implicit_defaults;
+  AppendBytes(1, "", &implicit_defaults);
+  EXPECT_EQ(Canonical(plan, explicit_defaults), implicit_defaults);
+  EXPECT_EQ(Canonical(plan, implicit_defaults), implicit_defaults);
+
+  // The same holds for proto3 entries, which don't track presence.
+  std::string entry;
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &entry);
+  AppendVarint(0, &entry);
+  AppendBytes(2, "", &entry);
+  std::string wire;
+  AppendBytes(7, entry, &wire);
+  std::string expected;
+  AppendBytes(7, "", &expected);
+  EXPECT_EQ(Canonical(wire), expected);
+}
+
+TEST_F(CanonicalTest, DropsValuesMissingFromClosedEnums) {
+  const ParsePlan* plan = plans_.Get(test::Legacy::descriptor());
+  std::string wire;
+  // colors { key: "a" value: GREEN }, then an entry for "a" with value 9,
+  // which the parser keeps as an unknown field.
+  AppendBytes(1, "\x0a\x01" "a" "\x10\x02", &wire);
+  AppendBytes(1, "\x0a\x01" "a" "\x10\x09", &wire);
+  // color: GREEN, then 7, which leaves GREEN set.
+  AppendTag(2, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(2, &wire);
+  AppendTag(2, WireFormatLite::WIRETYPE_VARINT, &wire);
+  AppendVarint(7, &wire);
+  // palette: [RED, 5, GREEN].
+  for (int color : {1, 5, 2}) {
+    AppendTag(3, WireFormatLite::WIRETYPE_VARINT, &wire);
+    AppendVarint(color, &wire);
+  }
+
+  std::string expected;
+  AppendBytes(1, "\x0a\x01" "a" "\x10\x02", &expected);
+  AppendTag(2, WireFormatLite::WIRETYPE_VARINT, &expected);
+  AppendVarint(2, &expected);
+  for (int color : {1, 2}) {
+    AppendTag(3, WireFormatLite::WIRETYPE_VARINT, &expected);
+    AppendVarint(color, &expected);
+  }
+  EXPECT_EQ(Canonical(plan, wire), expected);
+}
+
+TEST_F(CanonicalTest, IsIdempotent) {
+  const std::string canonical = Canonical(ScrambledWire());
+  EXPECT_EQ(Canonical(canonical), canonical);
+}
+
+TEST_F(CanonicalTest, EqualValuesHashEqual) {
+  std::string in_order;
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &in_order);
+  AppendVarint(42, &in_order);
+  AppendBytes(2, "name", &in_order);
+
+  std::string reordered;
+  AppendBytes(2, "name", &reordered);
+  AppendTag(3, WireFormatLite::WIRETYPE_VARINT, &reordered);
+  AppendVarint(0, &reordered);
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &reordered);
+  AppendVarint(42, &reordered);
+
+  EXPECT_EQ(ContentHash(Canonical(in_order)),
+            ContentHash(Canonical(reordered)));
+
+  std::string different = in_order;
+  AppendTag(1, WireFormatLite::WIRETYPE_VARINT, &different);
+  AppendVarint(43, &different);
+  EXPECT_NE(ContentHash(Canonical(in_order)),
+            ContentHash(Canonical(different)));
+}
+
+TEST_F(CanonicalTest, RejectsMalformedWire) {
+  Canonicalizer canonicalizer(plan_);
+  std::string output;
+  EXPECT_FALSE(canonicalizer.Canonicalize("\x32\x05\x08", &output));
+}
+
+TEST(ContentHashTest, MatchesMurmurHash3) {
+  EXPECT_EQ(ContentHash(""), 0);
+  EXPECT_EQ(ContentHashToHex(
+                ContentHash("The quick brown fox jumps over the lazy dog")),
+            "7a433ca9c49a9347e34bbc7bbc071b6c");
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,788 @@
+#include "protodb/io/columnar.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "protodb/io/parse_plan.h"
+#include "src/records/columns.pb.h"
+
+namespace protodb {
+
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::internal::WireFormatLite;
+
+namespace {
+
+// Dictionaries stop growing past this many distinct values.
+constexpr size_t kMaxDictionarySize = 1 << 16;
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+// Levels are stored as bytes.
+constexpr int kMaxLevel = UINT8_MAX;
+
+constexpr int kMaxVarintBytes = 10;
+
+// How the values of a column are ordered and encoded.
+enum class ValueKind { SIGNED, UNSIGNED, FLOAT, DOUBLE, BYTES };
+
+ValueKind GetValueKind(const FieldDescriptor* field) {
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_UINT32:
+    case FieldDescriptor::TYPE_UINT64:
+    case FieldDescriptor::TYPE_FIXED32:
+    case FieldDescriptor::TYPE_FIXED64:
+      return ValueKind::UNSIGNED;
+    case FieldDescriptor::TYPE_FLOAT:
+      return ValueKind::FLOAT;
+    case FieldDescriptor::TYPE_DOUBLE:
+      return ValueKind::DOUBLE;
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+      return ValueKind::BYTES;
+    default:
+      return ValueKind::SIGNED;
+  }
+}
+
+int BitWidth(uint64_t value) {
+  return std::bit_width(value);
+}
+
+void AppendVarint(uint64_t value, std::string* output) {
+  uint8_t buffer[kMaxVarintBytes];
+  const uint8_t* end = CodedOutputStream::WriteVarint64ToArray(value, buffer);
+  output->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+bool ReadVarint(absl::string_view* input, uint64_t* value) {
+  const char* p = ParsePlan::ReadVarint(
+      input->data(), input->data() + input->size(), value);
+  if (p == nullptr)
+    return false;
+  input->remove_prefix(p - input->data());
+  return true;
+}
+
+uint64_t ZigZag(uint64_t value) {
+  return WireFormatLite::ZigZagEncode64(static_cast<int64_t>(value));
+}
+
+uint64_t UnZigZag(uint64_t value) {
+  return static_cast<uint64_t>(WireFormatLite::ZigZagDecode64(value));
+}
+
+// Packs `values` at `width` bits each, least significant bit first.
+template <typename T>
+void BitPack(const std::vector<T>& values, int width, std::string* output) {
+  if (width == 0)
+    return;
+  absl::uint128 bits = 0;
+  int pending = 0;
+  for (const T value : values) {
+    bits |= absl::uint128(static_cast<uint64_t>(value)) << pending;
+    pending += width;
+    while (pending >= 8) {
+      output->push_back(static_cast<char>(absl::Uint128Low64(bits)));
+      bits >>= 8;
+      pending -= 8;
+    }
+  }
+  if (pending > 0) {
+    output->push_back(static_cast<char>(absl::Uint128Low64(bits)));
+  }
+}
+
+// Unpacks `count` values packed by BitPack() from the front of `input`.
+template <typename T>
+bool BitUnpack(absl::string_view* input, size_t count, int width,
+               std::vector<T>* values) {
+  if (width > 64)
+    return false;
+  if (width == 0) {
+    values->insert(values->end(), count, 0);
+    return true;
+  }
+  if (count > input->size() * 8 / width)
+    return false;
+  const size_t bytes = (count * width + 7) / 8;
+  const uint64_t mask = width == 64 ? UINT64_MAX : (uint64_t{1} << width) - 1;
+  absl::uint128 bits = 0;
+  int available = 0;
+  const char* p = input->data();
+  values->reserve(values->size() + count);
+  for (size_t i = 0; i < count; ++i) {
+    while (available < width) {
+      bits |= absl::uint128(static_cast<uint8_t>(*p++)) << available;
+      available += 8;
+    }
+    values->push_back(static_cast<T>(absl::Uint128Low64(bits) & mask));
+    bits >>= width;
+    available -= width;
+  }
+  input->remove_prefix(bytes);
+  return true;
+}
+
+// Reads `count` values encoded PLAIN from the front of `input`.
+bool ReadPlain(ValueKind kind, absl::string_view* input, size_t count,
+               ColumnValues* values) {
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t value;
+    switch (kind) {
+      case ValueKind::SIGNED:
+        if (!ReadVarint(input, &value))
+          return false;
+        values->scalars.push_back(UnZigZag(value));
+        break;
+      case ValueKind::UNSIGNED:
+        if (!ReadVarint(input, &value))
+          return false;
+        values->scalars.push_back(value);
+        break;
+      case ValueKind::FLOAT:
+        if (input->size() < 4)
+          return false;
+        values->scalars.push_back(absl::little_endian::Load32(input->data()));
+        input->remove_prefix(4);
+        break;
+      case ValueKind::DOUBLE:
+        if (input->size() < 8)
+          return false;
+        values->scalars.push_back(absl::little_endian::Load64(input->data()));
+        input->remove_prefix(8);
+        break;
+      case ValueKind::BYTES:
+        if (!ReadVarint(input, &value) || value > input->size())
+          return false;
+        values->strings.emplace_back(input->substr(0, value));
+        input->remove_prefix(value);
+        break;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// A field on the paths being shredded.
+struct ColumnShredder::Node {
+  // The field, or nullptr for the root message.
+  const ParsePlan::Field* field = nullptr;
+  // The plan of message and group fields.
+  const ParsePlan* plan = nullptr;
+  // The levels of the field's values.
+  int repetition_level = 0;
+  int definition_level = 0;
+  // The column of scalar, string and bytes fields, or -1.
+  int column = -1;
+  // The value of a field without presence when it is missing.
+  uint64_t default_bits = 0;
+  std::string default_string;
+
+  std::vector<std::unique_ptr<Node>> children;
+  // The child for each field of `plan` by index, or -1 if not shredded.
+  std::vector<int> child_index;
+  // Every column at or below this field.
+  std::vector<int> columns;
+
+  // Scratch for Shred(): the values of each child in the message being
+  // shredded, and the merged contents of split submessages.
+  struct Value {
+    uint64_t bits;
+    absl::string_view data;
+  };
+  std::vector<std::vector<Value>> found;
+  std::string merged;
+};
+
+// The levels and values of a column since the last Flush().
+struct ColumnShredder::Pending {
+  std::vector<uint8_t> repetition_levels;
+  std::vector<uint8_t> definition_levels;
+  std::vector<uint64_t> scalars;
+  // String values, concatenated, and where each one ends.
+  std::string bytes;
+  std::vector<size_t> byte_ends;
+
+  size_t value_count() const {
+    return scalars.size() + byte_ends.size();
+  }
+  absl::string_view string(size_t i) const {
+    const size_t start = i == 0 ? 0 : byte_ends[i - 1];
+    return absl::string_view(bytes).substr(start, byte_ends[i] - start);
+  }
+
+  void Add(int repetition_level, int definition_level) {
+    repetition_levels.push_back(repetition_level);
+    definition_levels.push_back(definition_level);
+  }
+  void AddString(absl::string_view value) {
+    bytes.append(value.data(), value.size());
+    byte_ends.push_back(bytes.size());
+  }
+
+  // Sizes to roll back to if a message turns out to be malformed.
+  struct Mark {
+    size_t levels, scalars, bytes, byte_ends;
+  };
+  Mark mark() const {
+    return {definition_levels.size(), scalars.size(), bytes.size(),
+            byte_ends.size()};
+  }
+  void Truncate(const Mark& mark) {
+    repetition_levels.resize(mark.levels);
+    definition_levels.resize(mark.levels);
+    scalars.resize(mark.scalars);
+    bytes.resize(mark.bytes);
+    byte_ends.resize(mark.byte_ends);
+  }
+};
+
+// Collects the values of the shredded children of a node.
+class ColumnShredder::NodeHandler {
+ public:
+  explicit NodeHandler(Node& node) : node_(node) {}
+
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    const int child = node_.child_index[field.index];
+    if (child >= 0)
+      node_.found[child].push_back({bits, absl::string_view()});
+  }
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    const int child = node_.child_index[field.index];
+    if (child >= 0)
+      node_.found[child].push_back({0, value});
+  }
+
+ private:
+  Node& node_;
+};
+
+namespace {
+
+// How a field path relates to the selected paths.
+struct Selection {
+  // The path is selected.
+  bool selected = false;
+  // A selected path goes through the field.
+  bool below = false;
+};
+
+Selection Select(const std::string& path, const std::vector<std::string>& paths,
+                 std::vector<bool>* matched) {
+  Selection selection;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (paths[i] == path) {
+      (*matched)[i] = true;
+      selection.selected = true;
+    } else if (paths[i].size() > path.size() &&
+               paths[i].compare(0, path.size(), path) == 0 &&
+               paths[i][path.size()] == '.') {
+      selection.below = true;
+    }
+  }
+  return selection;
+}
+
+}  // namespace
+
+ColumnShredder::ColumnShredder() = default;
+ColumnShredder::~ColumnShredder() = default;
+
+std::unique_ptr<ColumnShredder> ColumnShredder::Create(
+    const ParsePlan* plan, const std::vector<std::string>& paths,
+    std::string* error) {
+  std::unique_ptr<ColumnShredder> shredder(new ColumnShredder());
+  std::vector<bool> matched(paths.size());
+  std::vector<const Descriptor*> ancestors;
+  // A selected path too deep to shred.
+  std::string too_deep;
+
+  // Adds the fields of `node`'s message below it.  With `all` set every
+  // field is added, otherwise only the fields on the selected paths.
+  const auto build = [&](auto& build, Node* node, const std::string& prefix,
+                         bool all) -> void {
+    const ParsePlan* plan = node->plan;
+    ancestors.push_back(plan->descriptor());
+    node->child_index.assign(plan->field_count(), -1);
+    for (int i = 0; i < plan->field_count(); ++i) {
+      const ParsePlan::Field& field = plan->field(i);
+      const std::string path =
+          prefix.empty() ? field.descriptor->name()
+                         : absl::StrCat(prefix, ".", field.descriptor->name());
+      const Selection selection = Select(path, paths, &matched);
+      if (!all && !selection.selected && !selection.below)
+        continue;
+
+      auto child = std::make_unique<Node>();
+      child->field = &field;
+      child->repetition_level = node->repetition_level + field.repeated;
+      // Required fields are always defined, as in Dremel.
+      child->definition_level =
+          node->definition_level +
+          (field.repeated ||
+           (field.presence && !field.descriptor->is_required()));
+      if (child->definition_level > kMaxLevel) {
+        if ((selection.selected || selection.below) && too_deep.empty())
+          too_deep = path;
+        continue;
+      }
+
+      if (field.message != nullptr) {
+        // Recursive types are expanded only as far as a selected path goes.
+        if (!selection.selected && !selection.below &&
+            std::find(ancestors.begin(), ancestors.end(),
+                      field.message->descriptor()) != ancestors.end()) {
+          continue;
+        }
+        child->plan = field.message;
+        build(build, child.get(), path, all || selection.selected);
+        if (child->columns.empty())
+          continue;
+      } else {
+        child->column = shredder->columns_.size();
+        child->columns.push_back(child->column);
+        child->default_bits = ParsePlan::DefaultBits(field.descriptor);
+        if (field.descriptor->cpp_type() == FieldDescriptor::CPPTYPE_STRING)
+          child->default_string = field.descriptor->default_value_string();
+        shredder->columns_.push_back(Column{
+            .path = path,
+            .field = field.descriptor,
+            .max_repetition_level = child->repetition_level,
+            .max_definition_level = child->definition_level,
+        });
+      }
+      node->child_index[i] = node->children.size();
+      node->columns.insert(node->columns.end(), child->columns.begin(),
+                           child->columns.end());
+      node->children.push_back(std::move(child));
+    }
+    node->found.resize(node->children.size());
+    ancestors.pop_back();
+  };
+
+  shredder->root_ = std::make_unique<Node>();
+  shredder->root_->plan = plan;
+  build(build, shredder->root_.get(), "", paths.empty());
+  if (!too_deep.empty()) {
+    *error = absl::StrCat(too_deep, " is nested more than ", kMaxLevel,
+                          " levels deep");
+    return nullptr;
+  }
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (!matched[i]) {
+      *error = absl::StrCat("no field ", paths[i], " in ",
+                            plan->descriptor()->full_name());
+      return nullptr;
+    }
+  }
+  shredder->pending_columns_.resize(shredder->columns_.size());
+  return shredder;
+}
+
+bool ColumnShredder::Add(absl::string_view message) {
+  std::vector<Pending::Mark> marks;
+  marks.reserve(pending_columns_.size());
+  for (const Pending& pending : pending_columns_) {
+    marks.push_back(pending.mark());
+  }
+  const auto overfull = [this] {
+    return std::any_of(pending_columns_.begin(), pending_columns_.end(),
+                       [](const Pending& pending) {
+                         return pending.definition_levels.size() >
+                                kMaxChunkLevels;
+                       });
+  };
+  if (!Shred(*root_, message, 0, 0, 0) || overfull()) {
+    for (size_t i = 0; i < pending_columns_.size(); ++i) {
+      pending_columns_[i].Truncate(marks[i]);
+    }
+    return false;
+  }
+  ++pending_;
+  return true;
+}
+
+bool ColumnShredder::Shred(Node& node, absl::string_view message,
+                           int repetition_level, int definition_level,
+                           int depth) {
+  if (depth > kMaxDepth)
+    return false;
+  for (auto& values : node.found) values.clear();
+  NodeHandler handler(node);
+  if (!node.plan->Parse(message, handler))
+    return false;
+
+  for (size_t i = 0; i < node.children.size(); ++i) {
+    Node& child = *node.children[i];
+    const std::vector<Node::Value>& values = node.found[i];
+    const ParsePlan::Field& field = *child.field;
+
+    if (values.empty()) {
+      if (child.column >= 0 && child.definition_level == definition_level) {
+        // A field without presence reads as its default.
+        Pending& pending = pending_columns_[child.column];
+        pending.Add(repetition_level, child.definition_level);
+        if (field.descriptor->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+          pending.AddString(child.default_string);
+        } else {
+          pending.scalars.push_back(child.default_bits);
+        }
+      } else {
+        EmitNulls(child, repetition_level, definition_level);
+      }
+      continue;
+    }
+
+    if (child.column >= 0) {
+      Pending& pending = pending_columns_[child.column];
+      const bool is_string =
+          field.descriptor->cpp_type() == FieldDescriptor::CPPTYPE_STRING;
+      // The last value of a singular field wins, as when parsing.
+      const size_t first = field.repeated ? 0 : values.size() - 1;
+      for (size_t j = first; j < values.size(); ++j) {
+        pending.Add(j == first ? repetition_level : child.repetition_level,
+                    child.definition_level);
+        if (is_string) {
+          pending.AddString(values[j].data);
+        } else {
+          pending.scalars.push_back(values[j].bits);
+        }
+      }
+      continue;
+    }
+
+    if (!field.repeated) {
+      // A singular submessage split across several occurrences is merged,
+      // which for wire data is concatenation.
+      absl::string_view contents = values[0].data;
+      if (values.size() > 1) {
+        node.merged.clear();
+        for (const Node::Value& value : values) {
+          node.merged.append(value.data.data(), value.data.size());
+        }
+        contents = node.merged;
+      }
+      if (!Shred(child, contents, repetition_level, child.definition_level,
+                 depth + 1)) {
+        return false;
+      }
+      continue;
+    }
+    for (size_t j = 0; j < values.size(); ++j) {
+      if (!Shred(child, values[j].data,
+                 j == 0 ? repetition_level : child.repetition_level,
+                 child.definition_level, depth + 1)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void ColumnShredder::EmitNulls(const Node& node, int repetition_level,
+                               int definition_level) {
+  for (const int column : node.columns) {
+    pending_columns_[column].Add(repetition_level, definition_level);
+  }
+}
+
+void ColumnShredder::Flush(std::vector<records::ColumnChunk>* chunks) {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    Encode(i, &chunks->emplace_back());
+    pending_columns_[i] = Pending();
+  }
+  first_record_ += pending_;
+  pending_ = 0;
+}
+
+void ColumnShredder::Encode(int column, records::ColumnChunk* chunk) const {
+  const Column& info = columns_[column];
+  const Pending& pending = pending_columns_[column];
+  const ValueKind kind = GetValueKind(info.field);
+  const size_t count = pending.value_count();
+
+  chunk->set_path(info.path);
+  chunk->set_first_record(first_record_);
+  chunk->set_record_count(pending_);
+  chunk->set_max_repetition_level(info.max_repetition_level);
+  chunk->set_max_definition_level(info.max_definition_level);
+  chunk->set_level_count(pending.definition_levels.size());
+  BitPack(pending.repetition_levels, BitWidth(info.max_repetition_level),
+          chunk->mutable_repetition_levels());
+  BitPack(pending.definition_levels, BitWidth(info.max_definition_level),
+          chunk->mutable_definition_levels());
+  chunk->set_value_count(count);
+
+  records::ColumnStatistics* stats = chunk->mutable_statistics();
+  stats->set_null_count(pending.definition_levels.size() - count);
+  if (count > 0) {
+    switch (kind) {
+      case ValueKind::SIGNED: {
+        const auto [min, max] = std::minmax_element(
+            pending.scalars.begin(), pending.scalars.end(),
+            [](uint64_t a, uint64_t b) {
+              return static_cast<int64_t>(a) < static_cast<int64_t>(b);
+            });
+        stats->set_min_int(static_cast<int64_t>(*min));
+        stats->set_max_int(static_cast<int64_t>(*max));
+        break;
+      }
+      case ValueKind::UNSIGNED: {
+        const auto [min, max] = std::minmax_element(pending.scalars.begin(),
+                                                    pending.scalars.end());
+        stats->set_min_uint(*min);
+        stats->set_max_uint(*max);
+        break;
+      }
+      case ValueKind::FLOAT:
+      case ValueKind::DOUBLE: {
+        bool any = false;
+        double min = 0, max = 0;
+        for (const uint64_t bits : pending.scalars) {
+          const double value = kind == ValueKind::FLOAT
+                                   ? ParsePlan::AsFloat(bits)
+                                   : ParsePlan::AsDouble(bits);
+          if (std::isnan(value))
+            continue;
+          min = any ? std::min(min, value) : value;
+          max = any ? std::max(max, value) : value;
+          any = true;
+        }
+        if (any) {
+          stats->set_min_double(min);
+          stats->set_max_double(max);
+        }
+        break;
+      }
+      case ValueKind::BYTES: {
+        absl::string_view min = pending.string(0), max = min;
+        for (size_t i = 1; i < count; ++i) {
+          const absl::string_view value = pending.string(i);
+          min = std::min(min, value);
+          max = std::max(max, value);
+        }
+        stats->set_min_bytes(std::string(min));
+        stats->set_max_bytes(std::string(max));
+        break;
+      }
+    }
+  }
+
+  const auto append_plain = [&](size_t i, std::string* output) {
+    switch (kind) {
+      case ValueKind::SIGNED:
+        AppendVarint(ZigZag(pending.scalars[i]), output);
+        break;
+      case ValueKind::UNSIGNED:
+        AppendVarint(pending.scalars[i], output);
+        break;
+      case ValueKind::FLOAT: {
+        char bytes[4];
+        absl::little_endian::Store32(bytes, pending.scalars[i]);
+        output->append(bytes, sizeof(bytes));
+        break;
+      }
+      case ValueKind::DOUBLE: {
+        char bytes[8];
+        absl::little_endian::Store64(bytes, pending.scalars[i]);
+        output->append(bytes, sizeof(bytes));
+        break;
+      }
+      case ValueKind::BYTES: {
+        const absl::string_view value = pending.string(i);
+        AppendVarint(value.size(), output);
+        output->append(value.data(), value.size());
+        break;
+      }
+    }
+  };
+
+  std::string plain;
+  for (size_t i = 0; i < count; ++i) {
+    append_plain(i, &plain);
+  }
+  chunk->set_encoding(records::COLUMN_ENCODING_PLAIN);
+  size_t best_size = plain.size();
+
+  // Dictionary indices, while there are few enough distinct values.
+  std::vector<uint64_t> indices;
+  std::vector<size_t> distinct;
+  {
+    absl::flat_hash_map<uint64_t, uint64_t> scalar_dictionary;
+    absl::flat_hash_map<absl::string_view, uint64_t> string_dictionary;
+    indices.reserve(count);
+    for (size_t i = 0; i < count && distinct.size() <= kMaxDictionarySize;
+         ++i) {
+      uint64_t index;
+      if (kind == ValueKind::BYTES) {
+        index = string_dictionary
+                    .try_emplace(pending.string(i), distinct.size())
+                    .first->second;
+      } else {
+        index = scalar_dictionary
+                    .try_emplace(pending.scalars[i], distinct.size())
+                    .first->second;
+      }
+      if (index == distinct.size())
+        distinct.push_back(i);
+      indices.push_back(index);
+    }
+  }
+  std::string dictionary;
+  std::string dictionary_values;
+  if (count > 0 && distinct.size() <= kMaxDictionarySize) {
+    for (const size_t i : distinct) {
+      append_plain(i, &dictionary);
+    }
+    const int width = BitWidth(distinct.size() - 1);
+    AppendVarint(width, &dictionary_values);
+    BitPack(indices, width, &dictionary_values);
+    if (dictionary.size() + dictionary_values.size() < best_size) {
+      best_size = dictionary.size() + dictionary_values.size();
+      chunk->set_encoding(records::COLUMN_ENCODING_DICTIONARY);
+    }
+  }
+
+  std::string delta;
+  if (count > 0 &&
+      (kind == ValueKind::SIGNED || kind == ValueKind::UNSIGNED)) {
+    std::vector<uint64_t> deltas;
+    deltas.reserve(count - 1);
+    uint64_t max_delta = 0;
+    for (size_t i = 1; i < count; ++i) {
+      deltas.push_back(ZigZag(pending.scalars[i] - pending.scalars[i - 1]));
+      max_delta = std::max(max_delta, deltas.back());
+    }
+    const int width = BitWidth(max_delta);
+    AppendVarint(width, &delta);
+    AppendVarint(ZigZag(pending.scalars[0]), &delta);
+    BitPack(deltas, width, &delta);
+    if (delta.size() < best_size) {
+      best_size = delta.size();
+      chunk->set_encoding(records::COLUMN_ENCODING_DELTA);
+    }
+  }
+
+  switch (chunk->encoding()) {
+    case records::COLUMN_ENCODING_DICTIONARY:
+      *chunk->mutable_dictionary() = std::move(dictionary);
+      chunk->set_dictionary_size(distinct.size());
+      *chunk->mutable_values() = std::move(dictionary_values);
+      break;
+    case records::COLUMN_ENCODING_DELTA:
+      *chunk->mutable_values() = std::move(delta);
+      break;
+    default:
+      *chunk->mutable_values() = std::move(plain);
+      break;
+  }
+}
+
+bool DecodeColumnChunk(const records::ColumnChunk& chunk,
+                       const FieldDescriptor* field, ColumnValues* values) {
+  *values = ColumnValues();
+  const ValueKind kind = GetValueKind(field);
+  if (chunk.max_repetition_level() > kMaxLevel ||
+      chunk.max_definition_level() > kMaxLevel) {
+    return false;
+  }
+  // Every record has at least one pair of levels, and only one unless a
+  // field on the path repeats.
+  if (chunk.level_count() > kMaxChunkLevels ||
+      chunk.level_count() < chunk.record_count() ||
+      (chunk.max_repetition_level() == 0 &&
+       chunk.level_count() != chunk.record_count())) {
+    return false;
+  }
+
+  absl::string_view levels = chunk.repetition_levels();
+  if (!BitUnpack(&levels, chunk.level_count(),
+                 BitWidth(chunk.max_repetition_level()),
+                 &values->repetition_levels)) {
+    return false;
+  }
+  levels = chunk.definition_levels();
+  if (!BitUnpack(&levels, chunk.level_count(),
+                 BitWidth(chunk.max_definition_level()),
+                 &values->definition_levels)) {
+    return false;
+  }
+  const uint64_t count =
+      std::count(values->definition_levels.begin(),
+                 values->definition_levels.end(),
+                 static_cast<uint8_t>(chunk.max_definition_level()));
+  if (count != chunk.value_count())
+    return false;
+
+  absl::string_view input = chunk.values();
+  uint64_t width;
+  switch (chunk.encoding()) {
+    case records::COLUMN_ENCODING_PLAIN:
+      return ReadPlain(kind, &input, count, values);
+    case records::COLUMN_ENCODING_DICTIONARY: {
+      ColumnValues dictionary;
+      absl::string_view dictionary_input = chunk.dictionary();
+      if (chunk.dictionary_size() > kMaxDictionarySize ||
+          !ReadPlain(kind, &dictionary_input, chunk.dictionary_size(),
+                     &dictionary)) {
+        return false;
+      }
+      std::vector<uint64_t> indices;
+      if (!ReadVarint(&input, &width) ||
+          !BitUnpack(&input, count, width, &indices)) {
+        return false;
+      }
+      for (const uint64_t index : indices) {
+        if (index >= chunk.dictionary_size())
+          return false;
+        if (kind == ValueKind::BYTES) {
+          values->strings.push_back(dictionary.strings[index]);
+        } else {
+          values->scalars.push_back(dictionary.scalars[index]);
+        }
+      }
+      return true;
+    }
+    case records::COLUMN_ENCODING_DELTA: {
+      if (kind != ValueKind::SIGNED && kind != ValueKind::UNSIGNED)
+        return false;
+      if (count == 0)
+        return true;
+      uint64_t first;
+      std::vector<uint64_t> deltas;
+      if (!ReadVarint(&input, &width) || !ReadVarint(&input, &first) ||
+          !BitUnpack(&input, count - 1, width, &deltas)) {
+        return false;
+      }
+      uint64_t value = UnZigZag(first);
+      values->scalars.push_back(value);
+      for (const uint64_t delta : deltas) {
+        value += UnZigZag(delta);
+        values->scalars.push_back(value);
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace protodb
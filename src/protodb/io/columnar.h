@@ -0,0 +1,114 @@
+#ifndef PROTODB_IO_COLUMNAR_H__
+#define PROTODB_IO_COLUMNAR_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+#include "src/records/columns.pb.h"
+
+namespace protodb {
+
+using ::google::protobuf::FieldDescriptor;
+
+// The most level pairs a column chunk holds.  Levels of width 0 take no
+// space in a chunk, so this is what bounds the memory decoding one takes.
+constexpr uint64_t kMaxChunkLevels = uint64_t{1} << 24;
+
+// The levels and values of one column chunk, see records::ColumnChunk.
+struct ColumnValues {
+  std::vector<uint8_t> repetition_levels;
+  std::vector<uint8_t> definition_levels;
+  // The values of scalar columns, as passed by ParsePlan::Parse().
+  std::vector<uint64_t> scalars;
+  // The values of string and bytes columns.
+  std::vector<std::string> strings;
+};
+
+// Shreds encoded messages of one type into columns, one for each path to
+// a scalar, string or bytes field, with Dremel repetition and definition
+// levels so that the messages can be reassembled from their columns.
+//
+// Messages are walked in their wire form with ParsePlans and never parsed
+// into Message objects.  Fields of a message type already on the path are
+// skipped unless a selected path goes through them, so recursive types are
+// shredded one level deep.  Values are buffered until Flush(), which
+// encodes each column as a records::ColumnChunk with the smallest of the
+// PLAIN, DICTIONARY and DELTA encodings that apply to it, along with the
+// range of its values.
+//
+// A ColumnShredder is not thread-safe.
+class ColumnShredder {
+ public:
+  struct Column {
+    std::string path;
+    // The scalar, string or bytes field at the end of the path.
+    const FieldDescriptor* field;
+    int max_repetition_level;
+    int max_definition_level;
+  };
+
+  // Creates a shredder for messages of `plan`'s type.  `paths` selects the
+  // fields to shred, each with every field below it; with no paths every
+  // field is shredded.  Returns nullptr and sets `error` if a path doesn't
+  // name a field, or names one nested too deeply for its levels to fit in
+  // a byte.
+  static std::unique_ptr<ColumnShredder> Create(
+      const ParsePlan* plan, const std::vector<std::string>& paths,
+      std::string* error);
+
+  ColumnShredder(const ColumnShredder&) = delete;
+  ColumnShredder& operator=(const ColumnShredder&) = delete;
+  ~ColumnShredder();
+
+  const std::vector<Column>& columns() const {
+    return columns_;
+  }
+
+  // Shreds one encoded message.  Returns false, adding nothing, if the
+  // wire data is malformed or the message would take a column past
+  // kMaxChunkLevels, in which case Flush() makes room for it.
+  bool Add(absl::string_view message);
+
+  // The number of messages added since the last Flush().
+  uint64_t pending() const {
+    return pending_;
+  }
+
+  // Appends one chunk per column for the messages added since the last
+  // Flush() to `chunks`, and starts the next chunk.
+  void Flush(std::vector<records::ColumnChunk>* chunks);
+
+ private:
+  struct Node;
+  struct Pending;
+  class NodeHandler;
+
+  ColumnShredder();
+
+  bool Shred(Node& node, absl::string_view message, int repetition_level,
+             int definition_level, int depth);
+  void EmitNulls(const Node& node, int repetition_level,
+                 int definition_level);
+  void Encode(int column, records::ColumnChunk* chunk) const;
+
+  std::unique_ptr<Node> root_;
+  std::vector<Column> columns_;
+  std::vector<Pending> pending_columns_;
+  uint64_t pending_ = 0;
+  uint64_t first_record_ = 0;
+};
+
+// Decodes a chunk written by ColumnShredder for a column ending at `field`.
+// Returns false if the chunk is malformed, including when its counts don't
+// agree or it has more than kMaxChunkLevels level pairs.
+bool DecodeColumnChunk(const records::ColumnChunk& chunk,
+                       const FieldDescriptor* field, ColumnValues* values);
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_COLUMNAR_H__
@@ -0,0 +1,185 @@
+#include "protodb/io/columnar.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "gtest/gtest.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/test_util.h"
+#include "src/records/columns.pb.h"
+
+namespace protodb {
+namespace {
+
+constexpr absl::string_view kRecord1 = R"pb(
+  DocId: 10
+  Links { Forward: 20 Forward: 40 Forward: 60 }
+  Name {
+    Language { Code: "en-us" Country: "us" }
+    Language { Code: "en" }
+    Url: "http://A"
+  }
+  Name { Url: "http://B" }
+  Name { Language { Code: "en-gb" Country: "gb" } }
+)pb";
+
+constexpr absl::string_view kRecord2 = R"pb(
+  DocId: 20
+  Links { Backward: 10 Backward: 30 Forward: 80 }
+  Name { Url: "http://C" }
+)pb";
+
+class ColumnarTest : public testing::Test {
+ protected:
+  // Shreds both records and returns the chunk for `path`.
+  records::ColumnChunk Shred(const std::string& path) {
+    std::string error;
+    auto shredder = ColumnShredder::Create(plan_, {path}, &error);
+    EXPECT_NE(shredder, nullptr) << error;
+    EXPECT_TRUE(shredder->Add(test::Wire<test::Document>(kRecord1)));
+    EXPECT_TRUE(shredder->Add(test::Wire<test::Document>(kRecord2)));
+    std::vector<records::ColumnChunk> chunks;
+    shredder->Flush(&chunks);
+    EXPECT_EQ(chunks.size(), 1);
+    return chunks.empty() ? records::ColumnChunk() : chunks[0];
+  }
+
+  ColumnValues Decode(const records::ColumnChunk& chunk,
+                      const FieldDescriptor* field) {
+    ColumnValues values;
+    EXPECT_TRUE(DecodeColumnChunk(chunk, field, &values));
+    return values;
+  }
+
+  ParsePlanCache plans_;
+  const ParsePlan* const plan_ = plans_.Get(test::Document::descriptor());
+};
+
+TEST_F(ColumnarTest, ComputesDremelLevels) {
+  const FieldDescriptor* code =
+      test::Language::descriptor()->FindFieldByName("Code");
+  const records::ColumnChunk chunk = Shred("Name.Language.Code");
+  EXPECT_EQ(chunk.max_repetition_level(), 2);
+  EXPECT_EQ(chunk.max_definition_level(), 2);
+  const ColumnValues values = Decode(chunk, code);
+  EXPECT_EQ(values.repetition_levels, (std::vector<uint8_t>{0, 2, 1, 1, 0}));
+  EXPECT_EQ(values.definition_levels, (std::vector<uint8_t>{2, 2, 1, 2, 1}));
+  EXPECT_EQ(values.strings,
+            (std::vector<std::string>{"en-us", "en", "en-gb"}));
+  EXPECT_EQ(chunk.statistics().min_bytes(), "en");
+  EXPECT_EQ(chunk.statistics().max_bytes(), "en-us");
+  EXPECT_EQ(chunk.statistics().null_count(), 2);
+
+  const FieldDescriptor* url = test::Name::descriptor()->FindFieldByName("Url");
+  const ColumnValues urls = Decode(Shred("Name.Url"), url);
+  EXPECT_EQ(urls.repetition_levels, (std::vector<uint8_t>{0, 1, 1, 0}));
+  EXPECT_EQ(urls.definition_levels, (std::vector<uint8_t>{2, 2, 1, 2}));
+
+  const FieldDescriptor* backward =
+      test::Links::descriptor()->FindFieldByName("Backward");
+  const ColumnValues backwards = Decode(Shred("Links.Backward"), backward);
+  EXPECT_EQ(backwards.repetition_levels, (std::vector<uint8_t>{0, 0, 1}));
+  EXPECT_EQ(backwards.definition_levels, (std::vector<uint8_t>{1, 2, 2}));
+  EXPECT_EQ(backwards.scalars, (std::vector<uint64_t>{10, 30}));
+}
+
+TEST_F(ColumnarTest, SelectsEveryFieldBelowPath) {
+  std::string error;
+  auto shredder = ColumnShredder::Create(plan_, {"DocId", "Name"}, &error);
+  ASSERT_NE(shredder, nullptr) << error;
+  std::vector<std::string> paths;
+  for (const ColumnShredder::Column& column : shredder->columns()) {
+    paths.push_back(column.path);
+  }
+  EXPECT_EQ(paths, (std::vector<std::string>{"DocId", "Name.Language.Code",
+                                             "Name.Language.Country",
+                                             "Name.Url"}));
+
+  EXPECT_EQ(ColumnShredder::Create(plan_, {"Name.Missing"}, &error), nullptr);
+  EXPECT_NE(error, "");
+
+  // Levels are bytes, so a path can't go more than 255 fields deep.
+  const ParsePlan* tree = plans_.Get(test::Tree::descriptor());
+  std::string path;
+  for (int i = 0; i < 254; ++i) {
+    path += "child.";
+  }
+  EXPECT_NE(ColumnShredder::Create(tree, {path + "value"}, &error), nullptr)
+      << error;
+  error.clear();
+  EXPECT_EQ(ColumnShredder::Create(tree, {"child." + path + "value"}, &error),
+            nullptr);
+  EXPECT_NE(error, "");
+}
+
+TEST_F(ColumnarTest, PicksSmallestEncoding) {
+  const FieldDescriptor* doc_id =
+      test::Document::descriptor()->FindFieldByName("DocId");
+  const FieldDescriptor* url = test::Name::descriptor()->FindFieldByName("Url");
+  std::string error;
+  auto shredder = ColumnShredder::Create(plan_, {"DocId", "Name.Url"}, &error);
+  ASSERT_NE(shredder, nullptr) << error;
+  for (int i = 0; i < 1000; ++i) {
+    const std::string text = "DocId: " + std::to_string(1000000 + i * 3) +
+                             " Name { Url: \"http://" +
+                             std::to_string(i % 4) + "\" }";
+    ASSERT_TRUE(shredder->Add(test::Wire<test::Document>(text)));
+  }
+  // Malformed wire data adds nothing.
+  EXPECT_FALSE(shredder->Add("\x1a\x05"));
+  EXPECT_EQ(shredder->pending(), 1000);
+
+  std::vector<records::ColumnChunk> chunks;
+  shredder->Flush(&chunks);
+  ASSERT_EQ(chunks.size(), 2);
+  EXPECT_EQ(chunks[0].encoding(), records::COLUMN_ENCODING_DELTA);
+  EXPECT_EQ(chunks[0].statistics().min_int(), 1000000);
+  EXPECT_EQ(chunks[0].statistics().max_int(), 1000000 + 999 * 3);
+  const ColumnValues ids = Decode(chunks[0], doc_id);
+  ASSERT_EQ(ids.scalars.size(), 1000);
+  EXPECT_EQ(ids.scalars[999], 1000000 + 999 * 3);
+
+  EXPECT_EQ(chunks[1].encoding(), records::COLUMN_ENCODING_DICTIONARY);
+  EXPECT_EQ(chunks[1].dictionary_size(), 4);
+  const ColumnValues urls = Decode(chunks[1], url);
+  ASSERT_EQ(urls.strings.size(), 1000);
+  EXPECT_EQ(urls.strings[998], "http://2");
+
+  shredder->Add(test::Wire<test::Document>(kRecord2));
+  chunks.clear();
+  shredder->Flush(&chunks);
+  EXPECT_EQ(chunks[0].first_record(), 1000);
+  EXPECT_EQ(chunks[0].record_count(), 1);
+}
+
+TEST_F(ColumnarTest, RejectsChunksWithBadCounts) {
+  const FieldDescriptor* doc_id =
+      test::Document::descriptor()->FindFieldByName("DocId");
+  const records::ColumnChunk chunk = Shred("DocId");
+  ASSERT_EQ(chunk.level_count(), 2);
+  ColumnValues values;
+
+  // DocId's levels take no space, so only the counts bound them.
+  records::ColumnChunk corrupt = chunk;
+  corrupt.set_level_count(uint64_t{1} << 60);
+  corrupt.set_record_count(uint64_t{1} << 60);
+  EXPECT_FALSE(DecodeColumnChunk(corrupt, doc_id, &values));
+  corrupt = chunk;
+  corrupt.set_level_count(3);
+  EXPECT_FALSE(DecodeColumnChunk(corrupt, doc_id, &values));
+  corrupt = chunk;
+  corrupt.set_record_count(3);
+  EXPECT_FALSE(DecodeColumnChunk(corrupt, doc_id, &values));
+
+  const FieldDescriptor* backward =
+      test::Links::descriptor()->FindFieldByName("Backward");
+  corrupt = Shred("Links.Backward");
+  corrupt.set_record_count(4);
+  EXPECT_FALSE(DecodeColumnChunk(corrupt, backward, &values));
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,107 @@
+#include "protodb/io/content_hash.h"
+
+#include <cstdint>
+#include <string>
+
+#include "absl/base/internal/endian.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+
+namespace protodb {
+
+namespace {
+
+constexpr uint64_t kC1 = 0x87c37b91114253d5ull;
+constexpr uint64_t kC2 = 0x4cf5ad432745937full;
+
+inline uint64_t Rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t FMix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+inline uint64_t MixK1(uint64_t k1) {
+  k1 *= kC1;
+  k1 = Rotl64(k1, 31);
+  return k1 * kC2;
+}
+
+inline uint64_t MixK2(uint64_t k2) {
+  k2 *= kC2;
+  k2 = Rotl64(k2, 33);
+  return k2 * kC1;
+}
+
+}  // namespace
+
+absl::uint128 ContentHash(absl::string_view data, uint64_t seed) {
+  const char* p = data.data();
+  const size_t size = data.size();
+  const char* const blocks_end = p + (size & ~size_t{15});
+
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  for (; p != blocks_end; p += 16) {
+    h1 ^= MixK1(absl::little_endian::Load64(p));
+    h1 = Rotl64(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    h2 ^= MixK2(absl::little_endian::Load64(p + 8));
+    h2 = Rotl64(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  // The remaining 0-15 bytes, little endian.
+  const auto* tail = reinterpret_cast<const uint8_t*>(p);
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  switch (size & 15) {
+    case 15: k2 ^= uint64_t{tail[14]} << 48; [[fallthrough]];
+    case 14: k2 ^= uint64_t{tail[13]} << 40; [[fallthrough]];
+    case 13: k2 ^= uint64_t{tail[12]} << 32; [[fallthrough]];
+    case 12: k2 ^= uint64_t{tail[11]} << 24; [[fallthrough]];
+    case 11: k2 ^= uint64_t{tail[10]} << 16; [[fallthrough]];
+    case 10: k2 ^= uint64_t{tail[9]} << 8; [[fallthrough]];
+    case 9:
+      k2 ^= uint64_t{tail[8]};
+      h2 ^= MixK2(k2);
+      [[fallthrough]];
+    case 8: k1 ^= uint64_t{tail[7]} << 56; [[fallthrough]];
+    case 7: k1 ^= uint64_t{tail[6]} << 48; [[fallthrough]];
+    case 6: k1 ^= uint64_t{tail[5]} << 40; [[fallthrough]];
+    case 5: k1 ^= uint64_t{tail[4]} << 32; [[fallthrough]];
+    case 4: k1 ^= uint64_t{tail[3]} << 24; [[fallthrough]];
+    case 3: k1 ^= uint64_t{tail[2]} << 16; [[fallthrough]];
+    case 2: k1 ^= uint64_t{tail[1]} << 8; [[fallthrough]];
+    case 1:
+      k1 ^= uint64_t{tail[0]};
+      h1 ^= MixK1(k1);
+  }
+
+  h1 ^= size;
+  h2 ^= size;
+  h1 += h2;
+  h2 += h1;
+  h1 = FMix64(h1);
+  h2 = FMix64(h2);
+  h1 += h2;
+  h2 += h1;
+  return absl::MakeUint128(h2, h1);
+}
+
+std::string ContentHashToHex(absl::uint128 hash) {
+  return absl::StrFormat("%016x%016x", absl::Uint128High64(hash),
+                         absl::Uint128Low64(hash));
+}
+
+}  // namespace protodb
@@ -0,0 +1,25 @@
+#ifndef PROTODB_IO_CONTENT_HASH_H__
+#define PROTODB_IO_CONTENT_HASH_H__
+
+#include <cstdint>
+#include <string>
+
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
+
+namespace protodb {
+
+// Returns a 128-bit hash of `data` for identifying stored content, such as
+// the canonical encoding of a message.
+//
+// This is MurmurHash3 x64_128.  Unlike absl::Hash, its value is the same on
+// every platform and in every release, so it can be persisted and compared
+// across runs.  It is not a cryptographic hash.
+absl::uint128 ContentHash(absl::string_view data, uint64_t seed = 0);
+
+// Formats a content hash as 32 lowercase hex digits.
+std::string ContentHashToHex(absl::uint128 hash);
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_CONTENT_HASH_H__
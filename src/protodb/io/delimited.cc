@@ -0,0 +1,50 @@
+#include "protodb/io/delimited.h"
+
+#include <cstring>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+
+namespace protodb {
+
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+
+DelimitedReader::Status DelimitedReader::Next(std::string* message) {
+  // A new CodedInputStream per message keeps us clear of the total bytes
+  // limit on very large streams.  The destructor hands any buffered input
+  // past the message back to the underlying stream.
+  CodedInputStream cis(input_);
+  // Running out of input on a message boundary is a clean end of stream.
+  // A malformed varint can fail without consuming any bytes, so the check
+  // is for remaining input rather than for progress.
+  const void* data;
+  int available;
+  if (!cis.GetDirectBufferPointer(&data, &available))
+    return END_OF_STREAM;
+  uint32_t size = 0;
+  if (!cis.ReadVarint32(&size))
+    return ERROR;
+  if (!cis.ReadString(message, size)) {
+    return ERROR;
+  }
+  ++count_;
+  return OK;
+}
+
+DelimitedReader::Status DelimitedReader::Next(DelimitedMessage* message) {
+  message->index = count_;
+  return Next(&message->data);
+}
+
+void AppendDelimited(absl::string_view message, std::string* output) {
+  const size_t offset = output->size();
+  const size_t prefix_size = CodedOutputStream::VarintSize32(message.size());
+  output->resize(offset + prefix_size + message.size());
+  uint8_t* target = reinterpret_cast<uint8_t*>(&(*output)[offset]);
+  target = CodedOutputStream::WriteVarint32ToArray(message.size(), target);
+  memcpy(target, message.data(), message.size());
+}
+
+}  // namespace protodb
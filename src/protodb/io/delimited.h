@@ -0,0 +1,57 @@
+#ifndef PROTODB_IO_DELIMITED_H__
+#define PROTODB_IO_DELIMITED_H__
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+
+namespace protodb {
+
+using ::google::protobuf::io::ZeroCopyInputStream;
+
+// A framed message and its 0-based position in the stream, for handing
+// messages to other threads while still reporting which one failed.
+struct DelimitedMessage {
+  uint64_t index = 0;
+  std::string data;
+};
+
+// Frames a stream of length-delimited messages, where each message is
+// prefixed by its size encoded as a varint.  This is the same framing used by
+// `writeDelimitedTo()` in the Java and Python protobuf libraries.
+class DelimitedReader {
+ public:
+  enum Status {
+    OK,
+    END_OF_STREAM,
+    ERROR,
+  };
+
+  explicit DelimitedReader(ZeroCopyInputStream* input) : input_(input) {}
+  DelimitedReader(const DelimitedReader&) = delete;
+  DelimitedReader& operator=(const DelimitedReader&) = delete;
+
+  // Reads the next message into `message` without parsing it.  Returns
+  // END_OF_STREAM if the stream ended cleanly on a message boundary.
+  Status Next(std::string* message);
+  // As above, also setting the message's index.
+  Status Next(DelimitedMessage* message);
+
+  // The number of messages successfully read so far.
+  uint64_t count() const {
+    return count_;
+  }
+
+ private:
+  ZeroCopyInputStream* const input_;
+  uint64_t count_ = 0;
+};
+
+// Appends `message` to `output` prefixed with its varint encoded length.
+void AppendDelimited(absl::string_view message, std::string* output);
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_DELIMITED_H__
@@ -0,0 +1,80 @@
+#include "protodb/io/delimited.h"
+
+#include <string>
+
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::io::ArrayInputStream;
+
+TEST(DelimitedTest, ReadsBackAppendedMessages) {
+  std::string stream;
+  AppendDelimited("first", &stream);
+  AppendDelimited("", &stream);
+  AppendDelimited(std::string(300, 'x'), &stream);
+  // A small block size makes messages and prefixes span stream buffers.
+  ArrayInputStream in(stream.data(), stream.size(), 7);
+  DelimitedReader reader(&in);
+
+  DelimitedMessage message;
+  ASSERT_EQ(reader.Next(&message), DelimitedReader::OK);
+  EXPECT_EQ(message.index, 0u);
+  EXPECT_EQ(message.data, "first");
+  ASSERT_EQ(reader.Next(&message), DelimitedReader::OK);
+  EXPECT_EQ(message.index, 1u);
+  EXPECT_EQ(message.data, "");
+  std::string data;
+  ASSERT_EQ(reader.Next(&data), DelimitedReader::OK);
+  EXPECT_EQ(data, std::string(300, 'x'));
+  EXPECT_EQ(reader.Next(&data), DelimitedReader::END_OF_STREAM);
+  EXPECT_EQ(reader.count(), 3u);
+}
+
+TEST(DelimitedTest, EmptyStreamEndsCleanly) {
+  ArrayInputStream in("", 0);
+  DelimitedReader reader(&in);
+  std::string data;
+  EXPECT_EQ(reader.Next(&data), DelimitedReader::END_OF_STREAM);
+  EXPECT_EQ(reader.count(), 0u);
+}
+
+TEST(DelimitedTest, RejectsTruncatedInput) {
+  std::string valid;
+  AppendDelimited("ok", &valid);
+  for (const std::string& tail : {
+           std::string("\x80"),          // Truncated varint.
+           std::string("\x80\x80\x80"),  // Truncated varint.
+           std::string("\x05" "abc"),    // Truncated message.
+       }) {
+    const std::string stream = valid + tail;
+    ArrayInputStream in(stream.data(), stream.size());
+    DelimitedReader reader(&in);
+    DelimitedMessage message;
+    ASSERT_EQ(reader.Next(&message), DelimitedReader::OK);
+    EXPECT_EQ(reader.Next(&message), DelimitedReader::ERROR);
+    EXPECT_EQ(reader.count(), 1u);
+  }
+}
+
+TEST(DelimitedTest, RejectsOversizedVarints) {
+  for (const std::string& stream : {
+           // More than the 10 bytes of any varint.
+           std::string(11, '\xff'),
+           // A valid varint too large for a 32-bit size.
+           std::string("\xff\xff\xff\xff\xff\x01", 6),
+           // A size larger than the rest of the stream.
+           std::string("\xff\xff\xff\xff\x07" "abc"),
+       }) {
+    ArrayInputStream in(stream.data(), stream.size());
+    DelimitedReader reader(&in);
+    std::string data;
+    EXPECT_EQ(reader.Next(&data), DelimitedReader::ERROR);
+    EXPECT_EQ(reader.count(), 0u);
+  }
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,249 @@
+#include "protodb/io/field_projection.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace protodb {
+
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::internal::WireFormatLite;
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace {
+
+// Field numbers up to this value are looked up in a dense table, anything
+// larger falls back to a hash map.
+constexpr int kMaxDenseFieldNumber = 1024;
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+constexpr int kMaxVarint32Bytes = 5;
+
+}  // namespace
+
+struct FieldProjection::Node {
+  enum Action : uint8_t {
+    SKIP = 0,
+    COPY,
+    DESCEND,
+  };
+
+  struct Selection {
+    Action action = SKIP;
+    // Whether a field to DESCEND into is a group rather than a
+    // length-delimited message.
+    bool group = false;
+    std::unique_ptr<Node> child;
+  };
+
+  explicit Node(const Descriptor* descriptor) : descriptor(descriptor) {}
+
+  Selection& Select(int number) {
+    if (number > kMaxDenseFieldNumber) {
+      return sparse_fields[number];
+    }
+    if (dense_fields.size() <= number) {
+      dense_fields.resize(number + 1);
+    }
+    return dense_fields[number];
+  }
+
+  const Selection* Find(uint32_t number) const {
+    if (number < dense_fields.size()) {
+      return &dense_fields[number];
+    }
+    if (sparse_fields.empty()) {
+      return nullptr;
+    }
+    auto iter = sparse_fields.find(number);
+    return iter == sparse_fields.end() ? nullptr : &iter->second;
+  }
+
+  const Descriptor* const descriptor;
+  std::vector<Selection> dense_fields;
+  absl::flat_hash_map<uint32_t, Selection> sparse_fields;
+};
+
+FieldProjection::FieldProjection(std::unique_ptr<Node> root)
+    : root_(std::move(root)) {}
+
+FieldProjection::~FieldProjection() {}
+
+const Descriptor* FieldProjection::descriptor() const {
+  return root_->descriptor;
+}
+
+std::unique_ptr<FieldProjection> FieldProjection::Compile(
+    const Descriptor* descriptor, absl::string_view mask, std::string* error) {
+  auto root = std::make_unique<Node>(descriptor);
+
+  std::vector<absl::string_view> paths =
+      absl::StrSplit(mask, ',', absl::SkipWhitespace());
+  if (paths.empty()) {
+    *error = "empty field mask";
+    return nullptr;
+  }
+
+  for (absl::string_view path : paths) {
+    path = absl::StripAsciiWhitespace(path);
+    std::vector<absl::string_view> segments = absl::StrSplit(path, '.');
+    Node* node = root.get();
+    for (int i = 0; i < segments.size(); ++i) {
+      absl::string_view name = segments[i];
+      const bool all_elements = absl::ConsumeSuffix(&name, "[*]");
+      const FieldDescriptor* field =
+          node->descriptor->FindFieldByName(std::string(name));
+      if (field == nullptr) {
+        *error = absl::StrCat(path, ": no field \"", name, "\" in ",
+                              node->descriptor->full_name());
+        return nullptr;
+      }
+      if (all_elements && !field->is_repeated()) {
+        *error = absl::StrCat(path, ": ", name, "[*] used on a field that is ",
+                              "not repeated");
+        return nullptr;
+      }
+
+      Node::Selection& selection = node->Select(field->number());
+      if (i + 1 == segments.size()) {
+        // A leaf selects the entire field, including any paths that were
+        // previously selected below it.
+        selection.action = Node::COPY;
+        selection.child.reset();
+        break;
+      }
+
+      if (field->type() != FieldDescriptor::TYPE_MESSAGE &&
+          field->type() != FieldDescriptor::TYPE_GROUP) {
+        *error = absl::StrCat(path, ": ", name, " is not a message field");
+        return nullptr;
+      }
+      if (selection.action == Node::COPY) {
+        // The whole field is already selected.
+        break;
+      }
+      if (selection.action == Node::SKIP) {
+        selection.action = Node::DESCEND;
+        selection.group = field->type() == FieldDescriptor::TYPE_GROUP;
+        selection.child = std::make_unique<Node>(field->message_type());
+      }
+      node = selection.child.get();
+    }
+  }
+
+  return std::unique_ptr<FieldProjection>(new FieldProjection(std::move(root)));
+}
+
+bool FieldProjection::Project(absl::string_view wire,
+                              std::string* output) const {
+  const auto* base = reinterpret_cast<const uint8_t*>(wire.data());
+  CodedInputStream cis(base, wire.size());
+  cis.PushLimit(wire.size());
+  return ProjectMessage(*root_, cis, base, 0, 0, output);
+}
+
+bool FieldProjection::ProjectMessage(const Node& node, CodedInputStream& cis,
+                                     const uint8_t* base, int depth,
+                                     uint32_t end_tag, std::string* output) {
+  if (depth > kMaxDepth) {
+    return false;
+  }
+
+  while (cis.BytesUntilLimit() > 0) {
+    const int field_start = cis.CurrentPosition();
+    const uint32_t tag = cis.ReadTag();
+    if (tag == 0) {
+      return false;
+    }
+    if (WireFormatLite::GetTagWireType(tag) ==
+        WireFormatLite::WIRETYPE_END_GROUP) {
+      if (tag != end_tag)
+        return false;
+      output->append(reinterpret_cast<const char*>(base) + field_start,
+                     cis.CurrentPosition() - field_start);
+      return true;
+    }
+
+    const Node::Selection* selection =
+        node.Find(WireFormatLite::GetTagFieldNumber(tag));
+    if (selection == nullptr || selection->action == Node::SKIP) {
+      if (!WireFormatLite::SkipField(&cis, tag))
+        return false;
+      continue;
+    }
+
+    const WireFormatLite::WireType wire_type =
+        WireFormatLite::GetTagWireType(tag);
+    if (selection->action == Node::COPY ||
+        wire_type != (selection->group
+                          ? WireFormatLite::WIRETYPE_START_GROUP
+                          : WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) {
+      // Copy the tag and value through untouched.  A field we expected to
+      // descend into that has the wrong wire type is copied as well so the
+      // parser can treat it the same way it would in the full message.
+      if (!WireFormatLite::SkipField(&cis, tag))
+        return false;
+      output->append(reinterpret_cast<const char*>(base) + field_start,
+                     cis.CurrentPosition() - field_start);
+      continue;
+    }
+
+    output->append(reinterpret_cast<const char*>(base) + field_start,
+                   cis.CurrentPosition() - field_start);
+    if (selection->group) {
+      // A group needs no length, and ends with the tag that closes it.
+      if (!ProjectMessage(*selection->child, cis, base, depth + 1,
+                          WireFormatLite::MakeTag(
+                              WireFormatLite::GetTagFieldNumber(tag),
+                              WireFormatLite::WIRETYPE_END_GROUP),
+                          output)) {
+        return false;
+      }
+      continue;
+    }
+
+    uint32_t length = 0;
+    if (!cis.ReadVarint32(&length) || length > cis.BytesUntilLimit()) {
+      return false;
+    }
+
+    // Reserve a single byte for the length of the projected submessage and
+    // widen it afterwards if needed.  Most projected submessages are small
+    // enough that no bytes need to be moved.
+    const size_t length_offset = output->size();
+    output->push_back('\0');
+    const auto limit = cis.PushLimit(length);
+    if (!ProjectMessage(*selection->child, cis, base, depth + 1, 0, output)) {
+      return false;
+    }
+    cis.PopLimit(limit);
+
+    const size_t projected_length = output->size() - length_offset - 1;
+    uint8_t varint[kMaxVarint32Bytes];
+    const int varint_size =
+        CodedOutputStream::WriteVarint32ToArray(projected_length, varint) -
+        varint;
+    if (varint_size > 1) {
+      output->insert(length_offset + 1, varint_size - 1, '\0');
+    }
+    memcpy(&(*output)[length_offset], varint, varint_size);
+  }
+
+  // A group must end before its enclosing message does.
+  return end_tag == 0;
+}
+
+}  // namespace protodb
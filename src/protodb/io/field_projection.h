@@ -0,0 +1,66 @@
+#ifndef PROTODB_IO_FIELD_PROJECTION_H__
+#define PROTODB_IO_FIELD_PROJECTION_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::io::CodedInputStream;
+
+// A field mask compiled against a message type into a plan for filtering
+// wire data.
+//
+// A mask is a comma separated list of field paths, for example:
+//   a.b,c[*].d
+//
+// Path segments are field names separated by `.`.  A repeated field may be
+// written as `name[*]` to make it clear that every element is selected.  A
+// path that ends in a message or group field selects the whole message.
+//
+// Projecting wire data walks the encoded fields directly: fields that are
+// not selected are skipped using their length prefix or wire type without
+// being parsed, selected leaves are copied through byte for byte, and only
+// the messages along a selected path are re-encoded.  The output is valid
+// wire data for the same message type containing only the selected fields.
+class FieldProjection {
+ public:
+  FieldProjection(const FieldProjection&) = delete;
+  FieldProjection& operator=(const FieldProjection&) = delete;
+  ~FieldProjection();
+
+  // Compiles `mask` against `descriptor`.  Returns nullptr and sets `error`
+  // if a path doesn't name a field in the message type.
+  static std::unique_ptr<FieldProjection> Compile(const Descriptor* descriptor,
+                                                  absl::string_view mask,
+                                                  std::string* error);
+
+  // Appends the selected fields of `wire` to `output`.  Returns false if the
+  // wire data is malformed.
+  bool Project(absl::string_view wire, std::string* output) const;
+
+  const Descriptor* descriptor() const;
+
+ private:
+  struct Node;
+
+  explicit FieldProjection(std::unique_ptr<Node> root);
+
+  // Projects the fields of `node` up to the current limit or, for a group,
+  // up to and including `end_tag`, which is 0 for a message.
+  static bool ProjectMessage(const Node& node, CodedInputStream& cis,
+                             const uint8_t* base, int depth, uint32_t end_tag,
+                             std::string* output);
+
+  std::unique_ptr<Node> root_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_FIELD_PROJECTION_H__
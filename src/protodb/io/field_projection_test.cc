@@ -0,0 +1,151 @@
+#include "protodb/io/field_projection.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/text_format.h"
+#include "google/protobuf/util/message_differencer.h"
+#include "gtest/gtest.h"
+#include "protodb/io/test_util.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::TextFormat;
+using ::google::protobuf::util::MessageDifferencer;
+
+constexpr absl::string_view kTestMessage = R"pb(
+  id: 7
+  name: "event"
+  header {
+    host: "a"
+    time: 100
+    origin { host: "b" time: 50 }
+  }
+  spans { name: "x" start: 1 end: 2 }
+  spans { name: "y" start: 3 end: 4 }
+  tags: [ "t1", "t2" ]
+  Location { lat: 1.5 lng: -2.5 }
+  big: 9
+)pb";
+
+class FieldProjectionTest : public testing::Test {
+ protected:
+  // Projects `wire` through `mask` and checks that the output parses to the
+  // message in `expected`.
+  void ExpectProjection(absl::string_view mask, absl::string_view wire,
+                        absl::string_view expected) {
+    std::string error;
+    auto projection = FieldProjection::Compile(descriptor_, mask, &error);
+    ASSERT_NE(projection, nullptr) << error;
+    EXPECT_EQ(projection->descriptor(), descriptor_);
+    std::string output;
+    ASSERT_TRUE(projection->Project(wire, &output)) << mask;
+    test::Trace actual;
+    ASSERT_TRUE(actual.ParseFromString(output)) << mask;
+    test::Trace want;
+    ASSERT_TRUE(TextFormat::ParseFromString(std::string(expected), &want));
+    EXPECT_TRUE(MessageDifferencer::Equals(want, actual))
+        << mask << "\nexpected:\n"
+        << want.DebugString() << "actual:\n"
+        << actual.DebugString();
+  }
+
+  const Descriptor* const descriptor_ = test::Trace::descriptor();
+  const std::string wire_ = test::Wire<test::Trace>(kTestMessage);
+};
+
+TEST_F(FieldProjectionTest, SelectsTopLevelFields) {
+  ExpectProjection("id, name", wire_, R"pb(id: 7 name: "event")pb");
+  ExpectProjection("big", wire_, "big: 9");
+}
+
+TEST_F(FieldProjectionTest, SelectsNestedPaths) {
+  ExpectProjection("header.time", wire_, "header { time: 100 }");
+  ExpectProjection("header.origin.host,header.time", wire_,
+                   R"pb(header { time: 100 origin { host: "b" } })pb");
+  // A path ending in a message selects all of it, whatever else is
+  // selected below it.
+  ExpectProjection("header.time,header", wire_,
+                   R"pb(header {
+                          host: "a"
+                          time: 100
+                          origin { host: "b" time: 50 }
+                        })pb");
+  ExpectProjection("header,header.time", wire_,
+                   R"pb(header {
+                          host: "a"
+                          time: 100
+                          origin { host: "b" time: 50 }
+                        })pb");
+}
+
+TEST_F(FieldProjectionTest, SelectsEveryElementOfRepeatedFields) {
+  ExpectProjection("spans[*].name", wire_,
+                   R"pb(spans { name: "x" } spans { name: "y" })pb");
+  ExpectProjection("spans.start,spans.end", wire_,
+                   R"pb(spans { start: 1 end: 2 }
+                        spans { start: 3 end: 4 })pb");
+  ExpectProjection("tags[*]", wire_, R"pb(tags: [ "t1", "t2" ])pb");
+}
+
+TEST_F(FieldProjectionTest, SelectsGroups) {
+  ExpectProjection("location", wire_, "Location { lat: 1.5 lng: -2.5 }");
+  ExpectProjection("location.lng,id", wire_, "id: 7 Location { lng: -2.5 }");
+  // Unterminated and mismatched groups are malformed.
+  std::string error;
+  auto projection =
+      FieldProjection::Compile(descriptor_, "location.lat", &error);
+  ASSERT_NE(projection, nullptr) << error;
+  std::string output;
+  EXPECT_FALSE(projection->Project(absl::string_view("\x33\x38\x01", 3),
+                                   &output));
+  EXPECT_FALSE(projection->Project(absl::string_view("\x33\x38\x01\x3c", 4),
+                                   &output));
+}
+
+TEST_F(FieldProjectionTest, DropsUnknownFieldsAndKeepsMismatchedOnes) {
+  // Unknown field 99 as a varint and a group, then header (3) as a varint.
+  const std::string wire("\x98\x06\x01"              // 99: 1
+                         "\x9b\x06\x08\x01\x9c\x06"  // 99 { 1: 1 }
+                         "\x18\x05"                  // 3: 5
+                         "\x08\x07",                 // id: 7
+                         13);
+  std::string error;
+  auto projection =
+      FieldProjection::Compile(descriptor_, "id,header.time", &error);
+  ASSERT_NE(projection, nullptr) << error;
+  std::string output;
+  ASSERT_TRUE(projection->Project(wire, &output));
+  // The mismatched field is copied for the parser to treat as unknown.
+  EXPECT_EQ(output, std::string("\x18\x05\x08\x07", 4));
+}
+
+TEST_F(FieldProjectionTest, RejectsBadMasks) {
+  std::string error;
+  EXPECT_EQ(FieldProjection::Compile(descriptor_, "", &error), nullptr);
+  EXPECT_EQ(error, "empty field mask");
+  EXPECT_EQ(FieldProjection::Compile(descriptor_, "id,nope", &error), nullptr);
+  EXPECT_EQ(error, "nope: no field \"nope\" in protodb.test.Trace");
+  EXPECT_EQ(FieldProjection::Compile(descriptor_, "id.x", &error), nullptr);
+  EXPECT_EQ(error, "id.x: id is not a message field");
+  EXPECT_EQ(FieldProjection::Compile(descriptor_, "header[*]", &error),
+            nullptr);
+  EXPECT_EQ(error, "header[*]: header[*] used on a field that is not repeated");
+}
+
+TEST_F(FieldProjectionTest, RejectsMalformedInput) {
+  std::string error;
+  auto projection =
+      FieldProjection::Compile(descriptor_, "header.time", &error);
+  ASSERT_NE(projection, nullptr) << error;
+  std::string output;
+  EXPECT_FALSE(projection->Project(absl::string_view("\x1a\x05\x10", 3),
+                                   &output));
+  EXPECT_FALSE(projection->Project(absl::string_view("\x08\x80", 2), &output));
+  EXPECT_FALSE(projection->Project(absl::string_view("\x00", 1), &output));
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,235 @@
+#include "protodb/io/message_view.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/log/absl_check.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+namespace {
+
+// Keeps a reference to a Cord and flattens it.  Copying a Cord only takes a
+// reference to its data and Flatten() is a no-op for a flat Cord.
+std::shared_ptr<const void> FlattenCord(const absl::Cord& data,
+                                        absl::string_view* flat) {
+  auto cord = std::make_shared<absl::Cord>(data);
+  *flat = cord->Flatten();
+  return cord;
+}
+
+}  // namespace
+
+// Records the values of every field as ParsePlan::Parse() finds them.
+class MessageView::IndexBuilder {
+ public:
+  IndexBuilder(absl::string_view data, Index* index)
+      : data_(data), index_(index) {}
+
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    Add(field, bits);
+  }
+
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    const uint64_t offset = value.data() - data_.data();
+    Add(field, offset << 32 | value.size());
+  }
+
+ private:
+  void Add(const ParsePlan::Field& field, uint64_t value) {
+    Values& values = index_->fields[field.index];
+    if (!field.repeated) {
+      // The last value of a singular field wins.
+      values.clear();
+    }
+    values.push_back(value);
+  }
+
+  const absl::string_view data_;
+  Index* const index_;
+};
+
+MessageView::MessageView(const ParsePlan* plan, absl::string_view data)
+    : plan_(plan), data_(data) {}
+
+MessageView::MessageView(const ParsePlan* plan, const absl::Cord& data)
+    : plan_(plan) {
+  owner_ = FlattenCord(data, &data_);
+}
+
+MessageView::MessageView(const Descriptor* descriptor, absl::string_view data)
+    : data_(data), plans_(std::make_shared<ParsePlanCache>()) {
+  plan_ = plans_->Get(descriptor);
+}
+
+MessageView::MessageView(const Descriptor* descriptor, const absl::Cord& data)
+    : plans_(std::make_shared<ParsePlanCache>()) {
+  plan_ = plans_->Get(descriptor);
+  owner_ = FlattenCord(data, &data_);
+}
+
+MessageView::MessageView(const ParsePlan* plan, absl::string_view data,
+                         std::shared_ptr<const void> owner,
+                         std::shared_ptr<ParsePlanCache> plans)
+    : plan_(plan),
+      data_(data),
+      owner_(std::move(owner)),
+      plans_(std::move(plans)) {}
+
+const MessageView::Index& MessageView::index() const {
+  if (!index_) {
+    index_ = std::make_shared<Index>();
+    index_->fields.resize(plan_->field_count());
+    if (!CanIndex(data_.size())) {
+      index_->ok = false;
+      return *index_;
+    }
+    IndexBuilder builder(data_, index_.get());
+    index_->ok = plan_->Parse(data_, builder);
+  }
+  return *index_;
+}
+
+bool MessageView::ok() const {
+  return index().ok;
+}
+
+const uint64_t* MessageView::Find(const FieldDescriptor* field,
+                                  int i) const {
+  ABSL_DCHECK_EQ(field->containing_type(), descriptor());
+  const Values& values = index().fields[field->index()];
+  if (values.empty())
+    return nullptr;
+  if (i < 0)
+    return &values.back();
+  ABSL_CHECK_LT(i, values.size());
+  return &values[i];
+}
+
+absl::string_view MessageView::Slice(uint64_t value) const {
+  return data_.substr(value >> 32, value & 0xffffffff);
+}
+
+MessageView MessageView::SubView(const FieldDescriptor* field,
+                                 const uint64_t* value) const {
+  const ParsePlan* plan = plan_->field(field->index()).message;
+  ABSL_CHECK(plan) << field->full_name() << " is not a message field";
+  return MessageView(plan, value ? Slice(*value) : absl::string_view(),
+                     owner_, plans_);
+}
+
+bool MessageView::Has(const FieldDescriptor* field) const {
+  return FieldSize(field) > 0;
+}
+
+int MessageView::FieldSize(const FieldDescriptor* field) const {
+  return index().fields[field->index()].size();
+}
+
+int32_t MessageView::GetInt32(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? ParsePlan::AsInt64(*value) : field->default_value_int32();
+}
+
+int64_t MessageView::GetInt64(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? ParsePlan::AsInt64(*value) : field->default_value_int64();
+}
+
+uint32_t MessageView::GetUInt32(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? *value : field->default_value_uint32();
+}
+
+uint64_t MessageView::GetUInt64(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? *value : field->default_value_uint64();
+}
+
+float MessageView::GetFloat(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? ParsePlan::AsFloat(*value) : field->default_value_float();
+}
+
+double MessageView::GetDouble(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? ParsePlan::AsDouble(*value) : field->default_value_double();
+}
+
+bool MessageView::GetBool(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? *value != 0 : field->default_value_bool();
+}
+
+int MessageView::GetEnumValue(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? ParsePlan::AsInt64(*value)
+               : field->default_value_enum()->number();
+}
+
+absl::string_view MessageView::GetString(const FieldDescriptor* field) const {
+  const uint64_t* value = Find(field, -1);
+  return value ? Slice(*value) : field->default_value_string();
+}
+
+MessageView MessageView::GetMessage(const FieldDescriptor* field) const {
+  return SubView(field, Find(field, -1));
+}
+
+int32_t MessageView::GetRepeatedInt32(const FieldDescriptor* field,
+                                      int index) const {
+  return ParsePlan::AsInt64(*Find(field, index));
+}
+
+int64_t MessageView::GetRepeatedInt64(const FieldDescriptor* field,
+                                      int index) const {
+  return ParsePlan::AsInt64(*Find(field, index));
+}
+
+uint32_t MessageView::GetRepeatedUInt32(const FieldDescriptor* field,
+                                        int index) const {
+  return *Find(field, index);
+}
+
+uint64_t MessageView::GetRepeatedUInt64(const FieldDescriptor* field,
+                                        int index) const {
+  return *Find(field, index);
+}
+
+float MessageView::GetRepeatedFloat(const FieldDescriptor* field,
+                                    int index) const {
+  return ParsePlan::AsFloat(*Find(field, index));
+}
+
+double MessageView::GetRepeatedDouble(const FieldDescriptor* field,
+                                      int index) const {
+  return ParsePlan::AsDouble(*Find(field, index));
+}
+
+bool MessageView::GetRepeatedBool(const FieldDescriptor* field,
+                                  int index) const {
+  return *Find(field, index) != 0;
+}
+
+int MessageView::GetRepeatedEnumValue(const FieldDescriptor* field,
+                                      int index) const {
+  return ParsePlan::AsInt64(*Find(field, index));
+}
+
+absl::string_view MessageView::GetRepeatedString(const FieldDescriptor* field,
+                                                 int index) const {
+  return Slice(*Find(field, index));
+}
+
+MessageView MessageView::GetRepeatedMessage(const FieldDescriptor* field,
+                                            int index) const {
+  return SubView(field, Find(field, index));
+}
+
+}  // namespace protodb
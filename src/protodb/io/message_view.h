@@ -0,0 +1,145 @@
+#ifndef PROTODB_IO_MESSAGE_VIEW_H__
+#define PROTODB_IO_MESSAGE_VIEW_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+
+// A read-only view of an encoded message that gives random access to its
+// fields without parsing it into a Message.
+//
+// The view doesn't copy the wire data.  The first time a field is accessed,
+// the message is scanned once with its ParsePlan, decoding scalar values and
+// recording where length-delimited values are located.  String and bytes
+// fields are returned as string_views into the original buffer and
+// submessages as further views over the same buffer.
+//
+// Packed and unpacked repeated fields are both indexed element by element.
+// For a singular field that appears more than once, the last value wins, as
+// it would when parsing.  Singular submessages that are split across several
+// occurrences are not merged; the last occurrence is used.
+//
+// A MessageView isn't thread-safe because the index is built lazily.  Views
+// are cheap to copy; copies made after the index is built share it.
+class MessageView {
+ public:
+  // The largest message a view can index.  Larger messages are not ok().
+  static constexpr size_t kMaxSize = UINT32_MAX;
+
+  // Whether a message of `size` bytes can be indexed, as values record
+  // their offsets and lengths in 32 bits.
+  static constexpr bool CanIndex(size_t size) {
+    return size <= kMaxSize;
+  }
+
+  // Views a contiguous buffer, which must outlive the view.  `plan` must
+  // outlive the view as well.
+  MessageView(const ParsePlan* plan, absl::string_view data);
+
+  // Views a Cord.  A flat Cord is used in place; a fragmented one is
+  // flattened once.  The view holds a reference to the Cord's data.
+  MessageView(const ParsePlan* plan, const absl::Cord& data);
+
+  // As above, but compiles the plans for `descriptor` for this view and the
+  // views derived from it.  Prefer passing a cached plan when viewing many
+  // messages of the same type.
+  MessageView(const Descriptor* descriptor, absl::string_view data);
+  MessageView(const Descriptor* descriptor, const absl::Cord& data);
+
+  const Descriptor* descriptor() const {
+    return plan_->descriptor();
+  }
+  const ParsePlan* plan() const {
+    return plan_;
+  }
+  absl::string_view data() const {
+    return data_;
+  }
+
+  // False if the wire data couldn't be scanned.  Builds the index.
+  bool ok() const;
+
+  // Presence of a singular field or whether a repeated field is non-empty.
+  bool Has(const FieldDescriptor* field) const;
+
+  // The number of values of a field.  At most one for singular fields.
+  int FieldSize(const FieldDescriptor* field) const;
+
+  // Accessors for singular fields.  A missing field returns its default.
+  int32_t GetInt32(const FieldDescriptor* field) const;
+  int64_t GetInt64(const FieldDescriptor* field) const;
+  uint32_t GetUInt32(const FieldDescriptor* field) const;
+  uint64_t GetUInt64(const FieldDescriptor* field) const;
+  float GetFloat(const FieldDescriptor* field) const;
+  double GetDouble(const FieldDescriptor* field) const;
+  bool GetBool(const FieldDescriptor* field) const;
+  int GetEnumValue(const FieldDescriptor* field) const;
+  absl::string_view GetString(const FieldDescriptor* field) const;
+  MessageView GetMessage(const FieldDescriptor* field) const;
+
+  // Accessors for repeated fields.  `index` must be less than FieldSize().
+  int32_t GetRepeatedInt32(const FieldDescriptor* field, int index) const;
+  int64_t GetRepeatedInt64(const FieldDescriptor* field, int index) const;
+  uint32_t GetRepeatedUInt32(const FieldDescriptor* field, int index) const;
+  uint64_t GetRepeatedUInt64(const FieldDescriptor* field, int index) const;
+  float GetRepeatedFloat(const FieldDescriptor* field, int index) const;
+  double GetRepeatedDouble(const FieldDescriptor* field, int index) const;
+  bool GetRepeatedBool(const FieldDescriptor* field, int index) const;
+  int GetRepeatedEnumValue(const FieldDescriptor* field, int index) const;
+  absl::string_view GetRepeatedString(const FieldDescriptor* field,
+                                      int index) const;
+  MessageView GetRepeatedMessage(const FieldDescriptor* field,
+                                 int index) const;
+
+ private:
+  // A single value: the bits of a scalar as passed by ParsePlan::Parse(), or
+  // the offset of a length-delimited value relative to `data_` in the high
+  // 32 bits and its length in the low 32 bits.
+  using Values = absl::InlinedVector<uint64_t, 1>;
+
+  struct Index {
+    bool ok = true;
+    // Values for each field, indexed by FieldDescriptor::index().
+    std::vector<Values> fields;
+  };
+  class IndexBuilder;
+
+  MessageView(const ParsePlan* plan, absl::string_view data,
+              std::shared_ptr<const void> owner,
+              std::shared_ptr<ParsePlanCache> plans);
+
+  const Index& index() const;
+
+  // Returns the value at `index`, or the last value if `index` is negative.
+  // Returns nullptr if the field has no values.
+  const uint64_t* Find(const FieldDescriptor* field, int index) const;
+  absl::string_view Slice(uint64_t value) const;
+  MessageView SubView(const FieldDescriptor* field, const uint64_t* value) const;
+
+  const ParsePlan* plan_;
+  absl::string_view data_;
+
+  // Keeps a flattened or referenced Cord alive for the lifetime of the view.
+  std::shared_ptr<const void> owner_;
+
+  // Owns `plan_` when the view was created from a Descriptor.
+  std::shared_ptr<ParsePlanCache> plans_;
+
+  mutable std::shared_ptr<Index> index_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_MESSAGE_VIEW_H__
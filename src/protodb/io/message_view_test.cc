@@ -0,0 +1,141 @@
+#include "protodb/io/message_view.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "gtest/gtest.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/test_util.h"
+
+namespace protodb {
+namespace {
+
+constexpr absl::string_view kTestMessage = R"pb(
+  id: -5000000000
+  count: -7
+  size: 18000000000000000000
+  ratio: 0.5
+  score: -2.25
+  ok: true
+  name: "event"
+  level: ERROR
+  parent { id: 1 parent { name: "root" } }
+  values: [ 300, -1, 0 ]
+  tags: [ "a", "", "c" ]
+  children { count: 1 }
+  children { count: 2 }
+)pb";
+
+class MessageViewTest : public testing::Test {
+ protected:
+  const FieldDescriptor* field(absl::string_view name) const {
+    return descriptor_->FindFieldByName(std::string(name));
+  }
+
+  void ExpectTestMessage(const MessageView& view) {
+    ASSERT_TRUE(view.ok());
+    EXPECT_EQ(view.GetInt64(field("id")), -5000000000);
+    EXPECT_EQ(view.GetInt32(field("count")), -7);
+    EXPECT_EQ(view.GetUInt64(field("size")), 18000000000000000000u);
+    EXPECT_EQ(view.GetFloat(field("ratio")), 0.5);
+    EXPECT_EQ(view.GetDouble(field("score")), -2.25);
+    EXPECT_TRUE(view.GetBool(field("ok")));
+    EXPECT_EQ(view.GetString(field("name")), "event");
+    EXPECT_EQ(view.GetEnumValue(field("level")), -2);
+
+    const MessageView parent = view.GetMessage(field("parent"));
+    EXPECT_EQ(parent.GetInt64(field("id")), 1);
+    EXPECT_EQ(parent.GetMessage(field("parent")).GetString(field("name")),
+              "root");
+    EXPECT_FALSE(parent.Has(field("count")));
+
+    ASSERT_EQ(view.FieldSize(field("values")), 3);
+    EXPECT_EQ(view.GetRepeatedInt32(field("values"), 0), 300);
+    EXPECT_EQ(view.GetRepeatedInt32(field("values"), 1), -1);
+    ASSERT_EQ(view.FieldSize(field("tags")), 3);
+    EXPECT_EQ(view.GetRepeatedString(field("tags"), 1), "");
+    EXPECT_EQ(view.GetRepeatedString(field("tags"), 2), "c");
+    ASSERT_EQ(view.FieldSize(field("children")), 2);
+    EXPECT_EQ(view.GetRepeatedMessage(field("children"), 1)
+                  .GetInt32(field("count")),
+              2);
+  }
+
+  const Descriptor* const descriptor_ = test::Event::descriptor();
+  const std::string wire_ = test::Wire<test::Event>(kTestMessage);
+  ParsePlanCache plans_;
+};
+
+TEST_F(MessageViewTest, ReadsFields) {
+  ExpectTestMessage(MessageView(plans_.Get(descriptor_), wire_));
+  ExpectTestMessage(MessageView(descriptor_, wire_));
+}
+
+TEST_F(MessageViewTest, ReadsCords) {
+  // A fragmented Cord is flattened, and the view keeps it alive.
+  absl::Cord cord;
+  for (char c : wire_) {
+    cord.Append(std::string(1, c));
+  }
+  std::unique_ptr<MessageView> view;
+  {
+    absl::Cord copy = cord;
+    view = std::make_unique<MessageView>(plans_.Get(descriptor_), copy);
+  }
+  cord.Clear();
+  ExpectTestMessage(*view);
+  ExpectTestMessage(MessageView(descriptor_, absl::Cord(wire_)));
+}
+
+TEST_F(MessageViewTest, ReturnsDefaultsForMissingFields) {
+  MessageView view(plans_.Get(descriptor_), "");
+  ASSERT_TRUE(view.ok());
+  EXPECT_FALSE(view.Has(field("id")));
+  EXPECT_EQ(view.GetInt64(field("id")), 0);
+  EXPECT_EQ(view.GetString(field("name")), "unnamed");
+  EXPECT_EQ(view.GetEnumValue(field("level")), 1);
+  EXPECT_EQ(view.FieldSize(field("tags")), 0);
+  const MessageView parent = view.GetMessage(field("parent"));
+  EXPECT_TRUE(parent.ok());
+  EXPECT_EQ(parent.GetString(field("name")), "unnamed");
+}
+
+TEST_F(MessageViewTest, LastValueWins) {
+  // count: 1, count: 2, parent { id: 1 }, parent { count: 3 }
+  const std::string wire("\x10\x01\x10\x02"
+                         "\x4a\x02\x08\x02"
+                         "\x4a\x02\x10\x03",
+                         12);
+  MessageView view(plans_.Get(descriptor_), wire);
+  ASSERT_TRUE(view.ok());
+  EXPECT_EQ(view.FieldSize(field("count")), 1);
+  EXPECT_EQ(view.GetInt32(field("count")), 2);
+  // Split submessages aren't merged; the last occurrence is used.
+  const MessageView parent = view.GetMessage(field("parent"));
+  EXPECT_FALSE(parent.Has(field("id")));
+  EXPECT_EQ(parent.GetInt32(field("count")), 3);
+}
+
+TEST_F(MessageViewTest, RejectsMalformedMessages) {
+  EXPECT_FALSE(MessageView(plans_.Get(descriptor_),
+                           absl::string_view("\x3a\x05" "ab", 4))
+                   .ok());
+  EXPECT_FALSE(
+      MessageView(plans_.Get(descriptor_), absl::string_view("\x08\x80", 2))
+          .ok());
+}
+
+TEST_F(MessageViewTest, RejectsMessagesTooLargeToIndex) {
+  // Offsets into the message are kept in 32 bits.  The bound is checked
+  // without a view, which would need a buffer of over 4 GiB.
+  static_assert(MessageView::CanIndex(0));
+  static_assert(MessageView::CanIndex(UINT32_MAX));
+  static_assert(!MessageView::CanIndex(size_t{UINT32_MAX} + 1));
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,166 @@
+#ifndef PROTODB_IO_ORDERED_PIPELINE_H__
+#define PROTODB_IO_ORDERED_PIPELINE_H__
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace protodb {
+
+// Runs a three stage pipeline over a stream of inputs:
+//
+//   read  -- called on a dedicated reader thread to frame the next input.
+//   work  -- called concurrently on `num_workers` threads, one input each.
+//   write -- called on the calling thread with outputs in input order.
+//
+// At most `max_in_flight` inputs are buffered between the reader and the
+// writer, which bounds both the work queue and the reordering buffer.
+//
+// `work` is passed the index of the worker thread it runs on so callers
+// can keep per-worker state (parsers, arenas, scratch buffers) without
+// locking.
+//
+// `read` returning false marks the end of input: the inputs already read
+// are still worked on and written.  `work` or `write` returning false stops
+// the pipeline and makes `Run` return false.  Callers that need to tell a
+// read error from the end of input should record it themselves.
+template <typename Input, typename Output>
+class OrderedPipeline {
+ public:
+  using ReadFn = std::function<bool(Input* input)>;
+  using WorkFn = std::function<bool(int worker, Input& input, Output* output)>;
+  using WriteFn = std::function<bool(Output& output)>;
+
+  explicit OrderedPipeline(int num_workers, int max_in_flight = 0)
+      : num_workers_(num_workers < 1 ? 1 : num_workers),
+        max_in_flight_(max_in_flight > 0 ? max_in_flight : 4 * num_workers_) {}
+  OrderedPipeline(const OrderedPipeline&) = delete;
+  OrderedPipeline& operator=(const OrderedPipeline&) = delete;
+
+  int num_workers() const {
+    return num_workers_;
+  }
+
+  bool Run(ReadFn read, WorkFn work, WriteFn write) {
+    std::thread reader([&] { ReadLoop(read); });
+    std::vector<std::thread> workers;
+    workers.reserve(num_workers_);
+    for (int i = 0; i < num_workers_; ++i) {
+      workers.emplace_back([&, i] { WorkLoop(i, work); });
+    }
+    WriteLoop(write);
+
+    reader.join();
+    for (auto& worker : workers) worker.join();
+
+    absl::MutexLock lock(&mu_);
+    return !failed_;
+  }
+
+ private:
+  void ReadLoop(const ReadFn& read) {
+    while (true) {
+      {
+        absl::MutexLock lock(&mu_);
+        mu_.Await(absl::Condition(this, &OrderedPipeline::CanRead));
+        if (failed_)
+          return;
+      }
+
+      Input input;
+      const bool more = read(&input);
+
+      absl::MutexLock lock(&mu_);
+      if (!more) {
+        read_done_ = true;
+        return;
+      }
+      pending_.emplace_back(next_read_seq_++, std::move(input));
+    }
+  }
+
+  void WorkLoop(int worker, const WorkFn& work) {
+    while (true) {
+      uint64_t seq;
+      std::optional<Input> input;
+      {
+        absl::MutexLock lock(&mu_);
+        mu_.Await(absl::Condition(this, &OrderedPipeline::CanWork));
+        if (failed_ || pending_.empty())
+          return;
+        seq = pending_.front().first;
+        input.emplace(std::move(pending_.front().second));
+        pending_.pop_front();
+      }
+
+      Output output;
+      const bool ok = work(worker, *input, &output);
+
+      absl::MutexLock lock(&mu_);
+      if (!ok) {
+        failed_ = true;
+        return;
+      }
+      done_.emplace(seq, std::move(output));
+    }
+  }
+
+  void WriteLoop(const WriteFn& write) {
+    while (true) {
+      std::optional<Output> output;
+      {
+        absl::MutexLock lock(&mu_);
+        mu_.Await(absl::Condition(this, &OrderedPipeline::CanWrite));
+        if (failed_)
+          return;
+        auto iter = done_.find(next_write_seq_);
+        if (iter == done_.end())
+          return;  // All input has been read and written.
+        output.emplace(std::move(iter->second));
+        done_.erase(iter);
+      }
+
+      const bool ok = write(*output);
+
+      absl::MutexLock lock(&mu_);
+      if (!ok) {
+        failed_ = true;
+        return;
+      }
+      ++next_write_seq_;
+    }
+  }
+
+  bool CanRead() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return failed_ || next_read_seq_ - next_write_seq_ < max_in_flight_;
+  }
+  bool CanWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return failed_ || read_done_ || !pending_.empty();
+  }
+  bool CanWrite() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return failed_ || done_.contains(next_write_seq_) ||
+           (read_done_ && next_write_seq_ == next_read_seq_);
+  }
+
+  const int num_workers_;
+  const uint64_t max_in_flight_;
+
+  absl::Mutex mu_;
+  std::deque<std::pair<uint64_t, Input>> pending_ ABSL_GUARDED_BY(mu_);
+  std::map<uint64_t, Output> done_ ABSL_GUARDED_BY(mu_);
+  uint64_t next_read_seq_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t next_write_seq_ ABSL_GUARDED_BY(mu_) = 0;
+  bool read_done_ ABSL_GUARDED_BY(mu_) = false;
+  bool failed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_ORDERED_PIPELINE_H__
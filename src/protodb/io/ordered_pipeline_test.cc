@@ -0,0 +1,100 @@
+#include "protodb/io/ordered_pipeline.h"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace protodb {
+namespace {
+
+TEST(OrderedPipelineTest, WritesOutputsInInputOrder) {
+  constexpr int kInputs = 2000;
+  constexpr int kWorkers = 8;
+  OrderedPipeline<int, std::string> pipeline(kWorkers);
+  int next = 0;
+  std::vector<std::atomic<int>> per_worker(kWorkers);
+  std::vector<std::string> written;
+  ASSERT_TRUE(pipeline.Run(
+      [&](int* input) {
+        if (next == kInputs)
+          return false;
+        *input = next++;
+        return true;
+      },
+      [&](int worker, int& input, std::string* output) {
+        // Uneven delays finish the inputs out of order.
+        thread_local std::minstd_rand random(std::random_device{}());
+        if (random() % 4 == 0) {
+          std::this_thread::sleep_for(
+              std::chrono::microseconds(random() % 200));
+        }
+        EXPECT_GE(worker, 0);
+        EXPECT_LT(worker, kWorkers);
+        ++per_worker[worker];
+        *output = std::to_string(input);
+        return true;
+      },
+      [&](std::string& output) {
+        written.push_back(output);
+        return true;
+      }));
+
+  ASSERT_EQ(written.size(), kInputs);
+  for (int i = 0; i < kInputs; ++i) {
+    EXPECT_EQ(written[i], std::to_string(i));
+  }
+  int total = 0;
+  for (const auto& count : per_worker) total += count;
+  EXPECT_EQ(total, kInputs);
+}
+
+TEST(OrderedPipelineTest, RunsWithNoInput) {
+  OrderedPipeline<int, int> pipeline(4);
+  int writes = 0;
+  EXPECT_TRUE(pipeline.Run([](int*) { return false; },
+                           [](int, int&, int*) { return true; },
+                           [&](int&) { return ++writes, true; }));
+  EXPECT_EQ(writes, 0);
+}
+
+TEST(OrderedPipelineTest, StopsWhenAStageFails) {
+  for (const int failing : {0, 1}) {
+    OrderedPipeline<int, int> pipeline(4, 8);
+    int next = 0;
+    std::vector<int> written;
+    EXPECT_FALSE(pipeline.Run(
+        [&](int* input) {
+          // Without the failure, this would never end.
+          *input = next++;
+          return true;
+        },
+        [&](int, int& input, int* output) {
+          *output = input;
+          return failing != 0 || input != 100;
+        },
+        [&](int& output) {
+          written.push_back(output);
+          return failing != 1 || output != 100;
+        }));
+    // Outputs are written in order up to the failing input, and the reader
+    // stops within `max_in_flight` of the writer.
+    for (size_t i = 0; i < written.size(); ++i) {
+      EXPECT_EQ(written[i], i);
+    }
+    if (failing == 0) {
+      EXPECT_LE(written.size(), 100);
+    } else {
+      EXPECT_EQ(written.size(), 101);
+    }
+    EXPECT_LE(next, 101 + 8);
+  }
+}
+
+}  // namespace
+}  // namespace protodb
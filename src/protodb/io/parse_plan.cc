@@ -0,0 +1,182 @@
+#include "protodb/io/parse_plan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace protodb {
+
+namespace {
+
+// Field numbers below this value are looked up in a dense table, anything
+// larger falls back to a hash map.
+constexpr int kMaxDenseFieldNumber = 1024;
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+}  // namespace
+
+ParsePlan::ParsePlan(const Descriptor* descriptor) : descriptor_(descriptor) {
+  fields_.reserve(descriptor->field_count());
+  int max_dense_number = 0;
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    const auto type = static_cast<WireFormatLite::FieldType>(field->type());
+    fields_.push_back(Field{
+        .descriptor = field,
+        .type = field->type(),
+        .wire_type = WireFormatLite::WireTypeForFieldType(type),
+        .repeated = field->is_repeated(),
+        .packable = field->is_repeated() &&
+                    field->cpp_type() != FieldDescriptor::CPPTYPE_STRING &&
+                    field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE,
+        .packed = field->is_packed(),
+        .presence = field->has_presence(),
+        .map = field->is_map(),
+        .oneof = field->real_containing_oneof()
+                     ? field->real_containing_oneof()->index()
+                     : -1,
+        .index = field->index(),
+        .message = nullptr,
+    });
+    if (field->number() < kMaxDenseFieldNumber) {
+      max_dense_number = std::max(max_dense_number, field->number());
+    } else {
+      sparse_[field->number()] = i;
+    }
+  }
+
+  dense_.assign(max_dense_number + 1, -1);
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const int number = descriptor->field(i)->number();
+    if (number < kMaxDenseFieldNumber) {
+      dense_[number] = i;
+    }
+  }
+}
+
+uint64_t ParsePlan::DefaultBits(const FieldDescriptor* field) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return static_cast<uint64_t>(
+          static_cast<int64_t>(field->default_value_int32()));
+    case FieldDescriptor::CPPTYPE_INT64:
+      return static_cast<uint64_t>(field->default_value_int64());
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return field->default_value_uint32();
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return field->default_value_uint64();
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      const float value = field->default_value_float();
+      uint32_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      return bits;
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      const double value = field->default_value_double();
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      return bits;
+    }
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return field->default_value_bool();
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return static_cast<uint64_t>(
+          static_cast<int64_t>(field->default_value_enum()->number()));
+    default:
+      return 0;
+  }
+}
+
+const char* ParsePlan::SkipValue(const char* p, const char* end,
+                                 uint32_t tag) {
+  uint64_t value;
+  switch (WireFormatLite::GetTagWireType(tag)) {
+    case WireFormatLite::WIRETYPE_VARINT:
+    case WireFormatLite::WIRETYPE_FIXED32:
+    case WireFormatLite::WIRETYPE_FIXED64:
+      return ReadScalar(p, end, WireFormatLite::GetTagWireType(tag), &value);
+    case WireFormatLite::WIRETYPE_LENGTH_DELIMITED:
+      p = ReadVarint(p, end, &value);
+      if (p == nullptr || value > static_cast<uint64_t>(end - p))
+        return nullptr;
+      return p + value;
+    case WireFormatLite::WIRETYPE_START_GROUP: {
+      absl::string_view contents;
+      return SkipGroup(p, end, WireFormatLite::GetTagFieldNumber(tag),
+                       &contents);
+    }
+    default:
+      return nullptr;
+  }
+}
+
+const char* ParsePlan::SkipGroup(const char* p, const char* end,
+                                 uint32_t number, absl::string_view* contents,
+                                 int depth) {
+  if (depth > kMaxDepth)
+    return nullptr;
+
+  const char* const start = p;
+  while (p < end) {
+    const char* const tag_start = p;
+    uint64_t tag;
+    p = ReadVarint(p, end, &tag);
+    if (p == nullptr || tag > UINT32_MAX)
+      return nullptr;
+
+    switch (WireFormatLite::GetTagWireType(tag)) {
+      case WireFormatLite::WIRETYPE_END_GROUP:
+        if (WireFormatLite::GetTagFieldNumber(tag) != number)
+          return nullptr;
+        *contents = absl::string_view(start, tag_start - start);
+        return p;
+      case WireFormatLite::WIRETYPE_START_GROUP: {
+        absl::string_view nested;
+        p = SkipGroup(p, end, WireFormatLite::GetTagFieldNumber(tag), &nested,
+                      depth + 1);
+        break;
+      }
+      default:
+        p = SkipValue(p, end, tag);
+        break;
+    }
+    if (p == nullptr)
+      return nullptr;
+  }
+
+  // The group was never closed.
+  return nullptr;
+}
+
+const ParsePlan* ParsePlanCache::Get(const Descriptor* descriptor) {
+  absl::MutexLock lock(&mu_);
+  return GetLocked(descriptor);
+}
+
+ParsePlan* ParsePlanCache::GetLocked(const Descriptor* descriptor) {
+  auto& plan = plans_[descriptor];
+  if (plan) {
+    return plan.get();
+  }
+
+  // Insert the plan before linking its submessages so that recursive types
+  // find it instead of compiling it again.
+  plan.reset(new ParsePlan(descriptor));
+  ParsePlan* const result = plan.get();
+  for (ParsePlan::Field& field : result->fields_) {
+    if (field.descriptor->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      field.message = GetLocked(field.descriptor->message_type());
+    }
+  }
+  return result;
+}
+
+}  // namespace protodb
@@ -0,0 +1,323 @@
+#ifndef PROTODB_IO_PARSE_PLAN_H__
+#define PROTODB_IO_PARSE_PLAN_H__
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::internal::WireFormatLite;
+
+class ParsePlanCache;
+
+// A message type compiled into a table for walking its wire data.
+//
+// Every field of the message gets a precomputed entry holding its type, the
+// wire type its values are encoded with, whether it may be packed, its slot
+// in the message (FieldDescriptor::index()) and, for message and group
+// fields, the plan of the submessage.  Field numbers map to entries through
+// a dense table, falling back to a hash map for very large field numbers.
+//
+// Parse() walks wire data with that table instead of going through
+// reflection.  It decodes scalar values, expands packed fields and hands the
+// results to a handler, which is a template parameter so that the calls can
+// be inlined.  Submessages are not parsed recursively; the handler gets
+// their contents and may parse them with `field.message`.
+//
+// Plans are created and owned by a ParsePlanCache and are immutable once
+// created, so they can be shared between threads.
+class ParsePlan {
+ public:
+  struct Field {
+    const FieldDescriptor* descriptor;
+    FieldDescriptor::Type type;
+    // The wire type of a single, unpacked value.
+    WireFormatLite::WireType wire_type;
+    bool repeated;
+    // Repeated scalar fields accept both packed and unpacked values.
+    bool packable;
+    // Whether a serializer writes the field packed.
+    bool packed;
+    // Whether a singular field tracks presence; see
+    // FieldDescriptor::has_presence().
+    bool presence;
+    bool map;
+    // The index of the oneof containing the field, or -1.  Synthetic oneofs
+    // of proto3 optional fields are not included.
+    int oneof;
+    // The field's slot in the message: FieldDescriptor::index().
+    int index;
+    // The plan of the submessage for message and group fields.
+    const ParsePlan* message;
+  };
+
+  // Receives the values found by Parse().  Scalars are passed as 64 bits:
+  // signed values are sign extended, zigzag encoded values are decoded and
+  // floating point values are passed as their bit pattern.  See the AsX()
+  // helpers below.
+  //
+  // struct Handler {
+  //   void Scalar(const ParsePlan::Field& field, uint64_t bits);
+  //   // Strings, bytes and the contents of messages and groups.
+  //   void LengthDelimited(const ParsePlan::Field& field,
+  //                        absl::string_view value);
+  // };
+
+  ParsePlan(const ParsePlan&) = delete;
+  ParsePlan& operator=(const ParsePlan&) = delete;
+
+  const Descriptor* descriptor() const {
+    return descriptor_;
+  }
+
+  int field_count() const {
+    return fields_.size();
+  }
+  const Field& field(int index) const {
+    return fields_[index];
+  }
+
+  // Returns the field with the given number or nullptr if the message has
+  // no such field.
+  const Field* Find(uint32_t number) const {
+    if (number < dense_.size()) {
+      const int32_t index = dense_[number];
+      return index < 0 ? nullptr : &fields_[index];
+    }
+    if (sparse_.empty())
+      return nullptr;
+    auto iter = sparse_.find(number);
+    return iter == sparse_.end() ? nullptr : &fields_[iter->second];
+  }
+
+  // Walks `wire`, passing the value of every known field to `handler` in
+  // wire order.  Unknown fields and values whose wire type doesn't match
+  // the field are skipped, as the parser would keep them as unknown fields.
+  // Returns false if the wire data is malformed.
+  template <typename Handler>
+  bool Parse(absl::string_view wire, Handler& handler) const;
+
+  static int64_t AsInt64(uint64_t bits) {
+    return static_cast<int64_t>(bits);
+  }
+  static float AsFloat(uint64_t bits) {
+    const uint32_t bits32 = static_cast<uint32_t>(bits);
+    float value;
+    memcpy(&value, &bits32, sizeof(value));
+    return value;
+  }
+  static double AsDouble(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // The default of a scalar field, as Parse() would pass it.
+  static uint64_t DefaultBits(const FieldDescriptor* field);
+
+  // Reads a varint from [p, end).  Returns nullptr if it is truncated or
+  // longer than ten bytes.
+  static const char* ReadVarint(const char* p, const char* end,
+                                uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t>(*p++);
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        *value = result;
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  // Normalizes a decoded varint or fixed value for the field's type.
+  static uint64_t Normalize(const Field& field, uint64_t raw) {
+    switch (field.type) {
+      case FieldDescriptor::TYPE_INT32:
+      case FieldDescriptor::TYPE_ENUM:
+        return static_cast<uint64_t>(
+            static_cast<int64_t>(static_cast<int32_t>(raw)));
+      case FieldDescriptor::TYPE_SFIXED32:
+        return static_cast<uint64_t>(
+            static_cast<int64_t>(static_cast<int32_t>(raw)));
+      case FieldDescriptor::TYPE_UINT32:
+        return static_cast<uint32_t>(raw);
+      case FieldDescriptor::TYPE_SINT32:
+        return static_cast<uint64_t>(static_cast<int64_t>(
+            WireFormatLite::ZigZagDecode32(static_cast<uint32_t>(raw))));
+      case FieldDescriptor::TYPE_SINT64:
+        return static_cast<uint64_t>(WireFormatLite::ZigZagDecode64(raw));
+      case FieldDescriptor::TYPE_BOOL:
+        return raw != 0;
+      default:
+        return raw;
+    }
+  }
+
+  // Reads one scalar value encoded with `wire_type` at `p`.  Returns
+  // nullptr if it is truncated.
+  static const char* ReadScalar(const char* p, const char* end,
+                                WireFormatLite::WireType wire_type,
+                                uint64_t* raw) {
+    switch (wire_type) {
+      case WireFormatLite::WIRETYPE_VARINT:
+        return ReadVarint(p, end, raw);
+      case WireFormatLite::WIRETYPE_FIXED32: {
+        if (end - p < 4)
+          return nullptr;
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        *raw = absl::little_endian::ToHost32(value);
+        return p + 4;
+      }
+      case WireFormatLite::WIRETYPE_FIXED64: {
+        if (end - p < 8)
+          return nullptr;
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        *raw = absl::little_endian::ToHost64(value);
+        return p + 8;
+      }
+      default:
+        return nullptr;
+    }
+  }
+
+  // Skips the value that follows `tag`.  Returns nullptr if it is
+  // malformed.
+  static const char* SkipValue(const char* p, const char* end,
+                               uint32_t tag);
+
+  // Finds the end of the group that starts at `p`, after its start tag.  On
+  // success `contents` is set to the group's contents and the position
+  // after its end tag is returned.
+  static const char* SkipGroup(const char* p, const char* end,
+                               uint32_t number, absl::string_view* contents,
+                               int depth = 0);
+
+ private:
+  friend class ParsePlanCache;
+
+  explicit ParsePlan(const Descriptor* descriptor);
+
+  const Descriptor* const descriptor_;
+  std::vector<Field> fields_;
+  // Field number to index into `fields_`, or -1.
+  std::vector<int32_t> dense_;
+  absl::flat_hash_map<uint32_t, int> sparse_;
+};
+
+// Compiles and owns the parse plans of message types.
+class ParsePlanCache {
+ public:
+  ParsePlanCache() = default;
+  ParsePlanCache(const ParsePlanCache&) = delete;
+  ParsePlanCache& operator=(const ParsePlanCache&) = delete;
+
+  // Returns the plan for `descriptor`, compiling it along with the plans of
+  // every message type reachable from it on first use.  Plans live as long
+  // as the cache, which mustn't outlive the descriptors.  Thread-safe.
+  const ParsePlan* Get(const Descriptor* descriptor);
+
+ private:
+  ParsePlan* GetLocked(const Descriptor* descriptor)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  absl::Mutex mu_;
+  absl::flat_hash_map<const Descriptor*, std::unique_ptr<ParsePlan>> plans_
+      ABSL_GUARDED_BY(mu_);
+};
+
+template <typename Handler>
+bool ParsePlan::Parse(absl::string_view wire, Handler& handler) const {
+  const char* p = wire.data();
+  const char* const end = p + wire.size();
+  while (p < end) {
+    uint64_t tag;
+    p = ReadVarint(p, end, &tag);
+    if (p == nullptr || tag > UINT32_MAX)
+      return false;
+    const uint32_t number = WireFormatLite::GetTagFieldNumber(tag);
+    if (number == 0)
+      return false;
+    const auto wire_type = WireFormatLite::GetTagWireType(tag);
+
+    const Field* field = Find(number);
+    if (field == nullptr) {
+      p = SkipValue(p, end, tag);
+      if (p == nullptr)
+        return false;
+      continue;
+    }
+
+    if (wire_type == field->wire_type) {
+      switch (wire_type) {
+        case WireFormatLite::WIRETYPE_LENGTH_DELIMITED: {
+          uint64_t length;
+          p = ReadVarint(p, end, &length);
+          if (p == nullptr || length > static_cast<uint64_t>(end - p))
+            return false;
+          handler.LengthDelimited(*field, absl::string_view(p, length));
+          p += length;
+          break;
+        }
+        case WireFormatLite::WIRETYPE_START_GROUP: {
+          absl::string_view contents;
+          p = SkipGroup(p, end, number, &contents);
+          if (p == nullptr)
+            return false;
+          handler.LengthDelimited(*field, contents);
+          break;
+        }
+        default: {
+          uint64_t raw;
+          p = ReadScalar(p, end, wire_type, &raw);
+          if (p == nullptr)
+            return false;
+          handler.Scalar(*field, Normalize(*field, raw));
+          break;
+        }
+      }
+      continue;
+    }
+
+    if (field->packable &&
+        wire_type == WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint64_t length;
+      p = ReadVarint(p, end, &length);
+      if (p == nullptr || length > static_cast<uint64_t>(end - p))
+        return false;
+      const char* const packed_end = p + length;
+      while (p < packed_end) {
+        uint64_t raw;
+        p = ReadScalar(p, packed_end, field->wire_type, &raw);
+        if (p == nullptr)
+          return false;
+        handler.Scalar(*field, Normalize(*field, raw));
+      }
+      continue;
+    }
+
+    // A mismatched wire type is kept as an unknown field by the parser.
+    p = SkipValue(p, end, tag);
+    if (p == nullptr)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_PARSE_PLAN_H__
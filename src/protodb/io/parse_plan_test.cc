@@ -0,0 +1,218 @@
+#include "protodb/io/parse_plan.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/text_format.h"
+#include "google/protobuf/util/message_differencer.h"
+#include "gtest/gtest.h"
+#include "protodb/io/message_view.h"
+#include "protodb/io/test_messages.pb.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+using ::google::protobuf::TextFormat;
+using ::google::protobuf::util::MessageDifferencer;
+
+constexpr absl::string_view kTestMessage = R"pb(
+  i32: -7
+  i64: -8000000000
+  u32: 4000000000
+  u64: 18000000000000000000
+  s32: -32
+  s64: -64000000000
+  f32: 4000000001
+  f64: 18000000000000000001
+  sf32: -33
+  sf64: -65
+  flt: 1.5
+  dbl: -2.25
+  b: true
+  str: "hello"
+  byt: "\x00\xff"
+  e: NEGATIVE
+  child { i32: 1 child { str: "nested" } packed_i32: [ 1, -2, 3 ] }
+  packed_i32: [ 300, -1, 0 ]
+  packed_dbl: [ 0.5, 1e100 ]
+  rep_s64: [ -1, 1, -9000000000 ]
+  rep_str: [ "a", "", "c" ]
+  children { u32: 5 }
+  children { Group { a: 9 } }
+  Group { a: 42 }
+  big: 123
+)pb";
+
+// Rebuilds a message through reflection from the values ParsePlan::Parse()
+// hands out, so the result can be compared to the protobuf parser's.
+class ReflectionHandler {
+ public:
+  explicit ReflectionHandler(Message* message)
+      : message_(message), reflection_(message->GetReflection()) {}
+
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    const auto* fd = field.descriptor;
+    switch (fd->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_INT32:
+        if (fd->is_repeated())
+          reflection_->AddInt32(message_, fd, ParsePlan::AsInt64(bits));
+        else
+          reflection_->SetInt32(message_, fd, ParsePlan::AsInt64(bits));
+        break;
+      case FieldDescriptor::CPPTYPE_INT64:
+        if (fd->is_repeated())
+          reflection_->AddInt64(message_, fd, ParsePlan::AsInt64(bits));
+        else
+          reflection_->SetInt64(message_, fd, ParsePlan::AsInt64(bits));
+        break;
+      case FieldDescriptor::CPPTYPE_UINT32:
+        reflection_->SetUInt32(message_, fd, bits);
+        break;
+      case FieldDescriptor::CPPTYPE_UINT64:
+        reflection_->SetUInt64(message_, fd, bits);
+        break;
+      case FieldDescriptor::CPPTYPE_FLOAT:
+        reflection_->SetFloat(message_, fd, ParsePlan::AsFloat(bits));
+        break;
+      case FieldDescriptor::CPPTYPE_DOUBLE:
+        if (fd->is_repeated())
+          reflection_->AddDouble(message_, fd, ParsePlan::AsDouble(bits));
+        else
+          reflection_->SetDouble(message_, fd, ParsePlan::AsDouble(bits));
+        break;
+      case FieldDescriptor::CPPTYPE_BOOL:
+        reflection_->SetBool(message_, fd, bits != 0);
+        break;
+      case FieldDescriptor::CPPTYPE_ENUM:
+        reflection_->SetEnumValue(message_, fd, ParsePlan::AsInt64(bits));
+        break;
+      default:
+        ADD_FAILURE() << "unexpected scalar " << fd->full_name();
+    }
+  }
+
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    const auto* fd = field.descriptor;
+    if (fd->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+      if (fd->is_repeated())
+        reflection_->AddString(message_, fd, std::string(value));
+      else
+        reflection_->SetString(message_, fd, std::string(value));
+      return;
+    }
+    Message* child = fd->is_repeated()
+                         ? reflection_->AddMessage(message_, fd)
+                         : reflection_->MutableMessage(message_, fd);
+    ReflectionHandler handler(child);
+    EXPECT_TRUE(field.message->Parse(value, handler));
+  }
+
+ private:
+  Message* const message_;
+  const Reflection* const reflection_;
+};
+
+class ParsePlanTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(
+        TextFormat::ParseFromString(std::string(kTestMessage), &expected_));
+    wire_ = expected_.SerializeAsString();
+  }
+
+  const Descriptor* const descriptor_ = test::AllTypes::descriptor();
+  test::AllTypes expected_;
+  std::string wire_;
+  ParsePlanCache plans_;
+};
+
+TEST_F(ParsePlanTest, MatchesGeneratedMessage) {
+  const ParsePlan* plan = plans_.Get(descriptor_);
+  test::AllTypes actual;
+  ReflectionHandler handler(&actual);
+  ASSERT_TRUE(plan->Parse(wire_, handler));
+  EXPECT_TRUE(MessageDifferencer::Equals(expected_, actual))
+      << "expected:\n"
+      << expected_.DebugString() << "actual:\n"
+      << actual.DebugString();
+}
+
+TEST_F(ParsePlanTest, AcceptsUnpackedAndPackedEncodings) {
+  // Field 18 (packed_i32) sent unpacked, and field 20 (rep_s64) sent packed.
+  const std::string wire("\x90\x01\x05"           // packed_i32: 5
+                         "\xa2\x01\x02\x01\x02",  // rep_s64: [-1, 1]
+                         8);
+  test::AllTypes expected;
+  ASSERT_TRUE(expected.ParseFromString(wire));
+  test::AllTypes actual;
+  ReflectionHandler handler(&actual);
+  ASSERT_TRUE(plans_.Get(descriptor_)->Parse(wire, handler));
+  EXPECT_TRUE(MessageDifferencer::Equals(expected, actual));
+}
+
+TEST_F(ParsePlanTest, SkipsUnknownAndMismatchedFields) {
+  // Unknown field 99 as a varint and a group, then str (14) as a varint.
+  const std::string wire("\x98\x06\x01"   // 99: 1
+                         "\x9b\x06\x08\x01\x9c\x06"  // 99 { 1: 1 }
+                         "\x70\x01",  // 14: 1
+                         11);
+  test::AllTypes actual;
+  ReflectionHandler handler(&actual);
+  ASSERT_TRUE(plans_.Get(descriptor_)->Parse(wire, handler));
+  EXPECT_EQ(actual.ByteSizeLong(), 0);
+}
+
+TEST_F(ParsePlanTest, RejectsMalformedInput) {
+  test::AllTypes actual;
+  ReflectionHandler handler(&actual);
+  const ParsePlan* plan = plans_.Get(descriptor_);
+  EXPECT_FALSE(plan->Parse(absl::string_view("\x72\x05ab", 4), handler));
+  EXPECT_FALSE(plan->Parse(absl::string_view("\x08\x80", 2), handler));
+  EXPECT_FALSE(plan->Parse(absl::string_view("\xbb\x01", 2), handler));
+}
+
+TEST_F(ParsePlanTest, CachesRecursivePlans) {
+  const ParsePlan* plan = plans_.Get(descriptor_);
+  EXPECT_EQ(plans_.Get(descriptor_), plan);
+  const ParsePlan::Field* child = plan->Find(17);
+  ASSERT_NE(child, nullptr);
+  EXPECT_EQ(child->message, plan);
+  ASSERT_NE(plan->Find(100000), nullptr);
+  EXPECT_EQ(plan->Find(100000)->descriptor->name(), "big");
+  EXPECT_EQ(plan->Find(99), nullptr);
+}
+
+TEST_F(ParsePlanTest, MessageViewMatchesGeneratedMessage) {
+  MessageView view(plans_.Get(descriptor_), wire_);
+  ASSERT_TRUE(view.ok());
+  const Reflection* reflection = expected_.GetReflection();
+  auto field = [&](absl::string_view name) {
+    return descriptor_->FindFieldByName(std::string(name));
+  };
+  EXPECT_EQ(view.GetInt32(field("i32")),
+            reflection->GetInt32(expected_, field("i32")));
+  EXPECT_EQ(view.GetInt64(field("s64")),
+            reflection->GetInt64(expected_, field("s64")));
+  EXPECT_EQ(view.GetUInt64(field("f64")),
+            reflection->GetUInt64(expected_, field("f64")));
+  EXPECT_EQ(view.GetFloat(field("flt")),
+            reflection->GetFloat(expected_, field("flt")));
+  EXPECT_EQ(view.GetEnumValue(field("e")), -1);
+  EXPECT_EQ(view.GetString(field("byt")), std::string("\x00\xff", 2));
+  EXPECT_EQ(view.FieldSize(field("packed_i32")), 3);
+  EXPECT_EQ(view.GetRepeatedInt32(field("packed_i32"), 1), -1);
+  EXPECT_EQ(view.GetRepeatedString(field("rep_str"), 2), "c");
+  EXPECT_EQ(view.GetMessage(field("child"))
+                .GetMessage(field("child"))
+                .GetString(field("str")),
+            "nested");
+  EXPECT_FALSE(view.GetMessage(field("child")).Has(field("u32")));
+  EXPECT_EQ(view.GetInt32(field("big")), 123);
+}
+
+}  // namespace
+}  // namespace protodb
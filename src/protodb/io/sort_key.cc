@@ -0,0 +1,166 @@
+#include "protodb/io/sort_key.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/base/internal/endian.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+namespace {
+
+constexpr uint64_t kSignBit = uint64_t{1} << 63;
+
+void AppendBigEndian(uint64_t value, std::string* key) {
+  char bytes[8];
+  absl::big_endian::Store64(bytes, value);
+  key->append(bytes, sizeof(bytes));
+}
+
+// Maps a double to an integer with the same order: negative values have
+// every bit flipped and positive ones only the sign bit.
+uint64_t OrderedDouble(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return (bits & kSignBit) ? ~bits : bits | kSignBit;
+}
+
+}  // namespace
+
+struct SortKey::Value {
+  bool found = false;
+  uint64_t bits = 0;
+  absl::string_view data;
+};
+
+// Finds the path's field at one depth of a message, descending into
+// submessages as they are found.
+class SortKey::Handler {
+ public:
+  Handler(const SortKey& key, size_t depth, Value* value)
+      : key_(key), depth_(depth), field_(key.path_[depth]), value_(value) {}
+
+  bool ok() const {
+    return ok_;
+  }
+
+  void Scalar(const ParsePlan::Field& field, uint64_t bits) {
+    if (&field != field_)
+      return;
+    value_->found = true;
+    value_->bits = bits;
+  }
+
+  void LengthDelimited(const ParsePlan::Field& field,
+                       absl::string_view value) {
+    if (&field != field_ || !ok_)
+      return;
+    if (depth_ + 1 < key_.path_.size()) {
+      // Later occurrences of the submessage merge into earlier ones, so a
+      // value found in them wins.
+      ok_ = key_.Find(depth_ + 1, value, value_);
+      return;
+    }
+    value_->found = true;
+    value_->data = value;
+  }
+
+ private:
+  const SortKey& key_;
+  const size_t depth_;
+  const ParsePlan::Field* const field_;
+  Value* const value_;
+  bool ok_ = true;
+};
+
+std::unique_ptr<SortKey> SortKey::Compile(const ParsePlan* plan,
+                                          absl::string_view path,
+                                          std::string* error) {
+  std::unique_ptr<SortKey> key(new SortKey());
+  key->root_ = plan;
+  for (absl::string_view name : absl::StrSplit(path, '.')) {
+    if (plan == nullptr) {
+      *error = absl::StrCat(key->field()->full_name(), " has no fields");
+      return nullptr;
+    }
+    const FieldDescriptor* descriptor =
+        plan->descriptor()->FindFieldByName(std::string(name));
+    if (descriptor == nullptr) {
+      *error = absl::StrCat("no field ", name, " in ",
+                            plan->descriptor()->full_name());
+      return nullptr;
+    }
+    const ParsePlan::Field& field = plan->field(descriptor->index());
+    if (field.repeated) {
+      *error = absl::StrCat(descriptor->full_name(),
+                            " is repeated and can't be a key");
+      return nullptr;
+    }
+    key->path_.push_back(&field);
+    plan = field.message;
+  }
+  if (plan != nullptr) {
+    *error = absl::StrCat(key->field()->full_name(),
+                          " is a message and can't be a key");
+    return nullptr;
+  }
+  return key;
+}
+
+bool SortKey::Find(size_t depth, absl::string_view message,
+                   Value* value) const {
+  const ParsePlan* plan = depth == 0 ? root_ : path_[depth - 1]->message;
+  Handler handler(*this, depth, value);
+  return plan->Parse(message, handler) && handler.ok();
+}
+
+bool SortKey::Extract(absl::string_view message, std::string* key) const {
+  key->clear();
+  Value value;
+  if (!Find(0, message, &value))
+    return false;
+
+  const FieldDescriptor* descriptor = field();
+  if (descriptor->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+    if (value.found) {
+      key->assign(value.data.data(), value.data.size());
+    } else if (!descriptor->has_presence()) {
+      key->assign(descriptor->default_value_string());
+    }
+    return true;
+  }
+  if (!value.found) {
+    if (descriptor->has_presence())
+      return true;
+    value.bits = ParsePlan::DefaultBits(descriptor);
+  }
+  EncodeScalar(value.bits, key);
+  return true;
+}
+
+void SortKey::EncodeScalar(uint64_t bits, std::string* key) const {
+  switch (field()->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+      AppendBigEndian(bits, key);
+      break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      AppendBigEndian(OrderedDouble(ParsePlan::AsFloat(bits)), key);
+      break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      AppendBigEndian(OrderedDouble(ParsePlan::AsDouble(bits)), key);
+      break;
+    default:
+      AppendBigEndian(bits ^ kSignBit, key);
+      break;
+  }
+}
+
+}  // namespace protodb
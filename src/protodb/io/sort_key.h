@@ -0,0 +1,70 @@
+#ifndef PROTODB_IO_SORT_KEY_H__
+#define PROTODB_IO_SORT_KEY_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protodb {
+
+using ::google::protobuf::FieldDescriptor;
+
+// Extracts the value of a field from the wire data of messages as a sort
+// key: a byte string that compares with memcmp() the way the values
+// compare.
+//
+// The key field is named by a path of singular fields, such as
+// `header.timestamp`, ending at a scalar, string or bytes field.  Messages
+// are walked with ParsePlans, so finding the key costs a scan of the wire
+// data and no parsing.  As when parsing, the last value of the field wins
+// and submessages split across several occurrences are merged.
+//
+// Integers, enums and bools become eight big endian bytes, with the sign
+// bit flipped for signed types; floating point values are widened to
+// doubles and mapped to integers that sort the same way.  Strings and bytes
+// are used as they are.  A field without presence that is missing reads as
+// its default.  A missing field with presence gets an empty key, which
+// sorts before every value.
+//
+// A SortKey is immutable and can be shared between threads.
+class SortKey {
+ public:
+  // Compiles `path` for messages of `plan`'s type.  Returns nullptr and
+  // sets `error` if the path doesn't name a singular scalar, string or
+  // bytes field.
+  static std::unique_ptr<SortKey> Compile(const ParsePlan* plan,
+                                          absl::string_view path,
+                                          std::string* error);
+
+  // The field at the end of the path.
+  const FieldDescriptor* field() const {
+    return path_.back()->descriptor;
+  }
+
+  // Replaces `key` with the key of `message`.  Returns false if the wire
+  // data is malformed.
+  bool Extract(absl::string_view message, std::string* key) const;
+
+  // Encodes a value passed by ParsePlan::Parse() for the key field.
+  void EncodeScalar(uint64_t bits, std::string* key) const;
+
+ private:
+  struct Value;
+  class Handler;
+
+  SortKey() = default;
+
+  bool Find(size_t depth, absl::string_view message, Value* value) const;
+
+  const ParsePlan* root_ = nullptr;
+  // The fields along the path, starting in the root message.
+  std::vector<const ParsePlan::Field*> path_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_IO_SORT_KEY_H__
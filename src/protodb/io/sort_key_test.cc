@@ -0,0 +1,72 @@
+#include "protodb/io/sort_key.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/test_util.h"
+
+namespace protodb {
+namespace {
+
+class SortKeyTest : public testing::Test {
+ protected:
+  std::string Key(absl::string_view path, absl::string_view text) {
+    std::string error;
+    auto key = SortKey::Compile(plan_, path, &error);
+    EXPECT_NE(key, nullptr) << error;
+    std::string result;
+    EXPECT_TRUE(key->Extract(test::Wire<test::Sample>(text), &result));
+    return result;
+  }
+
+  ParsePlanCache plans_;
+  const ParsePlan* const plan_ = plans_.Get(test::Sample::descriptor());
+};
+
+TEST_F(SortKeyTest, OrdersLikeValues) {
+  EXPECT_LT(Key("id", "id: -5"), Key("id", "id: -1"));
+  EXPECT_LT(Key("id", "id: -1"), Key("id", ""));
+  EXPECT_LT(Key("id", ""), Key("id", "id: 300"));
+  EXPECT_EQ(Key("id", "").size(), 8);
+
+  EXPECT_LT(Key("score", "score: -2.5"), Key("score", "score: -0.5"));
+  EXPECT_LT(Key("score", "score: -0.5"), Key("score", "score: 0.25"));
+  EXPECT_LT(Key("score", "score: 0.25"), Key("score", "score: 1e10"));
+
+  EXPECT_EQ(Key("name", "name: \"b\""), "b");
+  EXPECT_EQ(Key("name", ""), "");
+}
+
+TEST_F(SortKeyTest, FollowsPathIntoSubmessages) {
+  EXPECT_LT(Key("header.at", "header { at: 2 }"),
+            Key("header.at", "header { at: 10 }"));
+  // A missing field without presence reads as its default.
+  EXPECT_EQ(Key("header.at", ""), Key("header.at", "header { at: 0 }"));
+  // A missing field with presence sorts first.
+  EXPECT_EQ(Key("header.shard", "header { at: 1 }"), "");
+  EXPECT_LT(Key("header.shard", ""),
+            Key("header.shard", "header { shard: -100 }"));
+
+  // Split submessages merge, so the last value wins.
+  std::string error;
+  auto key = SortKey::Compile(plan_, "header.at", &error);
+  ASSERT_NE(key, nullptr) << error;
+  std::string split_key;
+  ASSERT_TRUE(key->Extract("\x22\x02\x08\x07\x22\x02\x10\x01", &split_key));
+  EXPECT_EQ(split_key, Key("header.at", "header { at: 7 }"));
+  EXPECT_FALSE(key->Extract("\x22\x05\x08", &split_key));
+}
+
+TEST_F(SortKeyTest, RejectsPathsThatArentKeys) {
+  std::string error;
+  EXPECT_EQ(SortKey::Compile(plan_, "tags", &error), nullptr);
+  EXPECT_EQ(SortKey::Compile(plan_, "header", &error), nullptr);
+  EXPECT_EQ(SortKey::Compile(plan_, "header.missing", &error), nullptr);
+  EXPECT_EQ(SortKey::Compile(plan_, "id.more", &error), nullptr);
+  EXPECT_NE(error, "");
+}
+
+}  // namespace
+}  // namespace protodb
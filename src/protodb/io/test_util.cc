@@ -0,0 +1,29 @@
+#include "protodb/io/test_util.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace protodb {
+namespace test {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::Message;
+using ::google::protobuf::MessageFactory;
+using ::google::protobuf::TextFormat;
+
+std::string Wire(const Descriptor* type, absl::string_view text) {
+  std::unique_ptr<Message> message(
+      MessageFactory::generated_factory()->GetPrototype(type)->New());
+  EXPECT_TRUE(TextFormat::ParseFromString(std::string(text), message.get()))
+      << text;
+  return message->SerializeAsString();
+}
+
+}  // namespace test
+}  // namespace protodb
@@ -0,0 +1,28 @@
+#ifndef PROTODB_IO_TEST_UTIL_H__
+#define PROTODB_IO_TEST_UTIL_H__
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/test_messages.pb.h"
+#include "protodb/io/test_messages_proto3.pb.h"
+
+namespace protodb {
+namespace test {
+
+// Parses `text` as a text format message of `type`, a generated message
+// type, and returns its wire format.  Fails the current test if `text`
+// doesn't parse.
+std::string Wire(const google::protobuf::Descriptor* type,
+                 absl::string_view text);
+
+template <typename T>
+std::string Wire(absl::string_view text) {
+  return Wire(T::descriptor(), text);
+}
+
+}  // namespace test
+}  // namespace protodb
+
+#endif  // PROTODB_IO_TEST_UTIL_H__
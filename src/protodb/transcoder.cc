@@ -0,0 +1,395 @@
+#include "protodb/transcoder.h"
+
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "protodb/comparing_visitor.h"
+
+namespace protodb {
+
+using ::google::protobuf::internal::WireFormatLite;
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace {
+
+// Field numbers up to this value are looked up in a dense table, anything
+// larger falls back to a hash map.
+constexpr int kMaxDenseFieldNumber = 1024;
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+constexpr int kMaxVarint32Bytes = 5;
+
+// Groups field types whose values can be copied between each other without
+// being re-encoded.  Mirrors the changes the protobuf documentation lists as
+// wire compatible.
+enum class WireClass {
+  VARINT,
+  ZIGZAG,
+  FIXED32,
+  FIXED64,
+  FLOAT,
+  DOUBLE,
+  BYTES,
+  MESSAGE,
+  GROUP,
+};
+
+WireClass GetWireClass(const FieldDescriptor* field) {
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_INT32:
+    case FieldDescriptor::TYPE_INT64:
+    case FieldDescriptor::TYPE_UINT32:
+    case FieldDescriptor::TYPE_UINT64:
+    case FieldDescriptor::TYPE_BOOL:
+    case FieldDescriptor::TYPE_ENUM:
+      return WireClass::VARINT;
+    case FieldDescriptor::TYPE_SINT32:
+    case FieldDescriptor::TYPE_SINT64:
+      return WireClass::ZIGZAG;
+    case FieldDescriptor::TYPE_FIXED32:
+    case FieldDescriptor::TYPE_SFIXED32:
+      return WireClass::FIXED32;
+    case FieldDescriptor::TYPE_FIXED64:
+    case FieldDescriptor::TYPE_SFIXED64:
+      return WireClass::FIXED64;
+    case FieldDescriptor::TYPE_FLOAT:
+      return WireClass::FLOAT;
+    case FieldDescriptor::TYPE_DOUBLE:
+      return WireClass::DOUBLE;
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+      return WireClass::BYTES;
+    case FieldDescriptor::TYPE_MESSAGE:
+      return WireClass::MESSAGE;
+    case FieldDescriptor::TYPE_GROUP:
+      return WireClass::GROUP;
+  }
+  return WireClass::BYTES;
+}
+
+void AppendTag(uint32_t number, WireFormatLite::WireType wire_type,
+               std::string* output) {
+  uint8_t buffer[kMaxVarint32Bytes];
+  const uint8_t* end = CodedOutputStream::WriteVarint32ToArray(
+      WireFormatLite::MakeTag(number, wire_type), buffer);
+  output->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+}  // namespace
+
+struct Transcoder::Mapping {
+  struct Field {
+    enum Action : uint8_t {
+      // Not a field of the old version: keep the value under its number.
+      UNKNOWN = 0,
+      DROP,
+      // Copy the value under the new field number.
+      COPY,
+      // Rewrite the submessage or group with `message`.
+      REWRITE,
+    };
+    Action action = UNKNOWN;
+    uint32_t to_number = 0;
+    const Mapping* message = nullptr;
+  };
+
+  Field& Select(int number) {
+    if (number > kMaxDenseFieldNumber) {
+      return sparse_fields[number];
+    }
+    if (dense_fields.size() <= number) {
+      dense_fields.resize(number + 1);
+    }
+    return dense_fields[number];
+  }
+
+  const Field* Find(uint32_t number) const {
+    if (number < dense_fields.size()) {
+      return &dense_fields[number];
+    }
+    if (sparse_fields.empty()) {
+      return nullptr;
+    }
+    auto iter = sparse_fields.find(number);
+    return iter == sparse_fields.end() ? nullptr : &iter->second;
+  }
+
+  template <typename Fn>
+  void ForEachField(Fn fn) {
+    for (Field& field : dense_fields) fn(field);
+    for (auto& [number, field] : sparse_fields) fn(field);
+  }
+
+  // True while every field keeps its number and every submessage is itself
+  // an identity, in which case messages are copied untouched.
+  bool identity = true;
+  std::vector<Field> dense_fields;
+  absl::flat_hash_map<uint32_t, Field> sparse_fields;
+};
+
+// Maps each pair of fields matched by the ComparingDescriptorVisitor.
+struct Transcoder::FieldVisitor {
+  Transcoder* transcoder;
+  Mapping* mapping;
+
+  int WithIndent() {
+    return 0;
+  }
+  bool operator()(const FieldDescriptor* lhs, const FieldDescriptor* rhs) {
+    transcoder->MapField(mapping, lhs, rhs);
+    return true;
+  }
+  template <typename T>
+  bool operator()(const T*, const T*) {
+    return true;
+  }
+};
+
+Transcoder::~Transcoder() {}
+
+std::unique_ptr<Transcoder> Transcoder::Create(const Descriptor* from,
+                                               const Descriptor* to) {
+  std::unique_ptr<Transcoder> transcoder(new Transcoder());
+  transcoder->root_ = transcoder->GetMapping(from, to);
+  transcoder->ResolveIdentities();
+  return transcoder;
+}
+
+bool Transcoder::is_identity() const {
+  return root_->identity;
+}
+
+Transcoder::Mapping* Transcoder::GetMapping(const Descriptor* from,
+                                            const Descriptor* to) {
+  auto& mapping = mappings_[{from, to}];
+  if (mapping) {
+    return mapping.get();
+  }
+  // Insert the mapping before visiting its fields so that recursive types
+  // find it instead of mapping it again.
+  mapping = std::make_unique<Mapping>();
+  Mapping* const result = mapping.get();
+
+  const CompareOptions options{.fields = true};
+  ComparingDescriptorVisitor<FieldVisitor>{
+      .options = options,
+      .visit_fn = FieldVisitor{.transcoder = this, .mapping = result},
+  }
+      .Compare(from, to);
+  return result;
+}
+
+void Transcoder::MapField(Mapping* mapping, const FieldDescriptor* from,
+                          const FieldDescriptor* to) {
+  if (from == nullptr) {
+    // A field that only exists in the new version.
+    return;
+  }
+  Mapping::Field& field = mapping->Select(from->number());
+  if (to == nullptr) {
+    dropped_fields_.push_back(
+        absl::StrCat(from->full_name(), ": not in the new version"));
+    field.action = Mapping::Field::DROP;
+    mapping->identity = false;
+    return;
+  }
+
+  const WireClass from_class = GetWireClass(from);
+  const WireClass to_class = GetWireClass(to);
+  const bool message_as_bytes =
+      (from_class == WireClass::MESSAGE && to_class == WireClass::BYTES) ||
+      (from_class == WireClass::BYTES && to_class == WireClass::MESSAGE);
+  if (from_class != to_class && !message_as_bytes) {
+    dropped_fields_.push_back(absl::StrCat(
+        from->full_name(), ": ", from->type_name(), " can't be read as ",
+        to->full_name(), ": ", to->type_name()));
+    field.action = Mapping::Field::DROP;
+    mapping->identity = false;
+    return;
+  }
+
+  field.to_number = to->number();
+  if (from_class == to_class &&
+      (from_class == WireClass::MESSAGE || from_class == WireClass::GROUP)) {
+    field.action = Mapping::Field::REWRITE;
+    field.message = GetMapping(from->message_type(), to->message_type());
+  } else {
+    field.action = Mapping::Field::COPY;
+  }
+
+  if (from->number() != to->number()) {
+    mapping->identity = false;
+    if (from->containing_type()->FindFieldByNumber(to->number()) == nullptr) {
+      // Unknown fields under the number the field moves to would be read
+      // as the field, so they are dropped instead of kept.  This may grow
+      // the table and invalidate `field`.
+      mapping->Select(to->number()).action = Mapping::Field::DROP;
+      dropped_fields_.push_back(absl::StrCat(
+          "unknown fields numbered ", to->number(), " in ",
+          from->containing_type()->full_name(), ": the number is now ",
+          to->full_name()));
+    }
+  }
+}
+
+void Transcoder::ResolveIdentities() {
+  // A mapping is only an identity if all the mappings it rewrites with are.
+  // Propagate non-identities until nothing changes, which also settles
+  // recursive types.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& [types, mapping] : mappings_) {
+      if (!mapping->identity)
+        continue;
+      mapping->ForEachField([&](Mapping::Field& field) {
+        if (field.action == Mapping::Field::REWRITE &&
+            !field.message->identity && mapping->identity) {
+          mapping->identity = false;
+          changed = true;
+        }
+      });
+    }
+  }
+
+  // Submessages that are identities are copied instead of rewritten.
+  for (auto& [types, mapping] : mappings_) {
+    mapping->ForEachField([](Mapping::Field& field) {
+      if (field.action == Mapping::Field::REWRITE && field.message->identity) {
+        field.action = Mapping::Field::COPY;
+      }
+    });
+  }
+}
+
+bool Transcoder::Transcode(absl::string_view wire, std::string* output) const {
+  if (root_->identity) {
+    output->append(wire);
+    return true;
+  }
+  const auto* base = reinterpret_cast<const uint8_t*>(wire.data());
+  CodedInputStream cis(base, wire.size());
+  cis.PushLimit(wire.size());
+  return TranscodeMessage(*root_, cis, base, 0, 0, output);
+}
+
+bool Transcoder::TranscodeMessage(const Mapping& mapping,
+                                  CodedInputStream& cis, const uint8_t* base,
+                                  int depth, uint32_t end_group_number,
+                                  std::string* output) {
+  if (depth > kMaxDepth) {
+    return false;
+  }
+
+  while (true) {
+    if (cis.BytesUntilLimit() == 0) {
+      // A group must be closed by its end tag.
+      return end_group_number == 0;
+    }
+
+    const int field_start = cis.CurrentPosition();
+    const uint32_t tag = cis.ReadTag();
+    if (tag == 0) {
+      return false;
+    }
+    const uint32_t number = WireFormatLite::GetTagFieldNumber(tag);
+    const auto wire_type = WireFormatLite::GetTagWireType(tag);
+    if (wire_type == WireFormatLite::WIRETYPE_END_GROUP) {
+      return number == end_group_number;
+    }
+
+    const Mapping::Field* field = mapping.Find(number);
+    if (field == nullptr || field->action == Mapping::Field::UNKNOWN) {
+      // Unknown fields are kept as they are, as the parser would.
+      if (!WireFormatLite::SkipField(&cis, tag))
+        return false;
+      output->append(reinterpret_cast<const char*>(base) + field_start,
+                     cis.CurrentPosition() - field_start);
+      continue;
+    }
+    if (field->action == Mapping::Field::DROP) {
+      if (!WireFormatLite::SkipField(&cis, tag))
+        return false;
+      continue;
+    }
+
+    if (field->action == Mapping::Field::COPY ||
+        (wire_type != WireFormatLite::WIRETYPE_LENGTH_DELIMITED &&
+         wire_type != WireFormatLite::WIRETYPE_START_GROUP)) {
+      // Copy the value through under the new field number.  For a value
+      // with an unexpected wire type this leaves it to the parser to treat
+      // it as an unknown field, as it would have with the old version.
+      if (wire_type == WireFormatLite::WIRETYPE_START_GROUP &&
+          field->to_number != number) {
+        // The group's end tag has to be renumbered as well.
+        AppendTag(field->to_number, wire_type, output);
+        const int value_start = cis.CurrentPosition();
+        if (!WireFormatLite::SkipField(&cis, tag))
+          return false;
+        const int end_tag_size = CodedOutputStream::VarintSize32(
+            WireFormatLite::MakeTag(number, WireFormatLite::WIRETYPE_END_GROUP));
+        output->append(reinterpret_cast<const char*>(base) + value_start,
+                       cis.CurrentPosition() - value_start - end_tag_size);
+        AppendTag(field->to_number, WireFormatLite::WIRETYPE_END_GROUP,
+                  output);
+        continue;
+      }
+      AppendTag(field->to_number, wire_type, output);
+      const int value_start = cis.CurrentPosition();
+      if (!WireFormatLite::SkipField(&cis, tag))
+        return false;
+      output->append(reinterpret_cast<const char*>(base) + value_start,
+                     cis.CurrentPosition() - value_start);
+      continue;
+    }
+
+    AppendTag(field->to_number, wire_type, output);
+    if (wire_type == WireFormatLite::WIRETYPE_START_GROUP) {
+      if (!TranscodeMessage(*field->message, cis, base, depth + 1, number,
+                            output)) {
+        return false;
+      }
+      AppendTag(field->to_number, WireFormatLite::WIRETYPE_END_GROUP, output);
+      continue;
+    }
+
+    uint32_t length = 0;
+    if (!cis.ReadVarint32(&length) || length > cis.BytesUntilLimit()) {
+      return false;
+    }
+
+    // Reserve a single byte for the length of the rewritten submessage and
+    // widen it afterwards if needed.
+    const size_t length_offset = output->size();
+    output->push_back('\0');
+    const auto limit = cis.PushLimit(length);
+    if (!TranscodeMessage(*field->message, cis, base, depth + 1, 0, output)) {
+      return false;
+    }
+    cis.PopLimit(limit);
+
+    const size_t message_length = output->size() - length_offset - 1;
+    uint8_t varint[kMaxVarint32Bytes];
+    const int varint_size =
+        CodedOutputStream::WriteVarint32ToArray(message_length, varint) -
+        varint;
+    if (varint_size > 1) {
+      output->insert(length_offset + 1, varint_size - 1, '\0');
+    }
+    memcpy(&(*output)[length_offset], varint, varint_size);
+  }
+}
+
+}  // namespace protodb
@@ -0,0 +1,86 @@
+#ifndef PROTODB_TRANSCODER_H__
+#define PROTODB_TRANSCODER_H__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+
+namespace protodb {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::io::CodedInputStream;
+
+// Rewrites wire data encoded with one version of a message type so that it
+// parses as another version of the type, for example from an older snapshot
+// of the schema to a newer one.
+//
+// The mapping between the two versions is computed once when the
+// transcoder is created.  Fields are matched by name using a
+// ComparingDescriptorVisitor, which covers renumbered fields, and the
+// mapping follows matched message fields into their types wherever those
+// types were moved or renamed.  Fields whose types are not wire compatible
+// and fields missing from the new version are dropped.
+//
+// Transcoding walks the wire data directly.  Values are copied byte for
+// byte under their new tag and only the submessages whose layout changed
+// are re-encoded.  Unknown fields of the old version are kept under their
+// numbers, as they are when the messages are copied unchanged, unless a
+// renumbered field moved to their number; those are dropped and listed in
+// dropped_fields().
+//
+// A Transcoder is immutable once created and can be shared between threads.
+class Transcoder {
+ public:
+  Transcoder(const Transcoder&) = delete;
+  Transcoder& operator=(const Transcoder&) = delete;
+  ~Transcoder();
+
+  static std::unique_ptr<Transcoder> Create(const Descriptor* from,
+                                            const Descriptor* to);
+
+  // Appends `wire`, rewritten for the new version of the type, to `output`.
+  // Returns false if the wire data is malformed.
+  bool Transcode(absl::string_view wire, std::string* output) const;
+
+  // Describes the fields that are dropped when transcoding, one per line.
+  const std::vector<std::string>& dropped_fields() const {
+    return dropped_fields_;
+  }
+
+  // True if the two versions are wire identical and transcoding is a copy.
+  bool is_identity() const;
+
+ private:
+  struct Mapping;
+  struct FieldVisitor;
+
+  Transcoder() = default;
+
+  Mapping* GetMapping(const Descriptor* from, const Descriptor* to);
+  void MapField(Mapping* mapping, const FieldDescriptor* from,
+                const FieldDescriptor* to);
+  void ResolveIdentities();
+
+  static bool TranscodeMessage(const Mapping& mapping, CodedInputStream& cis,
+                               const uint8_t* base, int depth,
+                               uint32_t end_group_number,
+                               std::string* output);
+
+  std::map<std::pair<const Descriptor*, const Descriptor*>,
+           std::unique_ptr<Mapping>>
+      mappings_;
+  const Mapping* root_ = nullptr;
+  std::vector<std::string> dropped_fields_;
+};
+
+}  // namespace protodb
+
+#endif  // PROTODB_TRANSCODER_H__
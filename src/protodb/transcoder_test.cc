@@ -0,0 +1,219 @@
+#include "protodb/transcoder.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/text_format.h"
+#include "google/protobuf/unknown_field_set.h"
+#include "google/protobuf/util/message_differencer.h"
+#include "gtest/gtest.h"
+
+namespace protodb {
+namespace {
+
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::Message;
+using ::google::protobuf::TextFormat;
+using ::google::protobuf::UnknownField;
+using ::google::protobuf::UnknownFieldSet;
+using ::google::protobuf::util::MessageDifferencer;
+
+constexpr absl::string_view kOldProto = R"pb(
+  name: "transcoder_test.proto"
+  package: "protodb.test"
+  syntax: "proto2"
+  message_type {
+    name: "Event"
+    field { name: "id" number: 1 label: LABEL_OPTIONAL type: TYPE_INT64 }
+    field { name: "name" number: 2 label: LABEL_OPTIONAL type: TYPE_STRING }
+    field {
+      name: "inner"
+      number: 3
+      label: LABEL_REPEATED
+      type: TYPE_MESSAGE
+      type_name: ".protodb.test.Inner"
+    }
+    field { name: "removed" number: 4 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "moved" number: 5 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "changed" number: 6 label: LABEL_OPTIONAL type: TYPE_STRING }
+  }
+  message_type {
+    name: "Inner"
+    field { name: "a" number: 1 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "b" number: 2 label: LABEL_OPTIONAL type: TYPE_STRING }
+  }
+)pb";
+
+constexpr absl::string_view kNewProto = R"pb(
+  name: "transcoder_test.proto"
+  package: "protodb.test"
+  syntax: "proto2"
+  message_type {
+    name: "Event"
+    field { name: "id" number: 1 label: LABEL_OPTIONAL type: TYPE_INT64 }
+    field { name: "name" number: 2 label: LABEL_OPTIONAL type: TYPE_STRING }
+    field {
+      name: "inner"
+      number: 3
+      label: LABEL_REPEATED
+      type: TYPE_MESSAGE
+      type_name: ".protodb.test.Inner"
+    }
+    field { name: "moved" number: 7 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "changed" number: 6 label: LABEL_OPTIONAL type: TYPE_INT64 }
+  }
+  message_type {
+    name: "Inner"
+    field { name: "a" number: 1 label: LABEL_OPTIONAL type: TYPE_INT32 }
+    field { name: "b" number: 20 label: LABEL_OPTIONAL type: TYPE_STRING }
+  }
+)pb";
+
+class TranscoderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    for (auto [pool, text] : {std::pair{&old_pool_, kOldProto},
+                              std::pair{&new_pool_, kNewProto}}) {
+      FileDescriptorProto file;
+      ASSERT_TRUE(TextFormat::ParseFromString(std::string(text), &file));
+      ASSERT_NE(pool->BuildFile(file), nullptr);
+    }
+    old_type_ = old_pool_.FindMessageTypeByName("protodb.test.Event");
+    new_type_ = new_pool_.FindMessageTypeByName("protodb.test.Event");
+    ASSERT_NE(old_type_, nullptr);
+    ASSERT_NE(new_type_, nullptr);
+  }
+
+  std::unique_ptr<Message> Parse(const Descriptor* type,
+                                 absl::string_view text) {
+    std::unique_ptr<Message> message(factory_.GetPrototype(type)->New());
+    EXPECT_TRUE(TextFormat::ParseFromString(std::string(text), message.get()));
+    return message;
+  }
+
+  // Transcodes `wire` from the old to the new version and checks that it
+  // parses to `expected`, ignoring unknown fields, returning the parsed
+  // message.
+  std::unique_ptr<Message> ExpectTranscodes(const Transcoder& transcoder,
+                                            absl::string_view wire,
+                                            absl::string_view expected) {
+    std::string output;
+    EXPECT_TRUE(transcoder.Transcode(wire, &output));
+    std::unique_ptr<Message> actual(factory_.GetPrototype(new_type_)->New());
+    EXPECT_TRUE(actual->ParseFromString(output));
+    std::unique_ptr<Message> known(actual->New());
+    known->CopyFrom(*actual);
+    known->DiscardUnknownFields();
+    std::unique_ptr<Message> want = Parse(new_type_, expected);
+    EXPECT_TRUE(MessageDifferencer::Equals(*want, *known))
+        << "expected:\n"
+        << want->DebugString() << "actual:\n"
+        << known->DebugString();
+    return actual;
+  }
+
+  DescriptorPool old_pool_;
+  DescriptorPool new_pool_;
+  DynamicMessageFactory factory_;
+  const Descriptor* old_type_ = nullptr;
+  const Descriptor* new_type_ = nullptr;
+};
+
+TEST_F(TranscoderTest, CopiesIdenticalVersions) {
+  const auto transcoder = Transcoder::Create(old_type_, old_type_);
+  EXPECT_TRUE(transcoder->is_identity());
+  EXPECT_TRUE(transcoder->dropped_fields().empty());
+  // Unknown field 9 is copied along with the rest.
+  const std::string wire = Parse(old_type_, R"pb(id: 1 moved: 2)pb")
+                               ->SerializeAsString() +
+                           "\x48\x01";
+  std::string output;
+  ASSERT_TRUE(transcoder->Transcode(wire, &output));
+  EXPECT_EQ(output, wire);
+}
+
+TEST_F(TranscoderTest, MovesRenumberedFields) {
+  const auto transcoder = Transcoder::Create(old_type_, new_type_);
+  EXPECT_FALSE(transcoder->is_identity());
+  const std::string wire = Parse(old_type_, R"pb(
+                             id: 1
+                             name: "event"
+                             moved: 5
+                             inner { a: 1 b: "x" }
+                             inner { b: "a longer value to widen the length" }
+                           )pb")
+                               ->SerializeAsString();
+  ExpectTranscodes(*transcoder, wire, R"pb(
+    id: 1
+    name: "event"
+    moved: 5
+    inner { a: 1 b: "x" }
+    inner { b: "a longer value to widen the length" }
+  )pb");
+}
+
+TEST_F(TranscoderTest, DropsRemovedAndIncompatibleFields) {
+  const auto transcoder = Transcoder::Create(old_type_, new_type_);
+  EXPECT_EQ(transcoder->dropped_fields(),
+            (std::vector<std::string>{
+                "protodb.test.Event.changed: string can't be read as "
+                "protodb.test.Event.changed: int64",
+                "unknown fields numbered 20 in protodb.test.Inner: the "
+                "number is now protodb.test.Inner.b",
+                "unknown fields numbered 7 in protodb.test.Event: the number "
+                "is now protodb.test.Event.moved",
+                "protodb.test.Event.removed: not in the new version",
+            }));
+  const std::string wire =
+      Parse(old_type_, R"pb(id: 1 removed: 4 changed: "text")pb")
+          ->SerializeAsString();
+  const auto actual = ExpectTranscodes(*transcoder, wire, "id: 1");
+  EXPECT_EQ(actual->GetReflection()->GetUnknownFields(*actual).field_count(),
+            0);
+}
+
+TEST_F(TranscoderTest, KeepsUnknownFieldsUnlessTheirNumberIsReused) {
+  const auto transcoder = Transcoder::Create(old_type_, new_type_);
+  const std::string wire = Parse(old_type_, R"pb(id: 1 inner { a: 2 })pb")
+                               ->SerializeAsString() +
+                           "\x48\x09"              // 9: 9
+                           "\x38\x07"              // 7: 7, now `moved`
+                           "\x1a\x05\xa0\x01\x02"  // inner { 20: 2, ...
+                           "\x60\x03"              // ... 12: 3 }
+                           "\x5b\x08\x01\x5c";     // 11 { 1: 1 }
+  const auto actual = ExpectTranscodes(*transcoder, wire,
+                                       R"pb(id: 1 inner { a: 2 } inner {})pb");
+  const UnknownFieldSet& unknown =
+      actual->GetReflection()->GetUnknownFields(*actual);
+  ASSERT_EQ(unknown.field_count(), 2);
+  EXPECT_EQ(unknown.field(0).number(), 9);
+  EXPECT_EQ(unknown.field(0).varint(), 9);
+  EXPECT_EQ(unknown.field(1).number(), 11);
+  EXPECT_EQ(unknown.field(1).type(), UnknownField::TYPE_GROUP);
+  const Message& inner = actual->GetReflection()->GetRepeatedMessage(
+      *actual, new_type_->FindFieldByName("inner"), 1);
+  const UnknownFieldSet& inner_unknown =
+      inner.GetReflection()->GetUnknownFields(inner);
+  ASSERT_EQ(inner_unknown.field_count(), 1);
+  EXPECT_EQ(inner_unknown.field(0).number(), 12);
+}
+
+TEST_F(TranscoderTest, RejectsMalformedInput) {
+  const auto transcoder = Transcoder::Create(old_type_, new_type_);
+  std::string output;
+  EXPECT_FALSE(transcoder->Transcode(absl::string_view("\x12\x05" "ab", 4),
+                                     &output));
+  EXPECT_FALSE(
+      transcoder->Transcode(absl::string_view("\x08\x80", 2), &output));
+  EXPECT_FALSE(
+      transcoder->Transcode(absl::string_view("\x5b\x08\x01", 3), &output));
+}
+
+}  // namespace
+}  // namespace protodb
@@ -0,0 +1,715 @@
+#include "protoquery/aggregator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/numeric/bits.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "protodb/io/content_hash.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/query.h"
+#include "protoquery/query_program.h"
+#include "protoquery/row_printer.h"
+#include "protoquery/sketches.h"
+#include "records/external_sort.h"
+
+namespace protoquery {
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace {
+
+using Column = QueryProgram::Column;
+using Value = QueryProgram::Value;
+
+constexpr uint64_t kSignBit = uint64_t{1} << 63;
+
+// The memory held by a group besides its key and states: the table slot
+// and the key's and vector's headers.
+constexpr int64_t kGroupOverhead =
+    sizeof(std::string) + sizeof(std::vector<int>) + 8;
+
+// How values of a field are compared, summed and encoded.
+enum class Kind {
+  kSigned,
+  kUnsigned,
+  kFloat,
+  kDouble,
+  kString,
+  kMessage,
+};
+
+Kind KindOf(const FieldDescriptor* field) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return Kind::kSigned;
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return Kind::kUnsigned;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return Kind::kFloat;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return Kind::kDouble;
+    case FieldDescriptor::CPPTYPE_STRING:
+      return Kind::kString;
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      return Kind::kMessage;
+  }
+  return Kind::kMessage;
+}
+
+double ToDouble(Kind kind, uint64_t bits) {
+  switch (kind) {
+    case Kind::kSigned:
+      return static_cast<double>(ParsePlan::AsInt64(bits));
+    case Kind::kUnsigned:
+      return static_cast<double>(bits);
+    case Kind::kFloat:
+      return ParsePlan::AsFloat(bits);
+    case Kind::kDouble:
+      return ParsePlan::AsDouble(bits);
+    default:
+      return 0;
+  }
+}
+
+uint64_t DoubleBits(double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+uint64_t FloatBits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// Whether scalar `a` orders before `b`.
+bool Less(Kind kind, uint64_t a, uint64_t b) {
+  switch (kind) {
+    case Kind::kSigned:
+      return ParsePlan::AsInt64(a) < ParsePlan::AsInt64(b);
+    case Kind::kFloat:
+      return ParsePlan::AsFloat(a) < ParsePlan::AsFloat(b);
+    case Kind::kDouble:
+      return ParsePlan::AsDouble(a) < ParsePlan::AsDouble(b);
+    default:
+      return a < b;
+  }
+}
+
+bool GetBit(const std::vector<uint64_t>& words, size_t i) {
+  return (words[i / 64] >> (i % 64)) & 1;
+}
+
+// Calls `fn` with each value of `column` in message `i` of `batch`, or
+// once with no value for `count(*)`.
+template <typename Fn>
+void ForEachValue(const Column& column, const QueryProgram::Batch& batch,
+                  int i, Fn fn) {
+  if (column.slot < 0) {
+    fn(Value());
+    return;
+  }
+  const QueryProgram::Batch::Vector& vector = batch.vectors[column.slot];
+  if (column.repeated) {
+    for (uint32_t k = vector.offsets[i]; k < vector.offsets[i + 1]; ++k) {
+      fn(Value{.bits = vector.bits[k], .data = vector.data[k]});
+    }
+  } else if (column.defaulted || GetBit(vector.present, i)) {
+    fn(Value{.bits = vector.bits[i], .data = vector.data[i]});
+  }
+}
+
+void AppendBigEndian(uint64_t value, std::string* out) {
+  char bytes[8];
+  absl::big_endian::Store64(bytes, value);
+  out->append(bytes, sizeof(bytes));
+}
+
+// Maps a double to an integer with the same order: negative values have
+// every bit flipped and positive ones only the sign bit.
+uint64_t OrderedDouble(double value) {
+  const uint64_t bits = DoubleBits(value);
+  return (bits & kSignBit) ? ~bits : bits | kSignBit;
+}
+
+double UnorderedDouble(uint64_t ordered) {
+  const uint64_t bits = (ordered & kSignBit) ? ordered & ~kSignBit : ~ordered;
+  return ParsePlan::AsDouble(bits);
+}
+
+// Appends a group value to a key.  A string is escaped so that it can be
+// followed by more values: zero bytes become 00 FF and the string ends
+// with 00 01, which orders a string before any longer one it starts.
+void AppendKeyValue(Kind kind, const Value& value, std::string* key) {
+  switch (kind) {
+    case Kind::kSigned:
+      AppendBigEndian(value.bits ^ kSignBit, key);
+      return;
+    case Kind::kUnsigned:
+      AppendBigEndian(value.bits, key);
+      return;
+    case Kind::kFloat:
+      AppendBigEndian(OrderedDouble(ParsePlan::AsFloat(value.bits)), key);
+      return;
+    case Kind::kDouble:
+      AppendBigEndian(OrderedDouble(ParsePlan::AsDouble(value.bits)), key);
+      return;
+    case Kind::kString:
+      for (char c : value.data) {
+        key->push_back(c);
+        if (c == '\0')
+          key->push_back('\xff');
+      }
+      key->append("\0\1", 2);
+      return;
+    case Kind::kMessage:
+      return;
+  }
+}
+
+// Reads a group value appended by AppendKeyValue() from the start of
+// `key`, unescaping strings into `text`.  Returns false if `key` doesn't
+// start with one.
+bool ReadKeyValue(Kind kind, absl::string_view* key, Value* value,
+                  std::string* text) {
+  if (kind == Kind::kString) {
+    text->clear();
+    for (size_t i = 0; i < key->size(); ++i) {
+      if ((*key)[i] != '\0') {
+        text->push_back((*key)[i]);
+        continue;
+      }
+      if (++i == key->size())
+        return false;
+      if ((*key)[i] == '\1') {
+        key->remove_prefix(i + 1);
+        value->data = *text;
+        return true;
+      }
+      text->push_back('\0');
+    }
+    return false;
+  }
+  if (key->size() < 8)
+    return false;
+  const uint64_t bits = absl::big_endian::Load64(key->data());
+  key->remove_prefix(8);
+  switch (kind) {
+    case Kind::kSigned:
+      value->bits = bits ^ kSignBit;
+      break;
+    case Kind::kFloat:
+      value->bits = FloatBits(static_cast<float>(UnorderedDouble(bits)));
+      break;
+    case Kind::kDouble:
+      value->bits = DoubleBits(UnorderedDouble(bits));
+      break;
+    default:
+      value->bits = bits;
+      break;
+  }
+  return true;
+}
+
+void AppendVarint(uint64_t value, std::string* out) {
+  uint8_t buffer[10];
+  const uint8_t* end = CodedOutputStream::WriteVarint64ToArray(value, buffer);
+  out->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+bool ReadVarint(absl::string_view* in, uint64_t* value) {
+  const char* p =
+      ParsePlan::ReadVarint(in->data(), in->data() + in->size(), value);
+  if (p == nullptr)
+    return false;
+  in->remove_prefix(p - in->data());
+  return true;
+}
+
+}  // namespace
+
+// The partial state of one aggregate in one group.
+struct Aggregator::State {
+  // The number of values aggregated.
+  uint64_t count = 0;
+  // A sum, as the bits of an int64, a uint64 or a double, or a scalar
+  // minimum or maximum as ParsePlan::Parse() passes it.
+  uint64_t bits = 0;
+  // The minimum or maximum of a string or bytes field.
+  std::string text;
+  std::unique_ptr<DistinctCounter> distinct;
+  std::unique_ptr<QuantileSketch> quantile;
+};
+
+// The groups of one worker.
+struct Aggregator::Table {
+  absl::flat_hash_map<std::string, std::vector<State>> groups;
+  // The bytes held by `groups`, roughly.
+  int64_t memory = 0;
+  // Numbers the groups handed to the sorter.
+  uint64_t sequence = 0;
+  size_t spills = 0;
+  std::string key;
+  std::string record;
+};
+
+Aggregator::Aggregator(const QueryProgram* program,
+                       const AggregatorOptions& options)
+    : program_(program),
+      table_limit_(std::max<size_t>(
+          options.memory_limit / 2 / std::max(options.workers, 1), 1)),
+      sorter_(records::ExternalSortOptions{
+          .temp_dir = options.temp_dir,
+          .memory_limit = std::max<size_t>(options.memory_limit / 2, 1),
+          .workers = std::max(options.workers, 1)}) {
+  for (int i = 0; i < std::max(options.workers, 1); ++i) {
+    tables_.push_back(std::make_unique<Table>());
+  }
+
+  // Fields take the places in the `select` list that aggregates don't.
+  const auto& aggregates = program_->aggregates();
+  items_.resize(program_->columns().size() + aggregates.size());
+  for (size_t i = 0; i < aggregates.size(); ++i) {
+    items_[aggregates[i].position].aggregate = i;
+  }
+  const auto& keys = program_->group_keys();
+  size_t column = 0;
+  for (Item& item : items_) {
+    if (item.aggregate >= 0)
+      continue;
+    const int slot = program_->columns()[column++].slot;
+    item.key = std::find_if(keys.begin(), keys.end(),
+                            [slot](const Column& key) {
+                              return key.slot == slot;
+                            }) -
+               keys.begin();
+  }
+}
+
+Aggregator::~Aggregator() = default;
+
+bool Aggregator::Add(int worker, const QueryProgram::Batch& batch) {
+  Table& table = *tables_[worker];
+  const size_t states = program_->aggregates().size();
+  for (size_t word = 0; word * 64 < static_cast<size_t>(batch.size);
+       ++word) {
+    uint64_t messages =
+        batch.selection[word] & ~batch.malformed_messages[word];
+    if ((word + 1) * 64 > static_cast<size_t>(batch.size))
+      messages &= (uint64_t{1} << (batch.size % 64)) - 1;
+    for (; messages != 0; messages &= messages - 1) {
+      const int i = word * 64 + absl::countr_zero(messages);
+      table.key.clear();
+      AppendKey(batch, i, &table.key);
+      auto [group, inserted] = table.groups.try_emplace(table.key);
+      if (inserted) {
+        group->second.resize(states);
+        table.memory +=
+            kGroupOverhead + table.key.size() + states * sizeof(State);
+      }
+      table.memory += Update(batch, i, group->second);
+      if (table.memory > static_cast<int64_t>(table_limit_)) {
+        ++table.spills;
+        if (!Drain(worker, table))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+void Aggregator::AppendKey(const QueryProgram::Batch& batch, int i,
+                           std::string* key) const {
+  for (const Column& column : program_->group_keys()) {
+    // A missing value is a zero byte, which orders before every value.
+    bool found = false;
+    ForEachValue(column, batch, i, [&](const Value& value) {
+      key->push_back('\1');
+      AppendKeyValue(KindOf(column.field), value, key);
+      found = true;
+    });
+    if (!found)
+      key->push_back('\0');
+  }
+}
+
+int64_t Aggregator::Update(const QueryProgram::Batch& batch, int i,
+                           std::vector<State>& states) const {
+  int64_t memory = 0;
+  const auto& aggregates = program_->aggregates();
+  for (size_t a = 0; a < aggregates.size(); ++a) {
+    const QueryProgram::AggregateColumn& aggregate = aggregates[a];
+    const Column& argument = aggregate.argument;
+    const Kind kind =
+        argument.field == nullptr ? Kind::kMessage : KindOf(argument.field);
+    State& state = states[a];
+    ForEachValue(argument, batch, i, [&](const Value& value) {
+      switch (aggregate.function) {
+        case Aggregate::kCount:
+          break;
+        case Aggregate::kSum:
+          if (kind == Kind::kFloat || kind == Kind::kDouble) {
+            state.bits = DoubleBits(ParsePlan::AsDouble(state.bits) +
+                                    ToDouble(kind, value.bits));
+          } else {
+            // Integers wrap around, as in C++.
+            state.bits += value.bits;
+          }
+          break;
+        case Aggregate::kMin:
+        case Aggregate::kMax: {
+          const bool min = aggregate.function == Aggregate::kMin;
+          if (kind == Kind::kString) {
+            if (state.count == 0 ||
+                (min ? value.data < state.text : state.text < value.data)) {
+              memory -= state.text.capacity();
+              state.text.assign(value.data.data(), value.data.size());
+              memory += state.text.capacity();
+            }
+            break;
+          }
+          // NaNs have no order, so they are left out.
+          if (std::isnan(ToDouble(kind, value.bits)))
+            return;
+          if (state.count == 0 || (min ? Less(kind, value.bits, state.bits)
+                                       : Less(kind, state.bits, value.bits))) {
+            state.bits = value.bits;
+          }
+          break;
+        }
+        case Aggregate::kApproxDistinct: {
+          if (state.distinct == nullptr) {
+            state.distinct = std::make_unique<DistinctCounter>();
+          } else {
+            memory -= state.distinct->memory();
+          }
+          const absl::string_view data =
+              kind == Kind::kString
+                  ? value.data
+                  : absl::string_view(reinterpret_cast<const char*>(&value.bits),
+                                      sizeof(value.bits));
+          state.distinct->Add(absl::Uint128Low64(protodb::ContentHash(data)));
+          memory += state.distinct->memory();
+          break;
+        }
+        case Aggregate::kApproxQuantile:
+          if (state.quantile == nullptr) {
+            state.quantile = std::make_unique<QuantileSketch>();
+          } else {
+            memory -= state.quantile->memory();
+          }
+          state.quantile->Add(ToDouble(kind, value.bits));
+          memory += state.quantile->memory();
+          break;
+      }
+      ++state.count;
+    });
+  }
+  return memory;
+}
+
+void Aggregator::Merge(const std::vector<State>& from,
+                       std::vector<State>& to) const {
+  const auto& aggregates = program_->aggregates();
+  for (size_t a = 0; a < aggregates.size(); ++a) {
+    const QueryProgram::AggregateColumn& aggregate = aggregates[a];
+    const Kind kind = aggregate.argument.field == nullptr
+                          ? Kind::kMessage
+                          : KindOf(aggregate.argument.field);
+    const State& other = from[a];
+    State& state = to[a];
+    switch (aggregate.function) {
+      case Aggregate::kCount:
+        break;
+      case Aggregate::kSum:
+        if (kind == Kind::kFloat || kind == Kind::kDouble) {
+          state.bits = DoubleBits(ParsePlan::AsDouble(state.bits) +
+                                  ParsePlan::AsDouble(other.bits));
+        } else {
+          state.bits += other.bits;
+        }
+        break;
+      case Aggregate::kMin:
+      case Aggregate::kMax: {
+        if (other.count == 0)
+          break;
+        const bool min = aggregate.function == Aggregate::kMin;
+        if (kind == Kind::kString) {
+          if (state.count == 0 ||
+              (min ? other.text < state.text : state.text < other.text)) {
+            state.text = other.text;
+          }
+        } else if (state.count == 0 ||
+                   (min ? Less(kind, other.bits, state.bits)
+                        : Less(kind, state.bits, other.bits))) {
+          state.bits = other.bits;
+        }
+        break;
+      }
+      case Aggregate::kApproxDistinct:
+        if (other.distinct == nullptr)
+          break;
+        if (state.distinct == nullptr)
+          state.distinct = std::make_unique<DistinctCounter>();
+        state.distinct->Merge(*other.distinct);
+        break;
+      case Aggregate::kApproxQuantile:
+        if (other.quantile == nullptr)
+          break;
+        if (state.quantile == nullptr)
+          state.quantile = std::make_unique<QuantileSketch>();
+        state.quantile->Merge(*other.quantile);
+        break;
+    }
+    state.count += other.count;
+  }
+}
+
+void Aggregator::EncodeStates(const std::vector<State>& states,
+                              std::string* out) const {
+  const auto& aggregates = program_->aggregates();
+  for (size_t a = 0; a < aggregates.size(); ++a) {
+    const State& state = states[a];
+    AppendVarint(state.count, out);
+    AppendVarint(state.bits, out);
+    AppendVarint(state.text.size(), out);
+    out->append(state.text);
+    switch (aggregates[a].function) {
+      case Aggregate::kApproxDistinct:
+        if (state.distinct != nullptr) {
+          state.distinct->Encode(out);
+        } else {
+          DistinctCounter().Encode(out);
+        }
+        break;
+      case Aggregate::kApproxQuantile:
+        if (state.quantile != nullptr) {
+          state.quantile->Encode(out);
+        } else {
+          QuantileSketch().Encode(out);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+bool Aggregator::DecodeStates(absl::string_view in,
+                              std::vector<State>* states) const {
+  const auto& aggregates = program_->aggregates();
+  states->clear();
+  states->resize(aggregates.size());
+  for (size_t a = 0; a < aggregates.size(); ++a) {
+    State& state = (*states)[a];
+    uint64_t size;
+    if (!ReadVarint(&in, &state.count) || !ReadVarint(&in, &state.bits) ||
+        !ReadVarint(&in, &size) || size > in.size()) {
+      return false;
+    }
+    state.text.assign(in.data(), size);
+    in.remove_prefix(size);
+    switch (aggregates[a].function) {
+      case Aggregate::kApproxDistinct:
+        state.distinct = std::make_unique<DistinctCounter>();
+        if (!state.distinct->Decode(&in))
+          return false;
+        break;
+      case Aggregate::kApproxQuantile:
+        state.quantile = std::make_unique<QuantileSketch>();
+        if (!state.quantile->Decode(&in))
+          return false;
+        break;
+      default:
+        break;
+    }
+  }
+  return in.empty();
+}
+
+bool Aggregator::Drain(int worker, Table& table) {
+  for (const auto& [key, states] : table.groups) {
+    table.record.clear();
+    EncodeStates(states, &table.record);
+    if (!sorter_.Add(worker, key, table.sequence++, table.record))
+      return false;
+  }
+  table.groups = {};
+  table.memory = 0;
+  return true;
+}
+
+bool Aggregator::Finish(const LineFn& fn) {
+  for (size_t worker = 0; worker < tables_.size(); ++worker) {
+    if (!Drain(worker, *tables_[worker]))
+      return false;
+  }
+
+  const int64_t limit = program_->limit();
+  int64_t printed = 0;
+  std::string line;
+  // The group being combined, from the parts of it that arrive together.
+  bool have_group = false;
+  std::string key;
+  std::vector<State> states;
+  std::vector<State> part;
+  const auto limited = [&]() { return limit >= 0 && printed >= limit; };
+  const auto print = [&]() {
+    ++printed;
+    line.clear();
+    PrintGroup(key, states, &line);
+    return fn(line);
+  };
+
+  // Reaching the limit ends the merge early but isn't an error, unlike
+  // `fn` failing.
+  bool stopped = false;
+  bool failed = false;
+  bool corrupt = false;
+  const bool merged = sorter_.Merge([&](absl::string_view group_key,
+                                        absl::string_view record) {
+    if (!DecodeStates(record, &part)) {
+      corrupt = true;
+      return false;
+    }
+    if (have_group && group_key == key) {
+      Merge(part, states);
+      return true;
+    }
+    if (have_group && limited()) {
+      stopped = true;
+      return false;
+    }
+    if (have_group && !print()) {
+      failed = true;
+      return false;
+    }
+    key.assign(group_key.data(), group_key.size());
+    states.swap(part);
+    have_group = true;
+    return true;
+  });
+  if (failed)
+    return false;
+  if (stopped)
+    return true;
+  if (corrupt) {
+    std::cerr << "protoquery: a spilled group is corrupt" << std::endl;
+    return false;
+  }
+  if (!merged)
+    return false;
+
+  if (!have_group && program_->group_keys().empty()) {
+    // Aggregates over no messages still make a row, as in SQL.
+    states.resize(program_->aggregates().size());
+    have_group = true;
+  }
+  return !have_group || limited() || print();
+}
+
+size_t Aggregator::spills() const {
+  size_t spills = 0;
+  for (const auto& table : tables_) {
+    spills += table->spills;
+  }
+  return spills;
+}
+
+void Aggregator::PrintGroup(absl::string_view key,
+                            const std::vector<State>& states,
+                            std::string* line) const {
+  const auto& group_keys = program_->group_keys();
+  std::vector<Value> values(group_keys.size());
+  std::vector<bool> found(group_keys.size());
+  std::vector<std::string> texts(group_keys.size());
+  for (size_t k = 0; k < group_keys.size() && !key.empty(); ++k) {
+    found[k] = key.front() == '\1';
+    key.remove_prefix(1);
+    if (found[k] &&
+        !ReadKeyValue(KindOf(group_keys[k].field), &key, &values[k],
+                      &texts[k])) {
+      break;
+    }
+  }
+
+  bool first = true;
+  for (const Item& item : items_) {
+    if (!first)
+      line->push_back('\t');
+    first = false;
+    if (item.key >= 0) {
+      if (found[item.key]) {
+        RowPrinter::PrintValue(group_keys[item.key].field, values[item.key],
+                               line);
+      }
+      continue;
+    }
+
+    const QueryProgram::AggregateColumn& aggregate =
+        program_->aggregates()[item.aggregate];
+    const State& state = states[item.aggregate];
+    const FieldDescriptor* field = aggregate.argument.field;
+    switch (aggregate.function) {
+      case Aggregate::kCount:
+        absl::StrAppend(line, state.count);
+        break;
+      case Aggregate::kSum:
+        // A sum of no values is missing rather than zero, as in SQL.
+        if (state.count == 0)
+          break;
+        switch (KindOf(field)) {
+          case Kind::kSigned:
+            absl::StrAppend(line, ParsePlan::AsInt64(state.bits));
+            break;
+          case Kind::kUnsigned:
+            absl::StrAppend(line, state.bits);
+            break;
+          default:
+            absl::StrAppend(line,
+                            FormatDouble(ParsePlan::AsDouble(state.bits)));
+            break;
+        }
+        break;
+      case Aggregate::kMin:
+      case Aggregate::kMax:
+        if (state.count > 0) {
+          RowPrinter::PrintValue(field, Value{.bits = state.bits,
+                                              .data = state.text},
+                                 line);
+        }
+        break;
+      case Aggregate::kApproxDistinct:
+        absl::StrAppend(line, state.distinct == nullptr
+                                  ? 0
+                                  : state.distinct->Estimate());
+        break;
+      case Aggregate::kApproxQuantile:
+        if (state.quantile != nullptr && state.quantile->count() > 0) {
+          absl::StrAppend(
+              line, FormatDouble(state.quantile->Quantile(aggregate.quantile)));
+        }
+        break;
+    }
+  }
+}
+
+}  // namespace protoquery
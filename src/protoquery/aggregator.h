@@ -0,0 +1,107 @@
+#ifndef PROTOQUERY_AGGREGATOR_H__
+#define PROTOQUERY_AGGREGATOR_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "protoquery/query_program.h"
+#include "records/external_sort.h"
+
+namespace protoquery {
+
+struct AggregatorOptions {
+  // The number of threads adding batches.
+  int workers = 1;
+  // The memory for groups, split evenly between the workers' hash tables
+  // and the buffers of the sort that merges them.
+  size_t memory_limit = size_t{1} << 30;
+  // Where groups are spilled, or empty for $TMPDIR, falling back to /tmp.
+  std::string temp_dir;
+};
+
+// Runs the group by and aggregates of a QueryProgram over the batches it
+// selects, and prints a line per group.
+//
+// Each worker aggregates into its own hash table from the encoded group
+// key to the partial state of every aggregate, so workers never share a
+// group.  When a table outgrows its share of `memory_limit`, its groups are
+// encoded and handed to an ExternalSorter, which spills them to disk as
+// sorted runs, and the table starts again empty.  Finish() adds the groups
+// still in memory and merges everything by key, so the partial states of a
+// group, from every worker and every spill, arrive together and are
+// combined before the group is printed.
+//
+// Keys encode each group value so that comparing them as bytes orders
+// them as values: a missing value comes first, numbers order numerically
+// and strings as bytes.  Groups print in that order.  count, sum, min and
+// max are exact.  approx_distinct keeps a DistinctCounter and
+// approx_quantile a QuantileSketch per group, which bounds their state.
+class Aggregator {
+ public:
+  // Called with each line printed, without its newline.  Returning false
+  // stops printing and makes Finish() fail.
+  using LineFn = std::function<bool(absl::string_view line)>;
+
+  Aggregator(const QueryProgram* program, const AggregatorOptions& options);
+  Aggregator(const Aggregator&) = delete;
+  Aggregator& operator=(const Aggregator&) = delete;
+  ~Aggregator();
+
+  // Aggregates the messages of `batch` that are selected and not
+  // malformed, on worker `worker` in [0, workers).  Workers can add at the
+  // same time, but each worker must only be used by one thread at a time.
+  // Returns false and reports the error to stderr if groups fail to spill.
+  bool Add(int worker, const QueryProgram::Batch& batch);
+
+  // Merges the groups of every worker and calls `fn` with the line of
+  // each, up to the program's limit.  Without a `group by` clause there is
+  // a single group, even over no messages.  Must be called once, after all
+  // adds.  Returns false if spilled groups can't be read back or `fn`
+  // fails.
+  bool Finish(const LineFn& fn);
+
+  // The number of times a worker's groups were handed to the sorter for
+  // lack of memory.
+  size_t spills() const;
+
+ private:
+  struct State;
+  struct Table;
+  // An item of the `select` list: a group key or an aggregate, by index.
+  struct Item {
+    int key = -1;
+    int aggregate = -1;
+  };
+
+  // Appends the encoded group key of message `i` of `batch` to `key`.
+  void AppendKey(const QueryProgram::Batch& batch, int i,
+                 std::string* key) const;
+  // Updates `states` with the values of message `i`, returning the change
+  // in the memory they hold.
+  int64_t Update(const QueryProgram::Batch& batch, int i,
+                 std::vector<State>& states) const;
+  void Merge(const std::vector<State>& from, std::vector<State>& to) const;
+  void EncodeStates(const std::vector<State>& states, std::string* out) const;
+  bool DecodeStates(absl::string_view in, std::vector<State>* states) const;
+  // Hands every group of `table` to the sorter and empties it.
+  bool Drain(int worker, Table& table);
+  // Appends the line of a group to `line`.
+  void PrintGroup(absl::string_view key, const std::vector<State>& states,
+                  std::string* line) const;
+
+  const QueryProgram* const program_;
+  const size_t table_limit_;
+  std::vector<Item> items_;
+  std::vector<std::unique_ptr<Table>> tables_;
+  records::ExternalSorter sorter_;
+};
+
+}  // namespace protoquery
+
+#endif  // PROTOQUERY_AGGREGATOR_H__
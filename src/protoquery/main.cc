@@ -1,16 +1,607 @@
+// Runs a query over encoded protobuf messages:
+//
+//   protoquery --descriptor_set_in=protos.pb --input=delimited
+//       'select name, address.city from example.Person where age >= 21'
+//       people.bin
+//
+// Messages are read from a single binary message per file, from streams of
+// length-delimited messages or from records files, whose headers carry
+// their schema.  Messages are filtered a batch at a time on their wire data,
+// see QueryProgram, and only the ones that match are parsed to be printed.
+//
+// Queries with aggregates or a `group by` clause print a line per group
+// instead, see Aggregator.  Records files are then read and aggregated on
+// --jobs threads, and groups beyond --memory_limit spill to --temp_dir.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "absl/log/initialize.h"
-#include "absl/log/log.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/descriptor_database.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "protodb/io/delimited.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/aggregator.h"
+#include "protoquery/query.h"
+#include "protoquery/query_program.h"
+#include "protoquery/row_printer.h"
+#include "records/parallel_reader.h"
+#include "records/record_reader.h"
 
 namespace protoquery {
 
+namespace {
+
+using ::google::protobuf::DescriptorPoolDatabase;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::FileDescriptorSet;
+using ::google::protobuf::MergedDescriptorDatabase;
+using ::google::protobuf::SimpleDescriptorDatabase;
+using ::google::protobuf::io::FileInputStream;
+
+enum class InputFormat {
+  // Each file holds one message.
+  kBinary,
+  kDelimited,
+  kRecords,
+};
+
+struct Options {
+  std::vector<std::string> descriptor_set_in;
+  InputFormat input = InputFormat::kBinary;
+  std::string query;
+  std::vector<std::string> files;
+  // For aggregating queries.
+  int jobs = std::max(1u, std::thread::hardware_concurrency());
+  int64_t memory_limit = int64_t{1} << 30;
+  std::string temp_dir;
+};
+
+// Opens `path` for reading, or stdin for "-".  Returns -1 and reports the
+// error to stderr on failure.
+int OpenInput(const std::string& path) {
+  if (path == "-")
+    return STDIN_FILENO;
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+  return fd;
+}
+
+// Message types built from descriptor sets, falling back to the types
+// compiled into protoquery for the well-known types a set leaves out.
+class Schema {
+ public:
+  // Adds the files of `set`, read from `source`.  Returns false and reports
+  // the error to stderr if they don't fit the files already added.
+  bool Add(const std::string& source, const FileDescriptorSet& set) {
+    for (const FileDescriptorProto& file : set.file()) {
+      FileDescriptorProto existing;
+      if (db_.FindFileByName(file.name(), &existing))
+        continue;
+      if (!db_.Add(file)) {
+        std::cerr << source << ": invalid descriptor set" << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Adds the descriptor set in the file at `path`.
+  bool AddFile(const std::string& path) {
+    const int fd = OpenInput(path);
+    if (fd < 0)
+      return false;
+    FileInputStream input(fd);
+    input.SetCloseOnDelete(fd != STDIN_FILENO);
+    FileDescriptorSet set;
+    if (!set.ParseFromZeroCopyStream(&input)) {
+      std::cerr << path << ": not a FileDescriptorSet" << std::endl;
+      return false;
+    }
+    return Add(path, set);
+  }
+
+  const DescriptorPool* pool() const {
+    return &pool_;
+  }
+  ParsePlanCache* plans() {
+    return &plans_;
+  }
+
+ private:
+  SimpleDescriptorDatabase db_;
+  DescriptorPoolDatabase generated_db_{*DescriptorPool::generated_pool()};
+  MergedDescriptorDatabase merged_db_{&db_, &generated_db_};
+  DescriptorPool pool_{&merged_db_, nullptr};
+  ParsePlanCache plans_;
+};
+
+// Buffers the lines printed and counts them against the query's limit.
+// Once stdout fails to be written, nothing more is printed.
+class Output {
+ public:
+  explicit Output(int64_t limit) : limit_(limit) {}
+  ~Output() {
+    Flush();
+  }
+
+  std::string* buffer() {
+    return &buffer_;
+  }
+
+  // Counts a line appended to buffer().
+  void Printed() {
+    ++printed_;
+    if (buffer_.size() >= (64 << 10))
+      Flush();
+  }
+
+  // Whether the limit has been reached or stdout failed.
+  bool done() const {
+    return failed_ || (limit_ >= 0 && printed_ >= limit_);
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+  // Writes the lines buffered to stdout.  Returns false, reporting the
+  // error to stderr the first time, if stdout can't be written.
+  bool Flush() {
+    if (!failed_) {
+      const size_t written = fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+      if (written != buffer_.size() || fflush(stdout) != 0) {
+        std::cerr << "protoquery: output: " << strerror(errno) << std::endl;
+        failed_ = true;
+      }
+    }
+    buffer_.clear();
+    return !failed_;
+  }
+
+ private:
+  const int64_t limit_;
+  int64_t printed_ = 0;
+  bool failed_ = false;
+  std::string buffer_;
+};
+
+// A query compiled for one schema, with the state to run it over batches
+// of messages and, for an aggregating query, its groups.
+class Matcher {
+ public:
+  // Returns nullptr and reports the error to stderr if the query doesn't
+  // compile for `schema`.
+  static std::unique_ptr<Matcher> Create(const Query& query,
+                                         const Options& options,
+                                         std::unique_ptr<Schema> schema) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = QueryProgram::Compile(
+        query, schema->pool(), schema->plans(), &error);
+    if (program == nullptr) {
+      std::cerr << "protoquery: " << error << std::endl;
+      return nullptr;
+    }
+    return std::unique_ptr<Matcher>(
+        new Matcher(options, std::move(schema), std::move(program)));
+  }
+
+  bool aggregating() const {
+    return aggregator_ != nullptr;
+  }
+
+  // Queues `message`, message `index` of `source`, and runs the query
+  // over the queue once it holds a full batch.  Messages are copied, as
+  // readers reuse their buffers.  Returns false if a message run over is
+  // malformed.
+  bool Add(const std::string& source, uint64_t index,
+           absl::string_view message, Output* output) {
+    if (indexes_.empty())
+      source_ = source;
+    offsets_.push_back(buffer_.size());
+    buffer_.append(message.data(), message.size());
+    indexes_.push_back(index);
+    if (indexes_.size() < QueryProgram::kBatchSize)
+      return true;
+    return Flush(output);
+  }
+
+  // Runs the query over the messages queued, printing those that match to
+  // `output`, or aggregating them on worker 0.  Returns false and reports
+  // the error to stderr for each malformed message.
+  bool Flush(Output* output) {
+    offsets_.push_back(buffer_.size());
+    messages_.clear();
+    for (size_t i = 0; i + 1 < offsets_.size(); ++i) {
+      messages_.push_back(absl::string_view(buffer_).substr(
+          offsets_[i], offsets_[i + 1] - offsets_[i]));
+    }
+    QueryProgram::Batch& batch = batches_[0];
+    program_->EvaluateBatch(messages_, &batch);
+
+    bool ok = aggregator_ == nullptr || aggregator_->Add(0, batch);
+    for (int i = 0; i < batch.size && !output->done(); ++i) {
+      if (!batch.malformed(i) && (aggregator_ != nullptr ||
+                                  !batch.selected(i))) {
+        continue;
+      }
+      if (!batch.malformed(i)) {
+        program_->Project(batch, i, &row_);
+        if (printer_.Print(messages_[i], row_, output->buffer())) {
+          output->Printed();
+          continue;
+        }
+      }
+      std::cerr << source_ << ": message " << indexes_[i] << " is malformed"
+                << std::endl;
+      ok = false;
+    }
+    buffer_.clear();
+    offsets_.clear();
+    indexes_.clear();
+    return ok;
+  }
+
+  // Aggregates the records of `records`, read from `source` on worker
+  // `worker`.  Returns false if groups fail to spill.  Malformed records
+  // are reported to stderr and make Finish() fail.
+  bool AddRecords(int worker, const std::string& source,
+                  const records::RecordBatch& records) {
+    QueryProgram::Batch& batch = batches_[worker];
+    const auto messages = absl::MakeConstSpan(records.records);
+    for (size_t begin = 0; begin < messages.size();
+         begin += QueryProgram::kBatchSize) {
+      program_->EvaluateBatch(messages.subspan(begin, QueryProgram::kBatchSize),
+                              &batch);
+      if (!aggregator_->Add(worker, batch))
+        return false;
+      for (int i = 0; i < batch.size; ++i) {
+        if (!batch.malformed(i))
+          continue;
+        std::cerr << source << ": record " << begin + i << " of range "
+                  << records.range << " is malformed" << std::endl;
+        malformed_ = true;
+      }
+    }
+    return true;
+  }
+
+  // Prints the groups of an aggregating query to `output`.  Returns false
+  // if a record was malformed or spilled groups can't be read back.
+  bool Finish(Output* output) {
+    if (aggregator_ == nullptr)
+      return true;
+    const bool ok = aggregator_->Finish([output](absl::string_view line) {
+      output->buffer()->append(line.data(), line.size());
+      output->buffer()->push_back('\n');
+      output->Printed();
+      return !output->failed();
+    });
+    return ok && !malformed_;
+  }
+
+ private:
+  Matcher(const Options& options, std::unique_ptr<Schema> schema,
+          std::unique_ptr<QueryProgram> program)
+      : schema_(std::move(schema)),
+        program_(std::move(program)),
+        printer_(program_.get()),
+        batches_(options.jobs) {
+    if (program_->aggregating()) {
+      aggregator_ = std::make_unique<Aggregator>(
+          program_.get(),
+          AggregatorOptions{.workers = options.jobs,
+                            .memory_limit =
+                                static_cast<size_t>(options.memory_limit),
+                            .temp_dir = options.temp_dir});
+    }
+  }
+
+  const std::unique_ptr<Schema> schema_;
+  const std::unique_ptr<QueryProgram> program_;
+  RowPrinter printer_;
+  std::unique_ptr<Aggregator> aggregator_;
+  // The messages queued, end to end in `buffer_`, and where they came from.
+  std::string source_;
+  std::string buffer_;
+  std::vector<size_t> offsets_;
+  std::vector<uint64_t> indexes_;
+  std::vector<absl::string_view> messages_;
+  // A batch per worker; the queue is run on worker 0.
+  std::vector<QueryProgram::Batch> batches_;
+  QueryProgram::Row row_;
+  std::atomic<bool> malformed_ = false;
+};
+
+bool QueryBinary(const std::string& path, Matcher* matcher, Output* output) {
+  const int fd = OpenInput(path);
+  if (fd < 0)
+    return false;
+  std::string message;
+  char buffer[64 << 10];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    message.append(buffer, n);
+  }
+  const int read_errno = errno;
+  if (fd != STDIN_FILENO)
+    close(fd);
+  if (n < 0) {
+    std::cerr << path << ": " << strerror(read_errno) << std::endl;
+    return false;
+  }
+  return matcher->Add(path, 0, message, output) && matcher->Flush(output);
+}
+
+bool QueryDelimited(const std::string& path, Matcher* matcher,
+                    Output* output) {
+  const int fd = OpenInput(path);
+  if (fd < 0)
+    return false;
+  FileInputStream input(fd);
+  input.SetCloseOnDelete(fd != STDIN_FILENO);
+  protodb::DelimitedReader reader(&input);
+  std::string message;
+  bool ok = true;
+  while (!output->done()) {
+    const uint64_t index = reader.count();
+    switch (reader.Next(&message)) {
+      case protodb::DelimitedReader::OK:
+        ok &= matcher->Add(path, index, message, output);
+        continue;
+      case protodb::DelimitedReader::END_OF_STREAM:
+        return matcher->Flush(output) && ok;
+      case protodb::DelimitedReader::ERROR:
+        matcher->Flush(output);
+        std::cerr << path << ": truncated message " << index << std::endl;
+        return false;
+    }
+  }
+  return matcher->Flush(output) && ok;
+}
+
+// Compiles `query` with the schema in `header`, that of the records file
+// at `path`.  Returns nullptr and reports the error to stderr on failure.
+std::unique_ptr<Matcher> HeaderMatcher(const std::string& path,
+                                       const records::RecordSetHeader& header,
+                                       const Query& query,
+                                       const Options& options) {
+  if (header.descriptor_set().file().empty()) {
+    std::cerr << path << ": the header has no descriptor set, use "
+              << "--descriptor_set_in" << std::endl;
+    return nullptr;
+  }
+  auto schema = std::make_unique<Schema>();
+  if (!schema->Add(path, header.descriptor_set()))
+    return nullptr;
+  return Matcher::Create(query, options, std::move(schema));
+}
+
+// Aggregates a records file on `options.jobs` threads, each claiming
+// ranges of the file.
+bool AggregateRecords(const std::string& path, const Query& query,
+                      const Options& options,
+                      std::unique_ptr<Matcher>* matcher) {
+  records::ParallelReaderOptions reader_options;
+  reader_options.threads = options.jobs;
+  std::unique_ptr<records::ParallelRecordReader> reader =
+      records::ParallelRecordReader::Open(path, reader_options);
+  if (reader == nullptr)
+    return false;
+  if (*matcher == nullptr) {
+    *matcher = HeaderMatcher(path, reader->header(), query, options);
+    if (*matcher == nullptr)
+      return false;
+  }
+  Matcher* const aggregating = matcher->get();
+  return reader->ReadUnordered(
+      [&](int worker, const records::RecordBatch& batch) {
+        return aggregating->AddRecords(worker, path, batch);
+      });
+}
+
+// Queries a records file, with the schema in its header unless `matcher`
+// holds one.  An aggregating query keeps the matcher of the first file in
+// `matcher`, so that the groups of every file are merged.
+bool QueryRecords(const std::string& path, const Query& query,
+                  const Options& options, std::unique_ptr<Matcher>* matcher,
+                  Output* output) {
+  // Stdin can't be split into ranges, so it is read in order.
+  if (query.aggregating() && path != "-")
+    return AggregateRecords(path, query, options, matcher);
+
+  std::unique_ptr<records::RecordReader> reader =
+      records::RecordReader::Open(path == "-" ? "/dev/stdin" : path);
+  if (reader == nullptr)
+    return false;
+  std::unique_ptr<Matcher> header_matcher;
+  if (*matcher == nullptr) {
+    header_matcher = HeaderMatcher(path, reader->header(), query, options);
+    if (header_matcher == nullptr)
+      return false;
+  }
+  Matcher* const file_matcher =
+      header_matcher != nullptr ? header_matcher.get() : matcher->get();
+
+  bool ok = true;
+  absl::string_view record;
+  records::RecordReader::Status status = records::RecordReader::OK;
+  while (!output->done()) {
+    const uint64_t index = reader->count();
+    status = reader->Next(&record);
+    if (status != records::RecordReader::OK)
+      break;
+    ok &= file_matcher->Add(path, index, record, output);
+  }
+  ok &= file_matcher->Flush(output);
+  if (header_matcher != nullptr && header_matcher->aggregating())
+    *matcher = std::move(header_matcher);
+  if (status == records::RecordReader::CORRUPT) {
+    std::cerr << path << ": corrupt record at offset " << reader->offset()
+              << std::endl;
+    return false;
+  }
+  if (status == records::RecordReader::TRUNCATED) {
+    std::cerr << path << ": warning: partial record at offset "
+              << reader->offset() << std::endl;
+  }
+  return ok;
+}
+
+int Run(const Options& options) {
+  Query query;
+  std::string error;
+  if (!ParseQuery(options.query, &query, &error)) {
+    std::cerr << "protoquery: " << error << std::endl;
+    return 2;
+  }
+
+  std::unique_ptr<Matcher> matcher;
+  if (!options.descriptor_set_in.empty()) {
+    auto schema = std::make_unique<Schema>();
+    for (const std::string& path : options.descriptor_set_in) {
+      if (!schema->AddFile(path))
+        return 1;
+    }
+    matcher = Matcher::Create(query, options, std::move(schema));
+    if (matcher == nullptr)
+      return 1;
+  } else if (options.input != InputFormat::kRecords) {
+    std::cerr << "protoquery: --descriptor_set_in is needed unless reading "
+                 "records files"
+              << std::endl;
+    return 2;
+  }
+
+  std::vector<std::string> files = options.files;
+  if (files.empty())
+    files.push_back("-");
+  Output output(query.limit);
+  bool ok = true;
+  for (const std::string& path : files) {
+    if (output.done())
+      break;
+    switch (options.input) {
+      case InputFormat::kBinary:
+        ok &= QueryBinary(path, matcher.get(), &output);
+        break;
+      case InputFormat::kDelimited:
+        ok &= QueryDelimited(path, matcher.get(), &output);
+        break;
+      case InputFormat::kRecords:
+        ok &= QueryRecords(path, query, options, &matcher, &output);
+        break;
+    }
+  }
+  if (matcher != nullptr)
+    ok &= matcher->Finish(&output);
+  ok &= output.Flush();
+  return ok ? 0 : 1;
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: protoquery [--descriptor_set_in=FILES] "
+               "[--input=binary|delimited|records] QUERY [FILE...]\n"
+               "  --descriptor_set_in  descriptor sets holding the type, "
+               "separated by colons;\n"
+               "                       records files default to the schema "
+               "in their header\n"
+               "  --input              one binary message per file (the "
+               "default), length-delimited\n"
+               "                       messages or records files\n"
+               "  --jobs               threads aggregating records files "
+               "(default: one per core)\n"
+               "  --memory_limit       bytes of groups kept in memory before "
+               "they spill\n"
+               "                       (default: 1 GiB)\n"
+               "  --temp_dir           where groups spill (default: $TMPDIR "
+               "or /tmp)\n"
+               "Files default to stdin.  A query is\n"
+               "  select FIELDS|AGGREGATES|* from TYPE [where CONDITION]\n"
+               "      [group by FIELDS] [limit N]\n"
+               "where an aggregate is count(*), count(F), sum(F), min(F), "
+               "max(F),\n"
+               "approx_distinct(F) or approx_quantile(F, Q)."
+            << std::endl;
+}
+
+}  // namespace
+
 int Main(int argc, char* argv[]) {
   absl::InitializeLog();
 
-  // ABSL_LOG(INFO) << "start";
-
-  // CommandLineInterface cli;
-  // return cli.Run(argc, argv);
-  return 0;
+  Options options;
+  bool have_query = false;
+  for (int i = 1; i < argc; ++i) {
+    absl::string_view arg = argv[i];
+    if (absl::ConsumePrefix(&arg, "--descriptor_set_in=")) {
+      for (absl::string_view path :
+           absl::StrSplit(arg, ':', absl::SkipEmpty())) {
+        options.descriptor_set_in.push_back(std::string(path));
+      }
+    } else if (absl::ConsumePrefix(&arg, "--input=")) {
+      if (arg == "binary") {
+        options.input = InputFormat::kBinary;
+      } else if (arg == "delimited") {
+        options.input = InputFormat::kDelimited;
+      } else if (arg == "records") {
+        options.input = InputFormat::kRecords;
+      } else {
+        std::cerr << "unknown input format: " << arg << std::endl;
+        PrintUsage();
+        return 2;
+      }
+    } else if (absl::ConsumePrefix(&arg, "--jobs=")) {
+      if (!absl::SimpleAtoi(arg, &options.jobs) || options.jobs <= 0) {
+        std::cerr << "--jobs: expected a positive number" << std::endl;
+        return 2;
+      }
+    } else if (absl::ConsumePrefix(&arg, "--memory_limit=")) {
+      if (!absl::SimpleAtoi(arg, &options.memory_limit) ||
+          options.memory_limit <= 0) {
+        std::cerr << "--memory_limit: expected a positive number of bytes"
+                  << std::endl;
+        return 2;
+      }
+    } else if (absl::ConsumePrefix(&arg, "--temp_dir=")) {
+      options.temp_dir = std::string(arg);
+    } else if (absl::StartsWith(arg, "--")) {
+      std::cerr << "unknown argument: " << arg << std::endl;
+      PrintUsage();
+      return 2;
+    } else if (!have_query) {
+      options.query = std::string(arg);
+      have_query = true;
+    } else {
+      options.files.push_back(std::string(arg));
+    }
+  }
+  if (!have_query) {
+    PrintUsage();
+    return 2;
+  }
+  return Run(options);
 }
 
 }  // namespace protoquery
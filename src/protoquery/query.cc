@@ -0,0 +1,502 @@
+#include "protoquery/query.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace protoquery {
+
+namespace {
+
+struct Token {
+  enum Kind {
+    kEnd,
+    kName,
+    kInteger,
+    kFloat,
+    kString,
+    kSymbol,
+  };
+
+  Kind kind = kEnd;
+  // The token as written, or the unescaped contents of a string.
+  std::string text;
+  size_t offset = 0;
+};
+
+bool IsNameStart(char c) {
+  return absl::ascii_isalpha(c) || c == '_';
+}
+
+bool IsNameChar(char c) {
+  return absl::ascii_isalnum(c) || c == '_';
+}
+
+// Splits a query into tokens.
+class Lexer {
+ public:
+  Lexer(absl::string_view text, std::string* error)
+      : text_(text), error_(error) {}
+
+  bool Tokenize(std::vector<Token>* tokens) {
+    while (true) {
+      while (pos_ < text_.size() && absl::ascii_isspace(text_[pos_])) {
+        ++pos_;
+      }
+      Token token;
+      token.offset = pos_;
+      if (pos_ == text_.size()) {
+        tokens->push_back(std::move(token));
+        return true;
+      }
+      const char c = text_[pos_];
+      bool ok;
+      if (IsNameStart(c)) {
+        ok = LexName(&token);
+      } else if (absl::ascii_isdigit(c)) {
+        ok = LexNumber(&token);
+      } else if (c == '"' || c == '\'') {
+        ok = LexString(&token);
+      } else {
+        ok = LexSymbol(&token);
+      }
+      if (!ok)
+        return false;
+      tokens->push_back(std::move(token));
+    }
+  }
+
+ private:
+  bool Fail(size_t offset, absl::string_view message) {
+    *error_ = absl::StrCat(message, " at column ", offset + 1);
+    return false;
+  }
+
+  bool LexName(Token* token) {
+    const size_t start = pos_;
+    while (pos_ < text_.size() && IsNameChar(text_[pos_])) {
+      ++pos_;
+    }
+    token->kind = Token::kName;
+    token->text = std::string(text_.substr(start, pos_ - start));
+    return true;
+  }
+
+  void SkipDigits(bool hex) {
+    while (pos_ < text_.size() &&
+           (hex ? absl::ascii_isxdigit(text_[pos_])
+                : absl::ascii_isdigit(text_[pos_]))) {
+      ++pos_;
+    }
+  }
+
+  bool LexNumber(Token* token) {
+    const size_t start = pos_;
+    token->kind = Token::kInteger;
+    if (absl::StartsWithIgnoreCase(text_.substr(pos_), "0x")) {
+      pos_ += 2;
+      SkipDigits(/*hex=*/true);
+    } else {
+      SkipDigits(/*hex=*/false);
+      if (pos_ + 1 < text_.size() && text_[pos_] == '.' &&
+          absl::ascii_isdigit(text_[pos_ + 1])) {
+        token->kind = Token::kFloat;
+        ++pos_;
+        SkipDigits(/*hex=*/false);
+      }
+      if (pos_ < text_.size() && (text_[pos_] == 'e' || text_[pos_] == 'E')) {
+        token->kind = Token::kFloat;
+        ++pos_;
+        if (pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-'))
+          ++pos_;
+        SkipDigits(/*hex=*/false);
+      }
+    }
+    if (pos_ < text_.size() && IsNameChar(text_[pos_]))
+      return Fail(start, "invalid number");
+    token->text = std::string(text_.substr(start, pos_ - start));
+    return true;
+  }
+
+  bool LexString(Token* token) {
+    const size_t start = pos_;
+    const char quote = text_[pos_++];
+    while (pos_ < text_.size() && text_[pos_] != quote) {
+      pos_ += text_[pos_] == '\\' ? 2 : 1;
+    }
+    if (pos_ >= text_.size())
+      return Fail(start, "unterminated string");
+    const absl::string_view escaped =
+        text_.substr(start + 1, pos_ - start - 1);
+    ++pos_;
+    std::string unescape_error;
+    if (!absl::CUnescape(escaped, &token->text, &unescape_error))
+      return Fail(start, unescape_error);
+    token->kind = Token::kString;
+    return true;
+  }
+
+  bool LexSymbol(Token* token) {
+    static constexpr absl::string_view kSymbols[] = {
+        "==", "!=", "<>", "<=", ">=", "*", ",", ".",
+        "(",  ")",  "=",  "<",  ">",  "-",
+    };
+    for (absl::string_view symbol : kSymbols) {
+      if (absl::StartsWith(text_.substr(pos_), symbol)) {
+        token->kind = Token::kSymbol;
+        token->text = std::string(symbol);
+        pos_ += symbol.size();
+        return true;
+      }
+    }
+    return Fail(pos_, absl::StrCat("unexpected '", text_.substr(pos_, 1),
+                                   "'"));
+  }
+
+  const absl::string_view text_;
+  std::string* const error_;
+  size_t pos_ = 0;
+};
+
+// A recursive descent parser over the tokens of a query.
+class Parser {
+ public:
+  Parser(std::vector<Token> tokens, std::string* error)
+      : tokens_(std::move(tokens)), error_(error) {}
+
+  bool Parse(Query* query) {
+    if (!ExpectKeyword("select"))
+      return false;
+    if (!ConsumeSymbol("*")) {
+      int position = 0;
+      do {
+        if (token().kind == Token::kName && IsSymbol("(", 1)) {
+          Aggregate& aggregate = query->aggregates.emplace_back();
+          aggregate.position = position++;
+          if (!ParseAggregate(&aggregate))
+            return false;
+          continue;
+        }
+        std::string path;
+        if (!ParsePath(/*allow_star=*/true, &path))
+          return false;
+        query->select.push_back(std::move(path));
+        ++position;
+      } while (ConsumeSymbol(","));
+    }
+
+    if (!ExpectKeyword("from"))
+      return false;
+    ConsumeSymbol(".");
+    if (!ParsePath(/*allow_star=*/false, &query->from))
+      return false;
+
+    if (ConsumeKeyword("where")) {
+      query->where = ParseOr();
+      if (query->where == nullptr)
+        return false;
+    }
+    if (ConsumeKeyword("group")) {
+      if (!ExpectKeyword("by"))
+        return false;
+      do {
+        if (!ParsePath(/*allow_star=*/false, &query->group_by.emplace_back()))
+          return false;
+      } while (ConsumeSymbol(","));
+    }
+    if (ConsumeKeyword("limit")) {
+      if (token().kind != Token::kInteger ||
+          !absl::SimpleAtoi(token().text, &query->limit)) {
+        return Fail("a limit");
+      }
+      ++next_;
+    }
+    if (token().kind != Token::kEnd)
+      return Fail("the end of the query");
+    return true;
+  }
+
+ private:
+  const Token& token() const {
+    return tokens_[next_];
+  }
+
+  bool Fail(absl::string_view expected) {
+    const Token& found = token();
+    *error_ = absl::StrCat(
+        "expected ", expected, " but found ",
+        found.kind == Token::kEnd ? "the end of the query"
+                                  : absl::StrCat("'", found.text, "'"),
+        " at column ", found.offset + 1);
+    return false;
+  }
+
+  bool IsKeyword(absl::string_view keyword) const {
+    return token().kind == Token::kName &&
+           absl::EqualsIgnoreCase(token().text, keyword);
+  }
+
+  bool ConsumeKeyword(absl::string_view keyword) {
+    if (!IsKeyword(keyword))
+      return false;
+    ++next_;
+    return true;
+  }
+
+  bool ExpectKeyword(absl::string_view keyword) {
+    return ConsumeKeyword(keyword) || Fail(absl::StrCat("'", keyword, "'"));
+  }
+
+  bool IsSymbol(absl::string_view symbol, size_t ahead = 0) const {
+    const Token& found = tokens_[std::min(next_ + ahead, tokens_.size() - 1)];
+    return found.kind == Token::kSymbol && found.text == symbol;
+  }
+
+  bool ConsumeSymbol(absl::string_view symbol) {
+    if (!IsSymbol(symbol))
+      return false;
+    ++next_;
+    return true;
+  }
+
+  bool ExpectSymbol(absl::string_view symbol) {
+    return ConsumeSymbol(symbol) || Fail(absl::StrCat("'", symbol, "'"));
+  }
+
+  // Parses names separated by dots.  With `allow_star`, the path may end
+  // with `.*`, which is dropped.
+  bool ParsePath(bool allow_star, std::string* path) {
+    while (true) {
+      if (token().kind != Token::kName)
+        return Fail("a field name");
+      absl::StrAppend(path, token().text);
+      ++next_;
+      if (!ConsumeSymbol("."))
+        return true;
+      if (allow_star && ConsumeSymbol("*"))
+        return true;
+      absl::StrAppend(path, ".");
+    }
+  }
+
+  // Parses `function(path)`, `count(*)` or `approx_quantile(path, q)`.
+  bool ParseAggregate(Aggregate* aggregate) {
+    static constexpr std::pair<absl::string_view, Aggregate::Function>
+        kFunctions[] = {
+            {"count", Aggregate::kCount},
+            {"sum", Aggregate::kSum},
+            {"min", Aggregate::kMin},
+            {"max", Aggregate::kMax},
+            {"approx_distinct", Aggregate::kApproxDistinct},
+            {"approx_quantile", Aggregate::kApproxQuantile},
+        };
+    bool found = false;
+    for (const auto& [name, function] : kFunctions) {
+      if (ConsumeKeyword(name)) {
+        aggregate->function = function;
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      return Fail("an aggregate");
+    ++next_;  // The '('.
+
+    if (aggregate->function != Aggregate::kCount || !ConsumeSymbol("*")) {
+      if (!ParsePath(/*allow_star=*/false, &aggregate->path))
+        return false;
+    }
+    if (aggregate->function == Aggregate::kApproxQuantile) {
+      Literal quantile;
+      if (!ExpectSymbol(",") || !ParseLiteral(&quantile))
+        return false;
+      if ((quantile.kind != Literal::kInteger &&
+           quantile.kind != Literal::kFloat) ||
+          !(quantile.number >= 0 && quantile.number <= 1)) {
+        --next_;
+        return Fail("a quantile from 0 to 1");
+      }
+      aggregate->quantile = quantile.number;
+    }
+    return ExpectSymbol(")");
+  }
+
+  std::unique_ptr<Expr> Combine(Expr::Kind kind, std::unique_ptr<Expr> left,
+                                std::unique_ptr<Expr> right) {
+    auto expr = std::make_unique<Expr>();
+    expr->kind = kind;
+    expr->operands.push_back(std::move(left));
+    if (right != nullptr)
+      expr->operands.push_back(std::move(right));
+    return expr;
+  }
+
+  std::unique_ptr<Expr> ParseOr() {
+    std::unique_ptr<Expr> expr = ParseAnd();
+    while (expr != nullptr && ConsumeKeyword("or")) {
+      std::unique_ptr<Expr> right = ParseAnd();
+      if (right == nullptr)
+        return nullptr;
+      expr = Combine(Expr::kOr, std::move(expr), std::move(right));
+    }
+    return expr;
+  }
+
+  std::unique_ptr<Expr> ParseAnd() {
+    std::unique_ptr<Expr> expr = ParseUnary();
+    while (expr != nullptr && ConsumeKeyword("and")) {
+      std::unique_ptr<Expr> right = ParseUnary();
+      if (right == nullptr)
+        return nullptr;
+      expr = Combine(Expr::kAnd, std::move(expr), std::move(right));
+    }
+    return expr;
+  }
+
+  std::unique_ptr<Expr> ParseUnary() {
+    if (ConsumeKeyword("not")) {
+      std::unique_ptr<Expr> operand = ParseUnary();
+      if (operand == nullptr)
+        return nullptr;
+      return Combine(Expr::kNot, std::move(operand), nullptr);
+    }
+    return ParsePrimary();
+  }
+
+  std::unique_ptr<Expr> ParsePrimary() {
+    if (ConsumeSymbol("(")) {
+      std::unique_ptr<Expr> expr = ParseOr();
+      if (expr == nullptr || !ExpectSymbol(")"))
+        return nullptr;
+      return expr;
+    }
+
+    auto expr = std::make_unique<Expr>();
+    if (IsKeyword("has") && IsSymbol("(", 1)) {
+      next_ += 2;
+      expr->kind = Expr::kHas;
+      if (!ParsePath(/*allow_star=*/false, &expr->path) || !ExpectSymbol(")"))
+        return nullptr;
+      return expr;
+    }
+
+    if (IsKeyword("starts_with") && IsSymbol("(", 1)) {
+      next_ += 2;
+      expr->kind = Expr::kPrefix;
+      if (!ParsePath(/*allow_star=*/false, &expr->path) ||
+          !ExpectSymbol(",") || !ParseLiteral(&expr->value) ||
+          !ExpectSymbol(")")) {
+        return nullptr;
+      }
+      return expr;
+    }
+
+    if (!ParsePath(/*allow_star=*/false, &expr->path))
+      return nullptr;
+    if (ConsumeKeyword("in")) {
+      expr->kind = Expr::kIn;
+      if (!ExpectSymbol("("))
+        return nullptr;
+      do {
+        if (!ParseLiteral(&expr->values.emplace_back()))
+          return nullptr;
+      } while (ConsumeSymbol(","));
+      if (!ExpectSymbol(")"))
+        return nullptr;
+      return expr;
+    }
+    expr->kind = Expr::kCompare;
+    if (!ParseCompareOp(&expr->op) || !ParseLiteral(&expr->value))
+      return nullptr;
+    return expr;
+  }
+
+  bool ParseCompareOp(CompareOp* op) {
+    static constexpr std::pair<absl::string_view, CompareOp> kOps[] = {
+        {"=", CompareOp::kEq},  {"==", CompareOp::kEq}, {"!=", CompareOp::kNe},
+        {"<>", CompareOp::kNe}, {"<", CompareOp::kLt},  {"<=", CompareOp::kLe},
+        {">", CompareOp::kGt},  {">=", CompareOp::kGe},
+    };
+    for (const auto& [symbol, value] : kOps) {
+      if (ConsumeSymbol(symbol)) {
+        *op = value;
+        return true;
+      }
+    }
+    return Fail("a comparison");
+  }
+
+  bool ParseLiteral(Literal* literal) {
+    literal->negative = ConsumeSymbol("-");
+    const Token& value = token();
+    switch (value.kind) {
+      case Token::kInteger: {
+        const bool parsed =
+            absl::StartsWithIgnoreCase(value.text, "0x")
+                ? absl::SimpleHexAtoi(value.text.substr(2), &literal->integer)
+                : absl::SimpleAtoi(value.text, &literal->integer);
+        if (!parsed)
+          return Fail("an integer that fits in 64 bits");
+        literal->kind = Literal::kInteger;
+        literal->number = static_cast<double>(literal->integer);
+        break;
+      }
+      case Token::kFloat:
+        if (!absl::SimpleAtod(value.text, &literal->number))
+          return Fail("a number");
+        literal->kind = Literal::kFloat;
+        break;
+      case Token::kString:
+        if (literal->negative)
+          return Fail("a number");
+        literal->kind = Literal::kString;
+        literal->text = value.text;
+        break;
+      case Token::kName:
+        if (literal->negative)
+          return Fail("a number");
+        if (absl::EqualsIgnoreCase(value.text, "true") ||
+            absl::EqualsIgnoreCase(value.text, "false")) {
+          literal->kind = Literal::kBool;
+          literal->boolean = absl::EqualsIgnoreCase(value.text, "true");
+        } else {
+          literal->kind = Literal::kName;
+          literal->text = value.text;
+        }
+        break;
+      default:
+        return Fail("a value");
+    }
+    if (literal->negative)
+      literal->number = -literal->number;
+    ++next_;
+    return true;
+  }
+
+  const std::vector<Token> tokens_;
+  std::string* const error_;
+  size_t next_ = 0;
+};
+
+}  // namespace
+
+bool ParseQuery(absl::string_view text, Query* query, std::string* error) {
+  std::vector<Token> tokens;
+  if (!Lexer(text, error).Tokenize(&tokens))
+    return false;
+  *query = Query();
+  return Parser(std::move(tokens), error).Parse(query);
+}
+
+}  // namespace protoquery
@@ -0,0 +1,137 @@
+#ifndef PROTOQUERY_QUERY_H__
+#define PROTOQUERY_QUERY_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace protoquery {
+
+// A literal in a comparison, as written.  Its meaning depends on the field
+// it is compared with, which is only known once the query is compiled.
+struct Literal {
+  enum Kind {
+    kInteger,
+    kFloat,
+    kString,
+    kBool,
+    // A bare name, such as an enum value.
+    kName,
+  };
+
+  Kind kind = kInteger;
+  // The magnitude of an integer, with its sign kept apart so that the whole
+  // range of both int64 and uint64 can be written.
+  uint64_t integer = 0;
+  bool negative = false;
+  double number = 0;
+  bool boolean = false;
+  // The unescaped contents of a string, or a name.
+  std::string text;
+};
+
+enum class CompareOp {
+  kEq,
+  kNe,
+  kLt,
+  kLe,
+  kGt,
+  kGe,
+};
+
+// A node of a `where` expression.
+struct Expr {
+  enum Kind {
+    // `path op value`.
+    kCompare,
+    // `path in (value, ...)`.
+    kIn,
+    // `has(path)`.
+    kHas,
+    // `starts_with(path, "prefix")`.
+    kPrefix,
+    kAnd,
+    kOr,
+    kNot,
+  };
+
+  Kind kind = kCompare;
+  // A dotted path of field names.
+  std::string path;
+  CompareOp op = CompareOp::kEq;
+  // The value of a comparison or the prefix.
+  Literal value;
+  // The values of an `in` list.
+  std::vector<Literal> values;
+  // Two operands for kAnd and kOr, one for kNot.
+  std::vector<std::unique_ptr<Expr>> operands;
+};
+
+// An aggregate in the `select` list, such as `sum(price)`.
+struct Aggregate {
+  enum Function {
+    kCount,
+    kSum,
+    kMin,
+    kMax,
+    // An estimate of the number of distinct values.
+    kApproxDistinct,
+    // An estimate of a quantile of the values.
+    kApproxQuantile,
+  };
+
+  Function function = kCount;
+  // The dotted path of the field aggregated, or empty for `count(*)`.
+  std::string path;
+  // The quantile estimated by kApproxQuantile, from 0 to 1.
+  double quantile = 0;
+  // The position of the aggregate in the `select` list, counting fields
+  // and aggregates.
+  int position = 0;
+};
+
+// A parsed query:
+//
+//   select name, address.city from example.Person
+//   where age >= 21 and (address.country in ("NZ", "AU") or has(nickname))
+//     and not starts_with(name, "test_")
+//   limit 10
+//
+// or, aggregating:
+//
+//   select address.city, count(*), approx_quantile(age, 0.9)
+//   from example.Person group by address.city
+//
+// Keywords are case-insensitive.  `select *` selects whole messages, and a
+// path may end in `.*` to select a whole submessage, as in `file.*`.
+// Strings are quoted with single or double quotes and take C escapes.
+struct Query {
+  // The dotted field paths to print, or none to print whole messages.
+  std::vector<std::string> select;
+  // The aggregates selected, in order.
+  std::vector<Aggregate> aggregates;
+  // The full name of the message type.
+  std::string from;
+  // Null without a `where` clause.
+  std::unique_ptr<Expr> where;
+  // The dotted paths of the `group by` clause.
+  std::vector<std::string> group_by;
+  // The most messages, or groups, to print, or -1 for all of them.
+  int64_t limit = -1;
+
+  // Whether the query prints groups rather than messages.
+  bool aggregating() const {
+    return !aggregates.empty() || !group_by.empty();
+  }
+};
+
+// Parses `text` into `query`.  Returns false and sets `error` if it isn't a
+// valid query.
+bool ParseQuery(absl::string_view text, Query* query, std::string* error);
+
+}  // namespace protoquery
+
+#endif  // PROTOQUERY_QUERY_H__
@@ -0,0 +1,109 @@
+// Compares filtering messages one at a time with QueryProgram::Evaluate()
+// against filtering them in batches with EvaluateBatch().
+//
+//   bazel run -c opt //src/protoquery:query_benchmark
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/query.h"
+#include "protoquery/query_program.h"
+
+namespace protoquery {
+namespace {
+
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::FieldDescriptorProto;
+using ::google::protobuf::FileDescriptorProto;
+
+// Every field of descriptor.proto, repeated to fill many batches.
+std::vector<std::string> SampleFields() {
+  FileDescriptorProto file;
+  FileDescriptorProto::descriptor()->file()->CopyTo(&file);
+  std::vector<std::string> fields;
+  while (fields.size() < 100000) {
+    for (const auto& message : file.message_type()) {
+      for (const FieldDescriptorProto& field : message.field()) {
+        fields.push_back(field.SerializeAsString());
+      }
+    }
+  }
+  return fields;
+}
+
+constexpr const char* kQueries[] = {
+    "select name from google.protobuf.FieldDescriptorProto "
+    "where number > 5 and label = LABEL_OPTIONAL",
+    "select name from google.protobuf.FieldDescriptorProto "
+    "where type in (TYPE_STRING, TYPE_BYTES, TYPE_MESSAGE)",
+    "select name from google.protobuf.FieldDescriptorProto "
+    "where starts_with(name, 'java') or json_name = 'options'",
+    "select name from google.protobuf.FieldDescriptorProto "
+    "where (number in (1, 2, 3, 4, 5, 6, 7) or number > 100) "
+    "and not type in (TYPE_INT32, TYPE_INT64) "
+    "and (label = LABEL_OPTIONAL or oneof_index >= 0) "
+    "and proto3_optional != true",
+};
+
+std::unique_ptr<QueryProgram> CompileQuery(int index,
+                                           protodb::ParsePlanCache* plans) {
+  Query query;
+  std::string error;
+  if (!ParseQuery(kQueries[index], &query, &error))
+    return nullptr;
+  return QueryProgram::Compile(query, DescriptorPool::generated_pool(), plans,
+                               &error);
+}
+
+void BM_Evaluate(benchmark::State& state) {
+  const std::vector<std::string> fields = SampleFields();
+  protodb::ParsePlanCache plans;
+  const std::unique_ptr<QueryProgram> program =
+      CompileQuery(state.range(0), &plans);
+  QueryProgram::Row row;
+  for (auto _ : state) {
+    int64_t matches = 0;
+    for (const std::string& field : fields) {
+      matches += program->Evaluate(field, &row) == QueryProgram::MATCH;
+    }
+    benchmark::DoNotOptimize(matches);
+  }
+  state.SetItemsProcessed(state.iterations() * fields.size());
+}
+BENCHMARK(BM_Evaluate)->DenseRange(0, std::size(kQueries) - 1);
+
+void BM_EvaluateBatch(benchmark::State& state) {
+  const std::vector<std::string> fields = SampleFields();
+  const std::vector<absl::string_view> views(fields.begin(), fields.end());
+  protodb::ParsePlanCache plans;
+  const std::unique_ptr<QueryProgram> program =
+      CompileQuery(state.range(0), &plans);
+  QueryProgram::Batch batch;
+  for (auto _ : state) {
+    int64_t matches = 0;
+    for (size_t i = 0; i < views.size(); i += QueryProgram::kBatchSize) {
+      program->EvaluateBatch(
+          absl::MakeConstSpan(views).subspan(i, QueryProgram::kBatchSize),
+          &batch);
+      for (uint64_t word : batch.selection) {
+        matches += __builtin_popcountll(word);
+      }
+    }
+    benchmark::DoNotOptimize(matches);
+  }
+  state.SetItemsProcessed(state.iterations() * fields.size());
+}
+BENCHMARK(BM_EvaluateBatch)->DenseRange(0, std::size(kQueries) - 1);
+
+}  // namespace
+}  // namespace protoquery
+
+BENCHMARK_MAIN();
@@ -0,0 +1,1122 @@
+#include "protoquery/query_program.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/query.h"
+
+namespace protoquery {
+
+using ::google::protobuf::EnumValueDescriptor;
+using ::google::protobuf::internal::WireFormatLite;
+
+namespace {
+
+// Field numbers below this value are looked up in a dense table, as in
+// ParsePlan.  Scans hold few fields, so larger ones are searched for.
+constexpr uint32_t kMaxDenseFieldNumber = 1024;
+
+// Matches the default recursion limit of the protobuf parser.
+constexpr int kMaxDepth = 100;
+
+// `in` lists up to this long are matched with a pass over the values for
+// each constant, which vectorizes, rather than a search per value.
+constexpr size_t kMaxScannedInList = 8;
+
+size_t Words(size_t bits) {
+  return (bits + 63) / 64;
+}
+
+void SetBit(uint64_t* words, size_t i) {
+  words[i / 64] |= uint64_t{1} << (i % 64);
+}
+
+bool GetBit(const uint64_t* words, size_t i) {
+  return (words[i / 64] >> (i % 64)) & 1;
+}
+
+// Whether any bit from `begin` up to `end` is set.
+bool AnyBit(const uint64_t* words, size_t begin, size_t end) {
+  for (; begin < end && begin % 64 != 0; ++begin) {
+    if (GetBit(words, begin))
+      return true;
+  }
+  for (; begin + 64 <= end; begin += 64) {
+    if (words[begin / 64] != 0)
+      return true;
+  }
+  for (; begin < end; ++begin) {
+    if (GetBit(words, begin))
+      return true;
+  }
+  return false;
+}
+
+// Packs 64 bytes, each 0 or 1, into the bits of a word.
+uint64_t PackBits(const uint8_t* bytes) {
+  uint64_t word = 0;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t chunk;
+    std::memcpy(&chunk, bytes + 8 * i, 8);
+    // Gathers the low bit of each byte into the top byte of the product.
+    word |= ((chunk * 0x0102040810204080) >> 56) << (8 * i);
+  }
+  return word;
+}
+
+// Sets bit `i` of `out` to whether `values[i]` passes `predicate`, or with
+// `kOr`, sets it if it does.  The predicate runs over 64 values at a time
+// into bytes, a loop without branches that compilers vectorize for integer
+// and floating point comparisons, and the bytes are then packed into a word.
+template <bool kOr = false, typename V, typename Predicate>
+void SelectIf(const V* values, size_t n, Predicate predicate, uint64_t* out) {
+  uint8_t matches[64];
+  for (size_t base = 0; base < n; base += 64) {
+    if (base + 64 <= n) {
+      for (int j = 0; j < 64; ++j) {
+        matches[j] = predicate(values[base + j]);
+      }
+    } else {
+      std::fill(std::begin(matches), std::end(matches), 0);
+      for (size_t j = 0; base + j < n; ++j) {
+        matches[j] = predicate(values[base + j]);
+      }
+    }
+    const uint64_t word = PackBits(matches);
+    out[base / 64] = kOr ? out[base / 64] | word : word;
+  }
+}
+
+// Selects the values that compare with `constant` once read with `get`.
+// The comparison is chosen outside the loop so that each loop is a single
+// comparison.
+template <typename V, typename Get, typename T>
+void SelectCompare(CompareOp op, const V* values, size_t n, Get get,
+                   const T& constant, uint64_t* out) {
+  switch (op) {
+    case CompareOp::kEq:
+      SelectIf(values, n, [&](const V& v) { return get(v) == constant; }, out);
+      return;
+    case CompareOp::kNe:
+      SelectIf(values, n, [&](const V& v) { return get(v) != constant; }, out);
+      return;
+    case CompareOp::kLt:
+      SelectIf(values, n, [&](const V& v) { return get(v) < constant; }, out);
+      return;
+    case CompareOp::kLe:
+      SelectIf(values, n, [&](const V& v) { return get(v) <= constant; }, out);
+      return;
+    case CompareOp::kGt:
+      SelectIf(values, n, [&](const V& v) { return get(v) > constant; }, out);
+      return;
+    case CompareOp::kGe:
+      SelectIf(values, n, [&](const V& v) { return get(v) >= constant; }, out);
+      return;
+  }
+}
+
+// Selects the values that, read with `get`, are in the sorted `list`.
+template <typename V, typename Get, typename T>
+void SelectIn(const std::vector<T>& list, const V* values, size_t n, Get get,
+              uint64_t* out) {
+  if (list.size() > kMaxScannedInList) {
+    SelectIf(
+        values, n,
+        [&](const V& v) {
+          return std::binary_search(list.begin(), list.end(), get(v));
+        },
+        out);
+    return;
+  }
+  std::fill(out, out + Words(n), 0);
+  for (const T& constant : list) {
+    SelectIf</*kOr=*/true>(
+        values, n, [&](const V& v) { return get(v) == constant; }, out);
+  }
+}
+
+// How the kernels read values, as function objects so that they inline.
+struct GetSigned {
+  int64_t operator()(uint64_t bits) const {
+    return static_cast<int64_t>(bits);
+  }
+};
+
+struct GetUnsigned {
+  uint64_t operator()(uint64_t bits) const {
+    return bits;
+  }
+};
+
+struct GetFloat {
+  double operator()(uint64_t bits) const {
+    return ParsePlan::AsFloat(bits);
+  }
+};
+
+struct GetDouble {
+  double operator()(uint64_t bits) const {
+    return ParsePlan::AsDouble(bits);
+  }
+};
+
+struct GetString {
+  absl::string_view operator()(absl::string_view data) const {
+    return data;
+  }
+};
+
+template <typename T>
+bool Compare(CompareOp op, const T& a, const T& b) {
+  switch (op) {
+    case CompareOp::kEq:
+      return a == b;
+    case CompareOp::kNe:
+      return a != b;
+    case CompareOp::kLt:
+      return a < b;
+    case CompareOp::kLe:
+      return a <= b;
+    case CompareOp::kGt:
+      return a > b;
+    case CompareOp::kGe:
+      return a >= b;
+  }
+  return false;
+}
+
+// The value of an integer literal as an int64.  Returns false if it is out
+// of range.
+bool SignedValue(const Literal& literal, int64_t* value) {
+  constexpr uint64_t kMax = std::numeric_limits<int64_t>::max();
+  if (literal.integer > kMax + (literal.negative ? 1 : 0))
+    return false;
+  *value = literal.negative ? static_cast<int64_t>(0 - literal.integer)
+                            : static_cast<int64_t>(literal.integer);
+  return true;
+}
+
+bool IsNumber(const FieldDescriptor* field) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+    case FieldDescriptor::CPPTYPE_FLOAT:
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+absl::string_view FunctionName(Aggregate::Function function) {
+  switch (function) {
+    case Aggregate::kCount:
+      return "count";
+    case Aggregate::kSum:
+      return "sum";
+    case Aggregate::kMin:
+      return "min";
+    case Aggregate::kMax:
+      return "max";
+    case Aggregate::kApproxDistinct:
+      return "approx_distinct";
+    case Aggregate::kApproxQuantile:
+      return "approx_quantile";
+  }
+  return "";
+}
+
+}  // namespace
+
+// The fields needed from one message type on the query's paths.
+struct QueryProgram::Scan {
+  struct Action {
+    const ParsePlan::Field* field;
+    // The slot receiving the field's values, or -1 if the field is only
+    // on the way to others.
+    int slot = -1;
+    // Whether the slot keeps every value, on a path through a repeated
+    // field, rather than the last.
+    bool append = false;
+    // The scan of the submessage when a path continues into it.
+    std::unique_ptr<Scan> message;
+  };
+
+  explicit Scan(const ParsePlan* plan) : plan(plan) {}
+
+  const Action* Find(uint32_t number) const {
+    if (number < dense.size()) {
+      const int32_t index = dense[number];
+      return index < 0 ? nullptr : &actions[index];
+    }
+    if (number < kMaxDenseFieldNumber)
+      return nullptr;
+    for (const Action& action : actions) {
+      if (action.field->descriptor->number() == static_cast<int>(number))
+        return &action;
+    }
+    return nullptr;
+  }
+
+  // Returns the action for `field`, adding it if it's new.
+  Action& Add(const ParsePlan::Field* field) {
+    for (Action& action : actions) {
+      if (action.field == field)
+        return action;
+    }
+    const uint32_t number = field->descriptor->number();
+    if (number < kMaxDenseFieldNumber) {
+      if (number >= dense.size())
+        dense.resize(number + 1, -1);
+      dense[number] = actions.size();
+    }
+    actions.push_back(Action{.field = field});
+    return actions.back();
+  }
+
+  const ParsePlan* const plan;
+  // Field number to index into `actions`, or -1.
+  std::vector<int32_t> dense;
+  std::vector<Action> actions;
+};
+
+struct QueryProgram::Slot {
+  // Whether the slot keeps every value, see Scan::Action.
+  bool append = false;
+  bool defaulted = false;
+  Value default_value;
+};
+
+struct QueryProgram::Instruction {
+  enum Op {
+    // Pushes whether a value in `slot` compares with the constant.
+    kCompare,
+    // Pushes whether a value in `slot` is one of the constants.
+    kIn,
+    // Pushes whether a string in `slot` starts with `text`.
+    kPrefix,
+    // Pushes whether `slot` has a value.
+    kHas,
+    // Replace the top one or two results with their combination.
+    kAnd,
+    kOr,
+    kNot,
+  };
+
+  // How values of the slot are compared.
+  enum Type {
+    kSigned,
+    kUnsigned,
+    // A float field, widened to a double.
+    kFloat,
+    kDouble,
+    kString,
+  };
+
+  Op op = kCompare;
+  CompareOp compare = CompareOp::kEq;
+  Type type = kSigned;
+  int slot = -1;
+  // The constant of integer, enum and bool comparisons.
+  uint64_t bits = 0;
+  double number = 0;
+  std::string text;
+  // The constants of an `in` list, sorted.
+  std::vector<uint64_t> bits_list;
+  std::vector<double> number_list;
+  absl::flat_hash_set<std::string> text_set;
+
+  bool Test(const Value& value) const {
+    if (op == kIn)
+      return Contains(value);
+    if (op == kPrefix)
+      return absl::StartsWith(value.data, text);
+    switch (type) {
+      case kSigned:
+        return Compare(compare, static_cast<int64_t>(value.bits),
+                       static_cast<int64_t>(bits));
+      case kUnsigned:
+        return Compare(compare, value.bits, bits);
+      case kFloat:
+        return Compare(compare,
+                       static_cast<double>(ParsePlan::AsFloat(value.bits)),
+                       number);
+      case kDouble:
+        return Compare(compare, ParsePlan::AsDouble(value.bits), number);
+      case kString:
+        return Compare(compare, value.data, absl::string_view(text));
+    }
+    return false;
+  }
+
+  bool Contains(const Value& value) const {
+    switch (type) {
+      case kSigned:
+      case kUnsigned:
+        return std::binary_search(bits_list.begin(), bits_list.end(),
+                                  value.bits);
+      case kFloat:
+        return std::binary_search(number_list.begin(), number_list.end(),
+                                  GetFloat()(value.bits));
+      case kDouble:
+        return std::binary_search(number_list.begin(), number_list.end(),
+                                  GetDouble()(value.bits));
+      case kString:
+        return text_set.contains(value.data);
+    }
+    return false;
+  }
+
+  // Sets bit `i` of `out` for each of the `size` messages with a value in
+  // `vector` that passes the test.
+  void Select(const Slot& slot, const Batch::Vector& vector, int size,
+              uint64_t* out, std::vector<uint64_t>* scratch) const {
+    if (!slot.append) {
+      SelectValues(vector, size, out);
+      if (!slot.defaulted) {
+        for (size_t i = 0; i < Words(size); ++i) {
+          out[i] &= vector.present[i];
+        }
+      }
+      return;
+    }
+    // Select the values, then the messages with any of them.
+    const size_t count = vector.bits.size();
+    scratch->resize(Words(count));
+    SelectValues(vector, count, scratch->data());
+    std::fill(out, out + Words(size), 0);
+    for (int i = 0; i < size; ++i) {
+      if (AnyBit(scratch->data(), vector.offsets[i], vector.offsets[i + 1]))
+        SetBit(out, i);
+    }
+  }
+
+  // Sets bit `i` of `out` to whether the value `i` of `vector` passes.
+  void SelectValues(const Batch::Vector& vector, size_t n,
+                    uint64_t* out) const {
+    const uint64_t* const values = vector.bits.data();
+    const absl::string_view* const data = vector.data.data();
+    if (op == kPrefix) {
+      SelectIf(
+          data, n,
+          [&](absl::string_view v) { return absl::StartsWith(v, text); },
+          out);
+      return;
+    }
+    if (op == kIn) {
+      switch (type) {
+        case kSigned:
+        case kUnsigned:
+          SelectIn(bits_list, values, n, GetUnsigned(), out);
+          return;
+        case kFloat:
+          SelectIn(number_list, values, n, GetFloat(), out);
+          return;
+        case kDouble:
+          SelectIn(number_list, values, n, GetDouble(), out);
+          return;
+        case kString:
+          SelectIf(
+              data, n,
+              [&](absl::string_view v) { return text_set.contains(v); }, out);
+          return;
+      }
+    }
+    switch (type) {
+      case kSigned:
+        SelectCompare(compare, values, n, GetSigned(),
+                      static_cast<int64_t>(bits), out);
+        return;
+      case kUnsigned:
+        SelectCompare(compare, values, n, GetUnsigned(), bits, out);
+        return;
+      case kFloat:
+        SelectCompare(compare, values, n, GetFloat(), number, out);
+        return;
+      case kDouble:
+        SelectCompare(compare, values, n, GetDouble(), number, out);
+        return;
+      case kString:
+        SelectCompare(compare, data, n, GetString(), absl::string_view(text),
+                      out);
+        return;
+    }
+  }
+};
+
+// Resolves the paths of a query into scans and slots and its `where`
+// clause into instructions.
+class QueryProgram::Compiler {
+ public:
+  Compiler(QueryProgram* program, std::string* error)
+      : program_(program), error_(error) {}
+
+  std::string* error() const {
+    return error_;
+  }
+
+  // Returns the slot of `path`, adding its fields to the scans, or -1 if
+  // it doesn't name a field.  Sets `field` to the field at its end.
+  int AddPath(const std::string& path, const FieldDescriptor** field) {
+    if (const auto it = paths_.find(path); it != paths_.end()) {
+      *field = it->second.second;
+      return it->second.first;
+    }
+
+    const int slot = program_->slots_.size();
+    Scan* scan = program_->root_.get();
+    bool repeated = false;
+    const std::vector<absl::string_view> names = absl::StrSplit(path, '.');
+    for (size_t i = 0; i < names.size(); ++i) {
+      const Descriptor* type = scan->plan->descriptor();
+      const FieldDescriptor* descriptor =
+          type->FindFieldByName(std::string(names[i]));
+      if (descriptor == nullptr) {
+        *error_ = absl::StrCat("no field ", names[i], " in ", type->full_name());
+        return -1;
+      }
+      const ParsePlan::Field& plan_field = scan->plan->field(descriptor->index());
+      repeated |= plan_field.repeated;
+      Scan::Action& action = scan->Add(&plan_field);
+      if (i + 1 == names.size()) {
+        action.slot = slot;
+        action.append = repeated;
+        *field = descriptor;
+        break;
+      }
+      if (plan_field.message == nullptr) {
+        *error_ = absl::StrCat(descriptor->full_name(), " is not a message");
+        return -1;
+      }
+      if (action.message == nullptr)
+        action.message = std::make_unique<Scan>(plan_field.message);
+      scan = action.message.get();
+    }
+
+    Slot& added = program_->slots_.emplace_back();
+    added.append = repeated;
+    const FieldDescriptor* leaf = *field;
+    if (!repeated && !leaf->has_presence()) {
+      added.defaulted = true;
+      if (leaf->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+        added.default_value.data = leaf->default_value_string();
+      } else {
+        added.default_value.bits = ParsePlan::DefaultBits(leaf);
+      }
+    }
+    paths_[path] = {slot, leaf};
+    return slot;
+  }
+
+  // Appends the instructions of `expr`.
+  bool AddExpr(const Expr& expr) {
+    Instruction instruction;
+    switch (expr.kind) {
+      case Expr::kAnd:
+      case Expr::kOr:
+      case Expr::kNot:
+        for (const auto& operand : expr.operands) {
+          if (!AddExpr(*operand))
+            return false;
+        }
+        instruction.op = expr.kind == Expr::kAnd  ? Instruction::kAnd
+                         : expr.kind == Expr::kOr ? Instruction::kOr
+                                                  : Instruction::kNot;
+        break;
+      case Expr::kHas: {
+        const FieldDescriptor* field;
+        instruction.op = Instruction::kHas;
+        instruction.slot = AddPath(expr.path, &field);
+        if (instruction.slot < 0)
+          return false;
+        break;
+      }
+      case Expr::kCompare: {
+        const FieldDescriptor* field;
+        instruction.op = Instruction::kCompare;
+        instruction.compare = expr.op;
+        instruction.slot = AddPath(expr.path, &field);
+        if (instruction.slot < 0 ||
+            !SetConstant(expr, expr.value, field, &instruction)) {
+          return false;
+        }
+        break;
+      }
+      case Expr::kIn: {
+        const FieldDescriptor* field;
+        instruction.op = Instruction::kIn;
+        instruction.slot = AddPath(expr.path, &field);
+        if (instruction.slot < 0)
+          return false;
+        for (const Literal& literal : expr.values) {
+          if (!SetConstant(expr, literal, field, &instruction))
+            return false;
+          switch (instruction.type) {
+            case Instruction::kSigned:
+            case Instruction::kUnsigned:
+              instruction.bits_list.push_back(instruction.bits);
+              break;
+            case Instruction::kFloat:
+            case Instruction::kDouble:
+              instruction.number_list.push_back(instruction.number);
+              break;
+            case Instruction::kString:
+              instruction.text_set.insert(instruction.text);
+              break;
+          }
+        }
+        SortUnique(&instruction.bits_list);
+        SortUnique(&instruction.number_list);
+        break;
+      }
+      case Expr::kPrefix: {
+        const FieldDescriptor* field;
+        instruction.op = Instruction::kPrefix;
+        instruction.slot = AddPath(expr.path, &field);
+        if (instruction.slot < 0)
+          return false;
+        if (field->cpp_type() != FieldDescriptor::CPPTYPE_STRING) {
+          *error_ = absl::StrCat("starts_with() needs a string or bytes "
+                                 "field, not ",
+                                 expr.path);
+          return false;
+        }
+        if (!SetConstant(expr, expr.value, field, &instruction))
+          return false;
+        break;
+      }
+    }
+    program_->instructions_.push_back(std::move(instruction));
+    return true;
+  }
+
+ private:
+  bool Expected(const Expr& expr, absl::string_view expected) {
+    *error_ = absl::StrCat(expr.path, " must be compared with ", expected);
+    return false;
+  }
+
+  template <typename T>
+  static void SortUnique(std::vector<T>* values) {
+    std::sort(values->begin(), values->end());
+    values->erase(std::unique(values->begin(), values->end()), values->end());
+  }
+
+  // Sets the type and constant of a comparison of `expr`'s field with
+  // `literal`.
+  bool SetConstant(const Expr& expr, const Literal& literal,
+                   const FieldDescriptor* field, Instruction* instruction) {
+    switch (field->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_INT32:
+      case FieldDescriptor::CPPTYPE_INT64: {
+        int64_t value;
+        if (literal.kind != Literal::kInteger || !SignedValue(literal, &value))
+          return Expected(expr, "a signed 64-bit integer");
+        instruction->type = Instruction::kSigned;
+        instruction->bits = static_cast<uint64_t>(value);
+        return true;
+      }
+      case FieldDescriptor::CPPTYPE_UINT32:
+      case FieldDescriptor::CPPTYPE_UINT64:
+        if (literal.kind != Literal::kInteger || literal.negative)
+          return Expected(expr, "an unsigned integer");
+        instruction->type = Instruction::kUnsigned;
+        instruction->bits = literal.integer;
+        return true;
+      case FieldDescriptor::CPPTYPE_ENUM: {
+        int64_t value;
+        if (literal.kind == Literal::kName) {
+          const EnumValueDescriptor* enum_value =
+              field->enum_type()->FindValueByName(literal.text);
+          if (enum_value == nullptr) {
+            *error_ = absl::StrCat("no value ", literal.text, " in ",
+                                   field->enum_type()->full_name());
+            return false;
+          }
+          value = enum_value->number();
+        } else if (literal.kind != Literal::kInteger ||
+                   !SignedValue(literal, &value)) {
+          return Expected(expr, "a value of " + field->enum_type()->full_name());
+        }
+        instruction->type = Instruction::kSigned;
+        instruction->bits = static_cast<uint64_t>(value);
+        return true;
+      }
+      case FieldDescriptor::CPPTYPE_BOOL:
+        if (literal.kind != Literal::kBool)
+          return Expected(expr, "true or false");
+        instruction->type = Instruction::kUnsigned;
+        instruction->bits = literal.boolean;
+        return true;
+      case FieldDescriptor::CPPTYPE_FLOAT:
+      case FieldDescriptor::CPPTYPE_DOUBLE:
+        if (literal.kind != Literal::kInteger && literal.kind != Literal::kFloat)
+          return Expected(expr, "a number");
+        if (field->cpp_type() == FieldDescriptor::CPPTYPE_FLOAT) {
+          // Rounded as the field's values were.
+          instruction->type = Instruction::kFloat;
+          instruction->number = static_cast<float>(literal.number);
+        } else {
+          instruction->type = Instruction::kDouble;
+          instruction->number = literal.number;
+        }
+        return true;
+      case FieldDescriptor::CPPTYPE_STRING:
+        if (literal.kind != Literal::kString)
+          return Expected(expr, "a string");
+        instruction->type = Instruction::kString;
+        instruction->text = literal.text;
+        return true;
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+        *error_ = absl::StrCat(expr.path,
+                               " is a message and can't be compared, use "
+                               "has() or one of its fields");
+        return false;
+    }
+    return false;
+  }
+
+  QueryProgram* const program_;
+  std::string* const error_;
+  // The slot and field of each path added.
+  absl::flat_hash_map<std::string, std::pair<int, const FieldDescriptor*>>
+      paths_;
+};
+
+QueryProgram::QueryProgram() = default;
+QueryProgram::~QueryProgram() = default;
+
+std::unique_ptr<QueryProgram> QueryProgram::Compile(const Query& query,
+                                                    const DescriptorPool* pool,
+                                                    ParsePlanCache* plans,
+                                                    std::string* error) {
+  const Descriptor* descriptor = pool->FindMessageTypeByName(query.from);
+  if (descriptor == nullptr) {
+    *error = absl::StrCat("unknown message type ", query.from);
+    return nullptr;
+  }
+
+  std::unique_ptr<QueryProgram> program(new QueryProgram());
+  program->plan_ = plans->Get(descriptor);
+  program->root_ = std::make_unique<Scan>(program->plan_);
+  program->limit_ = query.limit;
+
+  Compiler compiler(program.get(), error);
+  for (const std::string& path : query.select) {
+    Column column{.path = path};
+    column.slot = compiler.AddPath(path, &column.field);
+    if (column.slot < 0)
+      return nullptr;
+    program->columns_.push_back(std::move(column));
+  }
+  if (query.where != nullptr && !compiler.AddExpr(*query.where))
+    return nullptr;
+
+  program->aggregating_ = query.aggregating();
+  if (program->aggregating_ && !program->AddAggregates(query, &compiler))
+    return nullptr;
+
+  const auto fill = [&program](Column& column) {
+    if (column.slot < 0)
+      return;
+    const Slot& slot = program->slots_[column.slot];
+    column.repeated = slot.append;
+    column.defaulted = slot.defaulted;
+    column.default_value = slot.default_value;
+  };
+  for (Column& column : program->columns_) {
+    fill(column);
+  }
+  for (Column& column : program->group_keys_) {
+    fill(column);
+  }
+  for (AggregateColumn& aggregate : program->aggregates_) {
+    fill(aggregate.argument);
+  }
+  return program;
+}
+
+bool QueryProgram::AddAggregates(const Query& query, Compiler* compiler) {
+  std::string* const error = compiler->error();
+  if (query.select.empty() && query.aggregates.empty()) {
+    *error = "select * can't be grouped, select fields or aggregates";
+    return false;
+  }
+  for (const std::string& path : query.group_by) {
+    Column key{.path = path};
+    key.slot = compiler->AddPath(path, &key.field);
+    if (key.slot < 0)
+      return false;
+    if (slots_[key.slot].append) {
+      *error = absl::StrCat("can't group by ", path, ", a repeated field");
+      return false;
+    }
+    if (key.field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      *error = absl::StrCat("can't group by ", path, ", a message");
+      return false;
+    }
+    group_keys_.push_back(std::move(key));
+  }
+  for (const Column& column : columns_) {
+    if (!absl::c_any_of(group_keys_, [&column](const Column& key) {
+          return key.slot == column.slot;
+        })) {
+      *error = absl::StrCat(column.path, " must be grouped by or aggregated");
+      return false;
+    }
+  }
+
+  for (const Aggregate& aggregate : query.aggregates) {
+    AggregateColumn column{.function = aggregate.function,
+                           .quantile = aggregate.quantile,
+                           .position = aggregate.position,
+                           .argument = {.path = aggregate.path,
+                                        .field = nullptr,
+                                        .slot = -1}};
+    if (!aggregate.path.empty()) {
+      column.argument.slot =
+          compiler->AddPath(aggregate.path, &column.argument.field);
+      if (column.argument.slot < 0)
+        return false;
+    }
+    const FieldDescriptor* field = column.argument.field;
+    const char* needs = nullptr;
+    switch (aggregate.function) {
+      case Aggregate::kCount:
+        break;
+      case Aggregate::kSum:
+      case Aggregate::kApproxQuantile:
+        if (!IsNumber(field))
+          needs = "a numeric field";
+        break;
+      case Aggregate::kMin:
+      case Aggregate::kMax:
+      case Aggregate::kApproxDistinct:
+        if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+          needs = "a scalar, string or bytes field";
+        break;
+    }
+    if (needs != nullptr) {
+      *error = absl::StrCat(FunctionName(aggregate.function), "() needs ",
+                            needs, ", not ", aggregate.path);
+      return false;
+    }
+    aggregates_.push_back(std::move(column));
+  }
+  return true;
+}
+
+QueryProgram::Status QueryProgram::Evaluate(absl::string_view message,
+                                            Row* row) const {
+  row->slots.resize(slots_.size());
+  for (auto& values : row->slots) {
+    values.clear();
+  }
+  const auto store = [row](const Scan::Action& action, Value value) {
+    auto& values = row->slots[action.slot];
+    if (!action.append)
+      values.clear();
+    values.push_back(value);
+  };
+  if (!Walk(*root_, message, 0, store))
+    return MALFORMED;
+  return Run(*row) ? MATCH : NO_MATCH;
+}
+
+void QueryProgram::EvaluateBatch(absl::Span<const absl::string_view> messages,
+                                 Batch* batch) const {
+  const int size = messages.size();
+  batch->size = size;
+  batch->vectors.resize(slots_.size());
+  absl::InlinedVector<Batch::Vector*, 8> repeated;
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    Batch::Vector& vector = batch->vectors[i];
+    if (slots_[i].append) {
+      vector.bits.clear();
+      vector.data.clear();
+      vector.offsets.assign(size + 1, 0);
+      repeated.push_back(&vector);
+    } else {
+      // Values are written as they're found, so only the vectors of a
+      // batch larger than the last need to grow.
+      vector.bits.resize(size);
+      vector.data.resize(size);
+      vector.present.assign(Words(size), 0);
+    }
+  }
+  batch->malformed_messages.assign(Words(size), 0);
+
+  for (int i = 0; i < size; ++i) {
+    const auto store = [batch, i](const Scan::Action& action, Value value) {
+      Batch::Vector& vector = batch->vectors[action.slot];
+      if (action.append) {
+        vector.bits.push_back(value.bits);
+        vector.data.push_back(value.data);
+        return;
+      }
+      vector.bits[i] = value.bits;
+      vector.data[i] = value.data;
+      SetBit(vector.present.data(), i);
+    };
+    if (!Walk(*root_, messages[i], 0, store))
+      SetBit(batch->malformed_messages.data(), i);
+    for (Batch::Vector* vector : repeated) {
+      vector->offsets[i + 1] = vector->bits.size();
+    }
+  }
+
+  // Fill in the defaults of singular values that weren't found.
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    const Slot& slot = slots_[i];
+    if (slot.append)
+      continue;
+    Batch::Vector& vector = batch->vectors[i];
+    for (size_t word = 0; word < Words(size); ++word) {
+      uint64_t missing = ~vector.present[word];
+      if (word + 1 == Words(size) && size % 64 != 0)
+        missing &= (uint64_t{1} << (size % 64)) - 1;
+      while (missing != 0) {
+        const size_t j = word * 64 + absl::countr_zero(missing);
+        vector.bits[j] = slot.default_value.bits;
+        vector.data[j] = slot.default_value.data;
+        missing &= missing - 1;
+      }
+    }
+  }
+  Run(batch);
+}
+
+void QueryProgram::Project(const Batch& batch, int i, Row* row) const {
+  row->slots.resize(slots_.size());
+  for (size_t slot = 0; slot < slots_.size(); ++slot) {
+    auto& values = row->slots[slot];
+    values.clear();
+    const Batch::Vector& vector = batch.vectors[slot];
+    if (slots_[slot].append) {
+      for (uint32_t k = vector.offsets[i]; k < vector.offsets[i + 1]; ++k) {
+        values.push_back(Value{.bits = vector.bits[k], .data = vector.data[k]});
+      }
+    } else if (GetBit(vector.present.data(), i)) {
+      values.push_back(Value{.bits = vector.bits[i], .data = vector.data[i]});
+    }
+  }
+}
+
+template <typename Store>
+bool QueryProgram::Walk(const Scan& scan, absl::string_view message, int depth,
+                        Store& store) const {
+  if (depth > kMaxDepth)
+    return false;
+
+  const char* p = message.data();
+  const char* const end = p + message.size();
+  while (p < end) {
+    uint64_t tag;
+    p = ParsePlan::ReadVarint(p, end, &tag);
+    if (p == nullptr || tag > UINT32_MAX)
+      return false;
+    const uint32_t number = WireFormatLite::GetTagFieldNumber(tag);
+    if (number == 0)
+      return false;
+    const auto wire_type = WireFormatLite::GetTagWireType(tag);
+
+    const Scan::Action* action = scan.Find(number);
+    const bool packed = action != nullptr && action->field->packable &&
+                        wire_type == WireFormatLite::WIRETYPE_LENGTH_DELIMITED;
+    if (action == nullptr ||
+        (wire_type != action->field->wire_type && !packed)) {
+      p = ParsePlan::SkipValue(p, end, tag);
+      if (p == nullptr)
+        return false;
+      continue;
+    }
+    const ParsePlan::Field& field = *action->field;
+
+    if (packed) {
+      uint64_t length;
+      p = ParsePlan::ReadVarint(p, end, &length);
+      if (p == nullptr || length > static_cast<uint64_t>(end - p))
+        return false;
+      const char* const packed_end = p + length;
+      while (p < packed_end) {
+        uint64_t raw;
+        p = ParsePlan::ReadScalar(p, packed_end, field.wire_type, &raw);
+        if (p == nullptr)
+          return false;
+        store(*action, Value{.bits = ParsePlan::Normalize(field, raw)});
+      }
+      continue;
+    }
+
+    absl::string_view data;
+    switch (wire_type) {
+      case WireFormatLite::WIRETYPE_LENGTH_DELIMITED: {
+        uint64_t length;
+        p = ParsePlan::ReadVarint(p, end, &length);
+        if (p == nullptr || length > static_cast<uint64_t>(end - p))
+          return false;
+        data = absl::string_view(p, length);
+        p += length;
+        break;
+      }
+      case WireFormatLite::WIRETYPE_START_GROUP:
+        p = ParsePlan::SkipGroup(p, end, number, &data);
+        if (p == nullptr)
+          return false;
+        break;
+      default: {
+        uint64_t raw;
+        p = ParsePlan::ReadScalar(p, end, wire_type, &raw);
+        if (p == nullptr)
+          return false;
+        store(*action, Value{.bits = ParsePlan::Normalize(field, raw)});
+        continue;
+      }
+    }
+    if (action->slot >= 0)
+      store(*action, Value{.data = data});
+    if (action->message != nullptr &&
+        !Walk(*action->message, data, depth + 1, store)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QueryProgram::Run(const Row& row) const {
+  if (instructions_.empty())
+    return true;
+
+  absl::InlinedVector<bool, 16> stack;
+  for (const Instruction& instruction : instructions_) {
+    switch (instruction.op) {
+      case Instruction::kCompare:
+      case Instruction::kIn:
+      case Instruction::kPrefix: {
+        const auto& values = row.slots[instruction.slot];
+        bool result = false;
+        if (values.empty()) {
+          const Slot& slot = slots_[instruction.slot];
+          result = slot.defaulted && instruction.Test(slot.default_value);
+        }
+        for (const Value& value : values) {
+          if (instruction.Test(value)) {
+            result = true;
+            break;
+          }
+        }
+        stack.push_back(result);
+        break;
+      }
+      case Instruction::kHas:
+        stack.push_back(!row.slots[instruction.slot].empty());
+        break;
+      case Instruction::kAnd: {
+        const bool right = stack.back();
+        stack.pop_back();
+        stack.back() = stack.back() && right;
+        break;
+      }
+      case Instruction::kOr: {
+        const bool right = stack.back();
+        stack.pop_back();
+        stack.back() = stack.back() || right;
+        break;
+      }
+      case Instruction::kNot:
+        stack.back() = !stack.back();
+        break;
+    }
+  }
+  return stack.back();
+}
+
+void QueryProgram::Run(Batch* batch) const {
+  const int size = batch->size;
+  const size_t words = Words(size);
+  batch->selection.assign(words, ~uint64_t{0});
+  if (!instructions_.empty()) {
+    // Each result on the stack is a bitmap of `words` words.
+    batch->stack.resize(words * instructions_.size());
+    uint64_t* top = batch->stack.data();
+    for (const Instruction& instruction : instructions_) {
+      switch (instruction.op) {
+        case Instruction::kCompare:
+        case Instruction::kIn:
+        case Instruction::kPrefix:
+          instruction.Select(slots_[instruction.slot],
+                             batch->vectors[instruction.slot], size, top,
+                             &batch->scratch);
+          top += words;
+          break;
+        case Instruction::kHas: {
+          const Batch::Vector& vector = batch->vectors[instruction.slot];
+          if (!slots_[instruction.slot].append) {
+            std::copy_n(vector.present.begin(), words, top);
+          } else {
+            std::fill(top, top + words, 0);
+            for (int i = 0; i < size; ++i) {
+              if (vector.offsets[i + 1] > vector.offsets[i])
+                SetBit(top, i);
+            }
+          }
+          top += words;
+          break;
+        }
+        case Instruction::kAnd: {
+          top -= words;
+          uint64_t* const left = top - words;
+          for (size_t i = 0; i < words; ++i) {
+            left[i] &= top[i];
+          }
+          break;
+        }
+        case Instruction::kOr: {
+          top -= words;
+          uint64_t* const left = top - words;
+          for (size_t i = 0; i < words; ++i) {
+            left[i] |= top[i];
+          }
+          break;
+        }
+        case Instruction::kNot: {
+          uint64_t* const operand = top - words;
+          for (size_t i = 0; i < words; ++i) {
+            operand[i] = ~operand[i];
+          }
+          break;
+        }
+      }
+    }
+    std::copy_n(batch->stack.begin(), words, batch->selection.begin());
+  }
+  for (size_t i = 0; i < words; ++i) {
+    batch->selection[i] &= ~batch->malformed_messages[i];
+  }
+  if (size % 64 != 0)
+    batch->selection.back() &= (uint64_t{1} << (size % 64)) - 1;
+}
+
+}  // namespace protoquery
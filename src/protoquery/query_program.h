@@ -0,0 +1,227 @@
+#ifndef PROTOQUERY_QUERY_PROGRAM_H__
+#define PROTOQUERY_QUERY_PROGRAM_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/query.h"
+
+namespace protoquery {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::FieldDescriptor;
+using ::protodb::ParsePlan;
+using ::protodb::ParsePlanCache;
+
+// A query compiled against its message type into a program that runs on
+// wire data.
+//
+// Compiling gives every field the query names, in its `select` list or its
+// `where` clause, a slot, and builds a scan for each message type along
+// their paths: a table from field number to the slot and the submessage
+// scan of each field that is needed.  Evaluate() walks an encoded message
+// with these scans, jumping from field to field by tag.  Fields that aren't
+// needed are skipped by their length or wire type without being decoded,
+// and submessages are only entered when a path goes through them, so a
+// message is filtered without being parsed into a Message.  The values
+// found are kept in a Row as views of the wire data, and the `where`
+// clause runs over them as a list of postfix instructions.
+//
+// A comparison is true if any value of its field satisfies it, so a
+// comparison with a repeated field, or with a path through one, asks
+// whether some element matches.  A missing field with presence has no
+// values and satisfies no comparison, while a missing singular field
+// without presence reads as its default.  As when parsing, the last value
+// of a singular field wins.
+//
+// EvaluateBatch() filters many messages at once.  It walks each message
+// of a batch into column vectors, one per slot, then runs every
+// instruction over a whole vector: comparisons, `in` lists and prefix
+// matches are tight loops over the values of the batch that set bits of a
+// selection bitmap, and `and`, `or` and `not` combine bitmaps a word at a
+// time.  Only the messages selected need to be gathered back into a Row
+// with Project().
+//
+// A QueryProgram is immutable and can be shared between threads, each
+// evaluating into its own Row or Batch.
+class QueryProgram {
+ public:
+  enum Status {
+    MATCH,
+    NO_MATCH,
+    // The wire data couldn't be walked.
+    MALFORMED,
+  };
+
+  // A value found in a message: a scalar as passed by ParsePlan::Parse(),
+  // or a string, bytes or message value as a view of the wire data.
+  struct Value {
+    uint64_t bits = 0;
+    absl::string_view data;
+  };
+
+  // The values of the query's fields in one message.  Reusing a Row across
+  // messages keeps its storage.
+  struct Row {
+    std::vector<absl::InlinedVector<Value, 1>> slots;
+  };
+
+  // The values of the query's fields in a batch of messages, by slot, and
+  // the messages selected.  Reusing a Batch across batches keeps its
+  // storage.
+  struct Batch {
+    // The values of one slot.  A singular slot has a value for every
+    // message, its default or zero where it is missing, and a bitmap of the
+    // messages it was found in.  A repeated slot has its values in message
+    // order, with those of message `i` from `offsets[i]` to
+    // `offsets[i + 1]`.
+    struct Vector {
+      std::vector<uint64_t> bits;
+      std::vector<absl::string_view> data;
+      std::vector<uint64_t> present;
+      std::vector<uint32_t> offsets;
+    };
+
+    // Whether message `i` was selected.
+    bool selected(int i) const {
+      return (selection[i / 64] >> (i % 64)) & 1;
+    }
+    // Whether message `i` couldn't be walked.
+    bool malformed(int i) const {
+      return (malformed_messages[i / 64] >> (i % 64)) & 1;
+    }
+
+    int size = 0;
+    std::vector<Vector> vectors;
+    // Bitmaps over the messages of the batch.
+    std::vector<uint64_t> selection;
+    std::vector<uint64_t> malformed_messages;
+    // The bitmaps of the instructions run, as a stack.
+    std::vector<uint64_t> stack;
+    std::vector<uint64_t> scratch;
+  };
+
+  // A selected field.
+  struct Column {
+    std::string path;
+    // The field at the end of the path.
+    const FieldDescriptor* field;
+    int slot;
+    // Whether the path goes through a repeated field, so the slot keeps
+    // every value.
+    bool repeated;
+    // Whether a missing value reads as the field's default.
+    bool defaulted;
+    // The default, for a defaulted field.
+    Value default_value;
+  };
+
+  // A selected aggregate.
+  struct AggregateColumn {
+    Aggregate::Function function;
+    double quantile;
+    // The position in the `select` list.
+    int position;
+    // The field aggregated.  For `count(*)`, `field` is null and `slot` is
+    // -1.
+    Column argument;
+  };
+
+  // Compiles `query` for its type in `pool`, walking messages with plans
+  // from `plans`.  Returns nullptr and sets `error` if the type isn't
+  // found, a path doesn't name a field, or a comparison or aggregate
+  // doesn't fit its field.
+  static std::unique_ptr<QueryProgram> Compile(const Query& query,
+                                               const DescriptorPool* pool,
+                                               ParsePlanCache* plans,
+                                               std::string* error);
+
+  QueryProgram(const QueryProgram&) = delete;
+  QueryProgram& operator=(const QueryProgram&) = delete;
+  ~QueryProgram();
+
+  const Descriptor* descriptor() const {
+    return plan_->descriptor();
+  }
+
+  // The selected fields, or none if whole messages are selected.  When
+  // aggregating, each of them is also a group key.
+  const std::vector<Column>& columns() const {
+    return columns_;
+  }
+
+  // Whether the query prints groups, with `group_keys()` and
+  // `aggregates()`, rather than messages.
+  bool aggregating() const {
+    return aggregating_;
+  }
+  // The fields of the `group by` clause, all singular.
+  const std::vector<Column>& group_keys() const {
+    return group_keys_;
+  }
+  const std::vector<AggregateColumn>& aggregates() const {
+    return aggregates_;
+  }
+
+  // The most messages, or groups, to print, or -1 for all of them.
+  int64_t limit() const {
+    return limit_;
+  }
+
+  // Walks `message`, filling `row` with its values, and runs the `where`
+  // clause over them.  The values in `row` are views of `message`.
+  Status Evaluate(absl::string_view message, Row* row) const;
+
+  // Walks `messages` into `batch` and runs the `where` clause over all of
+  // them, selecting the ones that match.  Malformed messages are never
+  // selected.  The values in `batch` are views of `messages`.  Batches of
+  // about kBatchSize messages keep the vectors in cache.
+  static constexpr int kBatchSize = 1024;
+  void EvaluateBatch(absl::Span<const absl::string_view> messages,
+                     Batch* batch) const;
+
+  // Gathers the values of message `i` of `batch` into `row`, as Evaluate()
+  // would have.
+  void Project(const Batch& batch, int i, Row* row) const;
+
+ private:
+  struct Scan;
+  struct Slot;
+  struct Instruction;
+  class Compiler;
+
+  QueryProgram();
+
+  // Compiles the group keys and aggregates of an aggregating query.
+  bool AddAggregates(const Query& query, Compiler* compiler);
+
+  // Walks `message`, passing each value found to `store(action, value)`.
+  template <typename Store>
+  bool Walk(const Scan& scan, absl::string_view message, int depth,
+            Store& store) const;
+  bool Run(const Row& row) const;
+  void Run(Batch* batch) const;
+
+  const ParsePlan* plan_ = nullptr;
+  std::unique_ptr<Scan> root_;
+  std::vector<Slot> slots_;
+  std::vector<Column> columns_;
+  bool aggregating_ = false;
+  std::vector<Column> group_keys_;
+  std::vector<AggregateColumn> aggregates_;
+  // The `where` clause in postfix order; empty without one.
+  std::vector<Instruction> instructions_;
+  int64_t limit_ = -1;
+};
+
+}  // namespace protoquery
+
+#endif  // PROTOQUERY_QUERY_PROGRAM_H__
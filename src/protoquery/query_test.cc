@@ -0,0 +1,675 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "gtest/gtest.h"
+#include "protodb/io/parse_plan.h"
+#include "protodb/io/test_util.h"
+#include "protoquery/aggregator.h"
+#include "protoquery/query.h"
+#include "protoquery/query_program.h"
+#include "protoquery/row_printer.h"
+
+namespace protoquery {
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DescriptorPool;
+
+class QueryTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<QueryProgram> Compile(absl::string_view text,
+                                        std::string* error) {
+    Query query;
+    if (!ParseQuery(text, &query, error))
+      return nullptr;
+    return QueryProgram::Compile(query, DescriptorPool::generated_pool(),
+                                 &plans_, error);
+  }
+
+  std::string Encode(
+      absl::string_view text,
+      const Descriptor* type = protodb::test::Person::descriptor()) {
+    return protodb::test::Wire(type, text);
+  }
+
+  // Whether `message` matches the `where` clause of `query`, checking that
+  // a batch of it agrees.
+  bool Matches(absl::string_view query, absl::string_view message) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = Compile(query, &error);
+    EXPECT_NE(program, nullptr) << error;
+    if (program == nullptr)
+      return false;
+    QueryProgram::Row row;
+    const QueryProgram::Status status = program->Evaluate(message, &row);
+    EXPECT_NE(status, QueryProgram::MALFORMED);
+
+    QueryProgram::Batch batch;
+    program->EvaluateBatch({message}, &batch);
+    EXPECT_FALSE(batch.malformed(0));
+    EXPECT_EQ(batch.selected(0), status == QueryProgram::MATCH) << query;
+    return status == QueryProgram::MATCH;
+  }
+
+  // The lines `query` prints for `messages`, up to its limit, evaluating
+  // them as a batch.
+  std::string Run(absl::string_view query,
+                  const std::vector<std::string>& messages) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = Compile(query, &error);
+    EXPECT_NE(program, nullptr) << error;
+    if (program == nullptr)
+      return "";
+    const std::vector<absl::string_view> views(messages.begin(),
+                                               messages.end());
+    QueryProgram::Batch batch;
+    program->EvaluateBatch(views, &batch);
+    RowPrinter printer(program.get());
+    QueryProgram::Row row;
+    std::string out;
+    int64_t printed = 0;
+    for (int i = 0; i < batch.size; ++i) {
+      if (printed == program->limit())
+        break;
+      if (!batch.selected(i))
+        continue;
+      program->Project(batch, i, &row);
+      EXPECT_TRUE(printer.Print(messages[i], row, &out));
+      ++printed;
+    }
+    return out;
+  }
+
+  // The lines an aggregating `query` prints for `messages`, added in
+  // batches of `batch_size` on `workers` workers in turn.
+  std::string Aggregate(absl::string_view query,
+                        const std::vector<std::string>& messages,
+                        AggregatorOptions options = AggregatorOptions(),
+                        size_t batch_size = QueryProgram::kBatchSize) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = Compile(query, &error);
+    EXPECT_NE(program, nullptr) << error;
+    if (program == nullptr)
+      return "";
+    const std::vector<absl::string_view> views(messages.begin(),
+                                               messages.end());
+    Aggregator aggregator(program.get(), options);
+    QueryProgram::Batch batch;
+    for (size_t begin = 0; begin < views.size(); begin += batch_size) {
+      program->EvaluateBatch(absl::MakeConstSpan(views).subspan(begin,
+                                                                batch_size),
+                             &batch);
+      EXPECT_TRUE(
+          aggregator.Add((begin / batch_size) % options.workers, batch));
+    }
+    spills_ = aggregator.spills();
+    std::string out;
+    EXPECT_TRUE(aggregator.Finish([&out](absl::string_view line) {
+      absl::StrAppend(&out, line, "\n");
+      return true;
+    }));
+    return out;
+  }
+
+  protodb::ParsePlanCache plans_;
+  size_t spills_ = 0;
+};
+
+TEST(ParseQueryTest, ParsesClauses) {
+  Query query;
+  std::string error;
+  ASSERT_TRUE(ParseQuery(
+      "SELECT name, file.* FROM .pkg.Type "
+      "WHERE not a.b = -5 and (c != 'x\\ty' or has(d)) Limit 10",
+      &query, &error))
+      << error;
+  EXPECT_EQ(query.select, (std::vector<std::string>{"name", "file"}));
+  EXPECT_EQ(query.from, "pkg.Type");
+  EXPECT_EQ(query.limit, 10);
+
+  const Expr& where = *query.where;
+  ASSERT_EQ(where.kind, Expr::kAnd);
+  const Expr& negated = *where.operands[0];
+  ASSERT_EQ(negated.kind, Expr::kNot);
+  const Expr& compare = *negated.operands[0];
+  EXPECT_EQ(compare.kind, Expr::kCompare);
+  EXPECT_EQ(compare.path, "a.b");
+  EXPECT_EQ(compare.op, CompareOp::kEq);
+  EXPECT_EQ(compare.value.kind, Literal::kInteger);
+  EXPECT_EQ(compare.value.integer, 5);
+  EXPECT_TRUE(compare.value.negative);
+
+  const Expr& either = *where.operands[1];
+  ASSERT_EQ(either.kind, Expr::kOr);
+  EXPECT_EQ(either.operands[0]->op, CompareOp::kNe);
+  EXPECT_EQ(either.operands[0]->value.text, "x\ty");
+  EXPECT_EQ(either.operands[1]->kind, Expr::kHas);
+  EXPECT_EQ(either.operands[1]->path, "d");
+
+  ASSERT_TRUE(ParseQuery("select * from T", &query, &error)) << error;
+  EXPECT_TRUE(query.select.empty());
+  EXPECT_EQ(query.where, nullptr);
+  EXPECT_EQ(query.limit, -1);
+
+  ASSERT_TRUE(ParseQuery(
+      "select * from T where a IN (1, -2, x) or starts_with(b.c, 'pre')",
+      &query, &error))
+      << error;
+  const Expr& in = *query.where->operands[0];
+  ASSERT_EQ(in.kind, Expr::kIn);
+  EXPECT_EQ(in.path, "a");
+  ASSERT_EQ(in.values.size(), 3);
+  EXPECT_EQ(in.values[0].integer, 1);
+  EXPECT_TRUE(in.values[1].negative);
+  EXPECT_EQ(in.values[2].kind, Literal::kName);
+  const Expr& prefix = *query.where->operands[1];
+  ASSERT_EQ(prefix.kind, Expr::kPrefix);
+  EXPECT_EQ(prefix.path, "b.c");
+  EXPECT_EQ(prefix.value.text, "pre");
+}
+
+TEST(ParseQueryTest, ParsesAggregates) {
+  Query query;
+  std::string error;
+  ASSERT_TRUE(ParseQuery(
+      "select a, COUNT(*), sum(b.c), approx_quantile(d, 0.5), count(e) "
+      "from T where a > 1 group by a, f limit 3",
+      &query, &error))
+      << error;
+  EXPECT_EQ(query.select, (std::vector<std::string>{"a"}));
+  ASSERT_EQ(query.aggregates.size(), 4);
+  EXPECT_EQ(query.aggregates[0].function, Aggregate::kCount);
+  EXPECT_EQ(query.aggregates[0].path, "");
+  EXPECT_EQ(query.aggregates[0].position, 1);
+  EXPECT_EQ(query.aggregates[1].function, Aggregate::kSum);
+  EXPECT_EQ(query.aggregates[1].path, "b.c");
+  EXPECT_EQ(query.aggregates[2].function, Aggregate::kApproxQuantile);
+  EXPECT_EQ(query.aggregates[2].quantile, 0.5);
+  EXPECT_EQ(query.aggregates[3].path, "e");
+  EXPECT_EQ(query.aggregates[3].position, 4);
+  EXPECT_EQ(query.group_by, (std::vector<std::string>{"a", "f"}));
+  EXPECT_EQ(query.limit, 3);
+  EXPECT_TRUE(query.aggregating());
+
+  ASSERT_TRUE(ParseQuery("select a from T group by a", &query, &error));
+  EXPECT_TRUE(query.aggregates.empty());
+  EXPECT_TRUE(query.aggregating());
+
+  EXPECT_FALSE(ParseQuery("select median(a) from T", &query, &error));
+  EXPECT_EQ(error, "expected an aggregate but found 'median' at column 8");
+  EXPECT_FALSE(
+      ParseQuery("select approx_quantile(a, 2) from T", &query, &error));
+  EXPECT_EQ(error, "expected a quantile from 0 to 1 but found '2' at "
+                   "column 27");
+  EXPECT_FALSE(ParseQuery("select approx_quantile(a) from T", &query, &error));
+  EXPECT_FALSE(ParseQuery("select sum(*) from T", &query, &error));
+  EXPECT_FALSE(ParseQuery("select count(a from T", &query, &error));
+  EXPECT_FALSE(ParseQuery("select a from T group a", &query, &error));
+}
+
+TEST(ParseQueryTest, RejectsMalformedQueries) {
+  Query query;
+  std::string error;
+  EXPECT_FALSE(ParseQuery("select name", &query, &error));
+  EXPECT_EQ(error, "expected 'from' but found the end of the query at "
+                   "column 12");
+  EXPECT_FALSE(ParseQuery("select * from T where a = 'x", &query, &error));
+  EXPECT_EQ(error, "unterminated string at column 27");
+  EXPECT_FALSE(ParseQuery("select * from T where a = 1 b", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where (a = 1", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where a ~ 1", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where a = 12abc", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where a = 99999999999999999999",
+                          &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T limit x", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where a in ()", &query, &error));
+  EXPECT_FALSE(ParseQuery("select * from T where a in (1", &query, &error));
+  EXPECT_FALSE(
+      ParseQuery("select * from T where starts_with(a)", &query, &error));
+}
+
+TEST_F(QueryTest, RejectsQueriesThatDontFitTheType) {
+  std::string error;
+  EXPECT_EQ(Compile("select * from protodb.test.Nope", &error), nullptr);
+  EXPECT_EQ(error, "unknown message type protodb.test.Nope");
+  EXPECT_EQ(Compile("select nope from protodb.test.Person", &error), nullptr);
+  EXPECT_EQ(error, "no field nope in protodb.test.Person");
+  EXPECT_EQ(Compile("select name.x from protodb.test.Person", &error), nullptr);
+  EXPECT_EQ(error, "protodb.test.Person.name is not a message");
+
+  const char* const kBadWheres[] = {
+      "address = 1",   "age = 'x'",     "age = 1.5",   "id = -1",
+      "color = PINK",  "active = 1",    "name = 1",    "score = 'x'",
+      "age = 9223372036854775808",     "age in (1, 'x')",
+      "starts_with(age, '1')",         "starts_with(name, 1)",
+  };
+  for (const char* where : kBadWheres) {
+    EXPECT_EQ(Compile(std::string("select * from protodb.test.Person "
+                                  "where ") +
+                          where,
+                      &error),
+              nullptr)
+        << where;
+  }
+}
+
+TEST_F(QueryTest, RejectsAggregatesThatDontFitTheType) {
+  const std::pair<const char*, const char*> kBadQueries[] = {
+      {"select * from protodb.test.Person group by name",
+       "select * can't be grouped, select fields or aggregates"},
+      {"select count(*) from protodb.test.Person group by tags",
+       "can't group by tags, a repeated field"},
+      {"select count(*) from protodb.test.Person group by addresses.city",
+       "can't group by addresses.city, a repeated field"},
+      {"select count(*) from protodb.test.Person group by address",
+       "can't group by address, a message"},
+      {"select name, count(*) from protodb.test.Person",
+       "name must be grouped by or aggregated"},
+      {"select age, count(*) from protodb.test.Person group by name",
+       "age must be grouped by or aggregated"},
+      {"select sum(name) from protodb.test.Person",
+       "sum() needs a numeric field, not name"},
+      {"select approx_quantile(active, 0.5) from protodb.test.Person",
+       "approx_quantile() needs a numeric field, not active"},
+      {"select max(address) from protodb.test.Person",
+       "max() needs a scalar, string or bytes field, not address"},
+      {"select count(nope) from protodb.test.Person",
+       "no field nope in protodb.test.Person"},
+  };
+  for (const auto& [query, expected] : kBadQueries) {
+    std::string error;
+    EXPECT_EQ(Compile(query, &error), nullptr) << query;
+    EXPECT_EQ(error, expected);
+  }
+}
+
+TEST_F(QueryTest, ComparesScalars) {
+  const std::string person = Encode(R"pb(
+    name: "Ada" age: 36 score: 1.25 active: true color: BLUE
+    ratio: 0.1 id: 18446744073709551615 delta: -7
+  )pb");
+  const char* const kMatching[] = {
+      "age = 36",        "age >= 36",          "age < 37",
+      "age != 35",       "age <> 35",          "age > -1",
+      "name = 'Ada'",    "name > 'Ab'",        "name <= \"Ada\"",
+      "score < 1.5",     "score = 1.25",       "score > 1",
+      "active = true",   "color = BLUE",       "color = 2",
+      "color > GREEN",   "ratio = 0.1",        "id = 18446744073709551615",
+      "id > 0",          "delta = -7",         "delta < 0",
+  };
+  for (const char* where : kMatching) {
+    EXPECT_TRUE(Matches(std::string("select * from protodb.test.Person "
+                                    "where ") +
+                            where,
+                        person))
+        << where;
+  }
+  const char* const kNotMatching[] = {
+      "age = 35",      "age > 36",       "name = 'ada'",  "name < 'Ada'",
+      "score >= 2",    "active = false", "color = RED",   "ratio = 0.2",
+      "id < 5",        "delta > 0",
+  };
+  for (const char* where : kNotMatching) {
+    EXPECT_FALSE(Matches(std::string("select * from protodb.test.Person "
+                                     "where ") +
+                             where,
+                         person))
+        << where;
+  }
+}
+
+TEST_F(QueryTest, MatchesListsAndPrefixes) {
+  const std::string person = Encode(R"pb(
+    name: "Ada" age: 36 score: 1.25 color: BLUE ratio: 0.1
+    tags: "admin" tags: "dev"
+  )pb");
+  const char* const kMatching[] = {
+      "age in (1, 36)",
+      "age in (1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 36)",
+      "color in (RED, BLUE)",
+      "score in (1.25)",
+      "ratio in (0.1, 0.2)",
+      "name in ('Bob', 'Ada')",
+      "tags in ('ops', 'dev')",
+      "starts_with(name, 'Ad')",
+      "starts_with(name, '')",
+      "starts_with(tags, 'de')",
+      "not age in (1, 2)",
+  };
+  for (const char* where : kMatching) {
+    EXPECT_TRUE(Matches(std::string("select * from protodb.test.Person "
+                                    "where ") +
+                            where,
+                        person))
+        << where;
+  }
+  const char* const kNotMatching[] = {
+      "age in (35, 37)",
+      "age in (1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11)",
+      "color in (RED, GREEN)",
+      "name in ('ada')",
+      "tags in ('ops')",
+      "starts_with(name, 'Ada L')",
+      "starts_with(tags, 'x')",
+      "starts_with(address.city, '')",
+  };
+  for (const char* where : kNotMatching) {
+    EXPECT_FALSE(Matches(std::string("select * from protodb.test.Person "
+                                     "where ") +
+                             where,
+                         person))
+        << where;
+  }
+}
+
+TEST_F(QueryTest, CombinesConditions) {
+  const std::string person = Encode(R"pb(name: "Ada" age: 36)pb");
+  EXPECT_TRUE(Matches("select * from protodb.test.Person "
+                      "where age = 36 and name = 'Ada'",
+                      person));
+  EXPECT_FALSE(Matches("select * from protodb.test.Person "
+                       "where age = 36 and not name = 'Ada'",
+                       person));
+  EXPECT_TRUE(Matches("select * from protodb.test.Person "
+                      "where age = 1 or name = 'Ada' and not age = 2",
+                      person));
+  EXPECT_FALSE(Matches("select * from protodb.test.Person "
+                       "where (age = 1 or name = 'Ada') and age = 2",
+                       person));
+}
+
+TEST_F(QueryTest, MissingFieldsWithPresenceMatchNothing) {
+  const std::string empty = Encode("");
+  EXPECT_FALSE(Matches("select * from protodb.test.Person where age = 0",
+                       empty));
+  EXPECT_FALSE(Matches("select * from protodb.test.Person where age != 0",
+                       empty));
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where not has(age)", empty));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where has(address)", empty));
+
+  // Fields without presence read as their defaults.
+  const std::string counter = Encode("", protodb::test::Counter::descriptor());
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Counter where count = 0 and label = ''",
+      counter));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Counter where has(count)", counter));
+}
+
+TEST_F(QueryTest, MatchesAnyRepeatedValue) {
+  std::string person = Encode(R"pb(
+    tags: "a" tags: "b" scores: 3 scores: 40
+    addresses { city: "Paris" zip: 75001 }
+    addresses { city: "Oslo" }
+  )pb");
+  EXPECT_TRUE(Matches("select * from protodb.test.Person where tags = 'b'",
+                      person));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where tags = 'c'", person));
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where scores > 10", person));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where scores > 40", person));
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where addresses.city = 'Oslo'",
+      person));
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where addresses.zip = 75001", person));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where addresses.zip = 0", person));
+
+  // Scores written unpacked, as field 7 varints.
+  person.append("\x38\x63", 2);
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where scores = 99", person));
+}
+
+TEST_F(QueryTest, FollowsNestedPaths) {
+  const std::string person = Encode(R"pb(
+    address { city: "Paris" zip: 75001 }
+  )pb");
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where address.city = 'Paris'",
+      person));
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where has(address.zip)", person));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where address.zip > 75001", person));
+
+  // A later occurrence of the submessage merges into the first.
+  const std::string merged =
+      person + Encode(R"pb(address { zip: 1 })pb");
+  EXPECT_TRUE(Matches("select * from protodb.test.Person "
+                      "where address.city = 'Paris' and address.zip = 1",
+                      merged));
+}
+
+TEST_F(QueryTest, SkipsUnknownFields) {
+  std::string person = Encode(R"pb(name: "Ada")pb");
+  // Field 100 as bytes, field 101 as a group holding a varint, and field 2
+  // with the wrong wire type.
+  person.append("\xa2\x06\x03xyz", 6);
+  person.append("\xab\x06\x08\x01\xac\x06", 6);
+  person.append("\x15\x01\x02\x03\x04", 5);
+  EXPECT_TRUE(Matches(
+      "select * from protodb.test.Person where name = 'Ada'", person));
+  EXPECT_FALSE(Matches(
+      "select * from protodb.test.Person where has(age)", person));
+}
+
+TEST_F(QueryTest, ReportsMalformedMessages) {
+  std::string error;
+  std::unique_ptr<QueryProgram> program = Compile(
+      "select * from protodb.test.Person where name = 'Ada'", &error);
+  ASSERT_NE(program, nullptr) << error;
+  QueryProgram::Row row;
+  std::string person = Encode(R"pb(name: "Ada")pb");
+  person.pop_back();
+  EXPECT_EQ(program->Evaluate(person, &row), QueryProgram::MALFORMED);
+  // Field number 0.
+  EXPECT_EQ(program->Evaluate(absl::string_view("\x00", 1), &row),
+            QueryProgram::MALFORMED);
+}
+
+TEST_F(QueryTest, BatchesAgreeWithSingleMessages) {
+  // Enough messages to fill several words of the bitmaps, with repeated
+  // and missing fields varying between them, and a malformed one.
+  std::vector<std::string> people;
+  for (int i = 0; i < 300; ++i) {
+    std::string text = absl::StrCat("name: \"p", i, "\"");
+    if (i % 3 != 0)
+      absl::StrAppend(&text, " age: ", i % 50);
+    for (int j = 0; j < i % 4; ++j) {
+      absl::StrAppend(&text, " tags: \"t", j, "\" scores: ", i * j);
+    }
+    if (i % 7 == 0)
+      absl::StrAppend(&text, " address { city: \"c", i % 5, "\" }");
+    people.push_back(Encode(text));
+  }
+  people[150].pop_back();
+  const std::vector<absl::string_view> views(people.begin(), people.end());
+
+  const char* const kWheres[] = {
+      "age > 20",
+      "age in (1, 2, 3) or not has(age)",
+      "tags = 't2' and scores > 300",
+      "starts_with(name, 'p1') and not scores in (0, 100, 200)",
+      "address.city in ('c1', 'c3') or (has(tags) and age <= 10)",
+      "not (starts_with(address.city, 'c') or has(scores))",
+  };
+  for (const char* where : kWheres) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = Compile(
+        absl::StrCat("select name, age, tags, address.city "
+                     "from protodb.test.Person where ",
+                     where),
+        &error);
+    ASSERT_NE(program, nullptr) << error;
+    QueryProgram::Batch batch;
+    program->EvaluateBatch(views, &batch);
+    ASSERT_EQ(batch.size, people.size());
+    int selected = 0;
+    for (size_t i = 0; i < people.size(); ++i) {
+      QueryProgram::Row row;
+      const QueryProgram::Status status = program->Evaluate(people[i], &row);
+      EXPECT_EQ(batch.malformed(i), status == QueryProgram::MALFORMED);
+      EXPECT_EQ(batch.selected(i), status == QueryProgram::MATCH)
+          << where << " on message " << i;
+      if (status != QueryProgram::MATCH)
+        continue;
+      ++selected;
+      QueryProgram::Row projected;
+      program->Project(batch, i, &projected);
+      ASSERT_EQ(projected.slots.size(), row.slots.size());
+      for (size_t slot = 0; slot < row.slots.size(); ++slot) {
+        ASSERT_EQ(projected.slots[slot].size(), row.slots[slot].size());
+        for (size_t k = 0; k < row.slots[slot].size(); ++k) {
+          EXPECT_EQ(projected.slots[slot][k].bits, row.slots[slot][k].bits);
+          EXPECT_EQ(projected.slots[slot][k].data, row.slots[slot][k].data);
+        }
+      }
+    }
+    EXPECT_GT(selected, 0) << where;
+  }
+}
+
+TEST_F(QueryTest, PrintsSelectedFields) {
+  const std::vector<std::string> people = {
+      Encode(R"pb(
+        name: "Ada\tL" age: 36 color: BLUE tags: "a" tags: "b"
+        address { city: "Paris" }
+      )pb"),
+      Encode(R"pb(name: "Bob" age: 20 ratio: 0.5)pb"),
+      Encode(R"pb(name: "Cy" age: 50)pb"),
+  };
+  EXPECT_EQ(Run("select name, age, color, tags, address, address.city "
+                "from protodb.test.Person where age > 30",
+                people),
+            "Ada\\tL\t36\tBLUE\ta,b\t{city: \"Paris\"}\tParis\n"
+            "Cy\t50\t\t\t\t\n");
+  EXPECT_EQ(Run("select * from protodb.test.Person where ratio > 0", people),
+            "name: \"Bob\" age: 20 ratio: 0.5\n");
+  EXPECT_EQ(Run("select name from protodb.test.Person limit 2", people),
+            "Ada\\tL\nBob\n");
+
+  const std::vector<std::string> counters = {
+      Encode("", protodb::test::Counter::descriptor())};
+  EXPECT_EQ(Run("select label, count from protodb.test.Counter", counters),
+            "\t0\n");
+}
+
+TEST_F(QueryTest, AggregatesGroups) {
+  const std::vector<std::string> people = {
+      Encode(R"pb(name: "a" age: 30 color: RED score: 1.5 tags: "x"
+                  tags: "y" address { city: "Paris" })pb"),
+      Encode(R"pb(name: "b" age: -5 color: BLUE score: -2 ratio: 0.25
+                  address { city: "Paris" })pb"),
+      Encode(R"pb(name: "c" age: 12 color: BLUE id: 18446744073709551615
+                  tags: "x")pb"),
+      Encode(R"pb(name: "d" color: GREEN address { city: "Oslo" })pb"),
+      Encode(R"pb(name: "e\0f" age: 7 color: BLUE id: 2)pb"),
+  };
+
+  // Missing keys group first, then keys in order.
+  EXPECT_EQ(Aggregate("select count(*), address.city, count(age), "
+                      "count(tags), sum(age), min(name), max(name) "
+                      "from protodb.test.Person group by address.city",
+                      people),
+            "2\t\t2\t1\t19\tc\te\\000f\n"
+            "1\tOslo\t0\t0\t\td\td\n"
+            "2\tParis\t2\t2\t25\ta\tb\n");
+  // Enums group by number and print their names; a field without presence
+  // in the message groups by its default.
+  EXPECT_EQ(Aggregate("select color, count(*), min(age), max(score), "
+                      "sum(score), sum(ratio), sum(id), max(id) "
+                      "from protodb.test.Person group by color",
+                      people),
+            "RED\t1\t30\t1.5\t1.5\t\t\t\n"
+            "GREEN\t1\t\t\t\t\t\t\n"
+            "BLUE\t3\t-5\t-2\t-2\t0.25\t1\t18446744073709551615\n");
+  EXPECT_EQ(Aggregate("select color, approx_distinct(tags), "
+                      "approx_quantile(age, 0.5), approx_quantile(age, 1) "
+                      "from protodb.test.Person where color != GREEN "
+                      "group by color limit 1",
+                      people),
+            "RED\t2\t30\t30\n");
+  EXPECT_EQ(Aggregate("select color, address.city from protodb.test.Person "
+                      "group by address.city, color",
+                      people),
+            "BLUE\t\nGREEN\tOslo\nRED\tParis\nBLUE\tParis\n");
+
+  // Without `group by` there is one group, even over no messages.
+  EXPECT_EQ(Aggregate("select count(*), sum(age), approx_distinct(name), "
+                      "approx_quantile(score, 0.5) "
+                      "from protodb.test.Person where age > 100",
+                      people),
+            "0\t\t0\t\n");
+  EXPECT_EQ(Aggregate("select color, count(*) from protodb.test.Person "
+                      "where age > 100 group by color",
+                      people),
+            "");
+}
+
+TEST_F(QueryTest, FailsWhenPrintingFails) {
+  const std::vector<std::string> people = {
+      Encode(R"pb(name: "a" color: RED)pb"),
+      Encode(R"pb(name: "b" color: BLUE)pb"),
+  };
+  const auto finish = [&](absl::string_view query, int lines) {
+    std::string error;
+    std::unique_ptr<QueryProgram> program = Compile(query, &error);
+    EXPECT_NE(program, nullptr) << error;
+    std::vector<absl::string_view> views(people.begin(), people.end());
+    QueryProgram::Batch batch;
+    program->EvaluateBatch(views, &batch);
+    Aggregator aggregator(program.get(), AggregatorOptions());
+    EXPECT_TRUE(aggregator.Add(0, batch));
+    int printed = 0;
+    return aggregator.Finish(
+        [&](absl::string_view line) { return ++printed <= lines; });
+  };
+
+  // Failing on a group before the last, on the last, or on the only one.
+  constexpr absl::string_view kGroups =
+      "select color, count(*) from protodb.test.Person group by color";
+  EXPECT_FALSE(finish(kGroups, 0));
+  EXPECT_FALSE(finish(kGroups, 1));
+  EXPECT_TRUE(finish(kGroups, 2));
+  EXPECT_FALSE(finish("select count(*) from protodb.test.Person", 0));
+  // Reaching the limit isn't a failure.
+  EXPECT_TRUE(finish(absl::StrCat(kGroups, " limit 1"), 1));
+}
+
+TEST_F(QueryTest, SpillsAndMergesGroups) {
+  std::vector<std::string> people;
+  for (int i = 0; i < 5000; ++i) {
+    people.push_back(Encode(absl::StrCat("name: \"p", i % 1000, "\" age: ",
+                                         i % 97, " score: ", i * 0.5)));
+  }
+  people[2500].pop_back();
+  const char* const kQuery =
+      "select name, count(*), sum(age), max(score), approx_distinct(age), "
+      "approx_quantile(score, 0.5) from protodb.test.Person group by name";
+
+  const std::string expected = Aggregate(kQuery, people);
+  EXPECT_EQ(spills_, 0);
+  EXPECT_EQ(std::count(expected.begin(), expected.end(), '\n'), 1000);
+  EXPECT_EQ(expected.substr(0, expected.find('\n')),
+            "p0\t5\t203\t2000\t5\t1002.42800852213");
+
+  AggregatorOptions options;
+  options.workers = 3;
+  options.memory_limit = 64 << 10;
+  options.temp_dir = ::testing::TempDir();
+  EXPECT_EQ(Aggregate(kQuery, people, options, 100), expected);
+  EXPECT_GT(spills_, 0);
+}
+
+}  // namespace
+}  // namespace protoquery
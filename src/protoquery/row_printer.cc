@@ -0,0 +1,141 @@
+#include "protoquery/row_printer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "protodb/io/parse_plan.h"
+#include "protoquery/query_program.h"
+
+namespace protoquery {
+
+using ::google::protobuf::EnumValueDescriptor;
+using ::google::protobuf::Message;
+
+namespace {
+
+std::string FormatFloat(float value) {
+  std::string text = absl::StrFormat("%.6g", value);
+  float parsed;
+  if (absl::SimpleAtof(text, &parsed) && parsed == value)
+    return text;
+  return absl::StrFormat("%.9g", value);
+}
+
+}  // namespace
+
+std::string FormatDouble(double value) {
+  std::string text = absl::StrFormat("%.15g", value);
+  double parsed;
+  if (absl::SimpleAtod(text, &parsed) && parsed == value)
+    return text;
+  return absl::StrFormat("%.17g", value);
+}
+
+RowPrinter::RowPrinter(const QueryProgram* program) : program_(program) {
+  printer_.SetSingleLineMode(true);
+}
+
+bool RowPrinter::Print(absl::string_view message, const QueryProgram::Row& row,
+                       std::string* out) {
+  if (program_->columns().empty()) {
+    if (!PrintMessage(program_->descriptor(), message, out))
+      return false;
+    out->push_back('\n');
+    return true;
+  }
+
+  bool first_column = true;
+  for (const QueryProgram::Column& column : program_->columns()) {
+    if (!first_column)
+      out->push_back('\t');
+    first_column = false;
+
+    const auto& values = row.slots[column.slot];
+    if (values.empty() && column.defaulted) {
+      PrintValue(column.field, column.default_value, out);
+      continue;
+    }
+    bool first_value = true;
+    for (const QueryProgram::Value& value : values) {
+      if (!first_value)
+        out->push_back(',');
+      first_value = false;
+      if (column.field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) {
+        PrintValue(column.field, value, out);
+        continue;
+      }
+      out->push_back('{');
+      if (!PrintMessage(column.field->message_type(), value.data, out))
+        return false;
+      out->push_back('}');
+    }
+  }
+  out->push_back('\n');
+  return true;
+}
+
+void RowPrinter::PrintValue(const FieldDescriptor* field,
+                            const QueryProgram::Value& value,
+                            std::string* out) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+      absl::StrAppend(out, ParsePlan::AsInt64(value.bits));
+      break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+      absl::StrAppend(out, value.bits);
+      break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      absl::StrAppend(out, FormatFloat(ParsePlan::AsFloat(value.bits)));
+      break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      absl::StrAppend(out, FormatDouble(ParsePlan::AsDouble(value.bits)));
+      break;
+    case FieldDescriptor::CPPTYPE_BOOL:
+      absl::StrAppend(out, value.bits ? "true" : "false");
+      break;
+    case FieldDescriptor::CPPTYPE_ENUM: {
+      const int number = static_cast<int>(ParsePlan::AsInt64(value.bits));
+      const EnumValueDescriptor* enum_value =
+          field->enum_type()->FindValueByNumber(number);
+      if (enum_value != nullptr) {
+        absl::StrAppend(out, enum_value->name());
+      } else {
+        absl::StrAppend(out, number);
+      }
+      break;
+    }
+    case FieldDescriptor::CPPTYPE_STRING:
+      absl::StrAppend(out, absl::CEscape(value.data));
+      break;
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      break;
+  }
+}
+
+bool RowPrinter::PrintMessage(const Descriptor* descriptor,
+                              absl::string_view data, std::string* out) {
+  std::unique_ptr<Message>& message = messages_[descriptor];
+  if (message == nullptr) {
+    message.reset(factory_.GetPrototype(descriptor)->New());
+  }
+  message->Clear();
+  if (!message->ParsePartialFromArray(data.data(), data.size()))
+    return false;
+  text_.clear();
+  printer_.PrintToString(*message, &text_);
+  absl::StrAppend(out, absl::StripTrailingAsciiWhitespace(text_));
+  return true;
+}
+
+}  // namespace protoquery
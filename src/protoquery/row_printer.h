@@ -0,0 +1,62 @@
+#ifndef PROTOQUERY_ROW_PRINTER_H__
+#define PROTOQUERY_ROW_PRINTER_H__
+
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/dynamic_message.h"
+#include "google/protobuf/message.h"
+#include "google/protobuf/text_format.h"
+#include "protoquery/query_program.h"
+
+namespace protoquery {
+
+// The shorter of 15 and 17 digits that reads back as `value`, as the text
+// format prints doubles.
+std::string FormatDouble(double value);
+
+// Prints the messages a QueryProgram matches, one line each.
+//
+// With selected fields, a line holds their values separated by tabs.
+// Repeated values are separated by commas, strings and bytes are C escaped
+// and enums print their names.  A missing field prints nothing unless it
+// reads as its default.  Submessages are printed in the text format in
+// braces.  With `select *`, a line is the whole message in the text format.
+//
+// Only the messages printed are parsed, and only the selected submessages
+// of them, each into a DynamicMessage kept for its type.  A RowPrinter is
+// not thread-safe.
+class RowPrinter {
+ public:
+  explicit RowPrinter(const QueryProgram* program);
+  RowPrinter(const RowPrinter&) = delete;
+  RowPrinter& operator=(const RowPrinter&) = delete;
+
+  // Appends the line for `message`, whose values Evaluate() put in `row`.
+  // Returns false if a message to print doesn't parse.
+  bool Print(absl::string_view message, const QueryProgram::Row& row,
+             std::string* out);
+
+  // Appends a scalar, string or bytes value of `field` as Print() would.
+  static void PrintValue(const FieldDescriptor* field,
+                         const QueryProgram::Value& value, std::string* out);
+
+ private:
+  bool PrintMessage(const Descriptor* descriptor, absl::string_view data,
+                    std::string* out);
+
+  const QueryProgram* const program_;
+  google::protobuf::DynamicMessageFactory factory_;
+  google::protobuf::TextFormat::Printer printer_;
+  absl::flat_hash_map<const Descriptor*,
+                      std::unique_ptr<google::protobuf::Message>>
+      messages_;
+  std::string text_;
+};
+
+}  // namespace protoquery
+
+#endif  // PROTOQUERY_ROW_PRINTER_H__
@@ -0,0 +1,349 @@
+#include "protoquery/sketches.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "protodb/io/parse_plan.h"
+
+namespace protoquery {
+
+using ::google::protobuf::io::CodedOutputStream;
+using ::protodb::ParsePlan;
+
+namespace {
+
+// How a DistinctCounter is encoded.
+enum : uint8_t {
+  kExactHashes = 0,
+  kRegisterBytes = 1,
+};
+
+constexpr double kRelativeAccuracy = 0.01;
+const double kGamma = (1 + kRelativeAccuracy) / (1 - kRelativeAccuracy);
+const double kLogGamma = std::log(kGamma);
+
+void AppendVarint(uint64_t value, std::string* out) {
+  uint8_t buffer[10];
+  const uint8_t* end = CodedOutputStream::WriteVarint64ToArray(value, buffer);
+  out->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+void AppendFixed64(uint64_t value, std::string* out) {
+  char buffer[8];
+  absl::little_endian::Store64(buffer, value);
+  out->append(buffer, 8);
+}
+
+void AppendDouble(double value, std::string* out) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, 8);
+  AppendFixed64(bits, out);
+}
+
+uint32_t ZigZag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+int32_t UnZigZag(uint32_t value) {
+  return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+bool ReadVarint(absl::string_view* in, uint64_t* value) {
+  const char* p = ParsePlan::ReadVarint(in->data(), in->data() + in->size(),
+                                        value);
+  if (p == nullptr)
+    return false;
+  in->remove_prefix(p - in->data());
+  return true;
+}
+
+bool ReadFixed64(absl::string_view* in, uint64_t* value) {
+  if (in->size() < 8)
+    return false;
+  *value = absl::little_endian::Load64(in->data());
+  in->remove_prefix(8);
+  return true;
+}
+
+bool ReadDouble(absl::string_view* in, double* value) {
+  uint64_t bits;
+  if (!ReadFixed64(in, &bits))
+    return false;
+  std::memcpy(value, &bits, 8);
+  return true;
+}
+
+}  // namespace
+
+void DistinctCounter::Add(uint64_t hash) {
+  if (!registers_.empty()) {
+    AddToRegisters(hash);
+    return;
+  }
+  exact_.insert(hash);
+  if (exact_.size() > kMaxExact)
+    ToRegisters();
+}
+
+void DistinctCounter::AddToRegisters(uint64_t hash) {
+  // The low bits pick the register and the rest give the rank: the
+  // position of their first one bit.
+  const uint64_t rest = hash >> kPrecision;
+  const uint8_t rank =
+      rest == 0 ? 64 - kPrecision + 1
+                : absl::countl_zero(rest) - kPrecision + 1;
+  uint8_t& value = registers_[hash & (kRegisters - 1)];
+  value = std::max(value, rank);
+}
+
+void DistinctCounter::ToRegisters() {
+  registers_.assign(kRegisters, 0);
+  for (uint64_t hash : exact_) {
+    AddToRegisters(hash);
+  }
+  exact_ = absl::flat_hash_set<uint64_t>();
+}
+
+void DistinctCounter::Merge(const DistinctCounter& other) {
+  if (other.registers_.empty()) {
+    for (uint64_t hash : other.exact_) {
+      Add(hash);
+    }
+    return;
+  }
+  if (registers_.empty())
+    ToRegisters();
+  for (size_t i = 0; i < kRegisters; ++i) {
+    registers_[i] = std::max(registers_[i], other.registers_[i]);
+  }
+}
+
+uint64_t DistinctCounter::Estimate() const {
+  if (registers_.empty())
+    return exact_.size();
+
+  constexpr double m = kRegisters;
+  double sum = 0;
+  int zeros = 0;
+  for (uint8_t value : registers_) {
+    sum += std::ldexp(1.0, -value);
+    zeros += value == 0;
+  }
+  const double alpha = 0.7213 / (1 + 1.079 / m);
+  double estimate = alpha * m * m / sum;
+  // Small counts are estimated better by the registers left empty.
+  if (estimate <= 2.5 * m && zeros > 0)
+    estimate = m * std::log(m / zeros);
+  return static_cast<uint64_t>(std::llround(estimate));
+}
+
+size_t DistinctCounter::memory() const {
+  return sizeof(*this) + registers_.capacity() +
+         exact_.capacity() * (sizeof(uint64_t) + 1);
+}
+
+void DistinctCounter::Encode(std::string* out) const {
+  if (!registers_.empty()) {
+    out->push_back(kRegisterBytes);
+    out->append(reinterpret_cast<const char*>(registers_.data()),
+                registers_.size());
+    return;
+  }
+  out->push_back(kExactHashes);
+  AppendVarint(exact_.size(), out);
+  for (uint64_t hash : exact_) {
+    AppendFixed64(hash, out);
+  }
+}
+
+bool DistinctCounter::Decode(absl::string_view* in) {
+  exact_.clear();
+  registers_.clear();
+  if (in->empty())
+    return false;
+  const uint8_t kind = in->front();
+  in->remove_prefix(1);
+  if (kind == kRegisterBytes) {
+    if (in->size() < kRegisters)
+      return false;
+    registers_.assign(in->begin(), in->begin() + kRegisters);
+    in->remove_prefix(kRegisters);
+    return true;
+  }
+  uint64_t size;
+  if (kind != kExactHashes || !ReadVarint(in, &size) || size > kMaxExact)
+    return false;
+  for (uint64_t i = 0; i < size; ++i) {
+    uint64_t hash;
+    if (!ReadFixed64(in, &hash))
+      return false;
+    exact_.insert(hash);
+  }
+  return true;
+}
+
+int32_t QuantileSketch::Index(double magnitude) {
+  // Bucket i holds magnitudes in (gamma^(i-1), gamma^i].  Subnormals clamp
+  // to the smallest normal bucket.
+  magnitude = std::max(magnitude, 1e-300);
+  return static_cast<int32_t>(std::ceil(std::log(magnitude) / kLogGamma));
+}
+
+double QuantileSketch::Value(int32_t index) {
+  // The point of the bucket with the same relative error to both bounds.
+  return 2 * std::pow(kGamma, index) / (kGamma + 1);
+}
+
+void QuantileSketch::Collapse(Buckets* buckets) {
+  if (buckets->size() <= kMaxBuckets)
+    return;
+  std::vector<int32_t> indexes;
+  indexes.reserve(buckets->size());
+  for (const auto& [index, count] : *buckets) {
+    indexes.push_back(index);
+  }
+  std::sort(indexes.begin(), indexes.end());
+  // Folding an eighth more than needed leaves room for new buckets, so
+  // that a run of ever smaller values doesn't fold on every value.
+  const size_t excess = indexes.size() - kMaxBuckets + kMaxBuckets / 8;
+  uint64_t folded = 0;
+  for (size_t i = 0; i < excess; ++i) {
+    folded += (*buckets)[indexes[i]];
+    buckets->erase(indexes[i]);
+  }
+  (*buckets)[indexes[excess]] += folded;
+}
+
+void QuantileSketch::Add(double value) {
+  if (!std::isfinite(value))
+    return;
+  if (count_ == 0) {
+    min_ = max_ = value;
+  } else {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+  ++count_;
+  if (value > 0) {
+    ++positive_[Index(value)];
+    Collapse(&positive_);
+  } else if (value < 0) {
+    ++negative_[Index(-value)];
+    Collapse(&negative_);
+  } else {
+    ++zeros_;
+  }
+}
+
+void QuantileSketch::Merge(const QuantileSketch& other) {
+  if (other.count_ == 0)
+    return;
+  if (count_ == 0) {
+    min_ = other.min_;
+    max_ = other.max_;
+  } else {
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+  count_ += other.count_;
+  zeros_ += other.zeros_;
+  for (const auto& [index, count] : other.positive_) {
+    positive_[index] += count;
+  }
+  for (const auto& [index, count] : other.negative_) {
+    negative_[index] += count;
+  }
+  Collapse(&positive_);
+  Collapse(&negative_);
+}
+
+double QuantileSketch::Quantile(double q) const {
+  // The 0-based rank of the quantile, as numpy's default interpolation
+  // would place it before interpolating.
+  const double rank = q * (count_ - 1);
+  if (rank <= 0)
+    return min_;
+  if (rank >= count_ - 1)
+    return max_;
+
+  std::vector<std::pair<int32_t, uint64_t>> buckets(negative_.begin(),
+                                                    negative_.end());
+  // The most negative values, with the largest magnitudes, come first.
+  std::sort(buckets.begin(), buckets.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first; });
+  double seen = 0;
+  for (const auto& [index, count] : buckets) {
+    seen += count;
+    if (seen > rank)
+      return std::clamp(-Value(index), min_, max_);
+  }
+  seen += zeros_;
+  if (seen > rank)
+    return 0;
+  buckets.assign(positive_.begin(), positive_.end());
+  std::sort(buckets.begin(), buckets.end());
+  for (const auto& [index, count] : buckets) {
+    seen += count;
+    if (seen > rank)
+      return std::clamp(Value(index), min_, max_);
+  }
+  return max_;
+}
+
+size_t QuantileSketch::memory() const {
+  return sizeof(*this) + (positive_.capacity() + negative_.capacity()) *
+                             (sizeof(Buckets::value_type) + 1);
+}
+
+void QuantileSketch::Encode(std::string* out) const {
+  AppendVarint(count_, out);
+  if (count_ == 0)
+    return;
+  AppendVarint(zeros_, out);
+  AppendDouble(min_, out);
+  AppendDouble(max_, out);
+  for (const Buckets* buckets : {&positive_, &negative_}) {
+    AppendVarint(buckets->size(), out);
+    for (const auto& [index, count] : *buckets) {
+      AppendVarint(ZigZag(index), out);
+      AppendVarint(count, out);
+    }
+  }
+}
+
+bool QuantileSketch::Decode(absl::string_view* in) {
+  *this = QuantileSketch();
+  if (!ReadVarint(in, &count_))
+    return false;
+  if (count_ == 0)
+    return true;
+  if (!ReadVarint(in, &zeros_) || !ReadDouble(in, &min_) ||
+      !ReadDouble(in, &max_)) {
+    return false;
+  }
+  for (Buckets* buckets : {&positive_, &negative_}) {
+    uint64_t size;
+    if (!ReadVarint(in, &size) || size > kMaxBuckets)
+      return false;
+    for (uint64_t i = 0; i < size; ++i) {
+      uint64_t index, count;
+      if (!ReadVarint(in, &index) || !ReadVarint(in, &count) ||
+          index > UINT32_MAX) {
+        return false;
+      }
+      (*buckets)[UnZigZag(static_cast<uint32_t>(index))] = count;
+    }
+  }
+  return true;
+}
+
+}  // namespace protoquery
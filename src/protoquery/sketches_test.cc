@@ -0,0 +1,157 @@
+#include "protoquery/sketches.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace protoquery {
+namespace {
+
+uint64_t Hash(uint64_t i) {
+  // SplitMix64, for well mixed hashes of distinct values.
+  uint64_t z = i + 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+TEST(DistinctCounterTest, CountsSmallSetsExactly) {
+  DistinctCounter counter;
+  EXPECT_EQ(counter.Estimate(), 0);
+  for (int round = 0; round < 3; ++round) {
+    for (uint64_t i = 0; i < 200; ++i) {
+      counter.Add(Hash(i));
+    }
+  }
+  EXPECT_EQ(counter.Estimate(), 200);
+}
+
+TEST(DistinctCounterTest, EstimatesLargeSets) {
+  for (uint64_t n : {1000, 20000, 1000000}) {
+    DistinctCounter counter;
+    for (uint64_t i = 0; i < n; ++i) {
+      counter.Add(Hash(i));
+      counter.Add(Hash(i / 2));
+    }
+    // Several standard errors of 1.6%.
+    EXPECT_NEAR(counter.Estimate(), n, n * 0.05) << n;
+    EXPECT_LE(counter.memory(), 8 << 10);
+  }
+}
+
+TEST(DistinctCounterTest, MergesAndEncodes) {
+  DistinctCounter a, b, small;
+  for (uint64_t i = 0; i < 30000; ++i) {
+    a.Add(Hash(i));
+  }
+  for (uint64_t i = 20000; i < 50000; ++i) {
+    b.Add(Hash(i));
+  }
+  for (uint64_t i = 49990; i < 50100; ++i) {
+    small.Add(Hash(i));
+  }
+  a.Merge(b);
+  a.Merge(small);
+  EXPECT_NEAR(a.Estimate(), 50100, 50100 * 0.05);
+
+  for (const DistinctCounter* counter : {&a, &small}) {
+    std::string encoded;
+    counter->Encode(&encoded);
+    encoded += "rest";
+    absl::string_view in = encoded;
+    DistinctCounter decoded;
+    ASSERT_TRUE(decoded.Decode(&in));
+    EXPECT_EQ(in, "rest");
+    EXPECT_EQ(decoded.Estimate(), counter->Estimate());
+  }
+
+  // Merging a small counter into an empty one stays exact.
+  DistinctCounter empty;
+  empty.Merge(small);
+  EXPECT_EQ(empty.Estimate(), 110);
+
+  absl::string_view truncated = "\1abc";
+  EXPECT_FALSE(empty.Decode(&truncated));
+}
+
+// The exact `q` quantile of sorted `values`, at the nearest rank.
+double ExactQuantile(const std::vector<double>& values, double q) {
+  return values[static_cast<size_t>(q * (values.size() - 1))];
+}
+
+TEST(QuantileSketchTest, EstimatesWithinRelativeAccuracy) {
+  std::mt19937_64 random(7);
+  std::lognormal_distribution<double> lognormal(3, 2);
+  std::vector<double> values;
+  QuantileSketch sketch;
+  for (int i = 0; i < 100000; ++i) {
+    // Both signs, many magnitudes and some zeros.
+    double value = i % 10 == 0 ? 0 : lognormal(random);
+    if (i % 3 == 0)
+      value = -value;
+    values.push_back(value);
+    sketch.Add(value);
+  }
+  sketch.Add(NAN);
+  sketch.Add(INFINITY);
+  std::sort(values.begin(), values.end());
+  EXPECT_EQ(sketch.count(), values.size());
+  EXPECT_EQ(sketch.Quantile(0), values.front());
+  EXPECT_EQ(sketch.Quantile(1), values.back());
+  for (double q : {0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999}) {
+    const double exact = ExactQuantile(values, q);
+    EXPECT_NEAR(sketch.Quantile(q), exact, std::abs(exact) * 0.0101) << q;
+  }
+}
+
+TEST(QuantileSketchTest, MergesAndEncodes) {
+  QuantileSketch a, b, all;
+  for (int i = 1; i <= 1000; ++i) {
+    (i % 2 ? a : b).Add(i);
+    all.Add(i);
+  }
+  a.Merge(b);
+  EXPECT_EQ(a.count(), 1000);
+  for (double q : {0.0, 0.5, 0.9, 1.0}) {
+    EXPECT_EQ(a.Quantile(q), all.Quantile(q)) << q;
+  }
+
+  std::string encoded;
+  a.Encode(&encoded);
+  QuantileSketch().Encode(&encoded);
+  absl::string_view in = encoded;
+  QuantileSketch decoded, empty;
+  ASSERT_TRUE(decoded.Decode(&in));
+  ASSERT_TRUE(empty.Decode(&in));
+  EXPECT_TRUE(in.empty());
+  EXPECT_EQ(empty.count(), 0);
+  EXPECT_EQ(decoded.count(), 1000);
+  EXPECT_EQ(decoded.Quantile(0.5), a.Quantile(0.5));
+  EXPECT_NEAR(decoded.Quantile(0.5), 500.5, 5);
+}
+
+TEST(QuantileSketchTest, BoundsItsBuckets) {
+  // Magnitudes from 1e-300 to 1e300 need far more buckets than are kept,
+  // so the smallest are folded together while the large ones stay accurate.
+  QuantileSketch sketch;
+  std::vector<double> values;
+  for (int e = -300; e <= 300; ++e) {
+    for (int i = 1; i <= 9; ++i) {
+      values.push_back(i * std::pow(10.0, e));
+      sketch.Add(values.back());
+    }
+  }
+  std::sort(values.begin(), values.end());
+  EXPECT_LE(sketch.memory(), 256 << 10);
+  const double exact = ExactQuantile(values, 0.99);
+  EXPECT_NEAR(sketch.Quantile(0.99), exact, exact * 0.0101);
+}
+
+}  // namespace
+}  // namespace protoquery
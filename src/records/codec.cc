@@ -0,0 +1,71 @@
+#include "records/codec.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+bool Compress(RecordCodec codec, int level, absl::string_view input,
+              std::string* output) {
+  const size_t offset = output->size();
+  switch (codec) {
+    case RECORD_CODEC_NONE:
+      output->append(input.data(), input.size());
+      return true;
+    case RECORD_CODEC_ZLIB: {
+      uLongf size = compressBound(input.size());
+      output->resize(offset + size);
+      const int result = compress2(
+          reinterpret_cast<Bytef*>(&(*output)[offset]), &size,
+          reinterpret_cast<const Bytef*>(input.data()), input.size(),
+          level == 0 ? Z_DEFAULT_COMPRESSION : level);
+      output->resize(result == Z_OK ? offset + size : offset);
+      return result == Z_OK;
+    }
+    case RECORD_CODEC_ZSTD: {
+      output->resize(offset + ZSTD_compressBound(input.size()));
+      const size_t size =
+          ZSTD_compress(&(*output)[offset], output->size() - offset,
+                        input.data(), input.size(), level);
+      const bool ok = !ZSTD_isError(size);
+      output->resize(ok ? offset + size : offset);
+      return ok;
+    }
+    default:
+      return false;
+  }
+}
+
+bool Decompress(RecordCodec codec, absl::string_view input,
+                size_t uncompressed_size, std::string* output) {
+  output->resize(uncompressed_size);
+  switch (codec) {
+    case RECORD_CODEC_NONE:
+      if (input.size() != uncompressed_size)
+        return false;
+      output->assign(input.data(), input.size());
+      return true;
+    case RECORD_CODEC_ZLIB: {
+      uLongf size = uncompressed_size;
+      return uncompress(reinterpret_cast<Bytef*>(output->data()), &size,
+                        reinterpret_cast<const Bytef*>(input.data()),
+                        input.size()) == Z_OK &&
+             size == uncompressed_size;
+    }
+    case RECORD_CODEC_ZSTD: {
+      const size_t size = ZSTD_decompress(output->data(), uncompressed_size,
+                                          input.data(), input.size());
+      return !ZSTD_isError(size) && size == uncompressed_size;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace records
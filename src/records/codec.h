@@ -0,0 +1,24 @@
+#ifndef RECORDS_CODEC_H__
+#define RECORDS_CODEC_H__
+
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+// Appends `input` compressed with `codec` to `output`.  `level` is the
+// codec's compression level, or 0 for its default.
+bool Compress(RecordCodec codec, int level, absl::string_view input,
+              std::string* output);
+
+// Replaces `output` with `input` decompressed with `codec`, which must
+// decompress to exactly `uncompressed_size` bytes.
+bool Decompress(RecordCodec codec, absl::string_view input,
+                size_t uncompressed_size, std::string* output);
+
+}  // namespace records
+
+#endif  // RECORDS_CODEC_H__
@@ -0,0 +1,372 @@
+#include "records/external_sort.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/strings/string_view.h"
+#include "records/record_reader.h"
+#include "records/record_writer.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+namespace {
+
+// A run entry is the key size as a fixed32, the key, the sequence number as
+// a fixed64 and the record.
+constexpr size_t kEntryOverhead = 4 + 8;
+
+// The first eight bytes of `key`, big endian and zero padded, which order
+// keys the same way as their leading bytes.
+uint64_t KeyPrefix(absl::string_view key) {
+  char bytes[8] = {};
+  memcpy(bytes, key.data(), std::min<size_t>(key.size(), sizeof(bytes)));
+  return absl::big_endian::Load64(bytes);
+}
+
+}  // namespace
+
+// A buffered record, stored in its worker's `Buffer::data`.
+struct ExternalSorter::Entry {
+  // Compared before the keys, which then only need comparing on a tie.
+  uint64_t prefix;
+  uint64_t sequence;
+  size_t offset;
+  uint32_t key_size;
+  uint32_t record_size;
+};
+
+// The records buffered by one worker, and the runs it has spilled.
+struct ExternalSorter::Buffer {
+  std::string data;
+  std::vector<Entry> entries;
+  std::vector<std::string> runs;
+
+  absl::string_view key(const Entry& entry) const {
+    return absl::string_view(data).substr(entry.offset, entry.key_size);
+  }
+  absl::string_view record(const Entry& entry) const {
+    return absl::string_view(data).substr(entry.offset + entry.key_size,
+                                          entry.record_size);
+  }
+  size_t memory() const {
+    return data.size() + entries.size() * sizeof(Entry);
+  }
+
+  void Sort() {
+    std::sort(entries.begin(), entries.end(),
+              [this](const Entry& a, const Entry& b) {
+                if (a.prefix != b.prefix)
+                  return a.prefix < b.prefix;
+                const int order = key(a).compare(key(b));
+                if (order != 0)
+                  return order < 0;
+                return a.sequence < b.sequence;
+              });
+  }
+};
+
+// The records of one sorted run, in order.
+class ExternalSorter::Cursor {
+ public:
+  virtual ~Cursor() = default;
+
+  // Moves to the next record.  Returns false at the end of the run or on an
+  // error, see ok().
+  virtual bool Next() = 0;
+  virtual bool ok() const {
+    return true;
+  }
+
+  // The current record, valid until the cursor is destroyed.
+  absl::string_view key;
+  uint64_t sequence = 0;
+  absl::string_view record;
+};
+
+class ExternalSorter::MemoryCursor : public Cursor {
+ public:
+  explicit MemoryCursor(const Buffer& buffer) : buffer_(buffer) {}
+
+  bool Next() override {
+    if (next_ == buffer_.entries.size())
+      return false;
+    const Entry& entry = buffer_.entries[next_++];
+    key = buffer_.key(entry);
+    sequence = entry.sequence;
+    record = buffer_.record(entry);
+    return true;
+  }
+
+ private:
+  const Buffer& buffer_;
+  size_t next_ = 0;
+};
+
+class ExternalSorter::FileCursor : public Cursor {
+ public:
+  FileCursor(std::unique_ptr<RecordReader> reader, std::string path)
+      : reader_(std::move(reader)), path_(std::move(path)) {}
+
+  bool Next() override {
+    absl::string_view data;
+    const RecordReader::Status status = reader_->Next(&data);
+    if (status == RecordReader::END_OF_STREAM)
+      return false;
+    if (status != RecordReader::OK || data.size() < kEntryOverhead) {
+      return Fail();
+    }
+    const uint32_t key_size = absl::little_endian::Load32(data.data());
+    if (data.size() - kEntryOverhead < key_size)
+      return Fail();
+    key = data.substr(4, key_size);
+    sequence = absl::little_endian::Load64(data.data() + 4 + key_size);
+    record = data.substr(kEntryOverhead + key_size);
+    return true;
+  }
+
+  bool ok() const override {
+    return ok_;
+  }
+
+ private:
+  bool Fail() {
+    std::cerr << path_ << ": corrupt sorted run at offset "
+              << reader_->offset() << std::endl;
+    ok_ = false;
+    return false;
+  }
+
+  const std::unique_ptr<RecordReader> reader_;
+  const std::string path_;
+  bool ok_ = true;
+};
+
+namespace {
+
+// A tournament tree over sorted runs that keeps the loser of each match in
+// its internal nodes.  After taking the winner, only the matches on the
+// path from its run to the root are replayed, against the stored losers,
+// for log2(k) comparisons per record instead of the 2 * log2(k) of a heap.
+template <typename Run, typename Less>
+class LoserTree {
+ public:
+  // `runs` must be positioned at their first record, or null if empty.
+  LoserTree(std::vector<Run*> runs, Less less)
+      : runs_(std::move(runs)), less_(less), tree_(runs_.size()) {
+    if (!runs_.empty())
+      tree_[0] = Build(1);
+  }
+
+  // The run holding the smallest record, or null once every run is done.
+  Run* top() const {
+    return runs_.empty() ? nullptr : runs_[tree_[0]];
+  }
+
+  // Replays the matches of the top run after it moved to its next record,
+  // or became null when it ran out.
+  void Replay(Run* run) {
+    int winner = tree_[0];
+    runs_[winner] = run;
+    for (size_t node = (winner + runs_.size()) / 2; node > 0; node /= 2) {
+      if (Beats(tree_[node], winner))
+        std::swap(tree_[node], winner);
+    }
+    tree_[0] = winner;
+  }
+
+ private:
+  // Plays the matches below `node`, where nodes from runs_.size() up are
+  // the runs themselves, and returns the winner.
+  int Build(size_t node) {
+    if (node >= runs_.size())
+      return node - runs_.size();
+    const int left = Build(2 * node);
+    const int right = Build(2 * node + 1);
+    if (Beats(right, left)) {
+      tree_[node] = left;
+      return right;
+    }
+    tree_[node] = right;
+    return left;
+  }
+
+  // Finished runs lose every match.
+  bool Beats(int a, int b) const {
+    if (runs_[a] == nullptr)
+      return false;
+    if (runs_[b] == nullptr)
+      return true;
+    return less_(*runs_[a], *runs_[b]);
+  }
+
+  std::vector<Run*> runs_;
+  Less less_;
+  // The overall winner in tree_[0], and the loser of each match in the
+  // internal nodes 1 to runs_.size() - 1.
+  std::vector<int> tree_;
+};
+
+}  // namespace
+
+ExternalSorter::ExternalSorter(const ExternalSortOptions& options)
+    : options_(options),
+      buffer_limit_(std::max<size_t>(
+          1, options.memory_limit / std::max(1, options.workers))) {
+  for (int i = 0; i < std::max(1, options.workers); ++i) {
+    buffers_.push_back(std::make_unique<Buffer>());
+  }
+}
+
+ExternalSorter::~ExternalSorter() {
+  for (const auto& buffer : buffers_) {
+    for (const std::string& run : buffer->runs) {
+      unlink(run.c_str());
+    }
+  }
+}
+
+size_t ExternalSorter::spilled_runs() const {
+  size_t runs = 0;
+  for (const auto& buffer : buffers_) {
+    runs += buffer->runs.size();
+  }
+  return runs;
+}
+
+bool ExternalSorter::Add(int worker, absl::string_view key, uint64_t sequence,
+                         absl::string_view record) {
+  Buffer& buffer = *buffers_[worker];
+  buffer.entries.push_back(Entry{
+      .prefix = KeyPrefix(key),
+      .sequence = sequence,
+      .offset = buffer.data.size(),
+      .key_size = static_cast<uint32_t>(key.size()),
+      .record_size = static_cast<uint32_t>(record.size()),
+  });
+  buffer.data.append(key.data(), key.size());
+  buffer.data.append(record.data(), record.size());
+  if (buffer.memory() >= buffer_limit_)
+    return Spill(buffer);
+  return true;
+}
+
+bool ExternalSorter::Spill(Buffer& buffer) {
+  buffer.Sort();
+
+  std::string dir = options_.temp_dir;
+  if (dir.empty()) {
+    const char* tmpdir = getenv("TMPDIR");
+    dir = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+  }
+  std::string path = dir + "/protodb-sort-XXXXXX";
+  const int fd = mkstemp(path.data());
+  if (fd < 0) {
+    std::cerr << dir << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  close(fd);
+  buffer.runs.push_back(path);
+
+  // Runs are read back once, soon after, so they go without checksums.
+  RecordSetHeader header;
+  header.set_name("protodb sorted run");
+  RecordWriterOptions writer_options;
+  writer_options.checksum = false;
+  auto writer = RecordWriter::Open(path, header, writer_options);
+  if (!writer)
+    return false;
+  std::string data;
+  for (const Entry& entry : buffer.entries) {
+    data.resize(4);
+    absl::little_endian::Store32(data.data(), entry.key_size);
+    const absl::string_view key = buffer.key(entry);
+    data.append(key.data(), key.size());
+    char sequence[8];
+    absl::little_endian::Store64(sequence, entry.sequence);
+    data.append(sequence, sizeof(sequence));
+    const absl::string_view record = buffer.record(entry);
+    data.append(record.data(), record.size());
+    if (!writer->Append(data))
+      return false;
+  }
+  if (!writer->Close())
+    return false;
+
+  buffer.entries.clear();
+  buffer.data.clear();
+  return true;
+}
+
+bool ExternalSorter::Merge(const MergeFn& fn) {
+  std::vector<std::unique_ptr<Cursor>> cursors;
+  for (const auto& buffer : buffers_) {
+    for (const std::string& run : buffer->runs) {
+      auto reader = RecordReader::Open(run);
+      if (!reader)
+        return false;
+      // The mapping outlives the file.
+      unlink(run.c_str());
+      cursors.push_back(std::make_unique<FileCursor>(std::move(reader), run));
+    }
+    buffer->runs.clear();
+    if (!buffer->entries.empty()) {
+      buffer->Sort();
+      cursors.push_back(std::make_unique<MemoryCursor>(*buffer));
+    }
+  }
+
+  std::vector<Cursor*> runs;
+  for (const auto& cursor : cursors) {
+    if (cursor->Next()) {
+      runs.push_back(cursor.get());
+    } else if (!cursor->ok()) {
+      return false;
+    } else {
+      runs.push_back(nullptr);
+    }
+  }
+  const auto less = [](const Cursor& a, const Cursor& b) {
+    const int order = a.key.compare(b.key);
+    return order != 0 ? order < 0 : a.sequence < b.sequence;
+  };
+  LoserTree<Cursor, decltype(less)> tree(std::move(runs), less);
+
+  // With `unique`, a record is held back until the next one shows whether
+  // it's the last for its key.
+  bool held = false;
+  absl::string_view held_key;
+  absl::string_view held_record;
+  while (Cursor* cursor = tree.top()) {
+    if (options_.unique) {
+      if (held && cursor->key != held_key && !fn(held_key, held_record))
+        return false;
+      held = true;
+      held_key = cursor->key;
+      held_record = cursor->record;
+    } else if (!fn(cursor->key, cursor->record)) {
+      return false;
+    }
+    if (cursor->Next()) {
+      tree.Replay(cursor);
+    } else if (!cursor->ok()) {
+      return false;
+    } else {
+      tree.Replay(nullptr);
+    }
+  }
+  return !held || fn(held_key, held_record);
+}
+
+}  // namespace records
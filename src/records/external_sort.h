@@ -0,0 +1,85 @@
+#ifndef RECORDS_EXTERNAL_SORT_H__
+#define RECORDS_EXTERNAL_SORT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace records {
+
+struct ExternalSortOptions {
+  // Where sorted runs are spilled, or empty for $TMPDIR, falling back to
+  // /tmp.
+  std::string temp_dir;
+  // The memory for buffered records, shared evenly between the workers.  A
+  // worker sorts and spills its buffer as a run once its share is full.
+  size_t memory_limit = size_t{1} << 30;
+  // The number of threads adding records.
+  int workers = 1;
+  // Keep only the record with the largest sequence number for each key.
+  bool unique = false;
+};
+
+// Sorts records by key with a bounded amount of memory.
+//
+// Each worker thread buffers the records it adds.  When its share of
+// `memory_limit` is full, the worker sorts the buffer and spills it to a
+// temporary records file as a sorted run, so runs are generated in
+// parallel.  Merge() then merges the spilled runs with the buffers still in
+// memory through a loser tree, which finds the next record with one
+// comparison per level of the tree, log2 of the number of runs.
+//
+// Records with equal keys are ordered by their sequence numbers, which
+// callers assign in input order to make the sort stable.  Keys are
+// compared as bytes.
+class ExternalSorter {
+ public:
+  // Called with each record in order.  Returning false stops the merge.
+  using MergeFn =
+      std::function<bool(absl::string_view key, absl::string_view record)>;
+
+  explicit ExternalSorter(
+      const ExternalSortOptions& options = ExternalSortOptions());
+  ExternalSorter(const ExternalSorter&) = delete;
+  ExternalSorter& operator=(const ExternalSorter&) = delete;
+  // Removes any runs left on disk.
+  ~ExternalSorter();
+
+  // Adds a record on worker `worker`, in [0, workers).  Workers can add at
+  // the same time, but each worker must only be used by one thread at a
+  // time.  Returns false and reports the error to stderr if a run fails to
+  // be spilled.
+  bool Add(int worker, absl::string_view key, uint64_t sequence,
+           absl::string_view record);
+
+  // Merges every record added, calling `fn` with each in key order.  Must
+  // be called once, after all adds.  Returns false if a run can't be read
+  // or `fn` returns false.
+  bool Merge(const MergeFn& fn);
+
+  // The number of runs spilled to disk, until Merge() takes them.
+  size_t spilled_runs() const;
+
+ private:
+  struct Entry;
+  struct Buffer;
+  class Cursor;
+  class MemoryCursor;
+  class FileCursor;
+
+  // Sorts `buffer` and writes it to a new run file.
+  bool Spill(Buffer& buffer);
+
+  const ExternalSortOptions options_;
+  const size_t buffer_limit_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+}  // namespace records
+
+#endif  // RECORDS_EXTERNAL_SORT_H__
@@ -0,0 +1,204 @@
+#include "records/group_commit_writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "records/record_writer.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+std::unique_ptr<GroupCommitWriter> GroupCommitWriter::Open(
+    const std::string& path, const RecordSetHeader& header,
+    const GroupCommitOptions& options) {
+  auto writer = RecordWriter::Open(path, header, options.writer);
+  if (!writer)
+    return nullptr;
+  return std::unique_ptr<GroupCommitWriter>(
+      new GroupCommitWriter(std::move(writer), path, options));
+}
+
+GroupCommitWriter::GroupCommitWriter(std::unique_ptr<RecordWriter> writer,
+                                     std::string path,
+                                     const GroupCommitOptions& options)
+    : path_(std::move(path)), options_(options), writer_(std::move(writer)) {
+  if (options_.sync == GroupCommitOptions::SyncMode::INTERVAL) {
+    sync_thread_ = std::thread([this] { SyncLoop(); });
+  }
+}
+
+GroupCommitWriter::~GroupCommitWriter() {
+  Close();
+}
+
+bool GroupCommitWriter::Append(absl::string_view data) {
+  return AppendKeyed(data, nullptr);
+}
+
+bool GroupCommitWriter::Append(absl::string_view data, absl::string_view key) {
+  return AppendKeyed(data, &key);
+}
+
+bool GroupCommitWriter::AppendKeyed(absl::string_view data,
+                                    const absl::string_view* key) {
+  // Encode and checksum the record before taking the lock, so that this
+  // work runs in parallel across the appending threads.
+  Request request;
+  AppendRecord(data, options_.writer.checksum, &request.record);
+  if (key != nullptr) {
+    request.key = *key;
+    request.has_key = true;
+  }
+
+  absl::MutexLock lock(&mu_);
+  if (closed_) {
+    std::cerr << path_ << ": append after close" << std::endl;
+    return false;
+  }
+  if (failed_)
+    return false;
+  queue_.push_back(&request);
+  queued_bytes_ += request.record.size();
+  if (leader_active_) {
+    mu_.Await(absl::Condition(&request.wake));
+    if (request.done)
+      return request.ok;
+    // Handed the lead of the next group.
+  }
+  leader_active_ = true;
+
+  if (options_.max_latency > absl::ZeroDuration()) {
+    mu_.AwaitWithTimeout(
+        absl::Condition(this, &GroupCommitWriter::GroupFull),
+        options_.max_latency);
+  }
+  CommitGroup();
+
+  if (queue_.empty()) {
+    leader_active_ = false;
+  } else {
+    queue_.front()->wake = true;
+  }
+  return request.ok;
+}
+
+bool GroupCommitWriter::CommitGroup() {
+  std::vector<Request*> group;
+  group.swap(queue_);
+  queued_bytes_ = 0;
+  bool ok = !failed_;
+
+  mu_.Unlock();
+  for (const Request* request : group) {
+    if (!ok)
+      break;
+    ok = writer_->AppendEncoded(request->record,
+                                request->has_key ? &request->key : nullptr);
+  }
+  if (ok) {
+    ok = options_.sync == GroupCommitOptions::SyncMode::GROUP
+             ? writer_->Sync()
+             : writer_->Flush();
+  }
+  mu_.Lock();
+
+  if (ok) {
+    count_ += group.size();
+    ++groups_;
+    if (options_.sync == GroupCommitOptions::SyncMode::GROUP)
+      synced_groups_ = groups_;
+  } else {
+    // The writer's state is unknown after a failed write, so fail every
+    // later append as well.
+    failed_ = true;
+  }
+  for (Request* request : group) {
+    request->ok = ok;
+    request->done = true;
+    request->wake = true;
+  }
+  return ok;
+}
+
+bool GroupCommitWriter::Sync() {
+  uint64_t groups;
+  {
+    absl::MutexLock lock(&mu_);
+    if (closed_)
+      return !failed_;
+    groups = groups_;
+  }
+  if (fdatasync(writer_->fd()) != 0) {
+    std::cerr << path_ << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  absl::MutexLock lock(&mu_);
+  synced_groups_ = std::max(synced_groups_, groups);
+  return true;
+}
+
+void GroupCommitWriter::SyncLoop() {
+  absl::MutexLock lock(&mu_);
+  while (!closed_) {
+    mu_.AwaitWithTimeout(absl::Condition(&closed_), options_.sync_interval);
+    if (closed_ || synced_groups_ == groups_)
+      continue;
+    const uint64_t groups = groups_;
+
+    mu_.Unlock();
+    const bool ok = fdatasync(writer_->fd()) == 0;
+    if (!ok)
+      std::cerr << path_ << ": " << strerror(errno) << std::endl;
+    mu_.Lock();
+
+    if (ok) {
+      synced_groups_ = std::max(synced_groups_, groups);
+    } else {
+      failed_ = true;
+    }
+  }
+}
+
+bool GroupCommitWriter::Close() {
+  bool ok;
+  {
+    absl::MutexLock lock(&mu_);
+    if (closed_)
+      return true;
+    closed_ = true;
+    // The queue drains before the last leader steps down.
+    mu_.Await(absl::Condition(this, &GroupCommitWriter::NoLeader));
+    ok = !failed_;
+  }
+  if (sync_thread_.joinable())
+    sync_thread_.join();
+
+  if (options_.sync != GroupCommitOptions::SyncMode::NONE)
+    ok = writer_->Sync() && ok;
+  return writer_->Close() && ok;
+}
+
+uint64_t GroupCommitWriter::count() const {
+  absl::MutexLock lock(&mu_);
+  return count_;
+}
+
+uint64_t GroupCommitWriter::groups() const {
+  absl::MutexLock lock(&mu_);
+  return groups_;
+}
+
+}  // namespace records
@@ -0,0 +1,140 @@
+#ifndef RECORDS_GROUP_COMMIT_WRITER_H__
+#define RECORDS_GROUP_COMMIT_WRITER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "records/record_writer.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+struct GroupCommitOptions {
+  enum class SyncMode {
+    // Records are written to the file but left to the OS to sync.
+    NONE,
+    // Each group is synced before its appends return.
+    GROUP,
+    // A background thread syncs written groups every `sync_interval`.
+    INTERVAL,
+  };
+
+  // How long a group stays open for more appends before it is written.
+  // With zero, a group is written as soon as the previous one is done, and
+  // groups only form from appends that arrive while a write is in flight.
+  absl::Duration max_latency = absl::ZeroDuration();
+  // A group is written without waiting out `max_latency` once its records
+  // reach this many bytes.
+  size_t max_group_size = 1 << 20;
+  SyncMode sync = SyncMode::NONE;
+  absl::Duration sync_interval = absl::Milliseconds(100);
+  RecordWriterOptions writer;
+};
+
+// Appends records to a records file from many threads at once.
+//
+// Appends are committed in groups.  Each caller encodes and checksums its
+// own record without holding any lock, then queues it.  The first caller
+// to find no write in progress becomes the group's leader: it writes every
+// queued record with a single write, syncs if the options ask for it, and
+// wakes the callers whose records it wrote.  Callers that queue while a
+// group is being written form the next group, led by the first of them.
+//
+// Append() returns once the record has been written, and with
+// SyncMode::GROUP, once it has reached stable storage.  Records are written
+// in the order they were queued.
+//
+// With a codec set in the header, each group ends a compressed block, so
+// `max_latency` should be long enough for groups to fill blocks.
+class GroupCommitWriter {
+ public:
+  // Opens `path` like RecordWriter::Open().  Returns nullptr and reports the
+  // error to stderr on failure.
+  static std::unique_ptr<GroupCommitWriter> Open(
+      const std::string& path, const RecordSetHeader& header,
+      const GroupCommitOptions& options = GroupCommitOptions());
+
+  GroupCommitWriter(const GroupCommitWriter&) = delete;
+  GroupCommitWriter& operator=(const GroupCommitWriter&) = delete;
+  // Waits for pending appends and closes the file.  Errors are only
+  // reported by Close().
+  ~GroupCommitWriter();
+
+  // Appends one record.  Thread-safe.  Returns false if the record's group
+  // failed to be written or the writer failed earlier.
+  bool Append(absl::string_view data);
+
+  // Appends one record with a key for the block index, see
+  // RecordWriter::Append().  Thread-safe.
+  bool Append(absl::string_view data, absl::string_view key);
+
+  // Waits for records written so far to reach stable storage.  Thread-safe,
+  // but must not race with Close().
+  bool Sync();
+
+  // Waits for pending appends, writes the footer and closes the file.
+  // Appends after Close() fail.
+  bool Close();
+
+  // The number of records written.
+  uint64_t count() const;
+
+  // The number of groups written.
+  uint64_t groups() const;
+
+ private:
+  // An append waiting in the queue, owned by the appending thread.
+  struct Request {
+    std::string record;
+    absl::string_view key;
+    bool has_key = false;
+    // Set when the request is done or its thread is to lead the next group.
+    bool wake = false;
+    bool done = false;
+    bool ok = false;
+  };
+
+  GroupCommitWriter(std::unique_ptr<RecordWriter> writer, std::string path,
+                    const GroupCommitOptions& options);
+
+  bool AppendKeyed(absl::string_view data, const absl::string_view* key);
+  // Writes the queued requests as one group, called by the leader.
+  bool CommitGroup() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void SyncLoop();
+
+  bool GroupFull() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return closed_ || queued_bytes_ >= options_.max_group_size;
+  }
+  bool NoLeader() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return !leader_active_;
+  }
+
+  const std::string path_;
+  const GroupCommitOptions options_;
+  // Only used by the leader, or by Close() once there is none.
+  const std::unique_ptr<RecordWriter> writer_;
+  std::thread sync_thread_;
+
+  mutable absl::Mutex mu_;
+  std::vector<Request*> queue_ ABSL_GUARDED_BY(mu_);
+  size_t queued_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+  bool leader_active_ ABSL_GUARDED_BY(mu_) = false;
+  bool failed_ ABSL_GUARDED_BY(mu_) = false;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+  uint64_t count_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t groups_ ABSL_GUARDED_BY(mu_) = 0;
+  // The number of groups written when the file was last synced.
+  uint64_t synced_groups_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace records
+
+#endif  // RECORDS_GROUP_COMMIT_WRITER_H__
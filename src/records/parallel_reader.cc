@@ -0,0 +1,196 @@
+#include "records/parallel_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "records/record_reader.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+namespace {
+
+// The batches of an ordered read.  Range `i` is read into slot
+// `i % slots.size()`, which is free once range `i - slots.size()` has been
+// delivered, so workers never get more than a slot count ahead.
+class OrderedBatches {
+ public:
+  OrderedBatches(size_t ranges, size_t slots)
+      : ranges_(ranges), slots_(slots) {}
+
+  // Claims the next range to read into its slot.  Returns false once every
+  // range has been claimed or the read has failed.
+  bool Claim(size_t* index, RecordBatch** batch) {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(this, &OrderedBatches::CanClaim));
+    if (failed_ || next_claim_ == ranges_)
+      return false;
+    *index = next_claim_++;
+    *batch = &slots_[*index % slots_.size()].batch;
+    return true;
+  }
+
+  void Ready(size_t index, bool ok) {
+    absl::MutexLock lock(&mu_);
+    if (!ok) {
+      failed_ = true;
+      return;
+    }
+    slots_[index % slots_.size()].ready = true;
+  }
+
+  // Waits for the next range in order.  Returns nullptr once every range
+  // has been delivered or the read has failed.
+  const RecordBatch* Next() {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(this, &OrderedBatches::CanDeliver));
+    if (failed_ || next_delivery_ == ranges_)
+      return nullptr;
+    return &slots_[next_delivery_ % slots_.size()].batch;
+  }
+
+  // Frees the slot of the batch returned by Next().
+  void Done(bool ok) {
+    absl::MutexLock lock(&mu_);
+    if (!ok) {
+      failed_ = true;
+      return;
+    }
+    slots_[next_delivery_++ % slots_.size()].ready = false;
+  }
+
+  bool failed() const {
+    absl::MutexLock lock(&mu_);
+    return failed_;
+  }
+
+ private:
+  struct Slot {
+    RecordBatch batch;
+    bool ready = false;
+  };
+
+  bool CanClaim() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return failed_ || next_claim_ == ranges_ ||
+           next_claim_ < next_delivery_ + slots_.size();
+  }
+  bool CanDeliver() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return failed_ || next_delivery_ == ranges_ ||
+           slots_[next_delivery_ % slots_.size()].ready;
+  }
+
+  const size_t ranges_;
+  mutable absl::Mutex mu_;
+  std::vector<Slot> slots_;
+  size_t next_claim_ ABSL_GUARDED_BY(mu_) = 0;
+  size_t next_delivery_ ABSL_GUARDED_BY(mu_) = 0;
+  bool failed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace
+
+std::unique_ptr<ParallelRecordReader> ParallelRecordReader::Open(
+    const std::string& path, const ParallelReaderOptions& options) {
+  RecordReaderOptions reader_options;
+  reader_options.verify_checksums = options.verify_checksums;
+  auto reader = RecordReader::Open(path, reader_options);
+  if (!reader)
+    return nullptr;
+
+  std::unique_ptr<ParallelRecordReader> parallel_reader(
+      new ParallelRecordReader(std::move(reader), path, options));
+  const RecordReader::Status status = parallel_reader->reader_->SplitRanges(
+      std::max<size_t>(1, options.range_size), &parallel_reader->ranges_);
+  if (status == RecordReader::CORRUPT) {
+    std::cerr << path << ": malformed records" << std::endl;
+    return nullptr;
+  }
+  return parallel_reader;
+}
+
+ParallelRecordReader::ParallelRecordReader(
+    std::unique_ptr<RecordReader> reader, std::string path,
+    const ParallelReaderOptions& options)
+    : path_(std::move(path)),
+      options_(options),
+      threads_(options.threads > 0
+                   ? options.threads
+                   : std::max(1u, std::thread::hardware_concurrency())),
+      reader_(std::move(reader)) {}
+
+bool ParallelRecordReader::ReadBatch(size_t index, RecordBatch* batch) const {
+  batch->range = index;
+  const RecordReader::Range& range = ranges_[index];
+  if (reader_->ReadRange(range, &batch->buffer, &batch->records) !=
+      RecordReader::OK) {
+    std::cerr << path_ << ": corrupt records between offsets " << range.offset
+              << " and " << range.end << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ParallelRecordReader::ReadUnordered(const BatchFn& fn) {
+  std::atomic<size_t> next_range = 0;
+  std::atomic<bool> ok = true;
+  const auto work = [&](int worker) {
+    RecordBatch batch;
+    while (ok) {
+      const size_t index = next_range++;
+      if (index >= ranges_.size())
+        return;
+      if (!ReadBatch(index, &batch) || !fn(worker, batch)) {
+        ok = false;
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  const int threads =
+      static_cast<int>(std::min<size_t>(threads_, ranges_.size()));
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(work, i);
+  }
+  work(0);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  return ok;
+}
+
+bool ParallelRecordReader::ReadOrdered(const OrderedBatchFn& fn) {
+  const size_t max_pending =
+      options_.max_pending > 0 ? options_.max_pending : 4 * threads_;
+  OrderedBatches batches(ranges_.size(), max_pending);
+  const auto work = [&] {
+    size_t index;
+    RecordBatch* batch;
+    while (batches.Claim(&index, &batch)) {
+      batches.Ready(index, ReadBatch(index, batch));
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads_; ++i) {
+    workers.emplace_back(work);
+  }
+  while (const RecordBatch* batch = batches.Next()) {
+    batches.Done(fn(*batch));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  return !batches.failed();
+}
+
+}  // namespace records
@@ -0,0 +1,111 @@
+#ifndef RECORDS_PARALLEL_READER_H__
+#define RECORDS_PARALLEL_READER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "records/record_reader.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+struct ParallelReaderOptions {
+  // The number of worker threads, or 0 for one per core.
+  int threads = 0;
+  // In ordered mode, the most batches read ahead of the one being
+  // delivered, or 0 for four per thread.  Bounds the memory held by
+  // batches waiting for an earlier one.
+  int max_pending = 0;
+  // Files without a block index are split into ranges of about this many
+  // bytes.
+  size_t range_size = 1 << 20;
+  bool verify_checksums = true;
+};
+
+// The records of one range of a file: an indexed block, or a run of
+// records in a file without an index.
+struct RecordBatch {
+  // The position of the range in the file, counting from 0.
+  size_t range = 0;
+  // Views of the records' data, valid until the callback returns.
+  std::vector<absl::string_view> records;
+
+  // Holds the decompressed block the records point into.
+  std::string buffer;
+};
+
+// Reads a records file on a pool of worker threads.
+//
+// The file is split into ranges of whole records, normally the blocks of
+// its index, and each worker claims ranges in turn, decompresses them and
+// checks their records.  Records are handed out in batches, one per range,
+// as views into the file or the decompressed block.
+//
+// ReadUnordered() runs the callback on the workers themselves, in whatever
+// order ranges finish, for the most throughput.  ReadOrdered() delivers
+// batches on the calling thread in file order; workers stay at most
+// `max_pending` ranges ahead, so one slow range stalls the readers instead
+// of growing the reordering buffer.
+class ParallelRecordReader {
+ public:
+  // Called on worker `worker` with each batch.  Returning false stops the
+  // read.
+  using BatchFn = std::function<bool(int worker, const RecordBatch& batch)>;
+  // Called on the calling thread with each batch in file order.  Returning
+  // false stops the read.
+  using OrderedBatchFn = std::function<bool(const RecordBatch& batch)>;
+
+  // Opens `path` and splits it into ranges.  Returns nullptr and reports
+  // the error to stderr on failure.  A partial record at the end of the
+  // file, left by a writer that is still running, is not read.
+  static std::unique_ptr<ParallelRecordReader> Open(
+      const std::string& path,
+      const ParallelReaderOptions& options = ParallelReaderOptions());
+
+  ParallelRecordReader(const ParallelRecordReader&) = delete;
+  ParallelRecordReader& operator=(const ParallelRecordReader&) = delete;
+
+  const RecordSetHeader& header() const {
+    return reader_->header();
+  }
+
+  // The number of ranges, and so of batches, in the file.
+  size_t ranges() const {
+    return ranges_.size();
+  }
+
+  int threads() const {
+    return threads_;
+  }
+
+  // Reads every range, calling `fn` on the workers.  Returns false if a
+  // range is corrupt, reporting it to stderr, or if `fn` returns false.
+  bool ReadUnordered(const BatchFn& fn);
+
+  // Reads every range, calling `fn` on the calling thread in file order.
+  // Returns false if a range is corrupt, reporting it to stderr, or if `fn`
+  // returns false.
+  bool ReadOrdered(const OrderedBatchFn& fn);
+
+ private:
+  ParallelRecordReader(std::unique_ptr<RecordReader> reader,
+                       std::string path, const ParallelReaderOptions& options);
+
+  // Reads range `index` into `batch`, reporting errors to stderr.
+  bool ReadBatch(size_t index, RecordBatch* batch) const;
+
+  const std::string path_;
+  const ParallelReaderOptions options_;
+  const int threads_;
+  const std::unique_ptr<RecordReader> reader_;
+  std::vector<RecordReader::Range> ranges_;
+};
+
+}  // namespace records
+
+#endif  // RECORDS_PARALLEL_READER_H__
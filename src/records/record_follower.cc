@@ -0,0 +1,155 @@
+#include "records/record_follower.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "records/record_reader.h"
+
+namespace records {
+
+std::unique_ptr<RecordFollower> RecordFollower::Open(
+    const std::string& path, const RecordFollowerOptions& options) {
+  RecordReaderOptions reader_options;
+  reader_options.verify_checksums = options.verify_checksums;
+  auto reader = RecordReader::Open(path, reader_options);
+  if (!reader)
+    return nullptr;
+  std::unique_ptr<RecordFollower> follower(
+      new RecordFollower(std::move(reader), path, options));
+#if defined(__linux__)
+  follower->inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+  follower->Watch();
+  return follower;
+}
+
+RecordFollower::RecordFollower(std::unique_ptr<RecordReader> reader,
+                               std::string path,
+                               const RecordFollowerOptions& options)
+    : path_(std::move(path)), options_(options), reader_(std::move(reader)) {}
+
+RecordFollower::~RecordFollower() {
+  if (inotify_fd_ >= 0)
+    close(inotify_fd_);
+}
+
+void RecordFollower::Watch() {
+#if defined(__linux__)
+  if (inotify_fd_ < 0)
+    return;
+  if (watch_ >= 0)
+    inotify_rm_watch(inotify_fd_, watch_);
+  // Truncation shows up as IN_MODIFY, replacement as IN_ATTRIB or
+  // IN_DELETE_SELF, since the old file loses its link.
+  watch_ = inotify_add_watch(inotify_fd_, path_.c_str(),
+                             IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                 IN_DELETE_SELF | IN_MOVE_SELF);
+#endif
+}
+
+bool RecordFollower::Reopen() {
+  struct stat st;
+  if (stat(path_.c_str(), &st) != 0)
+    return false;
+  RecordReaderOptions reader_options;
+  reader_options.verify_checksums = options_.verify_checksums;
+  auto reader = RecordReader::Open(path_, reader_options);
+  if (!reader)
+    return false;
+  std::cerr << path_ << ": file truncated or replaced, reading from the start"
+            << std::endl;
+  reader_ = std::move(reader);
+  first_record_ = 0;
+  Watch();
+  return true;
+}
+
+bool RecordFollower::SeekToRecord(uint64_t index) {
+  first_record_ = index;
+  return reader_->SeekToRecord(index);
+}
+
+bool RecordFollower::Read(const RecordFn& fn) {
+  if (!reader_->Refresh() && !Reopen()) {
+    // The file is gone for now; keep waiting for it to come back.
+    return true;
+  }
+  absl::string_view data;
+  while (true) {
+    switch (reader_->Next(&data)) {
+      case RecordReader::OK:
+        if (!fn(data))
+          return false;
+        break;
+      case RecordReader::END_OF_STREAM:
+      case RecordReader::TRUNCATED:
+        // A partial record is read again once the writer finishes it.
+        return true;
+      case RecordReader::CORRUPT:
+        std::cerr << path_ << ": corrupt record at offset "
+                  << reader_->offset() << std::endl;
+        return false;
+    }
+  }
+}
+
+bool RecordFollower::Wait(absl::Duration timeout) {
+#if defined(__linux__)
+  if (watch_ < 0)
+    Watch();
+  if (watch_ >= 0) {
+    const int timeout_ms =
+        timeout == absl::InfiniteDuration()
+            ? -1
+            : static_cast<int>(std::min<int64_t>(
+                  absl::ToInt64Milliseconds(absl::Ceil(
+                      timeout, absl::Milliseconds(1))),
+                  INT32_MAX));
+    pollfd watch = {.fd = inotify_fd_, .events = POLLIN, .revents = 0};
+    const int ready = poll(&watch, 1, timeout_ms);
+    if (ready < 0 && errno != EINTR) {
+      std::cerr << path_ << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    if (ready <= 0)
+      return true;
+
+    // Drain the events.  Once the file is deleted or moved away its watch
+    // is gone, and the next wait watches whatever is at the path then.
+    alignas(inotify_event) char events[4096];
+    ssize_t n;
+    while ((n = read(inotify_fd_, events, sizeof(events))) > 0) {
+      for (char* p = events; p < events + n;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(p);
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+          if (!(event->mask & IN_IGNORED))
+            inotify_rm_watch(inotify_fd_, watch_);
+          watch_ = -1;
+        }
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+    return true;
+  }
+#endif
+  absl::SleepFor(std::min(timeout, options_.poll_interval));
+  return true;
+}
+
+}  // namespace records
@@ -0,0 +1,97 @@
+#ifndef RECORDS_RECORD_FOLLOWER_H__
+#define RECORDS_RECORD_FOLLOWER_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "records/record_reader.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+struct RecordFollowerOptions {
+  bool verify_checksums = true;
+  // How often Wait() checks the file when it can't be watched, such as
+  // while it is missing or where inotify isn't available.
+  absl::Duration poll_interval = absl::Milliseconds(100);
+};
+
+// Follows a records file while it is being written, like `tail -f`.
+//
+// Read() continues from the last record that was read in full and passed
+// its checks.  A partial record at the end of the file, one the writer
+// hasn't finished, stops the read and is read once it is complete.  In
+// between, Wait() sleeps on an inotify watch of the file, so a follower
+// costs nothing while the file is idle and wakes as soon as it's written.
+//
+// The file is followed by name: if it is truncated or replaced, as when a
+// log is rotated, reading starts over from the beginning of the new file.
+class RecordFollower {
+ public:
+  // Called with the data of each new record, valid until it returns.
+  // Returning false stops the read.
+  using RecordFn = std::function<bool(absl::string_view data)>;
+
+  // Opens `path`, positioned at its first record.  Returns nullptr and
+  // reports the error to stderr on failure.
+  static std::unique_ptr<RecordFollower> Open(
+      const std::string& path,
+      const RecordFollowerOptions& options = RecordFollowerOptions());
+
+  RecordFollower(const RecordFollower&) = delete;
+  RecordFollower& operator=(const RecordFollower&) = delete;
+  ~RecordFollower();
+
+  const RecordSetHeader& header() const {
+    return reader_->header();
+  }
+
+  // The reader of the current file, for its index.
+  RecordReader& reader() {
+    return *reader_;
+  }
+
+  // Skips to record `index` of the current file before following, see
+  // RecordReader::SeekToRecord().
+  bool SeekToRecord(uint64_t index);
+
+  // The index in the current file of the next record to read.
+  uint64_t count() const {
+    return first_record_ + reader_->count();
+  }
+
+  // Reads the records written since the last read, calling `fn` with each.
+  // Returns false if the file is corrupt, reporting it to stderr, or if
+  // `fn` returns false.
+  bool Read(const RecordFn& fn);
+
+  // Waits for the file to change, or for `timeout`.  Returns false if the
+  // wait fails.
+  bool Wait(absl::Duration timeout = absl::InfiniteDuration());
+
+ private:
+  RecordFollower(std::unique_ptr<RecordReader> reader, std::string path,
+                 const RecordFollowerOptions& options);
+
+  // Starts over with the file now at `path`.  Returns false if there is no
+  // readable file there yet.
+  bool Reopen();
+  // Watches the file at `path`, replacing any earlier watch.
+  void Watch();
+
+  const std::string path_;
+  const RecordFollowerOptions options_;
+  std::unique_ptr<RecordReader> reader_;
+  // The record the reader was positioned at.
+  uint64_t first_record_ = 0;
+  // The inotify instance and the watch of the file, or -1.
+  int inotify_fd_ = -1;
+  int watch_ = -1;
+};
+
+}  // namespace records
+
+#endif  // RECORDS_RECORD_FOLLOWER_H__
@@ -0,0 +1,557 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/base/internal/endian.h"
+#include "gtest/gtest.h"
+#include "records/external_sort.h"
+#include "records/group_commit_writer.h"
+#include "records/parallel_reader.h"
+#include "records/record_follower.h"
+#include "records/record_reader.h"
+#include "records/record_writer.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+namespace {
+
+class RecordIoTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    const char* tmpdir = getenv("TEST_TMPDIR");
+    path_ = std::string(tmpdir ? tmpdir : "/tmp") + "/record_io_test." +
+            std::to_string(getpid()) + ".rec";
+    unlink(path_.c_str());
+    header_.set_name("test");
+  }
+  void TearDown() override {
+    unlink(path_.c_str());
+  }
+
+  std::string ReadFile() {
+    std::ifstream in(path_, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+  }
+
+  void WriteFile(const std::string& contents) {
+    std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+    out << contents;
+  }
+
+  std::string path_;
+  RecordSetHeader header_;
+};
+
+TEST_F(RecordIoTest, ReadsBackWhatWasWritten) {
+  {
+    auto writer = RecordWriter::Open(path_, header_);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("first"));
+    EXPECT_TRUE(writer->Append(""));
+    EXPECT_TRUE(writer->Append(std::string(100000, 'x')));
+    EXPECT_TRUE(writer->Close());
+  }
+
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(reader->header().name(), "test");
+  absl::string_view data;
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "first");
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "");
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, std::string(100000, 'x'));
+  EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+  EXPECT_EQ(reader->count(), 3);
+}
+
+TEST_F(RecordIoTest, FileIsARecordSet) {
+  {
+    auto writer = RecordWriter::Open(path_, header_);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("a"));
+  }
+  {
+    // Reopening appends without writing another header.
+    auto writer = RecordWriter::Open(path_, header_);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("b"));
+  }
+
+  RecordSet record_set;
+  ASSERT_TRUE(record_set.ParseFromString(ReadFile()));
+  EXPECT_EQ(record_set.header().name(), "test");
+  ASSERT_EQ(record_set.record_size(), 2);
+  EXPECT_EQ(record_set.record(0).data(), "a");
+  EXPECT_EQ(record_set.record(1).data(), "b");
+  EXPECT_NE(record_set.record(1).crc32(), 0);
+}
+
+TEST_F(RecordIoTest, DetectsCorruptAndTruncatedRecords) {
+  {
+    auto writer = RecordWriter::Open(path_, header_);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("good"));
+    EXPECT_TRUE(writer->Append("data"));
+  }
+  std::string contents = ReadFile();
+  const size_t last = contents.rfind("data");
+  ASSERT_NE(last, std::string::npos);
+
+  contents[last] = 'D';
+  WriteFile(contents);
+  {
+    auto reader = RecordReader::Open(path_);
+    ASSERT_NE(reader, nullptr);
+    absl::string_view data;
+    EXPECT_EQ(reader->Next(&data), RecordReader::OK);
+    const uint64_t offset = reader->offset();
+    EXPECT_EQ(reader->Next(&data), RecordReader::CORRUPT);
+    EXPECT_EQ(reader->offset(), offset);
+  }
+
+  contents.resize(last + 2);
+  WriteFile(contents);
+  {
+    auto reader = RecordReader::Open(path_);
+    ASSERT_NE(reader, nullptr);
+    absl::string_view data;
+    EXPECT_EQ(reader->Next(&data), RecordReader::OK);
+    EXPECT_EQ(reader->Next(&data), RecordReader::TRUNCATED);
+  }
+}
+
+TEST_F(RecordIoTest, SeeksWithBlockIndex) {
+  RecordWriterOptions options;
+  options.block_size = 100;
+  for (int session = 0; session < 2; ++session) {
+    // The second session continues the index of the first.
+    auto writer = RecordWriter::Open(path_, header_, options);
+    ASSERT_NE(writer, nullptr);
+    for (int i = session * 500; i < (session + 1) * 500; ++i) {
+      char key[4] = {static_cast<char>(i >> 24), static_cast<char>(i >> 16),
+                     static_cast<char>(i >> 8), static_cast<char>(i)};
+      EXPECT_TRUE(
+          writer->Append(std::to_string(i), absl::string_view(key, 4)));
+    }
+  }
+
+  RecordSet record_set;
+  ASSERT_TRUE(record_set.ParseFromString(ReadFile()));
+  EXPECT_EQ(record_set.record_size(), 1000);
+
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  ASSERT_TRUE(reader->has_index());
+  EXPECT_GT(reader->index().block_size(), 10);
+  absl::string_view data;
+  for (uint64_t i : {0, 1, 499, 500, 777, 999}) {
+    ASSERT_TRUE(reader->SeekToRecord(i));
+    ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+    EXPECT_EQ(data, std::to_string(i));
+  }
+  EXPECT_FALSE(reader->SeekToRecord(1000));
+
+  const std::string min_key("\0\0\x03\x20", 4);  // 800
+  const std::string max_key("\0\0\x03\x21", 4);  // 801
+  const std::vector<int> blocks = reader->FindBlocks(min_key, max_key);
+  ASSERT_EQ(blocks.size(), 1);
+  reader->SeekToBlock(blocks[0]);
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_LE(std::stoi(std::string(data)), 800);
+}
+
+TEST_F(RecordIoTest, FindsBlocksMixingKeyedAndUnkeyedRecords) {
+  {
+    auto writer = RecordWriter::Open(path_, header_);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("keyed", "m"));
+    EXPECT_TRUE(writer->Append("unkeyed"));
+    EXPECT_TRUE(writer->Append("keyed", "n"));
+  }
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  ASSERT_EQ(reader->index().block_size(), 1);
+  EXPECT_FALSE(reader->index().block(0).has_min_key());
+  // The unkeyed record may hold any key.
+  EXPECT_EQ(reader->FindBlocks("a", "b"), std::vector<int>{0});
+}
+
+TEST_F(RecordIoTest, DropsPartialRecordsOnlyWhenAsked) {
+  std::string contents;
+  AppendRecord("one", true, &contents);
+  std::string partial;
+  AppendRecord("two", true, &partial);
+  const std::string truncated =
+      contents + partial.substr(0, partial.size() - 2);
+  WriteFile(truncated);
+
+  // Failing to open leaves the file as it was.
+  EXPECT_EQ(RecordWriter::Open(path_, header_), nullptr);
+  EXPECT_EQ(ReadFile(), truncated);
+  RecordWriterOptions options;
+  options.truncate_partial_record = true;
+  {
+    auto writer = RecordWriter::Open(path_, header_, options);
+    ASSERT_NE(writer, nullptr);
+    EXPECT_TRUE(writer->Append("three"));
+  }
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  absl::string_view data;
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "one");
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "three");
+  EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+}
+
+TEST_F(RecordIoTest, ReadsFilesWithoutFooter) {
+  std::string contents;
+  AppendRecord("one", true, &contents);
+  AppendRecord("two", false, &contents);
+  WriteFile(contents);
+
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_FALSE(reader->has_index());
+  absl::string_view data;
+  ASSERT_TRUE(reader->SeekToRecord(1));
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "two");
+  EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+}
+
+TEST_F(RecordIoTest, StopsAfterAFailedWrite) {
+  RecordWriterOptions options;
+  options.buffer_size = 1;
+  auto writer = RecordWriter::Open(path_, header_, options);
+  ASSERT_NE(writer, nullptr);
+  EXPECT_TRUE(writer->Append("first"));
+  // Writes to a read-only descriptor fail.
+  const int read_only = open("/dev/null", O_RDONLY);
+  ASSERT_GE(read_only, 0);
+  ASSERT_GE(dup2(read_only, writer->fd()), 0);
+  close(read_only);
+  EXPECT_FALSE(writer->Append("second"));
+  EXPECT_FALSE(writer->Append("third"));
+  EXPECT_EQ(writer->count(), 1);
+  EXPECT_FALSE(writer->Close());
+
+  // No footer is written, so the file is scanned for what it holds.
+  auto reader = RecordReader::Open(path_);
+  ASSERT_NE(reader, nullptr);
+  EXPECT_FALSE(reader->has_index());
+  absl::string_view data;
+  ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+  EXPECT_EQ(data, "first");
+  EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+}
+
+TEST_F(RecordIoTest, FollowsAppends) {
+  std::string contents;
+  AppendRecord("one", true, &contents);
+  WriteFile(contents);
+  auto follower = RecordFollower::Open(path_);
+  ASSERT_NE(follower, nullptr);
+  std::vector<std::string> seen;
+  const auto collect = [&](absl::string_view data) {
+    seen.emplace_back(data);
+    return true;
+  };
+  const auto append = [&](const std::string& data) {
+    std::ofstream out(path_, std::ios::binary | std::ios::app);
+    out << data;
+  };
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(seen, std::vector<std::string>({"one"}));
+
+  // A partial record is read once the rest of it is written.
+  std::string more;
+  AppendRecord("two", true, &more);
+  AppendRecord("three", true, &more);
+  append(more.substr(0, more.size() - 2));
+  EXPECT_TRUE(follower->Wait(absl::Seconds(10)));
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(seen, std::vector<std::string>({"one", "two"}));
+  append(more.substr(more.size() - 2));
+  EXPECT_TRUE(follower->Wait(absl::Seconds(10)));
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(seen, std::vector<std::string>({"one", "two", "three"}));
+  EXPECT_EQ(follower->count(), 3);
+
+  // Truncating the file starts over.
+  WriteFile(contents);
+  EXPECT_TRUE(follower->Wait(absl::Seconds(10)));
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(seen, std::vector<std::string>({"one", "two", "three", "one"}));
+  EXPECT_EQ(follower->count(), 1);
+
+  // Counts start from the record sought.
+  append(more);
+  EXPECT_TRUE(follower->Wait(absl::Seconds(10)));
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(follower->count(), 3);
+  ASSERT_TRUE(follower->SeekToRecord(2));
+  seen.clear();
+  EXPECT_TRUE(follower->Read(collect));
+  EXPECT_EQ(seen, std::vector<std::string>({"three"}));
+  EXPECT_EQ(follower->count(), 3);
+}
+
+TEST_F(RecordIoTest, CompressesBlocks) {
+  for (const RecordCodec codec : {RECORD_CODEC_ZLIB, RECORD_CODEC_ZSTD}) {
+    unlink(path_.c_str());
+    header_.set_codec(codec);
+    RecordWriterOptions options;
+    options.block_size = 1000;
+    for (int session = 0; session < 2; ++session) {
+      auto writer = RecordWriter::Open(path_, header_, options);
+      ASSERT_NE(writer, nullptr);
+      for (int i = session * 500; i < (session + 1) * 500; ++i) {
+        EXPECT_TRUE(writer->Append("record " + std::to_string(i)));
+      }
+    }
+    EXPECT_LT(ReadFile().size(), 1000 * 10);
+
+    RecordReaderOptions reader_options;
+    reader_options.decompress_threads = 3;
+    auto reader = RecordReader::Open(path_, reader_options);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->header().codec(), codec);
+    ASSERT_TRUE(reader->has_index());
+    absl::string_view data;
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+      EXPECT_EQ(data, "record " + std::to_string(i));
+    }
+    EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+
+    for (uint64_t i : {0, 99, 500, 999}) {
+      ASSERT_TRUE(reader->SeekToRecord(i));
+      ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+      EXPECT_EQ(data, "record " + std::to_string(i));
+    }
+
+    // Reading through again reuses the decompressing threads.
+    ASSERT_TRUE(reader->SeekToRecord(0));
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(reader->Next(&data), RecordReader::OK);
+      EXPECT_EQ(data, "record " + std::to_string(i));
+    }
+    EXPECT_EQ(reader->Next(&data), RecordReader::END_OF_STREAM);
+  }
+}
+
+TEST_F(RecordIoTest, ReadsBlocksBeforeACorruptOne) {
+  header_.set_codec(RECORD_CODEC_ZSTD);
+  RecordWriterOptions options;
+  options.block_size = 100;
+  {
+    auto writer = RecordWriter::Open(path_, header_, options);
+    ASSERT_NE(writer, nullptr);
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_TRUE(writer->Append("record " + std::to_string(i)));
+    }
+  }
+  std::string contents = ReadFile();
+  RecordSet record_set;
+  ASSERT_TRUE(record_set.ParseFromString(contents));
+  ASSERT_GT(record_set.compressed_block_size(), 3);
+
+  // Make the third block's uncompressed_size a group, which the reader
+  // rejects.  The first batch is one block, so the second batch starts with
+  // a good block and then finds the corrupt one.
+  const std::string& data = record_set.compressed_block(2).data();
+  const size_t tag = contents.find(data) + data.size();
+  ASSERT_EQ(contents[tag], '\x10');
+  contents[tag] = '\x13';
+  WriteFile(contents);
+
+  RecordReaderOptions reader_options;
+  reader_options.decompress_threads = 2;
+  auto reader = RecordReader::Open(path_, reader_options);
+  ASSERT_NE(reader, nullptr);
+  const uint64_t good = record_set.footer().block(0).record_count() +
+                        record_set.footer().block(1).record_count();
+  absl::string_view record;
+  for (uint64_t i = 0; i < good; ++i) {
+    ASSERT_EQ(reader->Next(&record), RecordReader::OK);
+    EXPECT_EQ(record, "record " + std::to_string(i));
+  }
+  EXPECT_EQ(reader->Next(&record), RecordReader::CORRUPT);
+  EXPECT_EQ(reader->Next(&record), RecordReader::CORRUPT);
+}
+
+TEST_F(RecordIoTest, CommitsConcurrentAppendsInGroups) {
+  constexpr int kThreads = 8;
+  constexpr int kRecords = 500;
+  for (const auto sync : {GroupCommitOptions::SyncMode::GROUP,
+                          GroupCommitOptions::SyncMode::INTERVAL}) {
+    unlink(path_.c_str());
+    GroupCommitOptions options;
+    options.sync = sync;
+    options.max_latency = absl::Microseconds(100);
+    options.sync_interval = absl::Milliseconds(1);
+    auto writer = GroupCommitWriter::Open(path_, header_, options);
+    ASSERT_NE(writer, nullptr);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < kRecords; ++i) {
+          EXPECT_TRUE(writer->Append(std::to_string(t * kRecords + i)));
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(writer->count(), kThreads * kRecords);
+    EXPECT_LE(writer->groups(), writer->count());
+    EXPECT_TRUE(writer->Close());
+    EXPECT_FALSE(writer->Append("late"));
+
+    // Each thread's records are in the order it appended them.
+    auto reader = RecordReader::Open(path_);
+    ASSERT_NE(reader, nullptr);
+    ASSERT_TRUE(reader->has_index());
+    std::vector<int> next(kThreads, 0);
+    absl::string_view data;
+    while (reader->Next(&data) == RecordReader::OK) {
+      const int value = std::stoi(std::string(data));
+      EXPECT_EQ(value % kRecords, next[value / kRecords]++);
+    }
+    EXPECT_EQ(reader->count(), kThreads * kRecords);
+  }
+}
+
+TEST_F(RecordIoTest, ReadsRangesInParallel) {
+  constexpr int kRecords = 2000;
+  for (const RecordCodec codec : {RECORD_CODEC_NONE, RECORD_CODEC_ZSTD}) {
+    for (const bool indexed : {true, false}) {
+      unlink(path_.c_str());
+      header_.set_codec(codec);
+      RecordWriterOptions options;
+      options.block_size = 500;
+      {
+        auto writer = RecordWriter::Open(path_, header_, options);
+        ASSERT_NE(writer, nullptr);
+        for (int i = 0; i < kRecords; ++i) {
+          EXPECT_TRUE(writer->Append(std::to_string(i)));
+        }
+      }
+      if (!indexed) {
+        auto reader = RecordReader::Open(path_);
+        ASSERT_NE(reader, nullptr);
+        WriteFile(ReadFile().substr(0, reader->end()));
+      }
+
+      ParallelReaderOptions parallel_options;
+      parallel_options.threads = 4;
+      parallel_options.max_pending = 3;
+      parallel_options.range_size = 1000;
+      auto reader = ParallelRecordReader::Open(path_, parallel_options);
+      ASSERT_NE(reader, nullptr);
+      EXPECT_GT(reader->ranges(), 4);
+
+      int next = 0;
+      size_t next_range = 0;
+      EXPECT_TRUE(reader->ReadOrdered([&](const RecordBatch& batch) {
+        EXPECT_EQ(batch.range, next_range++);
+        for (absl::string_view data : batch.records) {
+          EXPECT_EQ(data, std::to_string(next++));
+        }
+        return true;
+      }));
+      EXPECT_EQ(next, kRecords);
+
+      std::mutex mu;
+      std::vector<bool> seen(kRecords);
+      EXPECT_TRUE(
+          reader->ReadUnordered([&](int worker, const RecordBatch& batch) {
+            EXPECT_LT(worker, 4);
+            std::lock_guard<std::mutex> lock(mu);
+            for (absl::string_view data : batch.records) {
+              seen[std::stoi(std::string(data))] = true;
+            }
+            return true;
+          }));
+      EXPECT_EQ(std::count(seen.begin(), seen.end(), true), kRecords);
+
+      // Stopping early stops every worker.
+      int batches = 0;
+      EXPECT_FALSE(reader->ReadOrdered([&](const RecordBatch& batch) {
+        return ++batches < 2;
+      }));
+      EXPECT_EQ(batches, 2);
+    }
+  }
+}
+
+TEST_F(RecordIoTest, SortsThroughSpilledRuns) {
+  constexpr int kRecords = 5000;
+  constexpr int kKeys = 1000;
+  const auto key_of = [](int i) {
+    char key[4];
+    absl::big_endian::Store32(key, (i * 7919) % kKeys);
+    return std::string(key, sizeof(key));
+  };
+
+  for (const bool unique : {false, true}) {
+    ExternalSortOptions options;
+    options.memory_limit = 16 << 10;
+    options.workers = 2;
+    options.unique = unique;
+    ExternalSorter sorter(options);
+    std::vector<std::thread> workers;
+    for (int worker = 0; worker < 2; ++worker) {
+      workers.emplace_back([&, worker] {
+        for (int i = worker; i < kRecords; i += 2) {
+          EXPECT_TRUE(sorter.Add(worker, key_of(i), i, std::to_string(i)));
+        }
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    EXPECT_GT(sorter.spilled_runs(), 2);
+
+    std::vector<int> sorted;
+    EXPECT_TRUE(
+        sorter.Merge([&](absl::string_view key, absl::string_view record) {
+          const int i = std::stoi(std::string(record));
+          EXPECT_EQ(key, key_of(i));
+          sorted.push_back(i);
+          return true;
+        }));
+    ASSERT_EQ(sorted.size(), unique ? kKeys : kRecords);
+    for (size_t i = 1; i < sorted.size(); ++i) {
+      // Sorted by key, then by sequence number.
+      EXPECT_LE(key_of(sorted[i - 1]), key_of(sorted[i]));
+      if (key_of(sorted[i - 1]) == key_of(sorted[i])) {
+        EXPECT_LT(sorted[i - 1], sorted[i]);
+      }
+    }
+    if (unique) {
+      // The last record of each key is kept.
+      for (const int i : sorted) {
+        EXPECT_GE(i + kKeys, kRecords);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace records
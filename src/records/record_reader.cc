@@ -0,0 +1,753 @@
+#include "records/record_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/crc/crc32c.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "records/codec.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+using ::google::protobuf::internal::WireFormatLite;
+
+namespace {
+
+// The footer_offset field: a two byte tag and a fixed64.
+constexpr size_t kTrailerSize = 10;
+
+// Compressed blocks are decompressed in batches of this many per thread.
+constexpr int kBlocksPerThread = 4;
+
+// Guards against allocating for the sizes of corrupt blocks.
+constexpr uint64_t kMaxBlockSize = uint64_t{1} << 30;
+
+// Bounds what a batch of blocks decompresses into.  A block of more than
+// this is decompressed on its own.
+constexpr uint64_t kMaxBatchSize = uint64_t{1} << 30;
+
+// Reads a varint from [p, end).  Returns nullptr if it is truncated or
+// longer than ten bytes.
+const char* ReadVarint(const char* p, const char* end, uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(*p++);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// The file's last modification time in nanoseconds.
+int64_t ModifiedNanos(const struct stat& st) {
+#if defined(__APPLE__)
+  const struct timespec& modified = st.st_mtimespec;
+#else
+  const struct timespec& modified = st.st_mtim;
+#endif
+  return int64_t{modified.tv_sec} * 1000000000 + modified.tv_nsec;
+}
+
+enum class FieldStatus { OK, TRUNCATED, CORRUPT };
+
+// Reads the field at `*p`.  Length-delimited values are returned in
+// `value`, varint and fixed32 values in `scalar`; fixed64 values are
+// skipped.
+FieldStatus ReadField(const char** p, const char* end, uint32_t* number,
+                      absl::string_view* value, uint64_t* scalar) {
+  uint64_t tag;
+  const char* q = ReadVarint(*p, end, &tag);
+  if (q == nullptr) {
+    return end - *p < 10 ? FieldStatus::TRUNCATED : FieldStatus::CORRUPT;
+  }
+  if (tag > UINT32_MAX || WireFormatLite::GetTagFieldNumber(tag) == 0)
+    return FieldStatus::CORRUPT;
+  *number = WireFormatLite::GetTagFieldNumber(tag);
+
+  uint64_t length;
+  switch (WireFormatLite::GetTagWireType(tag)) {
+    case WireFormatLite::WIRETYPE_VARINT: {
+      const char* value_start = q;
+      q = ReadVarint(q, end, scalar);
+      if (q == nullptr) {
+        return end - value_start < 10 ? FieldStatus::TRUNCATED
+                                       : FieldStatus::CORRUPT;
+      }
+      break;
+    }
+    case WireFormatLite::WIRETYPE_FIXED32:
+      if (end - q < 4)
+        return FieldStatus::TRUNCATED;
+      *scalar = absl::little_endian::Load32(q);
+      q += 4;
+      break;
+    case WireFormatLite::WIRETYPE_FIXED64:
+      if (end - q < 8)
+        return FieldStatus::TRUNCATED;
+      q += 8;
+      break;
+    case WireFormatLite::WIRETYPE_LENGTH_DELIMITED: {
+      const char* length_start = q;
+      q = ReadVarint(q, end, &length);
+      if (q == nullptr) {
+        return end - length_start < 10 ? FieldStatus::TRUNCATED
+                                        : FieldStatus::CORRUPT;
+      }
+      if (length > static_cast<uint64_t>(end - q))
+        return FieldStatus::TRUNCATED;
+      *value = absl::string_view(q, length);
+      q += length;
+      break;
+    }
+    default:
+      // Groups are not used by the records format.
+      return FieldStatus::CORRUPT;
+  }
+  *p = q;
+  return FieldStatus::OK;
+}
+
+// Reads the fields of a CompressedBlock message.
+bool ParseCompressedBlock(absl::string_view message,
+                          absl::string_view* compressed,
+                          uint64_t* uncompressed_size) {
+  // CompressedBlock { bytes data = 1; uint64 uncompressed_size = 2; }
+  *compressed = absl::string_view();
+  *uncompressed_size = 0;
+  const char* p = message.data();
+  const char* const end = message.data() + message.size();
+  while (p < end) {
+    uint32_t number = 0;
+    absl::string_view value;
+    uint64_t scalar = 0;
+    if (ReadField(&p, end, &number, &value, &scalar) != FieldStatus::OK)
+      return false;
+    if (number == CompressedBlock::kDataFieldNumber) {
+      *compressed = value;
+    } else if (number == CompressedBlock::kUncompressedSizeFieldNumber) {
+      *uncompressed_size = scalar;
+    }
+  }
+  return *uncompressed_size <= kMaxBlockSize;
+}
+
+}  // namespace
+
+std::unique_ptr<RecordReader> RecordReader::Open(
+    const std::string& path, const RecordReaderOptions& options) {
+  int fd;
+  do {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+
+  std::unique_ptr<RecordReader> reader(new RecordReader(path, options));
+  if (!reader->Load(fd)) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  close(fd);
+
+  if (!reader->ReadHeader()) {
+    std::cerr << path << ": malformed records header" << std::endl;
+    return nullptr;
+  }
+  reader->ReadFooter();
+  return reader;
+}
+
+bool RecordReader::Load(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  device_ = st.st_dev;
+  inode_ = st.st_ino;
+  modified_ns_ = ModifiedNanos(st);
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(mapping);
+      size_ = st.st_size;
+      mapped_ = true;
+      return true;
+    }
+  }
+
+  // Read files that can't be mapped in large chunks.
+  constexpr size_t kReadSize = 1 << 20;
+  while (true) {
+    const size_t size = buffer_.size();
+    buffer_.resize(size + kReadSize);
+    const ssize_t n = read(fd, &buffer_[size], kReadSize);
+    if (n < 0 && errno == EINTR) {
+      buffer_.resize(size);
+      continue;
+    }
+    if (n < 0)
+      return false;
+    buffer_.resize(size + n);
+    if (n == 0)
+      break;
+  }
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return true;
+}
+
+bool RecordReader::Refresh() {
+  int fd;
+  do {
+    fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_dev != device_ || st.st_ino != inode_ ||
+      static_cast<uint64_t>(st.st_size) < offset_) {
+    close(fd);
+    return false;
+  }
+  if (static_cast<uint64_t>(st.st_size) == size_ &&
+      ModifiedNanos(st) == modified_ns_) {
+    close(fd);
+    return true;
+  }
+
+  const char* const data = data_;
+  const size_t size = size_;
+  const bool mapped = mapped_;
+  const int64_t previous_modified_ns = modified_ns_;
+  std::string buffer = std::move(buffer_);
+  buffer_.clear();
+  mapped_ = false;
+  if (!Load(fd)) {
+    close(fd);
+    buffer_ = std::move(buffer);
+    data_ = mapped ? data : buffer_.data();
+    size_ = size;
+    mapped_ = mapped;
+    modified_ns_ = previous_modified_ns;
+    return false;
+  }
+  close(fd);
+  if (mapped) {
+    munmap(const_cast<char*>(data), size);
+  }
+
+  // Decompressed blocks don't point into the mapping and are kept.
+  if (start_ == 0 && offset_ == 0) {
+    // The header may have been incomplete.
+    ReadHeader();
+  }
+  has_index_ = false;
+  index_.Clear();
+  ReadFooter();
+  return true;
+}
+
+// Worker threads that each run a share of a batch alongside the calling
+// thread, waiting between batches.
+class RecordReader::DecompressPool {
+ public:
+  explicit DecompressPool(int workers) {
+    for (int i = 1; i <= workers; ++i) {
+      workers_.emplace_back([this, i] { Work(i); });
+    }
+  }
+
+  ~DecompressPool() {
+    {
+      absl::MutexLock lock(&mu_);
+      stopping_ = true;
+    }
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Calls `fn(0)` on the calling thread and `fn(i)` on worker i, for i in
+  // [1, workers], and returns once every call has returned.
+  void Run(const std::function<void(int)>& fn) {
+    {
+      absl::MutexLock lock(&mu_);
+      fn_ = &fn;
+      running_ = workers_.size();
+      ++generation_;
+    }
+    fn(0);
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(this, &DecompressPool::Finished));
+    fn_ = nullptr;
+  }
+
+ private:
+  bool Finished() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return running_ == 0;
+  }
+
+  void Work(int i) {
+    uint64_t done = 0;
+    const auto ready = [this, &done]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return stopping_ || generation_ != done;
+    };
+    absl::MutexLock lock(&mu_);
+    for (;;) {
+      mu_.Await(absl::Condition(&ready));
+      if (stopping_)
+        return;
+      done = generation_;
+      const std::function<void(int)>* fn = fn_;
+      mu_.Unlock();
+      (*fn)(i);
+      mu_.Lock();
+      --running_;
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  absl::Mutex mu_;
+  const std::function<void(int)>* fn_ ABSL_GUARDED_BY(mu_) = nullptr;
+  // The batch posted last, and the workers still running it.
+  uint64_t generation_ ABSL_GUARDED_BY(mu_) = 0;
+  size_t running_ ABSL_GUARDED_BY(mu_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+RecordReader::RecordReader(std::string path,
+                           const RecordReaderOptions& options)
+    : path_(std::move(path)), options_(options) {}
+
+RecordReader::~RecordReader() {
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+bool RecordReader::ReadHeader() {
+  const char* p = data_;
+  uint32_t number = 0;
+  absl::string_view value;
+  uint64_t scalar;
+  if (ReadField(&p, data_ + size_, &number, &value, &scalar) !=
+          FieldStatus::OK ||
+      number != RecordSet::kHeaderFieldNumber) {
+    // No header, or not one that can be read yet.
+    return true;
+  }
+  if (!header_.ParseFromArray(value.data(), value.size()))
+    return false;
+  start_ = offset_ = p - data_;
+  return true;
+}
+
+void RecordReader::ReadFooter() {
+  end_ = size_;
+  if (size_ < start_ + kTrailerSize)
+    return;
+  const char* trailer = data_ + size_ - kTrailerSize;
+  const uint32_t trailer_tag = WireFormatLite::MakeTag(
+      RecordSet::kFooterOffsetFieldNumber, WireFormatLite::WIRETYPE_FIXED64);
+  uint64_t tag;
+  if (ReadVarint(trailer, trailer + 2, &tag) != trailer + 2 ||
+      tag != trailer_tag) {
+    return;
+  }
+  const uint64_t footer_offset = absl::little_endian::Load64(trailer + 2);
+  if (footer_offset < start_ || footer_offset > size_ - kTrailerSize)
+    return;
+
+  // Anything that doesn't look like a footer is read as records instead.
+  const char* p = data_ + footer_offset;
+  uint32_t number = 0;
+  absl::string_view value;
+  uint64_t scalar;
+  if (ReadField(&p, trailer, &number, &value, &scalar) != FieldStatus::OK ||
+      number != RecordSet::kFooterFieldNumber || p != trailer) {
+    return;
+  }
+  if (!index_.ParseFromArray(value.data(), value.size())) {
+    index_.Clear();
+    return;
+  }
+  has_index_ = true;
+  end_ = footer_offset;
+}
+
+bool RecordReader::SeekToRecord(uint64_t index) {
+  ResetBlocks();
+  offset_ = start_;
+  uint64_t skip = index;
+  if (has_index_) {
+    // The last block starting at or before the record.
+    const auto& blocks = index_.block();
+    auto iter = std::upper_bound(
+        blocks.begin(), blocks.end(), index,
+        [](uint64_t index, const RecordBlock& block) {
+          return index < block.first_record();
+        });
+    if (iter != blocks.begin()) {
+      --iter;
+      offset_ = iter->offset();
+      skip = index - iter->first_record();
+    }
+  }
+
+  absl::string_view data;
+  for (uint64_t i = 0; i < skip; ++i) {
+    if (Next(&data) != OK)
+      return false;
+  }
+  count_ = 0;
+  return !block_records_.empty() || next_block_ < decoded_blocks_ ||
+         offset_ < end_;
+}
+
+void RecordReader::SeekToBlock(int block) {
+  ResetBlocks();
+  offset_ = index_.block(block).offset();
+  count_ = 0;
+}
+
+std::vector<int> RecordReader::FindBlocks(absl::string_view min_key,
+                                          absl::string_view max_key) const {
+  std::vector<int> blocks;
+  for (int i = 0; i < index_.block_size(); ++i) {
+    const RecordBlock& block = index_.block(i);
+    if (block.has_min_key() &&
+        (absl::string_view(block.max_key()) < min_key ||
+         absl::string_view(block.min_key()) > max_key)) {
+      continue;
+    }
+    blocks.push_back(i);
+  }
+  return blocks;
+}
+
+RecordReader::Status RecordReader::Next(absl::string_view* data) {
+  const char* const end = data_ + end_;
+  while (true) {
+    if (!block_records_.empty()) {
+      const char* p = block_records_.data();
+      uint32_t number = 0;
+      absl::string_view record;
+      uint64_t scalar;
+      if (ReadField(&p, block_records_.data() + block_records_.size(),
+                    &number, &record, &scalar) != FieldStatus::OK) {
+        return CORRUPT;
+      }
+      if (number == RecordSet::kRecordFieldNumber) {
+        const Status status = ParseRecord(record, data);
+        if (status != OK)
+          return status;
+        ++count_;
+      }
+      block_records_.remove_prefix(p - block_records_.data());
+      if (number == RecordSet::kRecordFieldNumber)
+        return OK;
+      continue;
+    }
+    if (next_block_ < decoded_blocks_) {
+      const DecodedBlock& block = blocks_[next_block_++];
+      block_records_ = block.records;
+      offset_ = block.end;
+      continue;
+    }
+
+    const char* p = data_ + offset_;
+    if (p == end)
+      return END_OF_STREAM;
+
+    uint32_t number = 0;
+    absl::string_view record;
+    uint64_t scalar;
+    switch (ReadField(&p, end, &number, &record, &scalar)) {
+      case FieldStatus::OK:
+        break;
+      case FieldStatus::TRUNCATED:
+        return TRUNCATED;
+      case FieldStatus::CORRUPT:
+        return CORRUPT;
+    }
+    if (number == RecordSet::kCompressedBlockFieldNumber) {
+      const Status status = DecodeBlocks();
+      if (status != OK)
+        return status;
+      continue;
+    }
+    if (number != RecordSet::kRecordFieldNumber) {
+      // Headers of appended record sets and fields of later versions of the
+      // format.
+      offset_ = p - data_;
+      continue;
+    }
+
+    const Status status = ParseRecord(record, data);
+    if (status != OK)
+      return status;
+    offset_ = p - data_;
+    ++count_;
+    return OK;
+  }
+}
+
+RecordReader::Status RecordReader::SplitRanges(
+    size_t range_size, std::vector<Range>* ranges) const {
+  ranges->clear();
+  if (has_index_) {
+    for (const RecordBlock& block : index_.block()) {
+      ranges->push_back({block.offset(), block.offset() + block.size()});
+    }
+    return OK;
+  }
+
+  const char* const end = data_ + end_;
+  const char* p = data_ + start_;
+  Range run{start_, start_};
+  const auto end_run = [&] {
+    if (run.end > run.offset)
+      ranges->push_back(run);
+    run = Range{run.end, run.end};
+  };
+  while (p < end) {
+    uint32_t number = 0;
+    absl::string_view value;
+    uint64_t scalar;
+    const FieldStatus status = ReadField(&p, end, &number, &value, &scalar);
+    if (status != FieldStatus::OK) {
+      end_run();
+      return status == FieldStatus::TRUNCATED ? TRUNCATED : CORRUPT;
+    }
+    if (number == RecordSet::kCompressedBlockFieldNumber) {
+      // Each compressed block is a range of its own.
+      end_run();
+      run.end = p - data_;
+      end_run();
+      continue;
+    }
+    run.end = p - data_;
+    if (run.end - run.offset >= range_size)
+      end_run();
+  }
+  end_run();
+  return OK;
+}
+
+RecordReader::Status RecordReader::ReadRange(
+    const Range& range, std::string* buffer,
+    std::vector<absl::string_view>* records) const {
+  records->clear();
+  if (range.offset > range.end || range.end > end_)
+    return CORRUPT;
+  const char* const end = data_ + range.end;
+
+  // Size the buffer for every compressed block up front, so that records
+  // decompressed into it stay put.
+  const char* p = data_ + range.offset;
+  uint64_t uncompressed_size = 0;
+  int compressed_blocks = 0;
+  while (p < end) {
+    uint32_t number = 0;
+    absl::string_view value;
+    uint64_t scalar;
+    if (ReadField(&p, end, &number, &value, &scalar) != FieldStatus::OK)
+      return CORRUPT;
+    if (number == RecordSet::kCompressedBlockFieldNumber) {
+      absl::string_view compressed;
+      uint64_t size;
+      if (!ParseCompressedBlock(value, &compressed, &size))
+        return CORRUPT;
+      uncompressed_size += size;
+      ++compressed_blocks;
+    }
+  }
+  buffer->clear();
+  buffer->reserve(uncompressed_size);
+
+  std::string scratch;
+  p = data_ + range.offset;
+  while (p < end) {
+    uint32_t number = 0;
+    absl::string_view value;
+    uint64_t scalar;
+    ReadField(&p, end, &number, &value, &scalar);
+    absl::string_view data;
+    if (number == RecordSet::kRecordFieldNumber) {
+      const Status status = ParseRecord(value, &data);
+      if (status != OK)
+        return status;
+      records->push_back(data);
+      continue;
+    }
+    if (number != RecordSet::kCompressedBlockFieldNumber)
+      continue;
+
+    absl::string_view compressed;
+    uint64_t size;
+    ParseCompressedBlock(value, &compressed, &size);
+    const size_t block_start = buffer->size();
+    if (compressed_blocks == 1) {
+      if (!Decompress(header_.codec(), compressed, size, buffer))
+        return CORRUPT;
+    } else {
+      if (!Decompress(header_.codec(), compressed, size, &scratch))
+        return CORRUPT;
+      buffer->append(scratch);
+    }
+    const char* q = buffer->data() + block_start;
+    const char* const block_end = buffer->data() + buffer->size();
+    while (q < block_end) {
+      absl::string_view record;
+      if (ReadField(&q, block_end, &number, &record, &scalar) !=
+          FieldStatus::OK) {
+        return CORRUPT;
+      }
+      if (number != RecordSet::kRecordFieldNumber)
+        continue;
+      const Status status = ParseRecord(record, &data);
+      if (status != OK)
+        return status;
+      records->push_back(data);
+    }
+  }
+  return OK;
+}
+
+RecordReader::Status RecordReader::ParseRecord(absl::string_view record,
+                                               absl::string_view* data) const {
+  // The fields of the Record message.
+  *data = absl::string_view();
+  bool has_crc = false;
+  uint32_t crc = 0;
+  const char* p = record.data();
+  const char* const end = record.data() + record.size();
+  while (p < end) {
+    uint32_t number = 0;
+    absl::string_view value;
+    uint64_t scalar = 0;
+    if (ReadField(&p, end, &number, &value, &scalar) != FieldStatus::OK)
+      return CORRUPT;
+    if (number == Record::kDataFieldNumber) {
+      *data = value;
+    } else if (number == Record::kCrc32FieldNumber) {
+      crc = static_cast<uint32_t>(scalar);
+      has_crc = true;
+    }
+  }
+  if (has_crc && options_.verify_checksums &&
+      static_cast<uint32_t>(absl::ComputeCrc32c(*data)) != crc) {
+    return CORRUPT;
+  }
+  return OK;
+}
+
+RecordReader::Status RecordReader::DecodeBlocks() {
+  const int threads = options_.decompress_threads > 0
+                          ? options_.decompress_threads
+                          : std::max(1u, std::thread::hardware_concurrency());
+  // Enough blocks to keep every thread busy for a while.
+  const size_t batch = sequential_ ? threads * kBlocksPerThread : 1;
+  if (blocks_.size() < batch) {
+    blocks_.resize(batch);
+  }
+
+  // Find the consecutive compressed blocks to decompress.
+  const char* const end = data_ + end_;
+  const char* p = data_ + offset_;
+  decoded_blocks_ = 0;
+  next_block_ = 0;
+  uint64_t batch_size = 0;
+  while (decoded_blocks_ < batch && p < end) {
+    const char* q = p;
+    uint32_t number = 0;
+    absl::string_view message;
+    uint64_t scalar;
+    const FieldStatus status = ReadField(&q, end, &number, &message, &scalar);
+    if (status != FieldStatus::OK && decoded_blocks_ == 0) {
+      return status == FieldStatus::TRUNCATED ? TRUNCATED : CORRUPT;
+    }
+    if (status != FieldStatus::OK ||
+        number != RecordSet::kCompressedBlockFieldNumber) {
+      break;
+    }
+
+    DecodedBlock& block = blocks_[decoded_blocks_];
+    block.end = q - data_;
+    // Like a field that fails to read, a corrupt block ends the batch and
+    // is reported once the blocks before it are read.
+    if (!ParseCompressedBlock(message, &block.compressed,
+                              &block.uncompressed_size)) {
+      if (decoded_blocks_ > 0)
+        break;
+      return CORRUPT;
+    }
+    if (decoded_blocks_ > 0 &&
+        block.uncompressed_size > kMaxBatchSize - batch_size) {
+      break;
+    }
+    batch_size += block.uncompressed_size;
+    ++decoded_blocks_;
+    p = q;
+  }
+
+  std::atomic<bool> ok = true;
+  const std::function<void(int)> decode = [&](int first) {
+    for (size_t i = first; i < decoded_blocks_; i += threads) {
+      DecodedBlock& block = blocks_[i];
+      if (!Decompress(header_.codec(), block.compressed,
+                      block.uncompressed_size, &block.records)) {
+        ok = false;
+      }
+    }
+  };
+  if (threads == 1 || decoded_blocks_ == 1) {
+    decode(0);
+  } else {
+    if (pool_ == nullptr)
+      pool_ = std::make_unique<DecompressPool>(threads - 1);
+    pool_->Run(decode);
+  }
+  if (!ok) {
+    decoded_blocks_ = 0;
+    return CORRUPT;
+  }
+  sequential_ = true;
+  return OK;
+}
+
+void RecordReader::ResetBlocks() {
+  decoded_blocks_ = 0;
+  next_block_ = 0;
+  block_records_ = absl::string_view();
+  sequential_ = false;
+}
+
+}  // namespace records
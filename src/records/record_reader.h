@@ -0,0 +1,210 @@
+#ifndef RECORDS_RECORD_READER_H__
+#define RECORDS_RECORD_READER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+struct RecordReaderOptions {
+  // Check the CRC32C of records that carry one.
+  bool verify_checksums = true;
+  // The number of threads decompressing blocks ahead of the reader in
+  // compressed files, or 0 for one per core.
+  int decompress_threads = 0;
+};
+
+// Reads the records of a records file written by RecordWriter, or of any
+// serialized RecordSet.
+//
+// The file is memory mapped and records are returned as views into the
+// mapping, so reading a record copies nothing.  Files that can't be mapped,
+// such as pipes, are read into memory instead.  The views stay valid for the
+// lifetime of the reader.  A RecordReader is not thread-safe, apart from
+// the const methods used to read ranges of it in parallel, see
+// ParallelRecordReader.
+//
+// Compressed blocks are decompressed in batches, in parallel, while reading
+// through the file, on threads started with the first batch and kept for
+// the lifetime of the reader.  Records in compressed files are views into the
+// decompressed batch instead, valid until the next call to Next() that
+// moves past the batch, and offset() moves a block at a time.
+//
+// If the file ends with a footer, its block index is used to seek to any
+// record with a binary search and to select blocks by key.  Files without
+// a footer are read the same way but seeking scans from the start.
+class RecordReader {
+ public:
+  enum Status {
+    OK,
+    END_OF_STREAM,
+    // The file ends part way through a record, for example while it is
+    // still being written.
+    TRUNCATED,
+    // The file is malformed or a record doesn't match its checksum.
+    CORRUPT,
+  };
+
+  // Opens and maps `path`.  Returns nullptr and reports the error to stderr
+  // on failure.
+  static std::unique_ptr<RecordReader> Open(
+      const std::string& path,
+      const RecordReaderOptions& options = RecordReaderOptions());
+
+  RecordReader(const RecordReader&) = delete;
+  RecordReader& operator=(const RecordReader&) = delete;
+  ~RecordReader();
+
+  // The header of the file, or an empty header if it has none.
+  const RecordSetHeader& header() const {
+    return header_;
+  }
+
+  // Whether the file has a footer, and the block index it holds.
+  bool has_index() const {
+    return has_index_;
+  }
+  const RecordSetFooter& index() const {
+    return index_;
+  }
+
+  // The file offset where the records end: the offset of the footer, or
+  // the size of the file.
+  uint64_t end() const {
+    return end_;
+  }
+
+  // Reads the data of the next record.  On TRUNCATED or CORRUPT the reader
+  // stays at the start of the offending record.
+  Status Next(absl::string_view* data);
+
+  // The file offset of the next record to read.
+  uint64_t offset() const {
+    return offset_;
+  }
+
+  // Continues reading at `offset`, which must be the start of a record,
+  // such as a previous value of offset().
+  void Seek(uint64_t offset) {
+    ResetBlocks();
+    offset_ = offset;
+  }
+
+  // Positions the reader at the record with the given index in the file.
+  // Returns false if the file has fewer records.
+  bool SeekToRecord(uint64_t index);
+
+  // Positions the reader at the first record of the indexed block.
+  void SeekToBlock(int block);
+
+  // Returns the indexed blocks that may hold records with keys in
+  // [min_key, max_key].  Blocks with records written without keys are
+  // always included.
+  std::vector<int> FindBlocks(absl::string_view min_key,
+                              absl::string_view max_key) const;
+
+  // A range of the file that holds whole records, see SplitRanges().
+  struct Range {
+    uint64_t offset = 0;
+    uint64_t end = 0;
+  };
+
+  // Splits the records of the file into ranges that can be read on their
+  // own with ReadRange(): the indexed blocks, or in a file without an index,
+  // runs of about `range_size` bytes found by skipping through the framing
+  // of the records.  A partial record at the end of the file ends the last
+  // range and returns TRUNCATED along with the ranges before it.
+  Status SplitRanges(size_t range_size, std::vector<Range>* ranges) const;
+
+  // Reads the records of `range`, decompressing any compressed blocks in it
+  // into `buffer`, and replaces `records` with views of their data in the
+  // file or in `buffer`.  Unlike Next(), ReadRange() doesn't move the reader
+  // and can be called from several threads at once.
+  Status ReadRange(const Range& range, std::string* buffer,
+                   std::vector<absl::string_view>* records) const;
+
+  // Maps the file again if it has changed since it was opened or last
+  // refreshed, so that Next() continues into records appended since, and
+  // picks up a footer written since.  Views returned by Next() before
+  // become invalid.  Returns false, leaving the reader as it was, if the
+  // path now names another file, the file has been truncated before
+  // offset() or it can't be read.
+  bool Refresh();
+
+  // The number of records read so far, counting from the record sought by
+  // SeekToRecord() or SeekToBlock().
+  uint64_t count() const {
+    return count_;
+  }
+
+  absl::string_view contents() const {
+    return absl::string_view(data_, size_);
+  }
+
+ private:
+  RecordReader(std::string path, const RecordReaderOptions& options);
+
+  class DecompressPool;
+
+  // A compressed block, decompressed ahead of the reader.
+  struct DecodedBlock {
+    absl::string_view compressed;
+    uint64_t uncompressed_size = 0;
+    // The file offset after the block.
+    uint64_t end = 0;
+    std::string records;
+  };
+
+  // Points the reader at the contents of `fd`.
+  bool Load(int fd);
+  bool ReadHeader();
+  void ReadFooter();
+  Status ParseRecord(absl::string_view record, absl::string_view* data) const;
+  // Decompresses the compressed block at offset() and, when reading
+  // sequentially, the blocks following it.
+  Status DecodeBlocks();
+  // Forgets decompressed blocks after a seek.
+  void ResetBlocks();
+
+  const std::string path_;
+  const RecordReaderOptions options_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  // Whether `data_` is a mapping, rather than pointing into `buffer_`.
+  bool mapped_ = false;
+  std::string buffer_;
+  // The file's identity and last modification, for Refresh().
+  uint64_t device_ = 0;
+  uint64_t inode_ = 0;
+  int64_t modified_ns_ = 0;
+  RecordSetHeader header_;
+  RecordSetFooter index_;
+  bool has_index_ = false;
+  // The offset of the first record, after the header.
+  uint64_t start_ = 0;
+  uint64_t end_ = 0;
+  uint64_t offset_ = 0;
+  uint64_t count_ = 0;
+
+  std::vector<DecodedBlock> blocks_;
+  // Decompresses batches alongside the reading thread, once the first
+  // batch of more than one block is read.
+  std::unique_ptr<DecompressPool> pool_;
+  size_t decoded_blocks_ = 0;
+  size_t next_block_ = 0;
+  // The unread records of the current decompressed block.
+  absl::string_view block_records_;
+  // Whether the last block was reached by reading rather than seeking, so
+  // that it's worth decompressing ahead.
+  bool sequential_ = false;
+};
+
+}  // namespace records
+
+#endif  // RECORDS_RECORD_READER_H__
@@ -0,0 +1,370 @@
+#include "records/record_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/crc/crc32c.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "records/codec.h"
+#include "records/record_reader.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+using ::google::protobuf::internal::WireFormatLite;
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace {
+
+constexpr int kMaxVarintBytes = 10;
+
+void AppendVarint(uint64_t value, std::string* output) {
+  uint8_t buffer[kMaxVarintBytes];
+  const uint8_t* end = CodedOutputStream::WriteVarint64ToArray(value, buffer);
+  output->append(reinterpret_cast<const char*>(buffer), end - buffer);
+}
+
+void AppendLengthDelimitedTag(int number, std::string* output) {
+  AppendVarint(WireFormatLite::MakeTag(
+                   number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED),
+               output);
+}
+
+}  // namespace
+
+void AppendRecord(absl::string_view data, bool checksum, std::string* output) {
+  // Record { bytes data = 6; fixed32 crc32 = 7; }
+  const size_t data_field_size = 1 +
+                                 CodedOutputStream::VarintSize64(data.size()) +
+                                 data.size();
+  const size_t record_size = data_field_size + (checksum ? 5 : 0);
+
+  AppendLengthDelimitedTag(RecordSet::kRecordFieldNumber, output);
+  AppendVarint(record_size, output);
+  AppendLengthDelimitedTag(Record::kDataFieldNumber, output);
+  AppendVarint(data.size(), output);
+  output->append(data.data(), data.size());
+  if (checksum) {
+    AppendVarint(WireFormatLite::MakeTag(Record::kCrc32FieldNumber,
+                                         WireFormatLite::WIRETYPE_FIXED32),
+                 output);
+    const uint32_t crc = static_cast<uint32_t>(absl::ComputeCrc32c(data));
+    uint8_t bytes[4];
+    WireFormatLite::WriteFixed32NoTagToArray(crc, bytes);
+    output->append(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+  }
+}
+
+std::unique_ptr<RecordWriter> RecordWriter::Open(
+    const std::string& path, const RecordSetHeader& header,
+    const RecordWriterOptions& options) {
+  int fd;
+  do {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+
+  std::unique_ptr<RecordWriter> writer(new RecordWriter(fd, path, options));
+  if (st.st_size == 0) {
+    writer->codec_ = header.codec();
+    AppendLengthDelimitedTag(RecordSet::kHeaderFieldNumber, &writer->buffer_);
+    const std::string serialized = header.SerializeAsString();
+    AppendVarint(serialized.size(), &writer->buffer_);
+    writer->buffer_.append(serialized);
+    writer->position_ = writer->buffer_.size();
+    if (!writer->WriteBuffer()) {
+      return nullptr;
+    }
+  } else if (!writer->ResumeIndex(st.st_size)) {
+    // Leave the file as it was, rather than closing it with a footer.
+    close(writer->fd_);
+    writer->fd_ = -1;
+    return nullptr;
+  }
+  return writer;
+}
+
+bool RecordWriter::ResumeIndex(uint64_t size) {
+  auto reader = RecordReader::Open(path_);
+  if (!reader)
+    return false;
+  codec_ = reader->header().codec();
+
+  uint64_t end;
+  if (reader->has_index()) {
+    footer_ = reader->index();
+    if (footer_.block_size() > 0) {
+      const RecordBlock& last = footer_.block(footer_.block_size() - 1);
+      next_record_ = last.first_record() + last.record_count();
+    }
+    end = reader->end();
+  } else {
+    absl::string_view data;
+    RecordReader::Status status;
+    uint64_t start = reader->offset();
+    while ((status = reader->Next(&data)) == RecordReader::OK) {
+      if (codec_ == RECORD_CODEC_NONE) {
+        AddToBlock(start, nullptr);
+        block_->set_size(reader->offset() - block_->offset());
+        if (block_->size() >= options_.block_size)
+          block_ = nullptr;
+      } else {
+        // The reader moves past a compressed block as it starts reading
+        // its records.
+        if (reader->offset() != start)
+          block_ = nullptr;
+        AddToBlock(start, nullptr);
+        block_->set_size(reader->offset() - block_->offset());
+      }
+      start = reader->offset();
+    }
+    if (status == RecordReader::CORRUPT) {
+      std::cerr << path_ << ": corrupt record at offset " << reader->offset()
+                << std::endl;
+      return false;
+    }
+    end = reader->offset();
+    if (status == RecordReader::TRUNCATED) {
+      if (!options_.truncate_partial_record) {
+        std::cerr << path_ << ": ends with a partial record of " << size - end
+                  << " bytes at offset " << end
+                  << ", set truncate_partial_record to drop it" << std::endl;
+        return false;
+      }
+      std::cerr << path_ << ": dropping a partial record of " << size - end
+                << " bytes at offset " << end << std::endl;
+    }
+  }
+  // Appended records start a new block.
+  block_ = nullptr;
+
+  // Drop the footer, or a partial record, so that appends continue from the
+  // last record.
+  if (end != size && ftruncate(fd_, end) != 0) {
+    std::cerr << path_ << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  position_ = end;
+  return true;
+}
+
+void RecordWriter::AddToBlock(uint64_t start, const absl::string_view* key) {
+  if (block_ == nullptr) {
+    block_ = footer_.add_block();
+    block_->set_offset(start);
+    block_->set_first_record(next_record_);
+  }
+  // A block's key range has to cover every record in it, so a block with
+  // any record appended without a key has no range and is always read.
+  const bool unkeyed = block_->record_count() > 0 && !block_->has_min_key();
+  block_->set_record_count(block_->record_count() + 1);
+  ++next_record_;
+  if (key == nullptr) {
+    block_->clear_min_key();
+    block_->clear_max_key();
+  } else if (!unkeyed) {
+    if (!block_->has_min_key() || *key < block_->min_key()) {
+      block_->set_min_key(*key);
+    }
+    if (!block_->has_max_key() || *key > block_->max_key()) {
+      block_->set_max_key(*key);
+    }
+  }
+}
+
+bool RecordWriter::EndCompressedBlock() {
+  if (block_ == nullptr)
+    return true;
+  compressed_.clear();
+  if (!Compress(codec_, options_.compression_level, block_records_,
+                &compressed_)) {
+    std::cerr << path_ << ": failed to compress block" << std::endl;
+    failed_ = true;
+    return false;
+  }
+
+  // CompressedBlock { bytes data = 1; uint64 uncompressed_size = 2; }
+  const size_t message_size =
+      1 + CodedOutputStream::VarintSize64(compressed_.size()) +
+      compressed_.size() + 1 +
+      CodedOutputStream::VarintSize64(block_records_.size());
+  const size_t buffered = buffer_.size();
+  AppendLengthDelimitedTag(RecordSet::kCompressedBlockFieldNumber, &buffer_);
+  AppendVarint(message_size, &buffer_);
+  AppendLengthDelimitedTag(CompressedBlock::kDataFieldNumber, &buffer_);
+  AppendVarint(compressed_.size(), &buffer_);
+  buffer_.append(compressed_);
+  AppendVarint(
+      WireFormatLite::MakeTag(CompressedBlock::kUncompressedSizeFieldNumber,
+                              WireFormatLite::WIRETYPE_VARINT),
+      &buffer_);
+  AppendVarint(block_records_.size(), &buffer_);
+
+  block_->set_offset(position_);
+  block_->set_size(buffer_.size() - buffered);
+  position_ += buffer_.size() - buffered;
+  block_ = nullptr;
+  block_records_.clear();
+  return true;
+}
+
+RecordWriter::RecordWriter(int fd, std::string path,
+                           const RecordWriterOptions& options)
+    : fd_(fd), path_(std::move(path)), options_(options) {}
+
+RecordWriter::~RecordWriter() {
+  Close();
+}
+
+bool RecordWriter::Append(absl::string_view data) {
+  return AppendKeyed(data, nullptr, false);
+}
+
+bool RecordWriter::Append(absl::string_view data, absl::string_view key) {
+  return AppendKeyed(data, &key, false);
+}
+
+bool RecordWriter::AppendEncoded(absl::string_view record,
+                                 const absl::string_view* key) {
+  return AppendKeyed(record, key, true);
+}
+
+bool RecordWriter::AppendKeyed(absl::string_view data,
+                               const absl::string_view* key, bool encoded) {
+  if (failed_) {
+    std::cerr << path_ << ": append after a failed write" << std::endl;
+    return false;
+  }
+  if (codec_ != RECORD_CODEC_NONE) {
+    // The block's offset is set once it is compressed and written.
+    AddToBlock(0, key);
+    if (encoded) {
+      block_records_.append(data.data(), data.size());
+    } else {
+      AppendRecord(data, options_.checksum, &block_records_);
+    }
+    if (block_records_.size() >= options_.block_size &&
+        !EndCompressedBlock()) {
+      return false;
+    }
+  } else {
+    const uint64_t start = position_;
+    const size_t buffered = buffer_.size();
+    if (encoded) {
+      buffer_.append(data.data(), data.size());
+    } else {
+      AppendRecord(data, options_.checksum, &buffer_);
+    }
+    position_ += buffer_.size() - buffered;
+    AddToBlock(start, key);
+    block_->set_size(position_ - block_->offset());
+    if (block_->size() >= options_.block_size)
+      block_ = nullptr;
+  }
+  if (buffer_.size() >= options_.buffer_size && !WriteBuffer())
+    return false;
+  ++count_;
+  return true;
+}
+
+bool RecordWriter::Flush() {
+  if (codec_ != RECORD_CODEC_NONE && !EndCompressedBlock())
+    return false;
+  return WriteBuffer();
+}
+
+bool RecordWriter::WriteBuffer() {
+  if (buffer_.empty())
+    return true;
+  const bool ok = Write(buffer_);
+  buffer_.clear();
+  return ok;
+}
+
+bool RecordWriter::Sync() {
+  if (!Flush())
+    return false;
+  if (fdatasync(fd_) != 0) {
+    std::cerr << path_ << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool RecordWriter::Close() {
+  if (fd_ < 0)
+    return true;
+  if (failed_) {
+    // The index may list records that never reached the file, so the
+    // footer is left off for the next writer or reader to rebuild.
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  bool ok = codec_ == RECORD_CODEC_NONE || EndCompressedBlock();
+
+  // RecordSet { RecordSetFooter footer = 132; fixed64 footer_offset = 133; }
+  const uint64_t footer_offset = position_;
+  AppendLengthDelimitedTag(RecordSet::kFooterFieldNumber, &buffer_);
+  const std::string footer = footer_.SerializeAsString();
+  AppendVarint(footer.size(), &buffer_);
+  buffer_.append(footer);
+  AppendVarint(WireFormatLite::MakeTag(RecordSet::kFooterOffsetFieldNumber,
+                                       WireFormatLite::WIRETYPE_FIXED64),
+               &buffer_);
+  uint8_t offset_bytes[8];
+  WireFormatLite::WriteFixed64NoTagToArray(footer_offset, offset_bytes);
+  buffer_.append(reinterpret_cast<const char*>(offset_bytes),
+                 sizeof(offset_bytes));
+
+  ok = WriteBuffer() && ok;
+  if (close(fd_) != 0) {
+    std::cerr << path_ << ": " << strerror(errno) << std::endl;
+    ok = false;
+  }
+  fd_ = -1;
+  return ok;
+}
+
+bool RecordWriter::Write(absl::string_view data) {
+  if (fd_ < 0) {
+    std::cerr << path_ << ": write after close" << std::endl;
+    return false;
+  }
+  if (failed_)
+    return false;
+  while (!data.empty()) {
+    const ssize_t written = write(fd_, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << path_ << ": " << strerror(errno) << std::endl;
+      failed_ = true;
+      return false;
+    }
+    data.remove_prefix(written);
+  }
+  return true;
+}
+
+}  // namespace records
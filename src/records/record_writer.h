@@ -0,0 +1,144 @@
+#ifndef RECORDS_RECORD_WRITER_H__
+#define RECORDS_RECORD_WRITER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "src/records/records.pb.h"
+
+namespace records {
+
+struct RecordWriterOptions {
+  // Store the CRC32C of each record's data in `Record.crc32`.
+  bool checksum = true;
+  // Records are buffered and written out once this many bytes are pending.
+  size_t buffer_size = 1 << 20;
+  // Records are grouped into blocks of at least this many bytes, the unit
+  // of the footer index.
+  size_t block_size = 64 << 10;
+  // The compression level for the codec set in the header, or 0 for the
+  // codec's default.
+  int compression_level = 0;
+  // Reopening a file that ends part way through a record, left by a writer
+  // that didn't finish, fails unless this is set, in which case the partial
+  // record is cut off.
+  bool truncate_partial_record = false;
+};
+
+// Appends records to a records file.
+//
+// A records file is a serialized RecordSet: the header, written once when
+// the file is created, followed by one `record` field per record.  Since
+// concatenated protobuf messages merge, appending a record is appending
+// its field, and the file parses as a single RecordSet at any record
+// boundary.
+//
+// If the header sets a codec, each block of records is compressed as a
+// unit and stored as a CompressedBlock, so random access still works a
+// block at a time.
+//
+// Records are grouped into blocks and Close() ends the file with a footer
+// indexing the blocks, see RecordSetFooter.  Reopening a file with a footer
+// removes the footer and continues its index; reopening one without a
+// footer scans it to rebuild the index.
+//
+// Records are encoded straight into a write buffer without building
+// Record messages.  Once a write fails, later appends fail too and Close()
+// leaves the footer off, so that the index never lists records the file
+// doesn't hold.  A RecordWriter is not thread-safe.
+class RecordWriter {
+ public:
+  // Opens `path` for appending, creating it if needed.  The header is only
+  // written if the file is new or empty.  A partial record at the end of the
+  // file, left by a writer that didn't finish, is only discarded if
+  // `options.truncate_partial_record` is set.  Returns nullptr and reports
+  // the error to stderr on failure.
+  static std::unique_ptr<RecordWriter> Open(
+      const std::string& path, const RecordSetHeader& header,
+      const RecordWriterOptions& options = RecordWriterOptions());
+
+  RecordWriter(const RecordWriter&) = delete;
+  RecordWriter& operator=(const RecordWriter&) = delete;
+  // Flushes and closes the file.  Errors are only reported by Close().
+  ~RecordWriter();
+
+  // Appends one record holding `data`.
+  bool Append(absl::string_view data);
+
+  // Appends one record and includes `key` in the key range of its block.
+  // Keys are compared as bytes, so integers such as timestamps should be
+  // encoded big endian.
+  bool Append(absl::string_view data, absl::string_view key);
+
+  // Appends a record already encoded by AppendRecord(), with the writer's
+  // checksum setting, so that callers can encode records on other threads.
+  // `key` may be nullptr.
+  bool AppendEncoded(absl::string_view record, const absl::string_view* key);
+
+  // Writes out any buffered records.  With compression this also ends the
+  // current block, so frequent flushes compress poorly.
+  bool Flush();
+
+  // Flushes and waits for the file to reach stable storage.
+  bool Sync();
+
+  // Flushes, writes the footer and closes the file.
+  bool Close();
+
+  // The number of records appended by this writer, not counting appends
+  // that failed.
+  uint64_t count() const {
+    return count_;
+  }
+
+  // The file descriptor, or -1 once closed.  Syncing it from another thread
+  // is safe.
+  int fd() const {
+    return fd_;
+  }
+
+ private:
+  RecordWriter(int fd, std::string path, const RecordWriterOptions& options);
+
+  // Recovers the index of an existing file of `size` bytes.
+  bool ResumeIndex(uint64_t size);
+  bool AppendKeyed(absl::string_view data, const absl::string_view* key,
+                   bool encoded);
+  // Counts a record in the current block, starting a block at `start` if
+  // there is none.
+  void AddToBlock(uint64_t start, const absl::string_view* key);
+  // Compresses the pending records and appends them to `buffer_`.
+  bool EndCompressedBlock();
+  bool WriteBuffer();
+  bool Write(absl::string_view data);
+
+  int fd_;
+  const std::string path_;
+  const RecordWriterOptions options_;
+  std::string buffer_;
+  uint64_t count_ = 0;
+  // Set once a write or compression fails.
+  bool failed_ = false;
+
+  // The file offset at the end of `buffer_`.
+  uint64_t position_ = 0;
+  RecordCodec codec_ = RECORD_CODEC_NONE;
+  // The uncompressed records of the current block, with compression.
+  std::string block_records_;
+  std::string compressed_;
+  RecordSetFooter footer_;
+  // The block being filled, or nullptr.
+  RecordBlock* block_ = nullptr;
+  uint64_t next_record_ = 0;
+};
+
+// Appends the encoding of one `RecordSet.record` field holding `data` to
+// `output`.  With `checksum`, the record carries the CRC32C of `data`.
+void AppendRecord(absl::string_view data, bool checksum, std::string* output);
+
+}  // namespace records
+
+#endif  // RECORDS_RECORD_WRITER_H__
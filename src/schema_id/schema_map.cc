@@ -0,0 +1,124 @@
+#include "schema_id/schema_map.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "schema_id/extensions.pb.h"
+#include "schema_id/message_id.pb.h"
+
+namespace protobunny::schema_id {
+
+uint64_t OptionsKey(const google::protobuf::MessageOptions& options) {
+  if (!options.HasExtension(id))
+    return 0;
+  const MessageOptions& schema_id = options.GetExtension(id);
+  switch (schema_id.id_case()) {
+    case MessageOptions::kId32:
+      return Id32Key(schema_id.id32());
+    case MessageOptions::kId64:
+      return Id64Key(schema_id.id64());
+    default:
+      return 0;
+  }
+}
+
+bool BuildSchemaHash(std::span<const uint64_t> keys,
+                     std::vector<uint32_t>* seeds,
+                     std::vector<uint32_t>* slots) {
+  std::vector<uint64_t> sorted(keys.begin(), keys.end());
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+    return false;
+
+  // Four keys to a bucket on average, in slots that are at most 80% full,
+  // so that even the last buckets placed find free slots in a few tries.
+  const size_t bucket_count =
+      std::bit_ceil(std::max<size_t>(1, keys.size() / 4));
+  const size_t slot_count =
+      std::bit_ceil(std::max<size_t>(1, keys.size() + keys.size() / 4));
+  seeds->assign(bucket_count, 0);
+  slots->assign(slot_count, 0);
+
+  std::vector<std::vector<uint32_t>> buckets(bucket_count);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    buckets[(HashKey(keys[i], 0) >> 32) & (bucket_count - 1)].push_back(i);
+  }
+  std::vector<uint32_t> order(bucket_count);
+  for (size_t i = 0; i < bucket_count; ++i) {
+    order[i] = i;
+  }
+  // The largest buckets are placed first, while most slots are free.
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  std::vector<bool> used(slot_count);
+  std::vector<uint64_t> placed;
+  for (const uint32_t bucket : order) {
+    if (buckets[bucket].empty())
+      break;
+    // Seed 0 is the bucket hash, so seeds start at 1.
+    for (uint32_t seed = 1;; ++seed) {
+      if (seed == 0)
+        return false;
+      placed.clear();
+      for (const uint32_t i : buckets[bucket]) {
+        const uint64_t slot = HashKey(keys[i], seed) & (slot_count - 1);
+        if (used[slot] ||
+            std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+          break;
+        }
+        placed.push_back(slot);
+      }
+      if (placed.size() < buckets[bucket].size())
+        continue;
+      for (size_t j = 0; j < placed.size(); ++j) {
+        used[placed[j]] = true;
+        (*slots)[placed[j]] = buckets[bucket][j];
+      }
+      (*seeds)[bucket] = seed;
+      break;
+    }
+  }
+  return true;
+}
+
+bool SchemaMap::Pack(const google::protobuf::Message& message,
+                     Any* any) const {
+  const uint64_t key = OptionsKey(message.GetDescriptor()->options());
+  if (table_.Find(key) == nullptr)
+    return false;
+  SetKey(key, any);
+  return message.SerializeToString(any->mutable_message());
+}
+
+bool SchemaMap::Unpack(const Any& any,
+                       google::protobuf::Message* message) const {
+  const SchemaType* type = Find(any);
+  if (type == nullptr ||
+      type->prototype().GetDescriptor() != message->GetDescriptor()) {
+    return false;
+  }
+  return message->ParseFromString(any.message());
+}
+
+google::protobuf::Message* SchemaMap::Unpack(
+    const Any& any, google::protobuf::Arena* arena) const {
+  const SchemaType* type = Find(any);
+  if (type == nullptr)
+    return nullptr;
+  google::protobuf::Message* message = type->prototype().New(arena);
+  if (!message->ParseFromString(any.message())) {
+    if (arena == nullptr)
+      delete message;
+    return nullptr;
+  }
+  return message;
+}
+
+}  // namespace protobunny::schema_id
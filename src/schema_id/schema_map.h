@@ -0,0 +1,207 @@
+#ifndef SCHEMA_ID_SCHEMA_MAP_H__
+#define SCHEMA_ID_SCHEMA_MAP_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/message.h"
+#include "schema_id/any.pb.h"
+
+namespace protobunny::schema_id {
+
+// A schema id as a single key.  An id64 keeps its upper 8 bits clear, so
+// the top bit marks an id32, and the two never share a key.
+inline constexpr uint64_t kId32Key = uint64_t{1} << 63;
+
+constexpr uint64_t Id32Key(uint32_t id32) {
+  return kId32Key | id32;
+}
+constexpr uint64_t Id64Key(uint64_t id64) {
+  return id64;
+}
+
+// Ids below kMinId are reserved for well-known types, and the upper 4 bits
+// of an id32 and 8 bits of an id64 are reserved.
+inline constexpr uint64_t kMinId = 0x100;
+inline constexpr uint64_t kMaxId32 = 0xFFFFFFF;
+inline constexpr uint64_t kMaxId64 = (uint64_t{1} << 56) - 1;
+
+// The id in `key`, without the id32 marker.
+constexpr uint64_t KeyId(uint64_t key) {
+  return key & ~kId32Key;
+}
+
+// Whether the id in `key` is outside the reserved ranges.
+constexpr bool IsValidKey(uint64_t key) {
+  return KeyId(key) >= kMinId &&
+         KeyId(key) <= (key & kId32Key ? kMaxId32 : kMaxId64);
+}
+
+// The key of the id in `any`, or 0 if it has none.  0 is reserved, so it
+// never names a type.
+inline uint64_t AnyKey(const Any& any) {
+  switch (any.id_case()) {
+    case Any::kId32:
+      return Id32Key(any.id32());
+    case Any::kId64:
+      return Id64Key(any.id64());
+    default:
+      return 0;
+  }
+}
+
+// The key of the `(protobunny.schema_id.id)` option in `options`, or 0 if
+// it has none.
+uint64_t OptionsKey(const google::protobuf::MessageOptions& options);
+
+// Mixes a key with a seed, the splitmix64 finalizer.
+constexpr uint64_t HashKey(uint64_t key, uint64_t seed) {
+  uint64_t x = key + seed * 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// The slot of `key` in a perfect hash built by BuildSchemaHash(), whose
+// `seeds` and `slots` are sized in powers of two.  The slot's value is the
+// index of the only entry that can have `key`, which must then be checked.
+constexpr uint32_t SchemaSlot(uint64_t key, std::span<const uint32_t> seeds,
+                              std::span<const uint32_t> slots) {
+  const uint64_t bucket = (HashKey(key, 0) >> 32) & (seeds.size() - 1);
+  return slots[HashKey(key, seeds[bucket]) & (slots.size() - 1)];
+}
+
+// Returns the default instance of a generated message type, which is its
+// factory: prototype().New() makes a new message of the type.
+using PrototypeFn = const google::protobuf::Message& (*)();
+
+template <typename T>
+const google::protobuf::Message& DefaultInstance() {
+  return T::default_instance();
+}
+
+// A message type in a schema table.
+struct SchemaType {
+  uint64_t key;
+  std::string_view full_name;
+  PrototypeFn prototype;
+};
+
+// Maps schema ids to message types through a perfect hash, built ahead of
+// time by BuildSchemaHash().
+//
+// The keys are split into buckets by one hash, and each bucket has a seed
+// for a second hash that places its keys in slots without a collision.  A
+// lookup is then two hashes, three loads and one key comparison, whether or
+// not the key is in the table, and never compares a name.
+//
+// The table only holds views of its arrays, so a generated table is a
+// constexpr value with no initialization at startup.
+class SchemaTable {
+ public:
+  constexpr SchemaTable() = default;
+  // `seeds` and `slots` are sized in powers of two, and each slot holds an
+  // index into `types`.
+  constexpr SchemaTable(std::span<const SchemaType> types,
+                        std::span<const uint32_t> seeds,
+                        std::span<const uint32_t> slots)
+      : types_(types), seeds_(seeds), slots_(slots) {}
+
+  constexpr std::span<const SchemaType> types() const {
+    return types_;
+  }
+
+  // The type with `key`, or null.
+  constexpr const SchemaType* Find(uint64_t key) const {
+    if (types_.empty())
+      return nullptr;
+    const SchemaType& type = types_[SchemaSlot(key, seeds_, slots_)];
+    return type.key == key ? &type : nullptr;
+  }
+
+ private:
+  std::span<const SchemaType> types_;
+  std::span<const uint32_t> seeds_;
+  std::span<const uint32_t> slots_;
+};
+
+// Computes the seeds and slots of a SchemaTable over `keys`, with slot
+// values indexing `keys`.  Returns false if a key repeats.
+bool BuildSchemaHash(std::span<const uint64_t> keys,
+                     std::vector<uint32_t>* seeds,
+                     std::vector<uint32_t>* slots);
+
+// The key of a generated message type, specialized by generated tables for
+// each type they hold.
+template <typename T>
+struct SchemaKeyOf;
+
+template <typename T>
+concept HasSchemaKey = requires { SchemaKeyOf<T>::kKey; };
+
+// Packs and unpacks messages in schema_id Anys, identified by the ids in
+// their `(protobunny.schema_id.id)` options.
+class SchemaMap {
+ public:
+  explicit constexpr SchemaMap(const SchemaTable& table) : table_(table) {}
+
+  const SchemaTable& table() const {
+    return table_;
+  }
+
+  // The type of the message in `any`, or null if it isn't in the map.
+  const SchemaType* Find(const Any& any) const {
+    return table_.Find(AnyKey(any));
+  }
+
+  // Packs `message` into `any`.  Returns false if its type has no schema
+  // id, or one that isn't in the map.
+  bool Pack(const google::protobuf::Message& message, Any* any) const;
+
+  // Parses the message in `any` into `message`.  Returns false if the id
+  // isn't in the map, it names another type, or the message doesn't parse.
+  bool Unpack(const Any& any, google::protobuf::Message* message) const;
+
+  // Makes a new message of the type in `any` and parses into it.  Returns
+  // null if the id isn't in the map or the message doesn't parse.
+  google::protobuf::Message* Unpack(
+      const Any& any, google::protobuf::Arena* arena = nullptr) const;
+
+  // Packs and unpacks a generated type held in the map, with its key known
+  // at compile time.
+  template <HasSchemaKey T>
+  static bool Pack(const T& message, Any* any) {
+    SetKey(SchemaKeyOf<T>::kKey, any);
+    return message.SerializeToString(any->mutable_message());
+  }
+  template <HasSchemaKey T>
+  static bool Unpack(const Any& any, T* message) {
+    return Is<T>(any) && message->ParseFromString(any.message());
+  }
+
+  // Whether `any` holds a T.
+  template <HasSchemaKey T>
+  static bool Is(const Any& any) {
+    return AnyKey(any) == SchemaKeyOf<T>::kKey;
+  }
+
+ private:
+  static void SetKey(uint64_t key, Any* any) {
+    if (key & kId32Key) {
+      any->set_id32(static_cast<uint32_t>(key));
+    } else {
+      any->set_id64(key);
+    }
+  }
+
+  const SchemaTable table_;
+};
+
+}  // namespace protobunny::schema_id
+
+#endif  // SCHEMA_ID_SCHEMA_MAP_H__
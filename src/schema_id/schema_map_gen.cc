@@ -0,0 +1,331 @@
+// Generates a C++ header holding a constexpr SchemaTable for the messages
+// with schema ids in one or more descriptor sets.
+//
+//   schema_map_gen --descriptor_set_in=protos.pb --namespace=my::pkg
+//       --output=my_schema_map.h
+//
+// Types without an id in their options can take one from a MessageIdMap,
+// such as one written by `protodb schema-ids --assign`.
+//
+// The header defines `kSchemaTable` in the namespace, for a SchemaMap, and
+// the SchemaKeyOf<T> of each type, for Pack<T>(), Unpack<T>() and Is<T>().
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "schema_id/message_id_map.pb.h"
+#include "schema_id/schema_map.h"
+
+namespace protobunny::schema_id {
+namespace {
+
+using ::google::protobuf::DescriptorProto;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::FileDescriptorSet;
+
+struct Options {
+  std::vector<std::string> descriptor_set_in;
+  std::string message_id_map;
+  std::string name_space;
+  std::string output;
+};
+
+struct Type {
+  uint64_t key;
+  std::string full_name;
+  std::string cc_name;
+};
+
+// Reads a binary `T` from `path`.
+template <typename T>
+bool ReadMessage(const std::string& path, T* message) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  google::protobuf::io::FileInputStream input(fd);
+  input.SetCloseOnDelete(true);
+  if (!message->ParseFromZeroCopyStream(&input)) {
+    std::cerr << path << ": not a " << T::descriptor()->name() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The id in `key`, as in "id32 0x1234567".
+std::string KeyName(uint64_t key) {
+  return absl::StrFormat("%s %#x", key & kId32Key ? "id32" : "id64",
+                         KeyId(key));
+}
+
+// Adds the types with ids in `message` and the types nested in it.  Ids
+// come from the options of each type, or from `assigned`, by full name.
+bool AddTypes(const DescriptorProto& message, const std::string& scope,
+              const std::string& cc_scope,
+              const absl::flat_hash_map<std::string, uint64_t>& assigned,
+              std::vector<Type>* types) {
+  const std::string full_name = scope.empty()
+                                    ? message.name()
+                                    : absl::StrCat(scope, ".", message.name());
+  const std::string cc_name = absl::StrCat(cc_scope, message.name());
+  uint64_t key = OptionsKey(message.options());
+  if (const auto it = assigned.find(full_name); it != assigned.end()) {
+    if (key != 0 && key != it->second) {
+      std::cerr << full_name << ": has " << KeyName(key)
+                << " but the id map gives it " << KeyName(it->second)
+                << std::endl;
+      return false;
+    }
+    key = it->second;
+  }
+  if (key != 0) {
+    if (!IsValidKey(key)) {
+      std::cerr << full_name << ": " << KeyName(key) << " is reserved"
+                << std::endl;
+      return false;
+    }
+    types->push_back(Type{key, full_name, cc_name});
+  }
+  for (const DescriptorProto& nested : message.nested_type()) {
+    if (!AddTypes(nested, full_name, cc_name + "_", assigned, types))
+      return false;
+  }
+  return true;
+}
+
+std::string KeyLiteral(uint64_t key) {
+  return absl::StrFormat("0x%016x", key);
+}
+
+void WriteNumbers(const std::vector<uint32_t>& numbers, std::string* out) {
+  for (size_t i = 0; i < numbers.size(); ++i) {
+    absl::StrAppend(out, i % 8 == 0 ? "\n   " : "", " ", numbers[i], ",");
+  }
+  absl::StrAppend(out, "\n");
+}
+
+// The file name of `path`.
+absl::string_view Basename(absl::string_view path) {
+  const size_t slash = path.rfind('/');
+  return slash == path.npos ? path : path.substr(slash + 1);
+}
+
+std::string HeaderGuard(const Options& options) {
+  std::string guard = absl::StrCat(
+      absl::StrReplaceAll(options.name_space, {{"::", "_"}}), "_",
+      options.output.empty() ? "schema_map.h" : Basename(options.output));
+  for (char& c : guard) {
+    c = std::isalnum(static_cast<unsigned char>(c))
+            ? std::toupper(static_cast<unsigned char>(c))
+            : '_';
+  }
+  return guard + "__";
+}
+
+std::string Generate(const Options& options, const std::vector<Type>& types,
+                     const std::set<std::string>& headers,
+                     const std::vector<uint32_t>& seeds,
+                     const std::vector<uint32_t>& slots) {
+  const std::string guard = HeaderGuard(options);
+  std::string out = absl::StrCat(
+      "// Generated by schema_map_gen from ",
+      absl::StrJoin(options.descriptor_set_in, ", ",
+                    [](std::string* out, const std::string& path) {
+                      absl::StrAppend(out, Basename(path));
+                    }),
+      ".  Do not edit.\n\n",
+      "#ifndef ", guard, "\n#define ", guard, "\n\n#include <cstdint>\n\n",
+      "#include \"schema_id/schema_map.h\"\n");
+  for (const std::string& header : headers) {
+    absl::StrAppend(&out, "#include \"", header, "\"\n");
+  }
+  absl::StrAppend(&out, "\nnamespace ", options.name_space, " {\n\n");
+
+  if (types.empty()) {
+    absl::StrAppend(&out,
+                    "inline constexpr ::protobunny::schema_id::SchemaTable "
+                    "kSchemaTable;\n");
+  } else {
+    absl::StrAppend(&out,
+                    "inline constexpr ::protobunny::schema_id::SchemaType "
+                    "kSchemaTypes[] = {\n");
+    for (const Type& type : types) {
+      absl::StrAppend(&out, "    {", KeyLiteral(type.key), ", \"",
+                      type.full_name, "\",\n",
+                      "     &::protobunny::schema_id::DefaultInstance<",
+                      type.cc_name, ">},\n");
+    }
+    absl::StrAppend(&out, "};\n\ninline constexpr uint32_t kSchemaSeeds[] = {");
+    WriteNumbers(seeds, &out);
+    absl::StrAppend(&out, "};\n\ninline constexpr uint32_t kSchemaSlots[] = {");
+    WriteNumbers(slots, &out);
+    absl::StrAppend(&out,
+                    "};\n\n"
+                    "inline constexpr ::protobunny::schema_id::SchemaTable "
+                    "kSchemaTable(\n"
+                    "    kSchemaTypes, kSchemaSeeds, kSchemaSlots);\n");
+  }
+  absl::StrAppend(&out, "\n}  // namespace ", options.name_space, "\n");
+
+  if (!types.empty()) {
+    absl::StrAppend(&out, "\nnamespace protobunny::schema_id {\n");
+    for (const Type& type : types) {
+      absl::StrAppend(&out, "\ntemplate <>\nstruct SchemaKeyOf<", type.cc_name,
+                      "> {\n  static constexpr uint64_t kKey = ",
+                      KeyLiteral(type.key), ";\n};\n");
+    }
+    absl::StrAppend(&out, "\n}  // namespace protobunny::schema_id\n");
+  }
+  absl::StrAppend(&out, "\n#endif  // ", guard, "\n");
+  return out;
+}
+
+int Run(const Options& options) {
+  absl::flat_hash_map<std::string, uint64_t> assigned;
+  if (!options.message_id_map.empty()) {
+    MessageIdMap map;
+    if (!ReadMessage(options.message_id_map, &map))
+      return 1;
+    for (const MessageIdMap::Entry& entry : map.entries()) {
+      assigned[entry.message_type()] =
+          entry.has_id32() ? Id32Key(entry.id32()) : Id64Key(entry.id64());
+    }
+  }
+
+  std::vector<Type> types;
+  std::set<std::string> headers;
+  std::set<std::string> files;
+  for (const std::string& path : options.descriptor_set_in) {
+    FileDescriptorSet set;
+    if (!ReadMessage(path, &set))
+      return 1;
+    for (const FileDescriptorProto& file : set.file()) {
+      if (!files.insert(file.name()).second)
+        continue;
+      const size_t first = types.size();
+      const std::string cc_scope = absl::StrCat(
+          "::", absl::StrReplaceAll(file.package(), {{".", "::"}}),
+          file.package().empty() ? "" : "::");
+      for (const DescriptorProto& message : file.message_type()) {
+        if (!AddTypes(message, file.package(), cc_scope, assigned, &types))
+          return 1;
+      }
+      if (types.size() > first) {
+        absl::string_view name = file.name();
+        absl::ConsumeSuffix(&name, ".proto");
+        headers.insert(absl::StrCat(name, ".pb.h"));
+      }
+    }
+  }
+
+  std::sort(types.begin(), types.end(), [](const Type& a, const Type& b) {
+    return a.key < b.key;
+  });
+  for (size_t i = 1; i < types.size(); ++i) {
+    if (types[i].key == types[i - 1].key) {
+      std::cerr << types[i - 1].full_name << ", " << types[i].full_name
+                << ": both have " << KeyName(types[i].key) << std::endl;
+      return 1;
+    }
+  }
+  std::sort(types.begin(), types.end(), [](const Type& a, const Type& b) {
+    return a.full_name < b.full_name;
+  });
+
+  std::vector<uint64_t> keys;
+  for (const Type& type : types) {
+    keys.push_back(type.key);
+  }
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;
+  if (!BuildSchemaHash(keys, &seeds, &slots)) {
+    std::cerr << "unable to build a perfect hash of the schema ids"
+              << std::endl;
+    return 1;
+  }
+
+  const std::string header =
+      Generate(options, types, headers, seeds, slots);
+  if (options.output.empty()) {
+    std::cout << header;
+    return std::cout.good() ? 0 : 1;
+  }
+  std::ofstream output(options.output, std::ios::binary | std::ios::trunc);
+  output << header;
+  output.close();
+  if (!output) {
+    std::cerr << options.output << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: schema_map_gen --descriptor_set_in=FILES "
+               "--namespace=NAMESPACE [--message_id_map=FILE] "
+               "[--output=FILE]\n"
+               "  --descriptor_set_in  descriptor sets to read, separated by "
+               "colons\n"
+               "  --namespace          the C++ namespace of the table\n"
+               "  --message_id_map     a MessageIdMap with ids for types "
+               "that have none\n"
+               "  --output             the header to write, or stdout"
+            << std::endl;
+}
+
+int Main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    absl::string_view arg = argv[i];
+    if (absl::ConsumePrefix(&arg, "--descriptor_set_in=")) {
+      for (absl::string_view path :
+           absl::StrSplit(arg, ':', absl::SkipEmpty())) {
+        options.descriptor_set_in.push_back(std::string(path));
+      }
+    } else if (absl::ConsumePrefix(&arg, "--message_id_map=")) {
+      options.message_id_map = std::string(arg);
+    } else if (absl::ConsumePrefix(&arg, "--namespace=")) {
+      options.name_space = std::string(arg);
+    } else if (absl::ConsumePrefix(&arg, "--output=")) {
+      options.output = std::string(arg);
+    } else {
+      std::cerr << "unknown argument: " << arg << std::endl;
+      PrintUsage();
+      return 2;
+    }
+  }
+  if (options.descriptor_set_in.empty() || options.name_space.empty()) {
+    PrintUsage();
+    return 2;
+  }
+  return Run(options);
+}
+
+}  // namespace
+}  // namespace protobunny::schema_id
+
+int main(int argc, char* argv[]) {
+  return ::protobunny::schema_id::Main(argc, argv);
+}
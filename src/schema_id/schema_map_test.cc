@@ -0,0 +1,253 @@
+#include "schema_id/schema_map.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
+#include "gtest/gtest.h"
+#include "schema_id/message_id_map.pb.h"
+#include "schema_id/schema_map_test.pb.h"
+#include "schema_id/schema_map_test_gen.h"
+#include "schema_id/schema_registry.h"
+
+namespace protobunny::schema_id {
+namespace {
+
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::FileDescriptorProto;
+using ::protobunny::schema_id::test::kSchemaTable;
+using ::protobunny::schema_id::test::Point;
+using ::protobunny::schema_id::test::Point_Label;
+using ::protobunny::schema_id::test::Unnamed;
+
+// The generated table is usable at compile time.
+static_assert(kSchemaTable.Find(Id32Key(0x1234567))->full_name ==
+              "protobunny.schema_id.test.Point");
+static_assert(kSchemaTable.Find(Id64Key(0x1234567))->full_name ==
+              "protobunny.schema_id.test.Point.Label");
+static_assert(kSchemaTable.Find(Id32Key(0x7654321)) == nullptr);
+
+TEST(SchemaMapTest, BuildsPerfectHash) {
+  std::mt19937_64 random(42);
+  std::set<uint64_t> unique;
+  while (unique.size() < 10000) {
+    unique.insert(Id32Key(random() & 0xFFFFFFF));
+  }
+  const std::vector<uint64_t> keys(unique.begin(), unique.end());
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;
+  ASSERT_TRUE(BuildSchemaHash(keys, &seeds, &slots));
+
+  std::vector<SchemaType> types;
+  for (const uint64_t key : keys) {
+    types.push_back(SchemaType{key, "", nullptr});
+  }
+  const SchemaTable table(types, seeds, slots);
+  for (const SchemaType& type : types) {
+    EXPECT_EQ(table.Find(type.key), &type);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    const uint64_t key = random() & 0xFFFFFFFFFFFFFF;
+    EXPECT_EQ(table.Find(key), nullptr);
+  }
+
+  const std::vector<uint64_t> repeated = {Id32Key(0x100), Id32Key(0x100)};
+  EXPECT_FALSE(BuildSchemaHash(repeated, &seeds, &slots));
+}
+
+TEST(SchemaMapTest, PacksAndUnpacks) {
+  const SchemaMap schema_map(kSchemaTable);
+  Point point;
+  point.set_x(3);
+  point.set_y(-4);
+
+  Any any;
+  ASSERT_TRUE(schema_map.Pack(point, &any));
+  EXPECT_EQ(any.id32(), 0x1234567);
+  EXPECT_TRUE(SchemaMap::Is<Point>(any));
+  EXPECT_FALSE(SchemaMap::Is<Point_Label>(any));
+
+  Point unpacked;
+  ASSERT_TRUE(schema_map.Unpack(any, &unpacked));
+  EXPECT_EQ(unpacked.y(), -4);
+  Point_Label label;
+  EXPECT_FALSE(schema_map.Unpack(any, &label));
+
+  // Through the message interface, with the key read from the options.
+  const google::protobuf::Message& message = point;
+  Any from_message;
+  ASSERT_TRUE(schema_map.Pack(message, &from_message));
+  EXPECT_EQ(from_message.SerializeAsString(), any.SerializeAsString());
+  google::protobuf::Message& into = unpacked;
+  EXPECT_TRUE(schema_map.Unpack(any, &into));
+
+  google::protobuf::Arena arena;
+  google::protobuf::Message* made = schema_map.Unpack(any, &arena);
+  ASSERT_NE(made, nullptr);
+  EXPECT_EQ(made->GetDescriptor(), Point::descriptor());
+  EXPECT_EQ(made->SerializeAsString(), point.SerializeAsString());
+
+  // A type without a schema id can't be packed.
+  EXPECT_FALSE(schema_map.Pack(Unnamed(), &any));
+  any.set_id32(0x7654321);
+  EXPECT_EQ(schema_map.Find(any), nullptr);
+}
+
+TEST(SchemaRegistryTest, InstallsMaps) {
+  SchemaRegistry registry;
+  auto reader = registry.NewReader();
+  EXPECT_EQ(reader->Find(Id32Key(0x1234567)).descriptor, nullptr);
+
+  ASSERT_TRUE(registry.Install(kSchemaTable));
+  EXPECT_EQ(reader->Find(Id32Key(0x1234567)).descriptor, Point::descriptor());
+
+  // A map over a pool of its own, as when a schema is loaded at runtime.
+  FileDescriptorProto file;
+  Point::descriptor()->file()->CopyTo(&file);
+  file.clear_dependency();
+  file.clear_options();
+  for (auto& message : *file.mutable_message_type()) {
+    message.clear_options();
+    for (auto& nested : *message.mutable_nested_type()) {
+      nested.clear_options();
+    }
+  }
+  DescriptorPool pool;
+  ASSERT_NE(pool.BuildFile(file), nullptr);
+  DynamicMessageFactory factory;
+  MessageIdMap map;
+  MessageIdMap::Entry* entry = map.add_entries();
+  entry->set_id64(0x5000);
+  entry->set_message_type("protobunny.schema_id.test.Unnamed");
+  entry = map.add_entries();
+  entry->set_id32(0x1234567);
+  entry->set_message_type("protobunny.schema_id.test.Point");
+  ASSERT_TRUE(registry.Install(map, &pool, &factory));
+  EXPECT_EQ(registry.size(), 3);
+
+  Point point;
+  point.set_x(9);
+  Any any;
+  SchemaMap::Pack(point, &any);
+  google::protobuf::Arena arena;
+  google::protobuf::Message* message = reader->Unpack(any, &arena);
+  ASSERT_NE(message, nullptr);
+  // The newer schema replaced the generated type.
+  EXPECT_EQ(message->GetDescriptor(),
+            pool.FindMessageTypeByName("protobunny.schema_id.test.Point"));
+  EXPECT_EQ(message->SerializeAsString(), point.SerializeAsString());
+
+  // An id can't move to another type.
+  entry->set_message_type("protobunny.schema_id.test.Unnamed");
+  EXPECT_FALSE(registry.Install(map, &pool, &factory));
+  map.Clear();
+  map.add_entries()->set_message_type("protobunny.schema_id.test.Missing");
+  EXPECT_FALSE(registry.Install(map, &pool, &factory));
+  EXPECT_EQ(registry.size(), 3);
+}
+
+TEST(SchemaRegistryTest, ReadsWhileInstalling) {
+  SchemaRegistry registry;
+  ASSERT_TRUE(registry.Install(kSchemaTable));
+  std::atomic<bool> done = false;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      auto reader = registry.NewReader();
+      while (!done) {
+        ASSERT_EQ(reader->Find(Id32Key(0x1234567)).descriptor,
+                  Point::descriptor());
+      }
+    });
+  }
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(registry.Install(kSchemaTable));
+  }
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  registry.Reclaim();
+}
+
+// Installs tables of changing types from two threads while readers look up
+// and unpack through readers that come and go.  Meant to be run under
+// --config=tsan, which reports a reader still using a freed table.
+TEST(SchemaRegistryTest, StressesInstallAndFind) {
+  FileDescriptorProto file;
+  Point::descriptor()->file()->CopyTo(&file);
+  file.clear_dependency();
+  file.clear_options();
+  for (auto& message : *file.mutable_message_type()) {
+    message.clear_options();
+    for (auto& nested : *message.mutable_nested_type()) {
+      nested.clear_options();
+    }
+  }
+  DescriptorPool pool;
+  ASSERT_NE(pool.BuildFile(file), nullptr);
+  DynamicMessageFactory factory;
+  MessageIdMap map;
+  MessageIdMap::Entry* entry = map.add_entries();
+  entry->set_id32(0x1234567);
+  entry->set_message_type("protobunny.schema_id.test.Point");
+
+  SchemaRegistry registry;
+  ASSERT_TRUE(registry.Install(kSchemaTable));
+  Point point;
+  point.set_x(9);
+  Any any;
+  SchemaMap::Pack(point, &any);
+
+  std::atomic<bool> done = false;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      while (!done) {
+        auto reader = registry.NewReader();
+        for (int j = 0; j < 100; ++j) {
+          const SchemaRegistry::Type type = reader->Find(Id32Key(0x1234567));
+          ASSERT_NE(type.descriptor, nullptr);
+          ASSERT_EQ(type.descriptor->full_name(),
+                    "protobunny.schema_id.test.Point");
+          google::protobuf::Arena arena;
+          google::protobuf::Message* message = reader->Unpack(any, &arena);
+          ASSERT_NE(message, nullptr);
+          ASSERT_EQ(message->SerializeAsString(), any.message());
+        }
+      }
+    });
+  }
+  std::vector<std::thread> installers;
+  for (int i = 0; i < 2; ++i) {
+    installers.emplace_back([&] {
+      for (int j = 0; j < 500; ++j) {
+        if (j % 2 == 0) {
+          ASSERT_TRUE(registry.Install(kSchemaTable));
+        } else {
+          ASSERT_TRUE(registry.Install(map, &pool, &factory));
+        }
+      }
+    });
+  }
+  for (std::thread& installer : installers) {
+    installer.join();
+  }
+  done = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  registry.Reclaim();
+}
+
+}  // namespace
+}  // namespace protobunny::schema_id
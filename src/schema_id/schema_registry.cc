@@ -0,0 +1,186 @@
+#include "schema_id/schema_registry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "schema_id/schema_map.h"
+
+namespace protobunny::schema_id {
+
+// An immutable set of types with a perfect hash over their keys.
+struct SchemaRegistry::Table {
+  std::vector<Type> types;
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;
+
+  Type Find(uint64_t key) const {
+    if (types.empty())
+      return Type();
+    const Type& type = types[SchemaSlot(key, seeds, slots)];
+    return type.key == key ? type : Type();
+  }
+};
+
+SchemaRegistry::Reader::~Reader() {
+  std::lock_guard<std::mutex> lock(registry_->mutex_);
+  slot_->in_use = false;
+}
+
+SchemaRegistry::Type SchemaRegistry::Reader::Find(uint64_t key) {
+  // The epoch is loaded, published and the table loaded all sequentially
+  // consistent.  A reader that sees an epoch advanced by Install() then also
+  // sees the table stored before it, and one that publishes an older epoch
+  // either does so before Install() checks the slots, keeping the old table
+  // alive, or after, and so loads the new table.
+  slot_->epoch.store(registry_->epoch_.load());
+  const Type type = registry_->table_.load()->Find(key);
+  slot_->epoch.store(0, std::memory_order_release);
+  return type;
+}
+
+google::protobuf::Message* SchemaRegistry::Reader::Unpack(
+    const Any& any, google::protobuf::Arena* arena) {
+  const Type type = Find(any);
+  if (type.prototype == nullptr)
+    return nullptr;
+  google::protobuf::Message* message = type.prototype->New(arena);
+  if (!message->ParseFromString(any.message())) {
+    if (arena == nullptr)
+      delete message;
+    return nullptr;
+  }
+  return message;
+}
+
+SchemaRegistry::SchemaRegistry() : table_(new Table()) {}
+
+SchemaRegistry::~SchemaRegistry() {
+  delete table_.load();
+}
+
+std::unique_ptr<SchemaRegistry::Reader> SchemaRegistry::NewReader() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto slot = std::find_if(slots_.begin(), slots_.end(),
+                           [](const ReaderSlot& slot) { return !slot.in_use; });
+  if (slot == slots_.end()) {
+    slots_.emplace_back();
+    slot = slots_.end() - 1;
+  }
+  slot->in_use = true;
+  return std::unique_ptr<Reader>(new Reader(this, &*slot));
+}
+
+bool SchemaRegistry::Install(const MessageIdMap& map,
+                             const google::protobuf::DescriptorPool* pool,
+                             google::protobuf::MessageFactory* factory) {
+  std::vector<Type> types;
+  types.reserve(map.entries_size());
+  for (const MessageIdMap::Entry& entry : map.entries()) {
+    const uint64_t key =
+        entry.has_id32() ? Id32Key(entry.id32()) : Id64Key(entry.id64());
+    if (!IsValidKey(key)) {
+      std::cerr << entry.message_type() << ": invalid schema id" << std::endl;
+      return false;
+    }
+    const google::protobuf::Descriptor* descriptor =
+        pool->FindMessageTypeByName(entry.message_type());
+    if (descriptor == nullptr) {
+      std::cerr << entry.message_type() << ": message type not found"
+                << std::endl;
+      return false;
+    }
+    types.push_back(Type{
+        .key = key,
+        .descriptor = descriptor,
+        .prototype = factory->GetPrototype(descriptor),
+    });
+  }
+  return InstallTypes(std::move(types));
+}
+
+bool SchemaRegistry::Install(const SchemaTable& table) {
+  std::vector<Type> types;
+  types.reserve(table.types().size());
+  for (const SchemaType& type : table.types()) {
+    const google::protobuf::Message& prototype = type.prototype();
+    types.push_back(Type{
+        .key = type.key,
+        .descriptor = prototype.GetDescriptor(),
+        .prototype = &prototype,
+    });
+  }
+  return InstallTypes(std::move(types));
+}
+
+size_t SchemaRegistry::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return table_.load()->types.size();
+}
+
+void SchemaRegistry::Reclaim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ReclaimLocked();
+}
+
+bool SchemaRegistry::InstallTypes(std::vector<Type> types) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Table* current = table_.load();
+
+  // New types go first, so that a stable sort by key puts each new type
+  // ahead of the one it replaces.
+  types.insert(types.end(), current->types.begin(), current->types.end());
+  std::stable_sort(types.begin(), types.end(),
+                   [](const Type& a, const Type& b) { return a.key < b.key; });
+  auto table = std::make_unique<Table>();
+  for (const Type& type : types) {
+    if (!table->types.empty() && table->types.back().key == type.key) {
+      const Type& kept = table->types.back();
+      if (kept.descriptor->full_name() != type.descriptor->full_name()) {
+        std::cerr << kept.descriptor->full_name() << ", "
+                  << type.descriptor->full_name() << ": both have id "
+                  << std::hex << std::showbase << KeyId(type.key)
+                  << std::dec << std::noshowbase << std::endl;
+        return false;
+      }
+      continue;
+    }
+    table->types.push_back(type);
+  }
+  std::vector<uint64_t> keys;
+  keys.reserve(table->types.size());
+  for (const Type& type : table->types) {
+    keys.push_back(type.key);
+  }
+  if (!BuildSchemaHash(keys, &table->seeds, &table->slots)) {
+    return false;
+  }
+
+  // Readers that entered before the epoch advances may still be using the
+  // old table.
+  table_.store(table.release());
+  retired_.emplace_back(epoch_.fetch_add(1), current);
+  ReclaimLocked();
+  return true;
+}
+
+void SchemaRegistry::ReclaimLocked() {
+  uint64_t oldest = UINT64_MAX;
+  for (const ReaderSlot& slot : slots_) {
+    const uint64_t epoch = slot.epoch.load();
+    if (epoch != 0)
+      oldest = std::min(oldest, epoch);
+  }
+  std::erase_if(retired_, [oldest](const auto& retired) {
+    return retired.first < oldest;
+  });
+}
+
+}  // namespace protobunny::schema_id
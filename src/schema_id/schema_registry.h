@@ -0,0 +1,126 @@
+#ifndef SCHEMA_ID_SCHEMA_REGISTRY_H__
+#define SCHEMA_ID_SCHEMA_REGISTRY_H__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/arena.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "schema_id/any.pb.h"
+#include "schema_id/message_id_map.pb.h"
+#include "schema_id/schema_map.h"
+
+namespace protobunny::schema_id {
+
+// Maps schema ids to message types at runtime, for services that unpack
+// Anys on many threads while new schema maps are loaded.
+//
+// Lookups go through a Reader, one per thread, and are wait-free: a reader
+// publishes the epoch it entered in, loads the current table, finds the
+// type through its perfect hash and leaves, with no locks, no shared
+// counters and no retries.  Install() builds a new table beside the current
+// one and swaps it in with a single store, so readers never wait for it.
+// The old table is freed once every reader has left the epochs that could
+// have seen it, which Install() checks without waiting.
+//
+// Installs are serialized with each other.  Descriptors and prototypes are
+// not copied, so their pools and factories must outlive the registry.
+class SchemaRegistry {
+ private:
+  // The epoch a reader entered in, or 0 between lookups, on its own cache
+  // line so readers don't contend.
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};
+    bool in_use = false;
+  };
+
+ public:
+  // A registered message type.
+  struct Type {
+    uint64_t key = 0;
+    const google::protobuf::Descriptor* descriptor = nullptr;
+    const google::protobuf::Message* prototype = nullptr;
+  };
+
+  // A thread's handle for lookups.  Each reader must only be used by one
+  // thread at a time, and must be destroyed before the registry.
+  class Reader {
+   public:
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    ~Reader();
+
+    // The type with `key`, or a Type with a null descriptor.
+    Type Find(uint64_t key);
+    Type Find(const Any& any) {
+      return Find(AnyKey(any));
+    }
+
+    // Makes a new message of the type in `any` and parses into it.  Returns
+    // null if the id isn't registered or the message doesn't parse.
+    google::protobuf::Message* Unpack(
+        const Any& any, google::protobuf::Arena* arena = nullptr);
+
+   private:
+    friend class SchemaRegistry;
+
+    Reader(SchemaRegistry* registry, ReaderSlot* slot)
+        : registry_(registry), slot_(slot) {}
+
+    SchemaRegistry* const registry_;
+    ReaderSlot* const slot_;
+  };
+
+  SchemaRegistry();
+  SchemaRegistry(const SchemaRegistry&) = delete;
+  SchemaRegistry& operator=(const SchemaRegistry&) = delete;
+  ~SchemaRegistry();
+
+  std::unique_ptr<Reader> NewReader();
+
+  // Adds the types in `map`, resolving names in `pool` and making
+  // prototypes with `factory`.  A type registered again, such as from a
+  // newer schema, replaces the earlier one.  Returns false, reporting the
+  // error to stderr and installing nothing, if a type isn't in `pool` or an
+  // id would name two types.
+  bool Install(const MessageIdMap& map,
+               const google::protobuf::DescriptorPool* pool,
+               google::protobuf::MessageFactory* factory);
+
+  // Adds the generated types in `table`.
+  bool Install(const SchemaTable& table);
+
+  // The number of registered types.
+  size_t size() const;
+
+  // Frees the tables that no reader can still see.  Install() does this
+  // itself, so this is only needed to free memory sooner.
+  void Reclaim();
+
+ private:
+  struct Table;
+
+  // Installs a table holding the current types and `types`.
+  bool InstallTypes(std::vector<Type> types);
+  void ReclaimLocked();
+
+  std::atomic<const Table*> table_;
+  // Advanced each time a table is replaced.
+  std::atomic<uint64_t> epoch_{1};
+
+  // Guards everything below, which only installs and new readers touch.
+  mutable std::mutex mutex_;
+  std::deque<ReaderSlot> slots_;
+  // Replaced tables, with the epoch they were replaced in.
+  std::vector<std::pair<uint64_t, std::unique_ptr<const Table>>> retired_;
+};
+
+}  // namespace protobunny::schema_id
+
+#endif  // SCHEMA_ID_SCHEMA_REGISTRY_H__
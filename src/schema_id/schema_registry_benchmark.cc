@@ -0,0 +1,193 @@
+// Measures schema id lookups from many threads while new maps are being
+// installed, in a SchemaRegistry and, for comparison, in a hash map behind
+// a reader-writer lock.
+//
+//   bazel run -c opt //src/schema_id:schema_registry_benchmark
+//
+// The argument is 1 to install maps on a background thread during the run,
+// with 100us between installs, or 0 for lookups alone.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
+#include "schema_id/message_id_map.pb.h"
+#include "schema_id/schema_map.h"
+#include "schema_id/schema_registry.h"
+
+namespace protobunny::schema_id {
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DescriptorPool;
+using ::google::protobuf::DynamicMessageFactory;
+using ::google::protobuf::FileDescriptorProto;
+
+constexpr int kTypes = 10000;
+
+// A schema of kTypes messages, and a map giving each an id32.
+struct Schema {
+  Schema() {
+    FileDescriptorProto file;
+    file.set_name("schema_registry_benchmark.proto");
+    file.set_package("bench");
+    for (int i = 0; i < kTypes; ++i) {
+      file.add_message_type()->set_name(absl::StrCat("Message", i));
+      MessageIdMap::Entry* entry = map.add_entries();
+      entry->set_id32(kMinId + i);
+      entry->set_message_type(absl::StrCat("bench.Message", i));
+      keys.push_back(Id32Key(kMinId + i));
+    }
+    pool.BuildFile(file);
+    // Lookups visit the types in a scattered order.
+    for (size_t i = 0; i < keys.size(); ++i) {
+      std::swap(keys[i], keys[(i * 7919) % keys.size()]);
+    }
+  }
+
+  DescriptorPool pool;
+  DynamicMessageFactory factory;
+  MessageIdMap map;
+  std::vector<uint64_t> keys;
+};
+
+Schema& GetSchema() {
+  static Schema* schema = new Schema();
+  return *schema;
+}
+
+// Runs `install` every 100us on a background thread until stopped.
+class Installer {
+ public:
+  template <typename Fn>
+  void Start(Fn install) {
+    stop_ = false;
+    installs_ = 0;
+    thread_ = std::thread([this, install] {
+      while (!stop_) {
+        install();
+        ++installs_;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    });
+  }
+
+  // Stops the thread, returning the number of installs.
+  int64_t Stop() {
+    if (!thread_.joinable())
+      return 0;
+    stop_ = true;
+    thread_.join();
+    return installs_;
+  }
+
+ private:
+  std::thread thread_;
+  std::atomic<bool> stop_ = false;
+  std::atomic<int64_t> installs_ = 0;
+};
+
+void BM_SchemaRegistryFind(benchmark::State& state) {
+  static SchemaRegistry* registry = nullptr;
+  static Installer installer;
+  Schema& schema = GetSchema();
+  if (state.thread_index() == 0) {
+    // The threads of the last run are gone, along with their readers.
+    delete registry;
+    registry = new SchemaRegistry();
+    registry->Install(schema.map, &schema.pool, &schema.factory);
+    if (state.range(0)) {
+      installer.Start([&schema] {
+        registry->Install(schema.map, &schema.pool, &schema.factory);
+      });
+    }
+  }
+  std::unique_ptr<SchemaRegistry::Reader> reader;
+  size_t next = state.thread_index() * 101;
+  for (auto _ : state) {
+    // Only thread 0's setup is sure to be done once the loop starts.
+    if (!reader)
+      reader = registry->NewReader();
+    const uint64_t key = schema.keys[next++ % schema.keys.size()];
+    benchmark::DoNotOptimize(reader->Find(key).prototype);
+  }
+  reader.reset();
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    state.counters["installs"] = installer.Stop();
+  }
+}
+BENCHMARK(BM_SchemaRegistryFind)->Arg(0)->Arg(1)->ThreadRange(1, 16);
+
+// The same lookups in a flat_hash_map behind a std::shared_mutex, where an
+// install builds a new map and swaps it in under the exclusive lock.
+struct LockedRegistry {
+  std::shared_mutex mutex;
+  std::unique_ptr<absl::flat_hash_map<uint64_t, SchemaRegistry::Type>> types;
+
+  void Install(const Schema& schema, DynamicMessageFactory* factory) {
+    auto installed = std::make_unique<
+        absl::flat_hash_map<uint64_t, SchemaRegistry::Type>>();
+    for (const MessageIdMap::Entry& entry : schema.map.entries()) {
+      const Descriptor* descriptor =
+          schema.pool.FindMessageTypeByName(entry.message_type());
+      const uint64_t key = Id32Key(entry.id32());
+      (*installed)[key] = SchemaRegistry::Type{
+          .key = key,
+          .descriptor = descriptor,
+          .prototype = factory->GetPrototype(descriptor),
+      };
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    types.swap(installed);
+  }
+
+  SchemaRegistry::Type Find(uint64_t key) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    const auto it = types->find(key);
+    return it == types->end() ? SchemaRegistry::Type() : it->second;
+  }
+};
+
+void BM_SharedMutexFind(benchmark::State& state) {
+  static LockedRegistry* registry = nullptr;
+  static Installer installer;
+  Schema& schema = GetSchema();
+  if (state.thread_index() == 0) {
+    delete registry;
+    registry = new LockedRegistry();
+    registry->Install(schema, &schema.factory);
+    if (state.range(0)) {
+      installer.Start(
+          [&schema] { registry->Install(schema, &schema.factory); });
+    }
+  }
+  size_t next = state.thread_index() * 101;
+  for (auto _ : state) {
+    const uint64_t key = schema.keys[next++ % schema.keys.size()];
+    benchmark::DoNotOptimize(registry->Find(key).prototype);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    state.counters["installs"] = installer.Stop();
+  }
+}
+BENCHMARK(BM_SharedMutexFind)->Arg(0)->Arg(1)->ThreadRange(1, 16);
+
+}  // namespace
+}  // namespace protobunny::schema_id
+
+BENCHMARK_MAIN();